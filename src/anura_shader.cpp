@@ -487,9 +487,10 @@ namespace graphics
 				}
 			}
 		} else {
-			game_logic::CommandCallable* cmd = var.try_convert<game_logic::CommandCallable>();
-			if(cmd != NULL) {
-				cmd->runCommand(*this);
+			const game_logic::FormulaCallable* callable = var.is_callable() ? var.as_callable() : nullptr;
+			if(callable && callable->getCommandType() == game_logic::COMMAND_TYPE::FORMULA) {
+				static_cast<const game_logic::CommandCallable*>(callable)->runCommand(*this);
+				game_logic::count_command_executed(game_logic::COMMAND_TYPE::FORMULA);
 			}
 		}
 		return result;
@@ -21,81 +21,356 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "asserts.hpp"
 #include "background_task_pool.hpp"
+#include "preferences.hpp"
 #include "thread.hpp"
+#include "unit_test.hpp"
+
+PREF_INT(background_task_workers, 0, "Number of threads to run background tasks on. 0 means one for each core, less one for the main thread");
 
 namespace background_task_pool
 {
 	namespace 
 	{
-		int next_task_id = 0;
+		const int NumPriorities = 4;
+
+		enum class STATE { QUEUED, RUNNING, DONE, CANCELLED };
 
 		struct task 
 		{
+			int id;
 			std::function<void()> job, on_complete;
-			std::shared_ptr<threading::thread> thread;
+			STATE state;
+		};
+
+		typedef std::shared_ptr<task> task_ptr;
+
+		//the jobs waiting to be run by one worker. Cancelled jobs are left
+		//in here and skipped over when they are taken.
+		struct worker_queue
+		{
+			threading::mutex mutex;
+			std::deque<task_ptr> tasks[NumPriorities];
 		};
 
-		const threading::mutex& get_completed_tasks_mutex()
+		//everything below is guarded by get_mutex() except for the
+		//contents of the worker queues, which have their own mutexes.
+		const threading::mutex& get_mutex()
 		{
 			static std::shared_ptr<threading::mutex> res = std::make_shared<threading::mutex>();
 			return *res;
 		}
 
+		threading::condition& get_work_available()
+		{
+			static std::shared_ptr<threading::condition> res = std::make_shared<threading::condition>();
+			return *res;
+		}
+
+		threading::condition& get_task_finished()
+		{
+			static std::shared_ptr<threading::condition> res = std::make_shared<threading::condition>();
+			return *res;
+		}
+
+		int next_task_id = 0;
+		int next_queue = 0;
+		int num_queued = 0;
+		bool shutting_down = false;
+
+		std::map<int, task_ptr> task_map;
 		std::vector<int> completed_tasks;
 
-		std::map<int, task> task_map;
+		std::vector<std::shared_ptr<worker_queue>> queues;
+		std::vector<unsigned> worker_thread_ids;
+		std::vector<std::shared_ptr<threading::thread>> workers;
+
+		task_ptr take_from(worker_queue& q, int priority, bool steal)
+		{
+			threading::lock lck(q.mutex);
+			std::deque<task_ptr>& d = q.tasks[priority];
+			if(d.empty()) {
+				return task_ptr();
+			}
+
+			task_ptr result;
+			if(steal) {
+				result = d.back();
+				d.pop_back();
+			} else {
+				result = d.front();
+				d.pop_front();
+			}
+
+			return result;
+		}
+
+		task_ptr take_task(int worker)
+		{
+			for(int priority = 0; priority != NumPriorities; ++priority) {
+				task_ptr t = take_from(*queues[worker], priority, false);
+				for(int n = 1; !t && n < static_cast<int>(queues.size()); ++n) {
+					t = take_from(*queues[(worker + n)%queues.size()], priority, true);
+				}
+
+				if(t) {
+					return t;
+				}
+			}
+
+			return task_ptr();
+		}
+
+		//runs a job which has been marked as running, on the current thread.
+		void run_task(const task_ptr& t)
+		{
+			t->job();
+
+			threading::lock lck(get_mutex());
+			t->state = STATE::DONE;
+			completed_tasks.push_back(t->id);
+			get_task_finished().notify_all();
+		}
 
-		void run_task(std::function<void()> job, int task_id)
+		void worker_thread(int worker)
 		{
-			job();
-			threading::lock lck(get_completed_tasks_mutex());
-			completed_tasks.push_back(task_id);
+			{
+				threading::lock lck(get_mutex());
+				worker_thread_ids[worker] = threading::get_current_thread_id();
+			}
+
+			for(;;) {
+				task_ptr t = take_task(worker);
+
+				{
+					threading::lock lck(get_mutex());
+					if(!t) {
+						if(shutting_down) {
+							return;
+						}
+
+						if(num_queued == 0) {
+							get_work_available().wait(get_mutex());
+						}
+
+						continue;
+					}
+
+					--num_queued;
+					if(t->state != STATE::QUEUED) {
+						continue;
+					}
+
+					t->state = STATE::RUNNING;
+				}
+
+				run_task(t);
+			}
 		}
 	}
 
 	manager::manager()
 	{
-		get_completed_tasks_mutex();
+		get_mutex();
+		get_work_available();
+		get_task_finished();
+
+		int nworkers = g_background_task_workers;
+		if(nworkers <= 0) {
+			nworkers = std::max(1, SDL_GetCPUCount() - 1);
+		}
+
+		shutting_down = false;
+		worker_thread_ids.resize(nworkers);
+		for(int n = 0; n != nworkers; ++n) {
+			queues.push_back(std::make_shared<worker_queue>());
+		}
+
+		for(int n = 0; n != nworkers; ++n) {
+			workers.push_back(std::make_shared<threading::thread>("background_task", std::bind(worker_thread, n)));
+		}
 	}
 
 	manager::~manager()
 	{
 		while(task_map.empty() == false) {
+			wait(task_map.begin()->first);
 			pump();
 		}
+
+		{
+			threading::lock lck(get_mutex());
+			shutting_down = true;
+			get_work_available().notify_all();
+		}
+
+		//destroying the threads joins them.
+		workers.clear();
+		queues.clear();
+		worker_thread_ids.clear();
 	}
 
-	void submit(std::function<void()> job, std::function<void()> on_complete)
+	int submit(std::function<void()> job, std::function<void()> on_complete, PRIORITY priority)
 	{
-        std::string task_name = "background_task";
-        std::function<void()> f = std::bind(run_task, job, next_task_id);
-        task t = {
-            job,
-            on_complete,
-            std::make_shared<threading::thread>(task_name, f) };
-		task_map[next_task_id] = t;
-		++next_task_id;
+		task_ptr t(new task);
+		t->job = job;
+		t->on_complete = on_complete;
+		t->state = STATE::QUEUED;
+
+		int queue = -1;
+		{
+			threading::lock lck(get_mutex());
+			t->id = next_task_id++;
+			task_map[t->id] = t;
+
+			if(workers.empty()) {
+				//there are no workers outside of a manager's lifetime, so just
+				//run the job now.
+				t->state = STATE::RUNNING;
+			} else {
+				//jobs submitted by a worker go on its own queue.
+				const unsigned thread_id = threading::get_current_thread_id();
+				auto itor = std::find(worker_thread_ids.begin(), worker_thread_ids.end(), thread_id);
+				if(itor != worker_thread_ids.end()) {
+					queue = static_cast<int>(itor - worker_thread_ids.begin());
+				} else {
+					queue = next_queue++%queues.size();
+				}
+			}
+		}
+
+		if(queue == -1) {
+			run_task(t);
+			return t->id;
+		}
+
+		{
+			worker_queue& q = *queues[queue];
+			threading::lock lck(q.mutex);
+			q.tasks[static_cast<int>(priority)].push_back(t);
+		}
+
+		{
+			threading::lock lck(get_mutex());
+			++num_queued;
+			get_work_available().notify_one();
+		}
+
+		return t->id;
+	}
+
+	bool cancel(int task_id)
+	{
+		threading::lock lck(get_mutex());
+		auto itor = task_map.find(task_id);
+		if(itor == task_map.end()) {
+			return false;
+		}
+
+		task& t = *itor->second;
+		if(t.state == STATE::QUEUED) {
+			t.state = STATE::CANCELLED;
+			task_map.erase(itor);
+			return true;
+		}
+
+		t.on_complete = std::function<void()>();
+		return false;
+	}
+
+	void wait(int task_id)
+	{
+		task_ptr t;
+		{
+			threading::lock lck(get_mutex());
+			auto itor = task_map.find(task_id);
+			if(itor == task_map.end()) {
+				return;
+			}
+
+			t = itor->second;
+			if(t->state == STATE::QUEUED) {
+				//nobody has started it yet, so rather than waiting for a
+				//worker to get to it, run it ourselves.
+				t->state = STATE::RUNNING;
+			} else {
+				while(t->state == STATE::RUNNING) {
+					get_task_finished().wait(get_mutex());
+				}
+
+				return;
+			}
+		}
+
+		run_task(t);
+	}
+
+	int num_workers()
+	{
+		return static_cast<int>(workers.size());
 	}
 
 	void pump()
 	{
-		std::vector<int> completed;
+		std::vector<std::function<void()>> callbacks;
 		{
-			threading::lock lck(get_completed_tasks_mutex());
-			completed.swap(completed_tasks);
+			threading::lock lck(get_mutex());
+			for(int id : completed_tasks) {
+				auto itor = task_map.find(id);
+				if(itor == task_map.end()) {
+					continue;
+				}
+
+				if(itor->second->on_complete) {
+					callbacks.push_back(itor->second->on_complete);
+				}
+
+				task_map.erase(itor);
+			}
+
+			completed_tasks.clear();
 		}
 
-		for(int t : completed) {
-			task_map[t].on_complete();
-			task_map.erase(t);
+		for(const std::function<void()>& fn : callbacks) {
+			fn();
 		}
 	}
 
 }
+
+UNIT_TEST(background_task_pool)
+{
+	using namespace background_task_pool;
+
+	threading::mutex m;
+	int count = 0;
+
+	std::vector<int> ids;
+	for(int n = 0; n != 100; ++n) {
+		ids.push_back(submit([&]() { threading::lock lck(m); ++count; }, std::function<void()>(), static_cast<PRIORITY>(n%NumPriorities)));
+	}
+
+	int ncancelled = 0;
+	for(int n = 0; n < static_cast<int>(ids.size()); n += 4) {
+		if(cancel(ids[n])) {
+			++ncancelled;
+		}
+	}
+
+	for(int id : ids) {
+		wait(id);
+	}
+
+	pump();
+
+	CHECK_EQ(count + ncancelled, 100);
+}
@@ -25,8 +25,16 @@
 
 #include <functional>
 
+//Runs jobs on a fixed set of worker threads, sized to the number of cores.
+//Each worker has its own queue of jobs, and takes jobs from the other
+//workers' queues when its own is empty. on_complete is always called on
+//the main thread, from pump().
 namespace background_task_pool
 {
+	//jobs with a higher priority are started before any job with a lower
+	//priority, in the order given here.
+	enum class PRIORITY { LEVEL_LOAD, AUDIO_DECODE, FILE_WRITE, CACHE_WARMUP };
+
 	struct manager 
 	{
 		manager();
@@ -35,5 +43,17 @@ namespace background_task_pool
 
 	void pump();
 
-	void submit(std::function<void()> job, std::function<void()> on_complete);
+	//returns an id for the job which can be used with cancel() and wait().
+	int submit(std::function<void()> job, std::function<void()> on_complete, PRIORITY priority=PRIORITY::CACHE_WARMUP);
+
+	//cancels a job. Returns true if the job hadn't started, in which case it
+	//will never run. If it is already running it is left to finish, but its
+	//on_complete won't be called.
+	bool cancel(int task_id);
+
+	//blocks until the given job has finished running. If it hasn't started
+	//yet it is run on the calling thread.
+	void wait(int task_id);
+
+	int num_workers();
 }
@@ -111,34 +111,62 @@ namespace checksum
 		}
 	}
 
-	void verify_file(const std::string& fname_input, const std::string& contents)
+	namespace
 	{
-		if(!verified) {
-			return;
-		}
+		//finds the signed md5 sum of a file, or returns nullptr if the file
+		//doesn't need to be checked.
+		const std::string* find_signature(const std::string& fname_input, bool empty)
+		{
+			if(!verified) {
+				return nullptr;
+			}
 
-		std::string fname = fname_input;
-		fname.erase(std::unique(fname.begin(), fname.end(), both_slashes), fname.end());
+			std::string fname = fname_input;
+			fname.erase(std::unique(fname.begin(), fname.end(), both_slashes), fname.end());
 
-		if(fname.size() < 5 || std::string(fname.begin(), fname.begin()+5) != "data/") {
-			return;
-		}
+			if(fname.size() < 5 || std::string(fname.begin(), fname.begin()+5) != "data/") {
+				return nullptr;
+			}
 
-		const std::map<std::string,std::string>::const_iterator itor = hashes.find(fname);
-		if(itor == hashes.end()) {
-			if(!contents.empty()) {
-				LOG_INFO("UNVERIFIED NEW FILE: " << fname);
-				verified = false;
+			const std::map<std::string,std::string>::const_iterator itor = hashes.find(fname);
+			if(itor == hashes.end()) {
+				if(!empty) {
+					LOG_INFO("UNVERIFIED NEW FILE: " << fname);
+					verified = false;
+				}
+				return nullptr;
 			}
+
+			return &itor->second;
+		}
+	}
+
+	void verify_file(const std::string& fname, const std::string& contents)
+	{
+		const std::string* signature = find_signature(fname, contents.empty());
+		if(signature == nullptr) {
 			return;
 		}
 
-		verified = md5::sum(contents) == itor->second;
+		verified = md5::sum(contents) == *signature;
 		if(!verified) {
 			LOG_INFO("UNVERIFIED FILE: " << fname << " (((" << contents << ")))");
 		}
 	}
 
+	void verify_file_sum(const std::string& fname, const std::string& md5sum, bool empty)
+	{
+		const std::string* signature = find_signature(fname, empty);
+		if(signature == nullptr) {
+			return;
+		}
+
+		verified = md5sum == *signature;
+		if(!verified) {
+			LOG_INFO("UNVERIFIED FILE: " << fname);
+		}
+	}
+
 	}
 
 	namespace {
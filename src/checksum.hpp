@@ -37,4 +37,7 @@ namespace checksum
 	bool is_verified();
 	void verify_file(const std::string& fname, const std::string& contents);
 
+	//as verify_file(), for a file whose md5 sum is already known.
+	void verify_file_sum(const std::string& fname, const std::string& md5sum, bool empty);
+
 }
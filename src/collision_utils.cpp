@@ -21,6 +21,8 @@
 	   distribution.
 */
 
+#include <algorithm>
+
 #include "asserts.hpp"
 #include "collision_utils.hpp"
 #include "frame.hpp"
@@ -28,6 +30,7 @@
 #include "level.hpp"
 #include "object_events.hpp"
 #include "solid_map.hpp"
+#include "unit_test.hpp"
 
 namespace 
 {
@@ -294,7 +297,7 @@ bool entity_collides_with_level(const Level& lvl, const Entity& e, MOVE_DIRECTIO
 	}
 
 	for(const ConstSolidMapPtr& m : s->solid()) {
-		if(lvl.solid(e, m->dir(dir), info ? &info->surf_info : nullptr)) {
+		if(lvl.solid(e, *m, dir, info ? &info->surf_info : nullptr)) {
 			if(info) {
 				info->readSurfInfo();
 			}
@@ -611,16 +614,155 @@ int get_collision_event_id(const std::string& area)
 
 }
 
+UserCollisionBroadphase::UserCollisionBroadphase(int cell_size)
+  : cell_size_(cell_size), stamp_(0), nmoved_(0)
+{
+	ASSERT_LOG(cell_size_ > 0, "Illegal broadphase cell size: " << cell_size_);
+}
+
+namespace {
+	int floor_div(int n, int d)
+	{
+		return n >= 0 ? n/d : -((d - 1 - n)/d);
+	}
+}
+
+UserCollisionBroadphase::CellRange UserCollisionBroadphase::calculateCells(const rect& box) const
+{
+	CellRange result = {
+		floor_div(box.x(), cell_size_), floor_div(box.y(), cell_size_),
+		floor_div(box.x2() - 1, cell_size_), floor_div(box.y2() - 1, cell_size_),
+	};
+
+	return result;
+}
+
+void UserCollisionBroadphase::insert(Entry* entry)
+{
+	const CellRange& r = entry->cells;
+	for(int y = r.y1; y <= r.y2; ++y) {
+		for(int x = r.x1; x <= r.x2; ++x) {
+			cells_[cellKey(x, y)].push_back(entry);
+		}
+	}
+}
+
+void UserCollisionBroadphase::erase(Entry* entry)
+{
+	const CellRange& r = entry->cells;
+	for(int y = r.y1; y <= r.y2; ++y) {
+		for(int x = r.x1; x <= r.x2; ++x) {
+			auto itor = cells_.find(cellKey(x, y));
+			assert(itor != cells_.end());
+
+			std::vector<Entry*>& v = itor->second;
+			v.erase(std::find(v.begin(), v.end(), entry));
+			if(v.empty()) {
+				cells_.erase(itor);
+			}
+		}
+	}
+}
+
+void UserCollisionBroadphase::update(const std::vector<const void*>& keys, const std::vector<rect>& boxes, std::vector<std::pair<int, int> >& pairs)
+{
+	ASSERT_EQ(keys.size(), boxes.size());
+
+	++stamp_;
+	nmoved_ = 0;
+	pairs.clear();
+
+	std::vector<Entry*> index_entries(keys.size());
+
+	for(int n = 0; n != keys.size(); ++n) {
+		const rect& box = boxes[n];
+		if(box.w() <= 0 || box.h() <= 0) {
+			continue;
+		}
+
+		const CellRange cells = calculateCells(box);
+
+		auto itor = entries_.find(keys[n]);
+		if(itor == entries_.end()) {
+			itor = entries_.insert(std::pair<const void*, Entry>(keys[n], Entry())).first;
+			itor->second.cells = cells;
+			insert(&itor->second);
+			++nmoved_;
+		} else if(itor->second.cells != cells) {
+			erase(&itor->second);
+			itor->second.cells = cells;
+			insert(&itor->second);
+			++nmoved_;
+		}
+
+		itor->second.index = n;
+		itor->second.stamp = stamp_;
+		index_entries[n] = &itor->second;
+	}
+
+	for(auto itor = entries_.begin(); itor != entries_.end(); ) {
+		if(itor->second.stamp != stamp_) {
+			erase(&itor->second);
+			itor = entries_.erase(itor);
+		} else {
+			++itor;
+		}
+	}
+
+	for(int n = 0; n != index_entries.size(); ++n) {
+		const Entry* entry = index_entries[n];
+		if(entry == nullptr) {
+			continue;
+		}
+
+		const CellRange& r = entry->cells;
+		for(int y = r.y1; y <= r.y2; ++y) {
+			for(int x = r.x1; x <= r.x2; ++x) {
+				for(const Entry* other : cells_[cellKey(x, y)]) {
+					if(other->index <= n) {
+						continue;
+					}
+
+					//a pair which shares several cells is only reported from
+					//the first cell they share.
+					if(x != std::max(r.x1, other->cells.x1) || y != std::max(r.y1, other->cells.y1)) {
+						continue;
+					}
+
+					if(rects_intersect(boxes[n], boxes[other->index])) {
+						pairs.push_back(std::pair<int, int>(n, other->index));
+					}
+				}
+			}
+		}
+	}
+
+	std::sort(pairs.begin(), pairs.end());
+}
+
 void detect_user_collisions(Level& lvl)
 {
 	std::vector<EntityPtr> chars;
+	std::vector<const void*> keys;
+	std::vector<rect> boxes;
 	chars.reserve(lvl.get_active_chars().size());
 	for(const EntityPtr& a : lvl.get_active_chars()) {
-		if(a->getWeakCollideDimensions() != 0 && a->getCurrentFrame().getCollisionAreas().empty() == false) {
+		const Frame& f = a->getCurrentFrame();
+		if(a->getWeakCollideDimensions() != 0 && f.getCollisionAreas().empty() == false) {
+			rect box;
+			for(const Frame::CollisionArea& area : f.getCollisionAreas()) {
+				box = rect_union(box, a->calculateCollisionRect(f, area));
+			}
+
 			chars.push_back(a);
+			keys.push_back(a.get());
+			boxes.push_back(box);
 		}
 	}
 
+	std::vector<std::pair<int, int> > candidates;
+	lvl.user_collision_broadphase().update(keys, boxes, candidates);
+
 	typedef std::pair<EntityPtr, const std::string*> collision_key;
 	std::map<collision_key, std::vector<collision_key> > collision_info;
 
@@ -628,30 +770,28 @@ void detect_user_collisions(Level& lvl)
 
 	const int MaxCollisions = 16;
 	CollisionPair collision_buf[MaxCollisions];
-	for(std::vector<EntityPtr>::const_iterator i = chars.begin(); i != chars.end(); ++i) {
-		for(std::vector<EntityPtr>::const_iterator j = i + 1; j != chars.end(); ++j) {
-			const EntityPtr& a = *i;
-			const EntityPtr& b = *j;
-			if(a == b ||
-			   ((a->getWeakCollideDimensions()&b->getCollideDimensions()) == 0 &&
-			   (a->getCollideDimensions()&b->getWeakCollideDimensions()) == 0)) {
-				//the objects do not share a dimension, and so can't collide.
-				continue;
-			}
+	for(const std::pair<int, int>& candidate : candidates) {
+		const EntityPtr& a = chars[candidate.first];
+		const EntityPtr& b = chars[candidate.second];
+		if(a == b ||
+		   ((a->getWeakCollideDimensions()&b->getCollideDimensions()) == 0 &&
+		   (a->getCollideDimensions()&b->getWeakCollideDimensions()) == 0)) {
+			//the objects do not share a dimension, and so can't collide.
+			continue;
+		}
 
-			int ncollisions = entity_user_collision(*a, *b, collision_buf, MaxCollisions);
-			if(ncollisions > MaxCollisions) {
-				ncollisions = MaxCollisions;
-			}
+		int ncollisions = entity_user_collision(*a, *b, collision_buf, MaxCollisions);
+		if(ncollisions > MaxCollisions) {
+			ncollisions = MaxCollisions;
+		}
 
-			for(int n = 0; n != ncollisions; ++n) {
-				{
-					collision_info[collision_key(a, collision_buf[n].first)].push_back(collision_key(b, collision_buf[n].second));
-				}
+		for(int n = 0; n != ncollisions; ++n) {
+			{
+				collision_info[collision_key(a, collision_buf[n].first)].push_back(collision_key(b, collision_buf[n].second));
+			}
 
-				{
-					collision_info[collision_key(b, collision_buf[n].second)].push_back(collision_key(a, collision_buf[n].first));
-				}
+			{
+				collision_info[collision_key(b, collision_buf[n].second)].push_back(collision_key(a, collision_buf[n].first));
 			}
 		}
 	}
@@ -709,3 +849,114 @@ bool is_flightpath_clear(const Level& lvl, const Entity& e, const rect& area)
 
 	return true;
 }
+
+namespace {
+	//scatters 'n' object sized boxes over an area which grows with 'n', so
+	//the density of objects stays about the same as in a busy level.
+	std::vector<rect> generate_broadphase_boxes(int n)
+	{
+		int world_size = 200;
+		while(world_size*world_size < n*200*200) {
+			world_size += 200;
+		}
+
+		std::vector<rect> result;
+		result.reserve(n);
+		for(int i = 0; i != n; ++i) {
+			result.push_back(rect(rand()%world_size - world_size/2, rand()%world_size - world_size/2, 16 + rand()%80, 16 + rand()%80));
+		}
+
+		return result;
+	}
+
+	void move_broadphase_boxes(std::vector<rect>& boxes)
+	{
+		for(rect& r : boxes) {
+			r = rect(r.x() + rand()%9 - 4, r.y() + rand()%9 - 4, r.w(), r.h());
+		}
+	}
+
+	void brute_force_pairs(const std::vector<rect>& boxes, std::vector<std::pair<int, int> >& pairs)
+	{
+		pairs.clear();
+		for(int i = 0; i != boxes.size(); ++i) {
+			for(int j = i + 1; j != boxes.size(); ++j) {
+				if(rects_intersect(boxes[i], boxes[j])) {
+					pairs.push_back(std::pair<int, int>(i, j));
+				}
+			}
+		}
+	}
+}
+
+UNIT_TEST(user_collision_broadphase)
+{
+	srand(0);
+
+	std::vector<rect> boxes = generate_broadphase_boxes(300);
+	std::vector<int> objects(boxes.size());
+	std::vector<const void*> keys;
+	for(const int& obj : objects) {
+		keys.push_back(&obj);
+	}
+
+	UserCollisionBroadphase broadphase(64);
+	std::vector<std::pair<int, int> > pairs, expected;
+	for(int cycle = 0; cycle != 20; ++cycle) {
+		move_broadphase_boxes(boxes);
+
+		//objects come and go, and have their order shuffled.
+		if(cycle%5 == 4) {
+			keys.pop_back();
+			boxes.pop_back();
+			std::swap(keys.front(), keys[keys.size()/2]);
+			std::swap(boxes.front(), boxes[boxes.size()/2]);
+		}
+
+		broadphase.update(keys, boxes, pairs);
+		brute_force_pairs(boxes, expected);
+
+		CHECK_EQ(pairs.size(), expected.size());
+		CHECK(pairs == expected, "broadphase pairs differ from brute force pairs on cycle " << cycle);
+		CHECK_EQ(broadphase.numObjects(), keys.size());
+	}
+}
+
+BENCHMARK_ARG(user_collision_broadphase, int nobjects)
+{
+	srand(0);
+
+	std::vector<rect> boxes = generate_broadphase_boxes(nobjects);
+	std::vector<int> objects(boxes.size());
+	std::vector<const void*> keys;
+	for(const int& obj : objects) {
+		keys.push_back(&obj);
+	}
+
+	UserCollisionBroadphase broadphase;
+	std::vector<std::pair<int, int> > pairs;
+	BENCHMARK_LOOP {
+		move_broadphase_boxes(boxes);
+		broadphase.update(keys, boxes, pairs);
+	}
+}
+
+BENCHMARK_ARG_CALL(user_collision_broadphase, objects_50, 50);
+BENCHMARK_ARG_CALL(user_collision_broadphase, objects_500, 500);
+BENCHMARK_ARG_CALL(user_collision_broadphase, objects_5000, 5000);
+
+BENCHMARK_ARG(user_collision_brute_force, int nobjects)
+{
+	srand(0);
+
+	std::vector<rect> boxes = generate_broadphase_boxes(nobjects);
+	std::vector<std::pair<int, int> > pairs;
+	BENCHMARK_LOOP {
+		move_broadphase_boxes(boxes);
+		brute_force_pairs(boxes, pairs);
+	}
+}
+
+BENCHMARK_ARG_CALL(user_collision_brute_force, brute_force_50, 50);
+BENCHMARK_ARG_CALL(user_collision_brute_force, brute_force_500, 500);
+BENCHMARK_ARG_CALL(user_collision_brute_force, brute_force_5000, 5000);
@@ -23,6 +23,10 @@
 
 #pragma once
 
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include "entity_fwd.hpp"
 #include "level_solid_map.hpp"
 #include "solid_map.hpp"
@@ -120,6 +124,54 @@ int entity_user_collision(const Entity& a, const Entity& b, CollisionPair* areas
 //function which returns true iff area_a of 'a' collides with area_b of 'b'
 bool entity_user_collision_specific_areas(const Entity& a, const std::string& area_a, const Entity& b, const std::string& area_b);
 
+//broadphase used to find candidates for user collisions. Objects are binned
+//into a uniform grid by the bounding box of their collision areas. The grid
+//is kept between cycles, and an object is only re-binned when it moves into
+//a different set of cells.
+class UserCollisionBroadphase
+{
+public:
+	explicit UserCollisionBroadphase(int cell_size=128);
+
+	//replaces the contents of the broadphase with the given objects. 'keys'
+	//identify objects from one update to the next; objects with an empty
+	//box are ignored. 'pairs' is filled with the indexes of every pair of
+	//objects whose boxes intersect, each with first < second, sorted.
+	void update(const std::vector<const void*>& keys, const std::vector<rect>& boxes, std::vector<std::pair<int, int> >& pairs);
+
+	int numObjects() const { return static_cast<int>(entries_.size()); }
+	int numCells() const { return static_cast<int>(cells_.size()); }
+
+	//the number of objects which were (re-)binned by the last update.
+	int numMoved() const { return nmoved_; }
+private:
+	struct CellRange {
+		int x1, y1, x2, y2;
+		bool operator==(const CellRange& o) const { return x1 == o.x1 && y1 == o.y1 && x2 == o.x2 && y2 == o.y2; }
+		bool operator!=(const CellRange& o) const { return !(*this == o); }
+	};
+
+	struct Entry {
+		CellRange cells;
+		int index;
+		unsigned int stamp;
+	};
+
+	CellRange calculateCells(const rect& box) const;
+	void insert(Entry* entry);
+	void erase(Entry* entry);
+
+	static long long cellKey(int x, int y) { return (static_cast<long long>(x) << 32) ^ static_cast<unsigned int>(y); }
+
+	int cell_size_;
+	unsigned int stamp_;
+	int nmoved_;
+
+	//cells hold pointers to entries, which stay valid as the map grows.
+	std::unordered_map<const void*, Entry> entries_;
+	std::unordered_map<long long, std::vector<Entry*> > cells_;
+};
+
 //function to detect all user collisions and fire appropriate events to
 //the colliding objects.
 void detect_user_collisions(Level& lvl);
@@ -54,6 +54,7 @@
 #include "formula_callable_visitor.hpp"
 #include "formula_object.hpp"
 #include "formula_profiler.hpp"
+#include "formula_vm.hpp"
 #include "geometry_callable.hpp"
 #include "graphical_font.hpp"
 #include "json_parser.hpp"
@@ -3309,6 +3310,23 @@ namespace
 	};
 }
 
+int CustomObject::getSlotLayoutId() const
+{
+	return type_->callableDefinition()->getSlotLayoutId();
+}
+
+int CustomObject::getSlotForKey(const std::string& key) const
+{
+	//only builtins and properties are read from slots by getValue().
+	const int slot = type_->callableDefinition()->getSlot(key);
+	const int base = type_->getSlotPropertiesBase();
+	if((slot >= 0 && slot < NUM_CUSTOM_OBJECT_PROPERTIES) || (base >= 0 && slot >= base && size_t(slot - base) < type_->getSlotProperties().size())) {
+		return slot;
+	}
+
+	return -1;
+}
+
 variant CustomObject::getValue(const std::string& key) const
 {
 	const int slot = type_->callableDefinition()->getSlot(key);
@@ -4886,6 +4904,319 @@ EntityPtr CustomObject::backup() const
 	return res;
 }
 
+struct CustomObject::BackupState
+{
+	EntityBackupState entity;
+	int previous_y;
+	boost::intrusive_ptr<const Frame> frame;
+	std::string frame_name;
+	int time_in_frame, time_in_frame_delta;
+	int velocity_x, velocity_y;
+	int accel_x, accel_y;
+	decimal rotate_z;
+	int hitpoints;
+	bool was_underwater;
+	int invincible;
+	EntityPtr last_hit_by;
+	int last_hit_by_anim;
+	int current_animation_id;
+	int cycle;
+	bool created, loaded;
+	EntityPtr standing_on;
+	int standing_on_prev_x, standing_on_prev_y;
+	int fall_through_platforms;
+	int parent_prev_x, parent_prev_y;
+	bool parent_prev_facing;
+	int relative_x, relative_y;
+
+	bool operator==(const BackupState& o) const {
+		return entity == o.entity &&
+		       previous_y == o.previous_y &&
+		       frame == o.frame &&
+		       frame_name == o.frame_name &&
+		       time_in_frame == o.time_in_frame &&
+		       time_in_frame_delta == o.time_in_frame_delta &&
+		       velocity_x == o.velocity_x && velocity_y == o.velocity_y &&
+		       accel_x == o.accel_x && accel_y == o.accel_y &&
+		       rotate_z == o.rotate_z &&
+		       hitpoints == o.hitpoints &&
+		       was_underwater == o.was_underwater &&
+		       invincible == o.invincible &&
+		       last_hit_by == o.last_hit_by &&
+		       last_hit_by_anim == o.last_hit_by_anim &&
+		       current_animation_id == o.current_animation_id &&
+		       cycle == o.cycle &&
+		       created == o.created && loaded == o.loaded &&
+		       standing_on == o.standing_on &&
+		       standing_on_prev_x == o.standing_on_prev_x &&
+		       standing_on_prev_y == o.standing_on_prev_y &&
+		       fall_through_platforms == o.fall_through_platforms &&
+		       parent_prev_x == o.parent_prev_x && parent_prev_y == o.parent_prev_y &&
+		       parent_prev_facing == o.parent_prev_facing &&
+		       relative_x == o.relative_x && relative_y == o.relative_y;
+	}
+};
+
+namespace
+{
+	typedef std::pair<int, variant> BackupValue;
+
+	//rough cost of a node in a std::map, besides its value.
+	const size_t MapNodeOverhead = 4*sizeof(void*);
+
+	//the memory held by the lists and maps in v, which deep_copy_variant()
+	//copies.
+	size_t deep_copy_bytes(const variant& v)
+	{
+		size_t result = 0;
+		if(v.is_list()) {
+			result += v.num_elements()*sizeof(variant);
+			for(int n = 0; n != v.num_elements(); ++n) {
+				result += deep_copy_bytes(v[n]);
+			}
+		} else if(v.is_map()) {
+			for(const variant_pair& p : v.as_map()) {
+				result += 2*sizeof(variant) + MapNodeOverhead + deep_copy_bytes(p.second);
+			}
+		}
+
+		return result;
+	}
+
+	//appends the slots of 'values' which differ from those in 'prev',
+	//which is the same size, to *changes.
+	void diff_backup_values(const std::vector<variant>& prev, const std::vector<variant>& values, std::vector<BackupValue>* changes, bool deep_copy)
+	{
+		for(size_t n = 0; n != values.size(); ++n) {
+			if(!variants_identical(prev[n], values[n])) {
+				changes->emplace_back(static_cast<int>(n), deep_copy ? deep_copy_variant(values[n]) : values[n]);
+			}
+		}
+	}
+
+	template<typename T>
+	bool pointees_equal(const std::shared_ptr<T>& a, const std::shared_ptr<T>& b)
+	{
+		return a == b || (a && b && *a == *b);
+	}
+
+	bool tags_identical(const std::map<std::string, variant>& a, const std::map<std::string, variant>& b)
+	{
+		if(a.size() != b.size()) {
+			return false;
+		}
+
+		for(auto i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+			if(i->first != j->first || !variants_identical(i->second, j->second)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+}
+
+struct CustomObject::BackupDelta : public EntityBackupDelta
+{
+	BackupState state;
+
+	//the slots of vars_, tmp_vars_ and property_data_ which changed, and
+	//their new values. Property data is deep copied, as the copy
+	//constructor does.
+	std::vector<BackupValue> vars, tmp_vars, property_data;
+
+	size_t bytes() const override {
+		size_t result = sizeof(*this) +
+		    (state.entity.scheduled_commands.size() + vars.size() + tmp_vars.size() + property_data.size())*sizeof(BackupValue);
+		for(const BackupValue& v : property_data) {
+			result += deep_copy_bytes(v.second);
+		}
+
+		return result;
+	}
+};
+
+void CustomObject::getBackupState(BackupState* state) const
+{
+	getEntityBackupState(&state->entity);
+	state->previous_y = previous_y_;
+	state->frame = frame_;
+	state->frame_name = frame_name_;
+	state->time_in_frame = time_in_frame_;
+	state->time_in_frame_delta = time_in_frame_delta_;
+	state->velocity_x = velocity_x_;
+	state->velocity_y = velocity_y_;
+	state->accel_x = accel_x_;
+	state->accel_y = accel_y_;
+	state->rotate_z = rotate_z_;
+	state->hitpoints = hitpoints_;
+	state->was_underwater = was_underwater_;
+	state->invincible = invincible_;
+	state->last_hit_by = last_hit_by_;
+	state->last_hit_by_anim = last_hit_by_anim_;
+	state->current_animation_id = current_animation_id_;
+	state->cycle = cycle_;
+	state->created = created_;
+	state->loaded = loaded_;
+	state->standing_on = standing_on_;
+	state->standing_on_prev_x = standing_on_prev_x_;
+	state->standing_on_prev_y = standing_on_prev_y_;
+	state->fall_through_platforms = fall_through_platforms_;
+	state->parent_prev_x = parent_prev_x_;
+	state->parent_prev_y = parent_prev_y_;
+	state->parent_prev_facing = parent_prev_facing_;
+	state->relative_x = relative_x_;
+	state->relative_y = relative_y_;
+}
+
+void CustomObject::setBackupState(const BackupState& state)
+{
+	setEntityBackupState(state.entity);
+	previous_y_ = state.previous_y;
+	frame_ = state.frame;
+	frame_name_ = state.frame_name;
+	time_in_frame_ = state.time_in_frame;
+	time_in_frame_delta_ = state.time_in_frame_delta;
+	velocity_x_ = state.velocity_x;
+	velocity_y_ = state.velocity_y;
+	accel_x_ = state.accel_x;
+	accel_y_ = state.accel_y;
+	rotate_z_ = state.rotate_z;
+	hitpoints_ = state.hitpoints;
+	was_underwater_ = state.was_underwater;
+	invincible_ = state.invincible;
+	last_hit_by_ = state.last_hit_by;
+	last_hit_by_anim_ = state.last_hit_by_anim;
+	current_animation_id_ = state.current_animation_id;
+	cycle_ = state.cycle;
+	created_ = state.created;
+	loaded_ = state.loaded;
+	standing_on_ = state.standing_on;
+	standing_on_prev_x_ = state.standing_on_prev_x;
+	standing_on_prev_y_ = state.standing_on_prev_y;
+	fall_through_platforms_ = state.fall_through_platforms;
+	parent_prev_x_ = state.parent_prev_x;
+	parent_prev_y_ = state.parent_prev_y;
+	parent_prev_facing_ = state.parent_prev_facing;
+	relative_x_ = state.relative_x;
+	relative_y_ = state.relative_y;
+}
+
+bool CustomObject::backupConstantsMatch(const CustomObject& o) const
+{
+	//shaders and physics bodies are copied in full by the copy
+	//constructor, and can't be compared.
+	if(shader_ || o.shader_ || !effects_shaders_.empty() || !o.effects_shaders_.empty()) {
+		return false;
+	}
+
+#ifdef USE_BOX2D
+	if(body_ || o.body_) {
+		return false;
+	}
+#endif
+
+	return entityBackupConstantsMatch(o) &&
+	       type_ == o.type_ &&
+	       base_type_ == o.base_type_ &&
+	       current_variation_ == o.current_variation_ &&
+	       gravity_shift_ == o.gravity_shift_ &&
+	       *parallax_scale_millis_ == *o.parallax_scale_millis_ &&
+	       zorder_ == o.zorder_ &&
+	       zsub_order_ == o.zsub_order_ &&
+	       max_hitpoints_ == o.max_hitpoints_ &&
+	       has_feet_ == o.has_feet_ &&
+	       use_absolute_screen_coordinates_ == o.use_absolute_screen_coordinates_ &&
+	       sound_volume_ == o.sound_volume_ &&
+	       next_animation_formula_ == o.next_animation_formula_ &&
+	       vars_->values().size() == o.vars_->values().size() &&
+	       tmp_vars_->values().size() == o.tmp_vars_->values().size() &&
+	       property_data_.size() == o.property_data_.size() &&
+	       tags_identical(tags_->values(), o.tags_->values()) &&
+	       event_handlers_ == o.event_handlers_ &&
+	       pointees_equal(draw_color_, o.draw_color_) &&
+	       pointees_equal(draw_scale_, o.draw_scale_) &&
+	       pointees_equal(draw_area_, o.draw_area_) &&
+	       pointees_equal(activation_area_, o.activation_area_) &&
+	       pointees_equal(clip_area_, o.clip_area_) &&
+	       activation_border_ == o.activation_border_ &&
+	       can_interact_with_ == o.can_interact_with_ &&
+	       particle_systems_ == o.particle_systems_ &&
+	       text_ == o.text_ &&
+	       driver_ == o.driver_ &&
+	       blur_ == o.blur_ &&
+	       always_active_ == o.always_active_ &&
+	       parent_ == o.parent_ &&
+	       parent_pivot_ == o.parent_pivot_ &&
+	       min_difficulty_ == o.min_difficulty_ &&
+	       max_difficulty_ == o.max_difficulty_ &&
+	       custom_draw_ == o.custom_draw_ &&
+	       platform_offsets_ == o.platform_offsets_ &&
+	       paused_ == o.paused_;
+}
+
+bool CustomObject::diffBackup(const Entity& prev_entity, ConstEntityBackupDeltaPtr* result) const
+{
+	const CustomObject* prev = dynamic_cast<const CustomObject*>(&prev_entity);
+	if(prev == nullptr || !backupConstantsMatch(*prev)) {
+		return false;
+	}
+
+	std::shared_ptr<BackupDelta> delta(new BackupDelta);
+	getBackupState(&delta->state);
+	diff_backup_values(prev->vars_->values(), vars_->values(), &delta->vars, false);
+	diff_backup_values(prev->tmp_vars_->values(), tmp_vars_->values(), &delta->tmp_vars, false);
+	diff_backup_values(prev->property_data_, property_data_, &delta->property_data, true);
+
+	if(delta->vars.empty() && delta->tmp_vars.empty() && delta->property_data.empty()) {
+		BackupState prev_state;
+		prev->getBackupState(&prev_state);
+		if(prev_state == delta->state) {
+			result->reset();
+			return true;
+		}
+	}
+
+	*result = delta;
+	return true;
+}
+
+void CustomObject::applyBackupDelta(const EntityBackupDelta& d)
+{
+	const BackupDelta& delta = static_cast<const BackupDelta&>(d);
+	setBackupState(delta.state);
+
+	for(const BackupValue& v : delta.vars) {
+		vars_->values()[v.first] = v.second;
+	}
+
+	for(const BackupValue& v : delta.tmp_vars) {
+		tmp_vars_->values()[v.first] = v.second;
+	}
+
+	//the delta's copy stays in the history, so the object gets its own.
+	for(const BackupValue& v : delta.property_data) {
+		property_data_[v.first] = deep_copy_variant(v.second);
+	}
+}
+
+size_t CustomObject::backupBytes() const
+{
+	//each variable also has a key in its storage's name to slot map.
+	const size_t nvars = vars_->values().size() + tmp_vars_->values().size();
+	size_t result = sizeof(CustomObject) +
+	    2*sizeof(game_logic::FormulaVariableStorage) + sizeof(game_logic::MapFormulaCallable) +
+	    nvars*(sizeof(variant) + sizeof(std::pair<const std::string, int>) + MapNodeOverhead) +
+	    tags_->values().size()*(sizeof(std::pair<const std::string, variant>) + MapNodeOverhead) +
+	    property_data_.size()*sizeof(variant);
+
+	for(const variant& v : property_data_) {
+		result += deep_copy_bytes(v);
+	}
+
+	return result;
+}
+
 bool CustomObject::handleEvent(const std::string& event, const FormulaCallable* context)
 {
 	return handleEvent(get_object_event_id(event), context);
@@ -5070,32 +5401,30 @@ bool CustomObject::executeCommand(const variant& var)
 			result = executeCommand(var[n]) && result;
 		}
 	} else {
-		game_logic::CommandCallable* cmd = var.try_convert<game_logic::CommandCallable>();
-		if(cmd != nullptr) {
-			cmd->runCommand(*this);
-		} else {
-			CustomObjectCommandCallable* cmd = var.try_convert<CustomObjectCommandCallable>();
-			if(cmd != nullptr) {
-				cmd->runCommand(Level::current(), *this);
-			} else {
-				EntityCommandCallable* cmd = var.try_convert<EntityCommandCallable>();
-				if(cmd != nullptr) {
-					cmd->runCommand(Level::current(), *this);
-				} else {
-					SwallowObjectCommandCallable* cmd = var.try_convert<SwallowObjectCommandCallable>();
-					if(cmd) {
-						result = false;
-					} else {
-						SwallowMouseCommandCallable* cmd = var.try_convert<SwallowMouseCommandCallable>();
-						if(cmd) {
-							swallow_mouse_event_ = true;
-						} else {
-							ASSERT_LOG(false, "COMMAND WAS EXPECTED, BUT FOUND: " << var.to_debug_string() << "\nFORMULA INFO: " << output_formula_error_info() << "\n");
-						}
-					}
-				}
-			}
+		const game_logic::FormulaCallable* callable = var.is_callable() ? var.as_callable() : nullptr;
+		const game_logic::COMMAND_TYPE type = callable ? callable->getCommandType() : game_logic::COMMAND_TYPE::NONE;
+		switch(type) {
+		case game_logic::COMMAND_TYPE::FORMULA:
+			static_cast<const game_logic::CommandCallable*>(callable)->runCommand(*this);
+			break;
+		case game_logic::COMMAND_TYPE::CUSTOM_OBJECT:
+			static_cast<const CustomObjectCommandCallable*>(callable)->runCommand(Level::current(), *this);
+			break;
+		case game_logic::COMMAND_TYPE::ENTITY:
+			static_cast<const EntityCommandCallable*>(callable)->runCommand(Level::current(), *this);
+			break;
+		case game_logic::COMMAND_TYPE::SWALLOW_OBJECT:
+			result = false;
+			break;
+		case game_logic::COMMAND_TYPE::SWALLOW_MOUSE:
+			swallow_mouse_event_ = true;
+			break;
+		default:
+			ASSERT_LOG(false, "COMMAND WAS EXPECTED, BUT FOUND: " << var.to_debug_string() << "\nFORMULA INFO: " << output_formula_error_info() << "\n");
+			break;
 		}
+
+		game_logic::count_command_executed(type);
 	}
 
 	return result;
@@ -5887,3 +6216,33 @@ BENCHMARK_ARG(custom_object_handle_event, const std::string& object_event)
 BENCHMARK_ARG_CALL(custom_object_handle_event, ant_non_exist, "ant_black:blahblah");
 
 BENCHMARK_ARG_CALL_COMMAND_LINE(custom_object_handle_event);
+
+//the same as custom_object_handle_event, but with the object type's
+//formulas compiled to bytecode.
+BENCHMARK_ARG(custom_object_handle_event_vm, const std::string& object_event)
+{
+	auto i = std::find(object_event.begin(), object_event.end(), ':');
+	ASSERT_LOG(i != object_event.end(), "custom_object_event_handle_vm argument must have a colon seperator: " << object_event);
+	std::string obj_type(object_event.begin(), i);
+	std::string event_name(i+1, object_event.end());
+	static Level* lvl = new Level("titlescreen.cfg");
+	lvl->setAsCurrentLevel();
+
+	static CustomObject* obj = nullptr;
+	if(obj == nullptr) {
+		const formula_vm::EnabledScope vm_scope;
+		CustomObjectType::invalidateObject(obj_type);
+		obj = new CustomObject(obj_type, 0, 0, false);
+		CustomObjectType::invalidateObject(obj_type);
+	}
+
+	obj->setLevel(*lvl);
+	const int event_id = get_object_event_id(event_name);
+	BENCHMARK_LOOP {
+		obj->handleEvent(event_id);
+	}
+}
+
+BENCHMARK_ARG_CALL(custom_object_handle_event_vm, ant_non_exist_vm, "ant_black:blahblah");
+
+BENCHMARK_ARG_CALL_COMMAND_LINE(custom_object_handle_event_vm);
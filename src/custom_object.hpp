@@ -158,6 +158,10 @@ public:
 	virtual EntityPtr clone() const;
 	virtual EntityPtr backup() const;
 
+	bool diffBackup(const Entity& prev, ConstEntityBackupDeltaPtr* delta) const override;
+	void applyBackupDelta(const EntityBackupDelta& delta) override;
+	size_t backupBytes() const override;
+
 	game_logic::ConstFormulaPtr getEventHandler(int key) const;
 	void setEventHandler(int, game_logic::ConstFormulaPtr f);
 
@@ -286,6 +290,9 @@ protected:
 	void setValue(const std::string& key, const variant& value);
 	void setValueBySlot(int slot, const variant& value);
 
+	int getSlotLayoutId() const;
+	int getSlotForKey(const std::string& key) const;
+
 	virtual variant getPlayerValueBySlot(int slot) const;
 	virtual void setPlayerValueBySlot(int slot, const variant& value);
 
@@ -329,6 +336,15 @@ private:
 	CustomObject& operator=(const CustomObject& o);
 	struct Accessor;
 
+	//the fields diffBackup() records when they change, and the delta it
+	//makes. Any field the copy constructor copies must either be in
+	//BackupState or be compared by backupConstantsMatch().
+	struct BackupState;
+	struct BackupDelta;
+	void getBackupState(BackupState* state) const;
+	void setBackupState(const BackupState& state);
+	bool backupConstantsMatch(const CustomObject& o) const;
+
 	struct gc_object_reference {
 		Entity* owner;
 		Entity* target;
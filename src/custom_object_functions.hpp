@@ -43,13 +43,16 @@ FunctionSymbolTable& get_custom_object_functions_symbol_table();
 class EntityCommandCallable : public game_logic::FormulaCallable 
 {
 public:
-	EntityCommandCallable() : expr_(nullptr) {}
+	EntityCommandCallable() : expr_(nullptr) { setCommandType(game_logic::COMMAND_TYPE::ENTITY); }
 	void runCommand(Level& lvl, Entity& obj) const;
 
 	void setExpression(const game_logic::FormulaExpression* expr);
 
 	bool isCommand() const { return true; }
 
+	static void* operator new(size_t size) { return game_logic::allocate_command(size); }
+	static void operator delete(void* p, size_t size) { game_logic::free_command(p, size); }
+
 private:
 	virtual void execute(Level& lvl, Entity& ob) const = 0;
 	variant getValue(const std::string& key) const { return variant(); }
@@ -64,13 +67,16 @@ private:
 class CustomObjectCommandCallable : public game_logic::FormulaCallable 
 {
 public:
-	CustomObjectCommandCallable() : expr_(nullptr) {}
+	CustomObjectCommandCallable() : expr_(nullptr) { setCommandType(game_logic::COMMAND_TYPE::CUSTOM_OBJECT); }
 	void runCommand(Level& lvl, CustomObject& ob) const;
 
 	void setExpression(const game_logic::FormulaExpression* expr);
 
 	bool isCommand() const { return true; }
 
+	static void* operator new(size_t size) { return game_logic::allocate_command(size); }
+	static void operator delete(void* p, size_t size) { game_logic::free_command(p, size); }
+
 private:
 	virtual void execute(Level& lvl, CustomObject& ob) const = 0;
 	variant getValue(const std::string& key) const { return variant(); }
@@ -85,6 +91,7 @@ private:
 class SwallowObjectCommandCallable : public game_logic::FormulaCallable 
 {
 public:
+	SwallowObjectCommandCallable() { setCommandType(game_logic::COMMAND_TYPE::SWALLOW_OBJECT); }
 	bool isCommand() const { return true; }
 private:
 	variant getValue(const std::string& key) const { return variant(); }
@@ -94,6 +101,7 @@ private:
 class SwallowMouseCommandCallable : public game_logic::FormulaCallable 
 {
 public:
+	SwallowMouseCommandCallable() { setCommandType(game_logic::COMMAND_TYPE::SWALLOW_MOUSE); }
 	bool isCommand() const { return true; }
 private:
 	variant getValue(const std::string& key) const { return variant(); }
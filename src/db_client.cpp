@@ -21,12 +21,22 @@
 	   distribution.
 */
 
+#include <stdio.h>
+
+#include <memory>
+
+#include "asserts.hpp"
 #include "db_client.hpp"
 #include "filesystem.hpp"
+#include "formatter.hpp"
 #include "json_parser.hpp"
 #include "preferences.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
 
 PREF_STRING(db_json_file, "", "The file to output database content to when using a file to simulate a database");
+PREF_STRING(db_log_file, "", "If set, simulate the database with an append-only log in this file, rather than a JSON document which is rewritten on every change");
+PREF_INT(db_log_compact_records, 1024, "The number of records the database log must have, and be at least twice the number of live keys, before it is compacted");
 
 BEGIN_DEFINE_CALLABLE_NOBASE(DbClient)
 BEGIN_DEFINE_FN(read_modify_write, "(string, function(any)->any) ->commands")
@@ -131,13 +141,373 @@ namespace
 		variant doc_;
 		bool dirty_;
 	};
+
+	//A database kept in a log file. Every put or remove appends a line to
+	//the log, and the latest document for each key is kept in memory. On
+	//startup the log is replayed to rebuild the documents. Once most of the
+	//log is superseded records it is rewritten with only the live ones, on
+	//a background thread.
+	//
+	//Each record is a JSON list on a single line: [key, doc] for a put and
+	//[key] for a remove.
+	class LogStructuredDbClient : public DbClient
+	{
+	public:
+		explicit LogStructuredDbClient(const std::string& fname) : fname_(fname), nrecords_(0), file_(nullptr), compacting_(false), compaction_done_(false) {
+			replay();
+			file_ = fopen(fname_.c_str(), "ab");
+			ASSERT_LOG(file_ != nullptr, "Could not open database log " << fname_);
+		}
+
+		~LogStructuredDbClient() {
+			if(compacting_) {
+				finishCompaction();
+			}
+
+			flush();
+			fclose(file_);
+		}
+
+		bool process(int timeout_us) {
+			flush();
+
+			if(compacting_) {
+				bool done = false;
+				{
+					threading::lock lck(compaction_mutex_);
+					done = compaction_done_;
+				}
+
+				if(done) {
+					finishCompaction();
+				}
+			} else if(nrecords_ >= g_db_log_compact_records && nrecords_ > index_.size()*2) {
+				startCompaction();
+			}
+
+			return false;
+		}
+
+		void put(const std::string& key, variant doc, std::function<void()> on_done, std::function<void()> on_error, PUT_OPERATION op=PUT_SET)
+		{
+			auto itor = index_.find(key);
+			if((op == PUT_ADD && itor != index_.end()) || (op == PUT_REPLACE && itor == index_.end())) {
+				on_error();
+				return;
+			}
+
+			Entry& entry = index_[key];
+			entry.doc = doc;
+			entry.record = makeRecord(key, &doc);
+			append(entry.record);
+			on_done();
+		}
+
+		void get(const std::string& key, std::function<void(variant)> on_done, int lock_seconds) {
+			auto itor = index_.find(key);
+			on_done(itor == index_.end() ? variant() : itor->second.doc);
+		}
+
+		void remove(const std::string& key) {
+			auto itor = index_.find(key);
+			if(itor == index_.end()) {
+				return;
+			}
+
+			index_.erase(itor);
+			append(makeRecord(key, nullptr));
+		}
+
+	private:
+		//records are shared with the compaction thread, so they are never
+		//modified once created.
+		typedef std::shared_ptr<const std::string> RecordPtr;
+
+		struct Entry {
+			variant doc;
+			RecordPtr record;
+		};
+
+		static RecordPtr makeRecord(const std::string& key, const variant* doc) {
+			std::vector<variant> items;
+			items.push_back(variant(key));
+			if(doc) {
+				items.push_back(*doc);
+			}
+
+			return RecordPtr(new std::string(variant(&items).write_json(false, variant::JSON_COMPLIANT) + "\n"));
+		}
+
+		void replay() {
+			if(!sys::file_exists(fname_)) {
+				return;
+			}
+
+			const std::string contents = sys::read_file(fname_);
+			size_t pos = 0;
+			while(pos < contents.size()) {
+				const size_t end = contents.find('\n', pos);
+				if(end == std::string::npos) {
+					break;
+				}
+
+				RecordPtr record(new std::string(contents, pos, end + 1 - pos));
+				variant items;
+				try {
+					items = json::parse(*record, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+				} catch(json::ParseError&) {
+				}
+
+				if(!items.is_list() || items.num_elements() < 1 || !items[0].is_string()) {
+					//records are only ever appended whole, so a complete
+					//line which can't be read has been corrupted. Skip it
+					//rather than losing the records after it.
+					LOG_ERROR("Skipping corrupt record at offset " << pos << " of database log " << fname_);
+					++nrecords_;
+					pos = end + 1;
+					continue;
+				}
+
+				const std::string key = items[0].as_string();
+				if(items.num_elements() > 1) {
+					Entry& entry = index_[key];
+					entry.doc = items[1];
+					entry.record = record;
+				} else {
+					index_.erase(key);
+				}
+
+				++nrecords_;
+				pos = end + 1;
+			}
+
+			if(pos < contents.size()) {
+				//the last record has no newline, so it was only partly
+				//written when we last stopped. Drop it, so that new records
+				//start on a new line.
+				LOG_WARN("Discarding an incomplete record at the end of database log " << fname_);
+				sys::write_file(fname_, contents.substr(0, pos));
+			}
+		}
+
+		void append(const RecordPtr& record) {
+			pending_ += *record;
+			++nrecords_;
+			if(compacting_) {
+				written_during_compaction_.push_back(record);
+			}
+		}
+
+		void flush() {
+			if(pending_.empty()) {
+				return;
+			}
+
+			const size_t written = fwrite(pending_.c_str(), 1, pending_.size(), file_);
+			ASSERT_LOG(written == pending_.size(), "Failed to write to database log " << fname_);
+			fflush(file_);
+			pending_.clear();
+		}
+
+		std::string compactionFileName() const {
+			return fname_ + ".compact";
+		}
+
+		void startCompaction() {
+			std::shared_ptr<std::vector<RecordPtr>> records(new std::vector<RecordPtr>);
+			records->reserve(index_.size());
+			for(const auto& p : index_) {
+				records->push_back(p.second.record);
+			}
+
+			compacting_ = true;
+			compaction_done_ = false;
+			written_during_compaction_.clear();
+
+			const std::string fname = compactionFileName();
+			compaction_thread_.reset(new threading::thread("db_log_compaction", [=]() {
+				std::string contents;
+				for(const RecordPtr& record : *records) {
+					contents += *record;
+				}
+
+				sys::write_file(fname, contents);
+
+				threading::lock lck(compaction_mutex_);
+				compaction_done_ = true;
+			}));
+		}
+
+		void finishCompaction() {
+			compaction_thread_->join();
+			compaction_thread_.reset();
+
+			//the compacted log only has the records which were live when it
+			//started. Anything written since goes on the end of it before it
+			//replaces the current log.
+			flush();
+			fclose(file_);
+
+			std::string tail;
+			for(const RecordPtr& record : written_during_compaction_) {
+				tail += *record;
+			}
+
+			const std::string fname = compactionFileName();
+			FILE* compacted = fopen(fname.c_str(), "ab");
+			ASSERT_LOG(compacted != nullptr, "Could not open compacted database log " << fname);
+			const size_t written = fwrite(tail.c_str(), 1, tail.size(), compacted);
+			ASSERT_LOG(written == tail.size(), "Failed to write compacted database log " << fname);
+			fclose(compacted);
+
+			sys::move_file(fname, fname_);
+			file_ = fopen(fname_.c_str(), "ab");
+			ASSERT_LOG(file_ != nullptr, "Could not open database log " << fname_);
+
+			nrecords_ = index_.size() + written_during_compaction_.size();
+			written_during_compaction_.clear();
+			compacting_ = false;
+		}
+
+		std::string fname_;
+		std::map<std::string, Entry> index_;
+
+		//the number of records in the log, including superseded ones.
+		size_t nrecords_;
+
+		FILE* file_;
+		std::string pending_;
+
+		bool compacting_;
+		std::unique_ptr<threading::thread> compaction_thread_;
+		threading::mutex compaction_mutex_;
+		bool compaction_done_;
+		std::vector<RecordPtr> written_during_compaction_;
+	};
+
+	DbClientPtr create_file_backed_client(const std::string& json_file)
+	{
+		if(!g_db_log_file.empty()) {
+			return DbClientPtr(new LogStructuredDbClient(g_db_log_file));
+		}
+
+		return DbClientPtr(new FileBackedDbClient(json_file));
+	}
 }
 
+UNIT_TEST(db_client_log)
+{
+	const std::string fname = "test-db-client-log.tmp";
+	sys::remove_file(fname);
+
+	variant result;
+	{
+		DbClientPtr db(new LogStructuredDbClient(fname));
+		db->put("a", variant(1), [](){}, [](){});
+		db->put("b", variant("line one\nline two"), [](){}, [](){});
+		db->put("a", variant(2), [](){}, [](){});
+		db->remove("b");
+		db->put("c", variant(3), [](){}, [](){});
+
+		bool failed = false;
+		db->put("c", variant(4), [](){}, [&failed]() { failed = true; }, DbClient::PUT_ADD);
+		CHECK(failed, "PUT_ADD of an existing key succeeded");
+		db->process(0);
+	}
+
+	//simulate a record cut short by a crash.
+	sys::write_file(fname, sys::read_file(fname) + "[\"d\", ");
+
+	{
+		DbClientPtr db(new LogStructuredDbClient(fname));
+		db->get("a", [&result](variant v) { result = v; });
+		CHECK_EQ(result, variant(2));
+		db->get("b", [&result](variant v) { result = v; });
+		CHECK(result.is_null(), "removed key was found");
+		db->get("c", [&result](variant v) { result = v; });
+		CHECK_EQ(result, variant(3));
+		db->get("d", [&result](variant v) { result = v; });
+		CHECK(result.is_null(), "incomplete record was found");
+
+		db->put("d", variant(5), [](){}, [](){});
+	}
+
+	{
+		DbClientPtr db(new LogStructuredDbClient(fname));
+		db->get("d", [&result](variant v) { result = v; });
+		CHECK_EQ(result, variant(5));
+	}
+
+	//a corrupt record with good records after it is skipped, and the
+	//records after it are kept.
+	sys::write_file(fname, sys::read_file(fname) + "{corrupt\n[\"e\", 6]\n");
+
+	{
+		DbClientPtr db(new LogStructuredDbClient(fname));
+		db->get("d", [&result](variant v) { result = v; });
+		CHECK_EQ(result, variant(5));
+		db->get("e", [&result](variant v) { result = v; });
+		CHECK_EQ(result, variant(6));
+	}
+
+	CHECK(sys::read_file(fname).find("{corrupt") != std::string::npos, "log was rewritten without the corrupt record");
+
+	sys::remove_file(fname);
+}
+
+BENCHMARK_ARG(db_client, const std::string& mode)
+{
+	//compares the JSON document and log backends with a few thousand
+	//accounts: '_put' updates one account and processes, as the
+	//matchmaking server does, and '_recover' opens the database.
+	const int NumAccounts = 4096;
+	const bool log = mode.find("log") == 0;
+	const std::string fname = log ? "benchmark-db.log" : "benchmark-db.json";
+
+	auto create = [=]() -> DbClientPtr {
+		if(log) {
+			return DbClientPtr(new LogStructuredDbClient(fname));
+		}
+		return DbClientPtr(new FileBackedDbClient(fname));
+	};
+
+	static std::map<std::string, DbClientPtr> clients;
+	DbClientPtr& client = clients[fname];
+	if(!client) {
+		sys::remove_file(fname);
+		client = create();
+		for(int n = 0; n != NumAccounts; ++n) {
+			variant doc = json::parse(formatter() << "{\"user\": \"user" << n << "\", \"rating\": 1500, \"games\": [1, 2, 3]}", json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+			client->put(formatter() << "user" << n, doc, [](){}, [](){});
+		}
+		client->process(0);
+	}
+
+	if(mode.find("_put") != std::string::npos) {
+		int n = 0;
+		BENCHMARK_LOOP {
+			client->put(formatter() << "user" << (n%NumAccounts), variant(n), [](){}, [](){});
+			client->process(0);
+			++n;
+		}
+	} else {
+		client->process(0);
+		BENCHMARK_LOOP {
+			create();
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(db_client, json_put, "json_put");
+BENCHMARK_ARG_CALL(db_client, log_put, "log_put");
+BENCHMARK_ARG_CALL(db_client, json_recover, "json_recover");
+BENCHMARK_ARG_CALL(db_client, log_recover, "log_recover");
+
 #ifndef USE_DBCLIENT
 
 DbClientPtr DbClient::create() 
 {
-	return DbClientPtr(new FileBackedDbClient(g_db_json_file.empty() ? "db.json" : g_db_json_file.c_str()));
+	return create_file_backed_client(g_db_json_file.empty() ? "db.json" : g_db_json_file.c_str());
 }
 
 #else
@@ -396,10 +766,10 @@ void remove_callback(lcb_t instance, const void* cookie, lcb_error_t error, cons
 
 DbClientPtr DbClient::create() 
 {
-	if(g_db_json_file.empty()) {
+	if(g_db_json_file.empty() && g_db_log_file.empty()) {
 		return DbClientPtr(new CouchbaseDbClient);
 	} else {
-		return DbClientPtr(new FileBackedDbClient(g_db_json_file));
+		return create_file_backed_client(g_db_json_file);
 	}
 }
 
@@ -143,12 +143,10 @@ namespace debug_console
 		canvas->drawSolidRect(graph_area, KRE::Color(255, 255, 255, 64));
 
 		canvas->drawSolidRect(rect(graph_area.x(), graph_area.y(), graph_area.w(), 2), KRE::Color::colorWhite());
-		canvas->blitTexture(KRE::Font::getInstance()->renderText(formatter() << max_value.as_int(), KRE::Color::colorWhite(), 14, false), 
-			0, rect(graph_area.x2() + 4, graph_area.y()));
+		KRE::Font::getInstance()->drawText(formatter() << max_value.as_int(), KRE::Color::colorWhite(), 14, graph_area.x2() + 4, graph_area.y());
 
 		canvas->drawSolidRect(rect(graph_area.x(), graph_area.y2(), graph_area.w(), 2), KRE::Color::colorWhite());
-		canvas->blitTexture(KRE::Font::getInstance()->renderText(formatter() << min_value.as_int(), KRE::Color::colorWhite(), 14, false), 
-			0, rect(graph_area.x2() + 4, graph_area.y2() - 12));
+		KRE::Font::getInstance()->drawText(formatter() << min_value.as_int(), KRE::Color::colorWhite(), 14, graph_area.x2() + 4, graph_area.y2() - 12);
 
 		KRE::Color GraphColors[] = {
 			KRE::Color(255,255,255,255),
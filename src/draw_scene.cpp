@@ -24,6 +24,7 @@
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <numeric>
 
 #include <boost/lexical_cast.hpp>
 
@@ -571,8 +572,25 @@ variant performance_data::getValue(const std::string& key) const
 	PERF_ATTR(flip);
 	PERF_ATTR(cycle);
 	PERF_ATTR(nevents);
+	PERF_ATTR(draw_calls);
+	PERF_ATTR(unbatched_draw_calls);
+	PERF_ATTR(text_atlas_pages);
+	PERF_ATTR(text_texture_uploads);
+	PERF_ATTR(tile_chunks_visible);
+	PERF_ATTR(tile_chunks_total);
+	PERF_ATTR(render_target_allocations);
+	PERF_ATTR(scene_objects_culled);
+	PERF_ATTR(scene_objects_queued);
 #undef PERF_ATTR
 
+	if(key == "commands") {
+		std::map<variant, variant> m;
+		for(int n = 0; n != static_cast<int>(commands.size()); ++n) {
+			m[variant(game_logic::get_command_type_name(static_cast<game_logic::COMMAND_TYPE>(n)))] = variant(commands[n]);
+		}
+		return variant(&m);
+	}
+
 	return variant();
 }
 
@@ -587,6 +605,16 @@ void performance_data::getInputs(std::vector<game_logic::FormulaInput>* inputs)
 	PERF_ATTR(flip);
 	PERF_ATTR(cycle);
 	PERF_ATTR(nevents);
+	PERF_ATTR(draw_calls);
+	PERF_ATTR(unbatched_draw_calls);
+	PERF_ATTR(text_atlas_pages);
+	PERF_ATTR(text_texture_uploads);
+	PERF_ATTR(tile_chunks_visible);
+	PERF_ATTR(tile_chunks_total);
+	PERF_ATTR(render_target_allocations);
+	PERF_ATTR(scene_objects_culled);
+	PERF_ATTR(scene_objects_queued);
+	PERF_ATTR(commands);
 #undef PERF_ATTR
 }
 
@@ -607,7 +635,7 @@ void draw_fps(const Level& lvl, const performance_data& data)
 	}
 
 	std::ostringstream s;
-	s << data.fps << "/" << data.cycles_per_second << "fps; " << (data.draw/10) << "% draw; " << (data.flip/10) << "% flip; " << (data.process/10) << "% process; " << (data.delay/10) << "% idle; " << lvl.num_active_chars() << " objects; " << data.nevents << " events";
+	s << data.fps << "/" << data.cycles_per_second << "fps; " << (data.draw/10) << "% draw; " << (data.flip/10) << "% flip; " << (data.process/10) << "% process; " << (data.delay/10) << "% idle; " << lvl.num_active_chars() << " objects; " << data.nevents << " events; " << data.draw_calls << " draw calls (" << data.unbatched_draw_calls << " unbatched); " << data.text_atlas_pages << " glyph pages; " << data.text_texture_uploads << " text uploads; " << data.tile_chunks_visible << "/" << data.tile_chunks_total << " tile chunks; " << std::accumulate(data.commands.begin(), data.commands.end(), 0) << " commands; " << data.render_target_allocations << " FBO allocs; " << data.scene_objects_culled << "/" << (data.scene_objects_culled + data.scene_objects_queued) << " scene objects culled";
 
 	std::ostringstream nets;
 
@@ -635,18 +663,15 @@ void draw_fps(const Level& lvl, const performance_data& data)
 	} else {
 		int y = 60;
 		const int font_size = 18;
-		auto canvas = KRE::Canvas::getInstance();
-		auto t = KRE::Font::getInstance()->renderText(s.str(), KRE::Color::colorWhite(), font_size, false, module::get_default_font());
-		canvas->blitTexture(t, 0, 10, y);
-		y += t->surfaceHeight() + 5;
+		auto font = KRE::Font::getInstance();
+		rect area = font->drawText(s.str(), KRE::Color::colorWhite(), font_size, 10, y, module::get_default_font());
+		y = area.y2() + 5;
 		if(!nets.str().empty()) {
-			t = KRE::Font::getInstance()->renderText(nets.str(), KRE::Color::colorWhite(), font_size, false, module::get_default_font()); 
-			canvas->blitTexture(t, 0, 10, y);
-			y += t->surfaceHeight() + 5;
+			area = font->drawText(nets.str(), KRE::Color::colorWhite(), font_size, 10, y, module::get_default_font());
+			y = area.y2() + 5;
 		}
 		if(!data.profiling_info.empty()) {
-			t = KRE::Font::getInstance()->renderText(data.profiling_info, KRE::Color::colorWhite(), font_size, false, module::get_default_font()); 
-			canvas->blitTexture(t, 0, 10, y);
+			font->drawText(data.profiling_info, KRE::Color::colorWhite(), font_size, 10, y, module::get_default_font());
 		}
 	}
 }
@@ -25,6 +25,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "ColorTransform.hpp"
 
@@ -89,13 +90,32 @@ struct performance_data {
 	int flip;
 	int cycle;
 	int nevents;
+	int draw_calls;
+	int unbatched_draw_calls;
+	int text_atlas_pages;
+	int text_texture_uploads;
+	int tile_chunks_visible;
+	int tile_chunks_total;
+	// Render targets created in the last second.
+	int render_target_allocations;
+	// Scene objects culled as out of view, and queued to be drawn, in the
+	// last second.
+	int scene_objects_culled;
+	int scene_objects_queued;
+
+	// Commands executed in the last second, indexed by game_logic::COMMAND_TYPE.
+	std::vector<int> commands;
 
 	std::string profiling_info;
 
-	performance_data(int fps_, int cycles_per_second_, int delay_, int draw_, int process_, int flip_, int cycle_, int nevents_, const std::string& profiling_info_)
+	performance_data(int fps_, int cycles_per_second_, int delay_, int draw_, int process_, int flip_, int cycle_, int nevents_, int draw_calls_, int unbatched_draw_calls_, int text_atlas_pages_, int text_texture_uploads_, int tile_chunks_visible_, int tile_chunks_total_, const std::string& profiling_info_)
 	  : fps(fps_), cycles_per_second(cycles_per_second_), delay(delay_),
 	    draw(draw_), process(process_), flip(flip_), cycle(cycle_),
-		nevents(nevents_), profiling_info(profiling_info_)
+		nevents(nevents_), draw_calls(draw_calls_), unbatched_draw_calls(unbatched_draw_calls_),
+		text_atlas_pages(text_atlas_pages_), text_texture_uploads(text_texture_uploads_),
+		tile_chunks_visible(tile_chunks_visible_), tile_chunks_total(tile_chunks_total_),
+		render_target_allocations(0), scene_objects_culled(0), scene_objects_queued(0),
+		profiling_info(profiling_info_)
 	{}
 
 	variant getValue(const std::string& key) const;
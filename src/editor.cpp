@@ -41,6 +41,7 @@
 #include "WindowManager.hpp"
 
 #include "asserts.hpp"
+#include "background_task_pool.hpp"
 #include "border_widget.hpp"
 #include "button.hpp"
 #include "character_editor_dialog.hpp"
@@ -834,6 +835,10 @@ editor::editor(const char* level_cfg)
 	drawing_rect_(false), 
 	dragging_(false), 
 	level_changed_(0),
+	autosave_edits_(0),
+	autosave_first_edit_time_(0),
+	autosave_last_edit_time_(0),
+	autosave_task_(-1),
 	selected_segment_(-1),
 	mouse_buttons_down_(0), 
 	prev_mousex_(-1), 
@@ -1176,6 +1181,8 @@ bool editor::handleEvent(const SDL_Event& event, bool swallowed)
 
 void editor::process()
 {
+	autosave_level_if_due();
+
 	if(code_dialog_) {
 		code_dialog_->process();
 	}
@@ -2847,6 +2854,8 @@ bool editor::confirm_quit(bool allow_cancel)
 		SDL_SetRelativeMouseMode(SDL_FALSE);
 	}
 
+	flush_autosave();
+
 	if(!level_changed_) {
 		return true;
 	}
@@ -2886,8 +2895,20 @@ bool editor::confirm_quit(bool allow_cancel)
 	return true;
 }
 
+namespace
+{
+	//an autosave is written once no edits have been made for
+	//AutosaveIdleTime, or AutosaveMaxDelay after the first unsaved edit if
+	//editing carries on, or after AutosaveMaxEdits edits.
+	const int AutosaveIdleTime = 1000;
+	const int AutosaveMaxDelay = 10000;
+	const int AutosaveMaxEdits = 100;
+}
+
 void editor::autosave_level()
 {
+	autosave_edits_ = 0;
+
 	controls::control_backup_scope ctrl_backup;
 
 	toggle_active_level();
@@ -2895,26 +2916,67 @@ void editor::autosave_level()
 	remove_ghost_objects();
 	ghost_objects_.clear();
 
-	std::string data;
+	//the level is serialized here rather than on the worker, since the
+	//variants in it are shared with the level and their reference counts
+	//aren't safe to touch from another thread.
 	variant lvl_node = lvl_->write();
 	std::map<variant,variant> attr = lvl_node.as_map();
 	attr.erase(variant("cycle"));  //levels saved in the editor should never
 	                               //have a cycle attached to them so that
 								   //all levels start at cycle 0.
 	lvl_node = variant(&attr);
+	std::shared_ptr<std::string> data(new std::string(lvl_node.write_json(true)));
+
+	toggle_active_level();
+
+	//only one autosave is written at a time so that the backup is always
+	//the autosave before this one.
+	background_task_pool::wait(autosave_task_);
+
 	const std::string target_path = std::string(preferences::user_data_path()) + "/autosave.cfg";
-	if(sys::file_exists(target_path)) {
-		const std::string backup_path = target_path + ".1";
-		if(sys::file_exists(backup_path)) {
-			sys::remove_file(backup_path);
+	std::shared_ptr<std::string> error(new std::string);
+	autosave_task_ = background_task_pool::submit([target_path, data, error]() {
+		//write to a temporary file and rename it into place, so a crash
+		//part way through never leaves a truncated autosave.
+		try {
+			const std::string tmp_path = target_path + ".tmp";
+			sys::write_file(tmp_path, *data);
+			if(sys::file_exists(target_path)) {
+				sys::move_file(target_path, target_path + ".1");
+			}
+
+			sys::move_file(tmp_path, target_path);
+		} catch(std::exception& e) {
+			*error = e.what();
 		}
+	}, [error]() {
+		if(error->empty() == false) {
+			LOG_ERROR("Could not write autosave: " << *error);
+		}
+	}, background_task_pool::PRIORITY::FILE_WRITE);
+}
 
-		sys::move_file(target_path, backup_path);
+void editor::autosave_level_if_due()
+{
+	if(autosave_edits_ == 0) {
+		return;
 	}
 
-	sys::write_file(target_path, lvl_node.write_json(true));
+	const int now = profile::get_tick_time();
+	if(autosave_edits_ >= AutosaveMaxEdits ||
+	   now - autosave_last_edit_time_ >= AutosaveIdleTime ||
+	   now - autosave_first_edit_time_ >= AutosaveMaxDelay) {
+		autosave_level();
+	}
+}
 
-	toggle_active_level();
+void editor::flush_autosave()
+{
+	if(autosave_edits_ > 0) {
+		autosave_level();
+	}
+
+	background_task_pool::wait(autosave_task_);
 }
 
 void editor::save_level()
@@ -3328,11 +3390,8 @@ void editor::draw_gui() const
 		}
 	}
 
-	auto xtex = KRE::Font::getInstance()->renderText(formatter() << (xpos_ + mousex*zoom_) << ",", KRE::Color::colorWhite(), 14);
-	auto ytex = KRE::Font::getInstance()->renderText(formatter() << (ypos_ + mousey*zoom_), KRE::Color::colorWhite(), 14);
-	
-	canvas->blitTexture(xtex, 0, rect(10, 80));
-	canvas->blitTexture(ytex, 0, rect(10 + xtex->width(), 80));
+	const rect xarea = KRE::Font::getInstance()->drawText(formatter() << (xpos_ + mousex*zoom_) << ",", KRE::Color::colorWhite(), 14, 10, 80);
+	KRE::Font::getInstance()->drawText(formatter() << (ypos_ + mousey*zoom_), KRE::Color::colorWhite(), 14, xarea.x2(), 80);
 	
 	if(!code_dialog_ && current_dialog_) {
 		current_dialog_->draw();
@@ -3429,7 +3488,13 @@ void editor::executeCommand(std::function<void()> command, std::function<void()>
 	undo_.push_back(cmd);
 	redo_.clear();
 
-	autosave_level();
+	const int now = profile::get_tick_time();
+	if(autosave_edits_++ == 0) {
+		autosave_first_edit_time_ = now;
+	}
+
+	autosave_last_edit_time_ = now;
+	autosave_level_if_due();
 }
 
 void editor::begin_command_group()
@@ -177,6 +177,9 @@ public:
 	void quit();
 	bool confirm_quit(bool allow_cancel=true);
 	void autosave_level();
+	//writes out any edits which haven't been autosaved yet, and waits for
+	//the write to finish.
+	void flush_autosave();
 	void zoomIn();
 	void zoomOut();
 	int zoom() const { return zoom_; }
@@ -373,6 +376,14 @@ private:
 	std::vector<EntityPtr> ghost_objects_;
 
 	int level_changed_;
+
+	//autosaves are put off until editing pauses, so that a burst of edits
+	//is saved once. These track the edits made since the last autosave.
+	void autosave_level_if_due();
+	int autosave_edits_;
+	int autosave_first_edit_time_, autosave_last_edit_time_;
+	int autosave_task_;
+
 	int selected_segment_;
 
 	//track mouse buttons that went down that we handled the event for,
@@ -21,6 +21,7 @@
 	   distribution.
 */
 
+#include <algorithm>
 #include <iostream>
 #include <limits.h>
 
@@ -327,6 +328,107 @@ std::vector<variant> Entity::popScheduledCommands()
 	return result;
 }
 
+bool Entity::EntityBackupState::operator==(const EntityBackupState& o) const
+{
+	if(x != o.x || y != o.y ||
+	   prev_feet_x != o.prev_feet_x || prev_feet_y != o.prev_feet_y ||
+	   last_move_x != o.last_move_x || last_move_y != o.last_move_y ||
+	   face_right != o.face_right || upside_down != o.upside_down ||
+	   mouse_over_entity != o.mouse_over_entity ||
+	   mouse_button_state != o.mouse_button_state ||
+	   being_dragged != o.being_dragged ||
+	   !std::equal(controls, controls + controls::NUM_CONTROLS, o.controls) ||
+	   !variants_identical(controls_user, o.controls_user) ||
+	   solid_rect != o.solid_rect || frame_rect != o.frame_rect ||
+	   platform_rect != o.platform_rect || prev_platform_rect != o.prev_platform_rect ||
+	   solid != o.solid || platform != o.platform ||
+	   platform_motion_x != o.platform_motion_x ||
+	   mouseover_trigger_cycle != o.mouseover_trigger_cycle ||
+	   scheduled_commands.size() != o.scheduled_commands.size()) {
+		return false;
+	}
+
+	for(size_t n = 0; n != scheduled_commands.size(); ++n) {
+		if(scheduled_commands[n].first != o.scheduled_commands[n].first ||
+		   !variants_identical(scheduled_commands[n].second, o.scheduled_commands[n].second)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Entity::getEntityBackupState(EntityBackupState* state) const
+{
+	state->x = x_;
+	state->y = y_;
+	state->prev_feet_x = prev_feet_x_;
+	state->prev_feet_y = prev_feet_y_;
+	state->last_move_x = last_move_x_;
+	state->last_move_y = last_move_y_;
+	state->face_right = face_right_;
+	state->upside_down = upside_down_;
+	state->mouse_over_entity = mouse_over_entity_;
+	state->mouse_button_state = mouse_button_state_;
+	state->being_dragged = being_dragged_;
+	state->scheduled_commands = scheduled_commands_;
+	std::copy(controls_, controls_ + controls::NUM_CONTROLS, state->controls);
+	state->controls_user = controls_user_;
+	state->solid_rect = solid_rect_;
+	state->frame_rect = frame_rect_;
+	state->platform_rect = platform_rect_;
+	state->prev_platform_rect = prev_platform_rect_;
+	state->solid = solid_;
+	state->platform = platform_;
+	state->platform_motion_x = platform_motion_x_;
+	state->mouseover_trigger_cycle = mouseover_trigger_cycle_;
+}
+
+void Entity::setEntityBackupState(const EntityBackupState& state)
+{
+	x_ = state.x;
+	y_ = state.y;
+	prev_feet_x_ = state.prev_feet_x;
+	prev_feet_y_ = state.prev_feet_y;
+	last_move_x_ = state.last_move_x;
+	last_move_y_ = state.last_move_y;
+	face_right_ = state.face_right;
+	upside_down_ = state.upside_down;
+	mouse_over_entity_ = state.mouse_over_entity;
+	mouse_button_state_ = state.mouse_button_state;
+	being_dragged_ = state.being_dragged;
+	scheduled_commands_ = state.scheduled_commands;
+	std::copy(state.controls, state.controls + controls::NUM_CONTROLS, controls_);
+	controls_user_ = state.controls_user;
+	solid_rect_ = state.solid_rect;
+	frame_rect_ = state.frame_rect;
+	platform_rect_ = state.platform_rect;
+	prev_platform_rect_ = state.prev_platform_rect;
+	solid_ = state.solid;
+	platform_ = state.platform;
+	platform_motion_x_ = state.platform_motion_x;
+	mouseover_trigger_cycle_ = state.mouseover_trigger_cycle;
+}
+
+bool Entity::entityBackupConstantsMatch(const Entity& o) const
+{
+	return label_ == o.label_ &&
+	       group_ == o.group_ &&
+	       id_ == o.id_ &&
+	       respawn_ == o.respawn_ &&
+	       solid_dimensions_ == o.solid_dimensions_ &&
+	       collide_dimensions_ == o.collide_dimensions_ &&
+	       weak_solid_dimensions_ == o.weak_solid_dimensions_ &&
+	       weak_collide_dimensions_ == o.weak_collide_dimensions_ &&
+	       current_generator_ == o.current_generator_ &&
+	       attached_objects_ == o.attached_objects_ &&
+	       spawned_by_ == o.spawned_by_ &&
+	       mouseover_delay_ == o.mouseover_delay_ &&
+	       mouse_over_area_ == o.mouse_over_area_ &&
+	       true_z_ == o.true_z_ &&
+	       tx_ == o.tx_ && ty_ == o.ty_ && tz_ == o.tz_;
+}
+
 void Entity::setCurrentGenerator(CurrentGenerator* generator)
 {
 	current_generator_ = CurrentGeneratorPtr(generator);
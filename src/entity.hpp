@@ -24,6 +24,7 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <string>
 
 #include "boost/intrusive_ptr.hpp"
@@ -51,6 +52,19 @@ class PlayerInfo;
 
 typedef boost::intrusive_ptr<character> CharacterPtr;
 
+//the changes to an entity between two snapshots of a level's rewind
+//history. See Entity::diffBackup().
+class EntityBackupDelta
+{
+public:
+	virtual ~EntityBackupDelta() {}
+
+	//the approximate memory held by the delta, in bytes.
+	virtual size_t bytes() const = 0;
+};
+
+typedef std::shared_ptr<const EntityBackupDelta> ConstEntityBackupDeltaPtr;
+
 class Entity : public game_logic::WmlSerializableFormulaCallable
 {
 public:
@@ -208,6 +222,19 @@ public:
 	virtual EntityPtr clone() const { return EntityPtr(); }
 	virtual EntityPtr backup() const = 0;
 
+	//Level::backup() records most cycles as what changed in each entity
+	//since the snapshot before. diffBackup() compares the entity with
+	//'prev', its state at the previous snapshot, and sets *delta to the
+	//changes, or to null if nothing changed. It returns false if the
+	//changes can't be recorded as a delta, and a backup() is needed.
+	virtual bool diffBackup(const Entity& prev, ConstEntityBackupDeltaPtr* delta) const { return false; }
+
+	//applies a delta made by diffBackup() to a backup of the entity.
+	virtual void applyBackupDelta(const EntityBackupDelta& delta) {}
+
+	//the approximate memory held by a backup() of the entity, in bytes.
+	virtual size_t backupBytes() const { return 0; }
+
 	virtual void generateCurrent(const Entity& target, int* velocity_x, int* velocity_y) const;
 
 	virtual game_logic::ConstFormulaPtr getEventHandler(int key) const { return game_logic::ConstFormulaPtr(); }
@@ -343,6 +370,36 @@ protected:
 	int getPrevFeetX() const { return prev_feet_x_; }
 	int getPrevFeetY() const { return prev_feet_y_; }
 
+	//the fields of Entity which usually change from cycle to cycle, and
+	//which diffBackup() records when they do. A change to any other field
+	//needs a full backup.
+	struct EntityBackupState {
+		int x, y;
+		int prev_feet_x, prev_feet_y;
+		int last_move_x, last_move_y;
+		bool face_right, upside_down;
+		bool mouse_over_entity;
+		uint8_t mouse_button_state;
+		bool being_dragged;
+		std::vector<std::pair<int, variant>> scheduled_commands;
+		bool controls[controls::NUM_CONTROLS];
+		variant controls_user;
+		rect solid_rect, frame_rect, platform_rect, prev_platform_rect;
+		ConstSolidInfoPtr solid, platform;
+		int platform_motion_x;
+		unsigned mouseover_trigger_cycle;
+
+		bool operator==(const EntityBackupState& o) const;
+		bool operator!=(const EntityBackupState& o) const { return !(*this == o); }
+	};
+
+	void getEntityBackupState(EntityBackupState* state) const;
+	void setEntityBackupState(const EntityBackupState& state);
+
+	//true iff the fields of Entity which aren't in EntityBackupState are
+	//the same as in o.
+	bool entityBackupConstantsMatch(const Entity& o) const;
+
 private:
 	virtual int currentRotation() const = 0;
 
@@ -0,0 +1,567 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "asserts.hpp"
+#include "file_archive.hpp"
+#include "filesystem.hpp"
+#include "md5.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
+
+namespace sys
+{
+	namespace
+	{
+		//An archive is laid out as:
+		//  the magic string 'ANURAPK1'
+		//  the number of files, as a 32-bit integer
+		//  an index entry for each file, sorted by name
+		//  the names and contents of the files.
+		//Integers are little endian, and offsets are from the start of
+		//the archive.
+		const char ArchiveMagic[] = "ANURAPK1";
+		const size_t ArchiveMagicSize = 8;
+		const size_t HeaderSize = ArchiveMagicSize + 4;
+
+		//name offset, name size, data offset, data size, md5 sum.
+		const size_t IndexEntrySize = 4*4 + 32;
+
+		void write_uint32(std::string& out, size_t value)
+		{
+			ASSERT_LOG(value <= 0xFFFFFFFFu, "Archive is too large");
+			for(int n = 0; n != 4; ++n) {
+				out.push_back(static_cast<char>((value >> (n*8))&0xFF));
+			}
+		}
+
+		size_t read_uint32(const char* p)
+		{
+			const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+			return size_t(u[0]) | (size_t(u[1]) << 8) | (size_t(u[2]) << 16) | (size_t(u[3]) << 24);
+		}
+
+		class MappedArchive
+		{
+		public:
+			explicit MappedArchive(const std::string& mount_point)
+			  : mount_point_(mount_point), data_(nullptr), size_(0), nfiles_(0)
+#if defined(_WIN32)
+			  , file_(INVALID_HANDLE_VALUE), mapping_(nullptr)
+#endif
+			{}
+
+			~MappedArchive()
+			{
+#if defined(_WIN32)
+				if(data_) {
+					UnmapViewOfFile(data_);
+				}
+				if(mapping_) {
+					CloseHandle(mapping_);
+				}
+				if(file_ != INVALID_HANDLE_VALUE) {
+					CloseHandle(file_);
+				}
+#else
+				if(data_) {
+					munmap(const_cast<char*>(data_), size_);
+				}
+#endif
+			}
+
+			bool open(const std::string& path)
+			{
+#if defined(_WIN32)
+				file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+				if(file_ == INVALID_HANDLE_VALUE) {
+					return false;
+				}
+
+				LARGE_INTEGER size;
+				if(!GetFileSizeEx(file_, &size) || size.QuadPart < static_cast<LONGLONG>(HeaderSize)) {
+					return false;
+				}
+
+				size_ = static_cast<size_t>(size.QuadPart);
+				mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if(mapping_ == nullptr) {
+					return false;
+				}
+
+				data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+				if(data_ == nullptr) {
+					return false;
+				}
+#else
+				const int fd = ::open(path.c_str(), O_RDONLY);
+				if(fd < 0) {
+					return false;
+				}
+
+				struct stat st;
+				if(fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(HeaderSize)) {
+					::close(fd);
+					return false;
+				}
+
+				size_ = static_cast<size_t>(st.st_size);
+				void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+				::close(fd);
+				if(p == MAP_FAILED) {
+					return false;
+				}
+
+				data_ = static_cast<const char*>(p);
+#endif
+				if(!validate(path)) {
+					return false;
+				}
+
+				findNewerLooseFiles(file_mod_time(path));
+				return true;
+			}
+
+			const std::string& mountPoint() const { return mount_point_; }
+			size_t numFiles() const { return nfiles_; }
+
+			const char* name(size_t n, size_t* len) const {
+				const char* entry = index(n);
+				*len = read_uint32(entry + 4);
+				return data_ + read_uint32(entry);
+			}
+
+			void get(size_t n, ArchivedFile* result) const {
+				const char* entry = index(n);
+				result->data = data_ + read_uint32(entry + 8);
+				result->size = read_uint32(entry + 12);
+				result->md5 = entry + 16;
+			}
+
+			//finds the first file with a name not less than the given one.
+			size_t lowerBound(const char* key, size_t key_len) const {
+				size_t lo = 0, hi = nfiles_;
+				while(lo < hi) {
+					const size_t mid = (lo + hi)/2;
+					if(compare(mid, key, key_len) < 0) {
+						lo = mid + 1;
+					} else {
+						hi = mid;
+					}
+				}
+
+				return lo;
+			}
+
+			int compare(size_t n, const char* key, size_t key_len) const {
+				size_t len = 0;
+				const char* s = name(n, &len);
+				const int res = memcmp(s, key, std::min(len, key_len));
+				if(res != 0) {
+					return res;
+				}
+
+				return len < key_len ? -1 : (len == key_len ? 0 : 1);
+			}
+
+			//true if the file with this name is to be read from disk.
+			bool isOverridden(const char* key, size_t key_len) const {
+				return overridden_.empty() == false && overridden_.count(std::string(key, key_len)) != 0;
+			}
+
+			void setOverridden(const char* key, size_t key_len) {
+				overridden_.insert(std::string(key, key_len));
+			}
+		private:
+			MappedArchive(const MappedArchive&);
+			void operator=(const MappedArchive&);
+
+			const char* index(size_t n) const {
+				return data_ + HeaderSize + n*IndexEntrySize;
+			}
+
+			bool validate(const std::string& path)
+			{
+				if(memcmp(data_, ArchiveMagic, ArchiveMagicSize) != 0) {
+					LOG_ERROR("Not a module archive: " << path);
+					return false;
+				}
+
+				nfiles_ = read_uint32(data_ + ArchiveMagicSize);
+				if(nfiles_ > (size_ - HeaderSize)/IndexEntrySize) {
+					LOG_ERROR("Corrupt module archive: " << path);
+					return false;
+				}
+
+				for(size_t n = 0; n != nfiles_; ++n) {
+					const char* entry = index(n);
+					const size_t name_offset = read_uint32(entry), name_len = read_uint32(entry + 4);
+					const size_t data_offset = read_uint32(entry + 8), data_len = read_uint32(entry + 12);
+					if(name_offset > size_ || name_len > size_ - name_offset || data_offset > size_ || data_len > size_ - data_offset) {
+						LOG_ERROR("Corrupt module archive: " << path);
+						return false;
+					}
+				}
+
+				return true;
+			}
+
+			//files on disk which were changed after the archive was built
+			//are used instead of the archived copies. This costs a stat per
+			//file, but only in directories which are present on disk, which
+			//they usually aren't when a module ships with an archive.
+			void findNewerLooseFiles(long long archive_time)
+			{
+				std::map<std::string, bool> dirs_present;
+				for(size_t n = 0; n != nfiles_; ++n) {
+					size_t len = 0;
+					const char* s = name(n, &len);
+					const std::string fname(s, len);
+					const std::string dir = mount_point_ + fname.substr(0, fname.find('/') + 1);
+
+					auto dir_itor = dirs_present.find(dir);
+					if(dir_itor == dirs_present.end()) {
+						dir_itor = dirs_present.insert(std::make_pair(dir, dir_exists(dir))).first;
+					}
+
+					if(dir_itor->second && file_mod_time(mount_point_ + fname) > archive_time) {
+						LOG_INFO("Using " << mount_point_ << fname << " rather than the older copy in the archive");
+						overridden_.insert(fname);
+					}
+				}
+			}
+
+			std::string mount_point_;
+			std::set<std::string> overridden_;
+			const char* data_;
+			size_t size_;
+			size_t nfiles_;
+#if defined(_WIN32)
+			HANDLE file_;
+			HANDLE mapping_;
+#endif
+		};
+
+		typedef std::shared_ptr<MappedArchive> MappedArchivePtr;
+
+		threading::mutex& get_archives_mutex()
+		{
+			static threading::mutex m;
+			return m;
+		}
+
+		//the mounted archives, most recently mounted first.
+		std::vector<MappedArchivePtr>& get_archives()
+		{
+			static std::vector<MappedArchivePtr> archives;
+			return archives;
+		}
+
+		//calls fn(archive, first, last) with the range of files in each
+		//archive with names starting with the part of 'prefix' below the
+		//archive's mount point.
+		template<typename F>
+		void for_each_archived_with_prefix(const std::string& prefix, F fn)
+		{
+			threading::lock lck(get_archives_mutex());
+			for(const MappedArchivePtr& archive : get_archives()) {
+				const std::string& mount = archive->mountPoint();
+				if(prefix.size() < mount.size() || prefix.compare(0, mount.size(), mount) != 0) {
+					continue;
+				}
+
+				const char* key = prefix.c_str() + mount.size();
+				const size_t key_len = prefix.size() - mount.size();
+
+				const size_t first = archive->lowerBound(key, key_len);
+				size_t last = first;
+				size_t len = 0;
+				while(last != archive->numFiles()) {
+					const char* name = archive->name(last, &len);
+					if(len < key_len || memcmp(name, key, key_len) != 0) {
+						break;
+					}
+					++last;
+				}
+
+				fn(*archive, first, last, key_len);
+			}
+		}
+
+		std::string as_dir(const std::string& dir)
+		{
+			if(dir.empty() || dir[dir.size()-1] == '/') {
+				return dir;
+			}
+
+			return dir + "/";
+		}
+	}
+
+	void write_archive(const std::string& path, std::vector<std::pair<std::string, std::string>> files)
+	{
+		std::sort(files.begin(), files.end());
+
+		size_t offset = HeaderSize + files.size()*IndexEntrySize;
+
+		std::string index, names, contents;
+		for(const auto& f : files) {
+			const std::string md5sum = md5::sum(f.second);
+			ASSERT_LOG(md5sum.size() == 32, "Unexpected md5 sum: " << md5sum);
+
+			write_uint32(index, offset + names.size());
+			write_uint32(index, f.first.size());
+			names += f.first;
+
+			//the contents come after all the names, so their offsets are
+			//fixed up once the names are all known.
+			write_uint32(index, contents.size());
+			write_uint32(index, f.second.size());
+			contents += f.second;
+
+			index += md5sum;
+		}
+
+		for(size_t n = 0; n != files.size(); ++n) {
+			std::string data_offset;
+			write_uint32(data_offset, offset + names.size() + read_uint32(index.c_str() + n*IndexEntrySize + 8));
+			index.replace(n*IndexEntrySize + 8, 4, data_offset);
+		}
+
+		std::string output(ArchiveMagic, ArchiveMagicSize);
+		write_uint32(output, files.size());
+		output += index;
+		output += names;
+		output += contents;
+
+		write_file(path, output);
+	}
+
+	bool mount_archive(const std::string& path, const std::string& mount_point)
+	{
+		MappedArchivePtr archive(new MappedArchive(as_dir(mount_point)));
+		if(!archive->open(path)) {
+			return false;
+		}
+
+		LOG_INFO("Mounted archive " << path << " with " << archive->numFiles() << " files at " << archive->mountPoint());
+
+		threading::lock lck(get_archives_mutex());
+		std::vector<MappedArchivePtr>& archives = get_archives();
+		archives.erase(std::remove_if(archives.begin(), archives.end(), [&archive](const MappedArchivePtr& a) { return a->mountPoint() == archive->mountPoint(); }), archives.end());
+		archives.insert(archives.begin(), archive);
+		return true;
+	}
+
+	void unmount_archives()
+	{
+		threading::lock lck(get_archives_mutex());
+		get_archives().clear();
+	}
+
+	bool find_archived_file(const std::string& path, ArchivedFile* result)
+	{
+		threading::lock lck(get_archives_mutex());
+		for(const MappedArchivePtr& archive : get_archives()) {
+			const std::string& mount = archive->mountPoint();
+			if(path.size() <= mount.size() || path.compare(0, mount.size(), mount) != 0) {
+				continue;
+			}
+
+			const char* key = path.c_str() + mount.size();
+			const size_t key_len = path.size() - mount.size();
+			const size_t n = archive->lowerBound(key, key_len);
+			if(n != archive->numFiles() && archive->compare(n, key, key_len) == 0) {
+				if(archive->isOverridden(key, key_len)) {
+					return false;
+				}
+
+				archive->get(n, result);
+				result->archive = archive;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void note_file_written(const std::string& path)
+	{
+		threading::lock lck(get_archives_mutex());
+		for(const MappedArchivePtr& archive : get_archives()) {
+			const std::string& mount = archive->mountPoint();
+			if(path.size() <= mount.size() || path.compare(0, mount.size(), mount) != 0) {
+				continue;
+			}
+
+			const char* key = path.c_str() + mount.size();
+			const size_t key_len = path.size() - mount.size();
+			const size_t n = archive->lowerBound(key, key_len);
+			if(n != archive->numFiles() && archive->compare(n, key, key_len) == 0) {
+				archive->setOverridden(key, key_len);
+			}
+		}
+	}
+
+	void get_archived_files_in_dir(const std::string& dir, std::vector<std::string>* files, std::vector<std::string>* dirs)
+	{
+		std::set<std::string> dirs_found;
+		for_each_archived_with_prefix(as_dir(dir), [=, &dirs_found](const MappedArchive& archive, size_t first, size_t last, size_t prefix_len) {
+			for(size_t n = first; n != last; ++n) {
+				size_t len = 0;
+				const char* name = archive.name(n, &len);
+				const std::string rest(name + prefix_len, name + len);
+				const std::string::size_type slash = rest.find('/');
+				if(slash == std::string::npos) {
+					if(files) {
+						files->push_back(rest);
+					}
+				} else if(dirs && dirs_found.insert(rest.substr(0, slash)).second) {
+					dirs->push_back(rest.substr(0, slash));
+				}
+			}
+		});
+	}
+
+	void get_archived_files_under_dir(const std::string& dir, std::vector<std::string>* paths)
+	{
+		for_each_archived_with_prefix(as_dir(dir), [=](const MappedArchive& archive, size_t first, size_t last, size_t prefix_len) {
+			for(size_t n = first; n != last; ++n) {
+				size_t len = 0;
+				const char* name = archive.name(n, &len);
+				if(archive.isOverridden(name, len) == false) {
+					paths->push_back(archive.mountPoint() + std::string(name, len));
+				}
+			}
+		});
+	}
+}
+
+UNIT_TEST(file_archive)
+{
+	const std::string path = sys::get_user_data_dir() + "/unit_test_archive.pak";
+
+	std::vector<std::pair<std::string, std::string>> files;
+	files.push_back(std::make_pair("data/b.cfg", "{b: 2}"));
+	files.push_back(std::make_pair("data/a.cfg", "{a: 1}"));
+	files.push_back(std::make_pair("data/objects/c.cfg", ""));
+	files.push_back(std::make_pair("module.cfg", "{}"));
+	sys::write_archive(path, files);
+
+	CHECK_EQ(sys::mount_archive(path, "unit_test_module/"), true);
+
+	sys::ArchivedFile f;
+	CHECK_EQ(sys::find_archived_file("unit_test_module/data/a.cfg", &f), true);
+	CHECK_EQ(f.contents(), "{a: 1}");
+	CHECK_EQ(f.md5sum(), md5::sum("{a: 1}"));
+	CHECK_EQ(sys::find_archived_file("unit_test_module/data/objects/c.cfg", &f), true);
+	CHECK_EQ(f.size, 0);
+	CHECK_EQ(sys::find_archived_file("unit_test_module/data/c.cfg", &f), false);
+	CHECK_EQ(sys::find_archived_file("unit_test_module/data", &f), false);
+	CHECK_EQ(sys::find_archived_file("data/a.cfg", &f), false);
+
+	std::vector<std::string> found_files, found_dirs;
+	sys::get_archived_files_in_dir("unit_test_module/data", &found_files, &found_dirs);
+	CHECK_EQ(found_files.size(), 2);
+	CHECK_EQ(found_files[0], "a.cfg");
+	CHECK_EQ(found_files[1], "b.cfg");
+	CHECK_EQ(found_dirs.size(), 1);
+	CHECK_EQ(found_dirs[0], "objects");
+
+	std::vector<std::string> paths;
+	sys::get_archived_files_under_dir("unit_test_module/data/", &paths);
+	CHECK_EQ(paths.size(), 3);
+	CHECK_EQ(paths.back(), "unit_test_module/data/objects/c.cfg");
+
+	//a file held on to stays readable after its archive is unmounted.
+	CHECK_EQ(sys::find_archived_file("unit_test_module/data/b.cfg", &f), true);
+
+	//a file written to disk is used instead of the archived copy.
+	const std::string loose_mount = sys::get_user_data_dir() + "/unit_test_loose/";
+	CHECK_EQ(sys::mount_archive(path, loose_mount), true);
+	sys::ArchivedFile loose;
+	CHECK_EQ(sys::find_archived_file(loose_mount + "data/a.cfg", &loose), true);
+	sys::write_file(loose_mount + "data/a.cfg", "{a: 2}");
+	CHECK_EQ(sys::find_archived_file(loose_mount + "data/a.cfg", &loose), false);
+	CHECK_EQ(sys::read_file(loose_mount + "data/a.cfg"), "{a: 2}");
+	CHECK_EQ(sys::read_file(loose_mount + "data/b.cfg"), "{b: 2}");
+
+	paths.clear();
+	sys::get_archived_files_under_dir(loose_mount + "data/", &paths);
+	CHECK_EQ(paths.size(), 2);
+
+	sys::unmount_archives();
+	CHECK_EQ(sys::find_archived_file("unit_test_module/data/a.cfg", &loose), false);
+	CHECK_EQ(f.contents(), "{b: 2}");
+	sys::remove_file(path);
+	sys::rmdir_recursive(loose_mount);
+}
+
+//Compares reading every file in a module archive from the archive
+//against reading the same files from disk. The argument is
+//'packed:<module path>' or 'loose:<module path>', where the module path
+//holds a module.pak built with --utility=pack_module.
+BENCHMARK_ARG(module_archive_read, const std::string& arg)
+{
+	const std::string::size_type colon = arg.find(':');
+	ASSERT_LOG(colon != std::string::npos, "Expected packed:<module path> or loose:<module path>");
+	const bool packed = arg.substr(0, colon) == "packed";
+	const std::string mount_point = arg.substr(colon+1) + "/";
+
+	sys::unmount_archives();
+	ASSERT_LOG(sys::mount_archive(mount_point + "module.pak", mount_point), "Could not mount " << mount_point << "module.pak");
+
+	std::vector<std::string> paths;
+	sys::get_archived_files_under_dir(mount_point, &paths);
+
+	if(!packed) {
+		sys::unmount_archives();
+	}
+
+	BENCHMARK_LOOP {
+		size_t nbytes = 0;
+		for(const std::string& p : paths) {
+			nbytes += sys::read_file(p).size();
+		}
+
+		ASSERT_LOG(nbytes > 0 || paths.empty(), "Failed to read module files");
+	}
+
+	sys::unmount_archives();
+}
+
+BENCHMARK_ARG_CALL_COMMAND_LINE(module_archive_read);
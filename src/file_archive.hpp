@@ -0,0 +1,84 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+//Packed archives of a module's data files. An archive holds the contents
+//of many files along with an index sorted by name and the md5 sum of each
+//file, and is memory mapped when mounted, so looking up and reading a file
+//involves no system calls and the data is never copied until a caller
+//needs it as a string.
+//
+//Archives are mounted over a directory; a file 'name' in an archive
+//mounted at 'modules/frogatto/' is found by the path
+//'modules/frogatto/name', and is used in preference to any file on disk
+//at that path, unless the file on disk is newer than the archive or has
+//been written with sys::write_file() since the archive was mounted.
+namespace sys
+{
+	struct ArchivedFile
+	{
+		//keeps the archive mapped, so data and md5 stay valid even if the
+		//archive is unmounted.
+		std::shared_ptr<const void> archive;
+
+		const char* data;
+		size_t size;
+
+		//the md5 sum of the data, as 32 hex digits.
+		const char* md5;
+
+		std::string contents() const { return std::string(data, size); }
+		std::string md5sum() const { return std::string(md5, 32); }
+	};
+
+	//writes an archive holding the given (name, contents) pairs.
+	void write_archive(const std::string& path, std::vector<std::pair<std::string, std::string>> files);
+
+	//mounts the archive at 'path' over the directory 'mount_point', which
+	//should end in a '/'. Returns false if the archive can't be read.
+	bool mount_archive(const std::string& path, const std::string& mount_point);
+	void unmount_archives();
+
+	//finds the file at 'path' in the mounted archives. Returns false if
+	//it isn't archived, or if the file on disk is to be used instead.
+	bool find_archived_file(const std::string& path, ArchivedFile* result);
+
+	//called when the file at 'path' is written to disk, so it's used in
+	//preference to an archived copy from then on.
+	void note_file_written(const std::string& path);
+
+	//adds the files and directories directly inside the directory 'dir'
+	//in the mounted archives.
+	void get_archived_files_in_dir(const std::string& dir, std::vector<std::string>* files, std::vector<std::string>* dirs);
+
+	//adds the paths of all files under the directory 'dir', at any depth,
+	//in the mounted archives. Files which are read from disk instead are
+	//left out.
+	void get_archived_files_under_dir(const std::string& dir, std::vector<std::string>* paths);
+}
@@ -46,6 +46,7 @@
 #include <boost/filesystem.hpp>
 
 #include "asserts.hpp"
+#include "file_archive.hpp"
 #include "filesystem.hpp"
 #include "preferences.hpp"
 #include "profile_timer.hpp"
@@ -82,21 +83,39 @@ namespace sys
 		std::vector<std::string>* files,
 		std::vector<std::string>* dirs)
 	{
+		const size_t first_file = files ? files->size() : 0;
+		const size_t first_dir = dirs ? dirs->size() : 0;
+
 		path p(dir);
-		if(!is_directory(p) && !is_other(p)) {
-			return;
-		}
-		for(directory_iterator it = directory_iterator(p); it != directory_iterator(); ++it) {
-			if(is_directory(it->path()) || is_other(it->path())) {
-				if(dirs != nullptr) {
-					dirs->push_back(it->path().filename().generic_string());
-				}
-			} else {
-				if(files != nullptr) {
-					files->push_back(it->path().filename().generic_string());
+		if(is_directory(p) || is_other(p)) {
+			for(directory_iterator it = directory_iterator(p); it != directory_iterator(); ++it) {
+				if(is_directory(it->path()) || is_other(it->path())) {
+					if(dirs != nullptr) {
+						dirs->push_back(it->path().filename().generic_string());
+					}
+				} else {
+					if(files != nullptr) {
+						files->push_back(it->path().filename().generic_string());
+					}
 				}
 			}
 		}
+
+		//add anything in mounted archives which isn't also on disk.
+		std::vector<std::string> archived_files, archived_dirs;
+		get_archived_files_in_dir(dir, files ? &archived_files : nullptr, dirs ? &archived_dirs : nullptr);
+		for(const std::string& f : archived_files) {
+			if(std::find(files->begin() + first_file, files->end(), f) == files->end()) {
+				files->push_back(f);
+			}
+		}
+
+		for(const std::string& d : archived_dirs) {
+			if(std::find(dirs->begin() + first_dir, dirs->end(), d) == dirs->end()) {
+				dirs->push_back(d);
+			}
+		}
+
 		if(files != nullptr)
 			std::sort(files->begin(), files->end());
 
@@ -111,14 +130,21 @@ namespace sys
 	{
 		ASSERT_LOG(file_map != nullptr, "get_unique_filenames_under_dir() passed a nullptr file_map");
 		path p(dir);
-		if(!is_directory(p)) {
-			return;
-		}
-		for(recursive_directory_iterator it = recursive_directory_iterator(p); it != recursive_directory_iterator(); ++it) {
-			if(!is_directory(it->path())) {
-				(*file_map)[prefix + it->path().filename().generic_string()] = it->path().generic_string();
+		if(is_directory(p)) {
+			for(recursive_directory_iterator it = recursive_directory_iterator(p); it != recursive_directory_iterator(); ++it) {
+				if(!is_directory(it->path())) {
+					(*file_map)[prefix + it->path().filename().generic_string()] = it->path().generic_string();
+				}
 			}
 		}
+
+		//archived files win, as they do in read_file(), except those which
+		//are read from disk instead and so aren't listed here.
+		std::vector<std::string> archived;
+		get_archived_files_under_dir(dir, &archived);
+		for(const std::string& fname : archived) {
+			(*file_map)[prefix + path(fname).filename().generic_string()] = fname;
+		}
 	}
 
 	std::string get_dir(const std::string& dir)
@@ -133,6 +159,11 @@ namespace sys
 
 	std::string read_file(const std::string& fname)
 	{
+		ArchivedFile archived;
+		if(find_archived_file(fname, &archived)) {
+			return archived.contents();
+		}
+
 		std::ifstream file(fname.c_str(), std::ios_base::binary);
 		std::stringstream ss;
 		ss << file.rdbuf();
@@ -151,6 +182,10 @@ namespace sys
 		// Write the file.
 		std::ofstream file(fname.c_str(), std::ios_base::binary);
 		file << data;
+		file.close();
+
+		// Any archived copy is out of date now.
+		note_file_written(fname);
 	}
 
 	bool dir_exists(const std::string& fname)
@@ -161,6 +196,11 @@ namespace sys
 
 	bool file_exists(const std::string& fname)
 	{
+		ArchivedFile archived;
+		if(find_archived_file(fname, &archived)) {
+			return true;
+		}
+
 		path p(fname);
 		return exists(p) && is_regular_file(p);
 	}
@@ -40,7 +40,9 @@
 #include "formula_function.hpp"
 #include "formula_interface.hpp"
 #include "formula_object.hpp"
+#include "formula_profiler.hpp"
 #include "formula_tokenizer.hpp"
+#include "formula_vm.hpp"
 #include "i18n.hpp"
 #include "lua_iface.hpp"
 #include "preferences.hpp"
@@ -126,9 +128,10 @@ namespace game_logic
 				executeCommand(v[n]);
 			}
 		} else {
-			CommandCallable* callable = v.try_convert<CommandCallable>();
-			if(callable) {
-				callable->runCommand(*this);
+			const FormulaCallable* callable = v.is_callable() ? v.as_callable() : nullptr;
+			if(callable && callable->getCommandType() == COMMAND_TYPE::FORMULA) {
+				static_cast<const CommandCallable*>(callable)->runCommand(*this);
+				count_command_executed(COMMAND_TYPE::FORMULA);
 			} else {
 				ASSERT_LOG(false, "EXPECTED EXECUTABLE COMMAND OBJECT, INSTEAD FOUND: " << v.to_debug_string() << "\nFORMULA INFO: " << output_formula_error_info() << "\n");
 			}
@@ -147,6 +150,7 @@ namespace game_logic
 
 	CommandCallable::CommandCallable() : expr_(nullptr)
 	{
+		setCommandType(COMMAND_TYPE::FORMULA);
 	}
 
 	void CommandCallable::runCommand(FormulaCallable& context) const
@@ -349,6 +353,20 @@ namespace game_logic
 				return staticEvaluate(variables);
 			}
 
+			int emitVM(formula_vm::Builder& builder) const {
+				const int first = builder.nextRegister();
+				for(const ExpressionPtr& item : items_) {
+					const int reg = builder.allocRegister();
+					builder.moveTo(*this, item->emitVM(builder), reg);
+					builder.releaseRegisters(reg+1);
+				}
+
+				builder.releaseRegisters(first);
+				const int dst = builder.allocRegister();
+				builder.emit(*this, formula_vm::OP::LIST, dst, first, static_cast<int>(items_.size()));
+				return dst;
+			}
+
 			std::vector<ConstExpressionPtr> getChildren() const {
 				return std::vector<ConstExpressionPtr>(items_.begin(), items_.end());
 			}
@@ -457,7 +475,16 @@ namespace game_logic
 		public:
 			explicit MapExpression(const std::vector<ExpressionPtr>& items)
 			: FormulaExpression("_map"), items_(items)
-			{}
+			{
+				//constant keys are shared by every map this builds, so intern
+				//them to make looking them up in those maps cheaper.
+				for(int n = 0; n < static_cast<int>(items_.size()); n += 2) {
+					variant key;
+					if(items_[n]->canReduceToVariant(key)) {
+						key.intern_string();
+					}
+				}
+			}
 	
 		private:
 			variant_type_ptr getVariantType() const {
@@ -575,6 +602,15 @@ namespace game_logic
 				}
 			}
 
+			int emitVM(formula_vm::Builder& builder) const {
+				const int first_free = builder.nextRegister();
+				const int operand = operand_->emitVM(builder);
+				builder.releaseRegisters(first_free);
+				const int dst = builder.allocRegister();
+				builder.emit(*this, op_ == OP::NOT ? formula_vm::OP::NOT : formula_vm::OP::NEG, dst, operand);
+				return dst;
+			}
+
 			variant execute(const FormulaCallable& variables) const {
 				const variant res = operand_->evaluate(variables);
 				switch(op_) {
@@ -647,6 +683,10 @@ namespace game_logic
 				return v_;
 			}
 
+			int emitVM(formula_vm::Builder& builder) const {
+				return builder.constant(v_);
+			}
+
 			variant_type_ptr getVariantType() const {
 				return variant_type::get_type(v_.type());
 			}
@@ -698,6 +738,12 @@ namespace game_logic
 				return variables.queryValueBySlot(slot_);
 			}
 
+			int emitVM(formula_vm::Builder& builder) const {
+				const int dst = builder.allocRegister();
+				builder.emit(*this, formula_vm::OP::LOAD_SLOT, dst, slot_);
+				return dst;
+			}
+
 			variant_type_ptr getVariantType() const {
 				return callable_def_->getEntry(slot_)->variant_type;
 			}
@@ -762,6 +808,7 @@ namespace game_logic
 			}
 
 			void set_function(ExpressionPtr fn) { function_ = fn; }
+			bool hasFunction() const { return function_.get() != nullptr; }
 
 			ExpressionPtr optimize() const {
 				if(callable_def_) {
@@ -857,6 +904,14 @@ namespace game_logic
 
 				return result;
 			}
+
+			int emitVM(formula_vm::Builder& builder) const {
+				if(function_) {
+					return FormulaExpression::emitVM(builder);
+				}
+
+				return builder.emitLoadId(*this, id_);
+			}
 			variant_type_ptr getVariantType() const {
 
 				if(callable_def_) {
@@ -1220,8 +1275,17 @@ namespace game_logic
 		class DotExpression : public FormulaExpression {
 		public:
 			DotExpression(ExpressionPtr left, ExpressionPtr right, ConstFormulaCallableDefinitionPtr right_def)
-			: FormulaExpression("_dot"), left_(left), right_(right), right_def_(right_def)
-			{}
+			: FormulaExpression("_dot"), left_(left), right_(right), right_def_(right_def), cached_layout_id_(0), cached_slot_(-1)
+			{
+				//a plain member name that couldn't be resolved to a slot when
+				//parsing gets an inline cache, filled in when it's executed.
+				const IdentifierExpression* id_expr = dynamic_cast<const IdentifierExpression*>(right_.get());
+				if(id_expr != nullptr && id_expr->hasFunction() == false && id_expr->id() != "self") {
+					member_ = id_expr->id();
+					map_key_ = variant(member_);
+					map_key_.intern_string();
+				}
+			}
 			ConstFormulaCallableDefinitionPtr getTypeDefinition() const {
 				return right_->getTypeDefinition();
 			}
@@ -1233,7 +1297,11 @@ namespace game_logic
 						FormulaCallablePtr lc(new ListCallable(left));	
 						return right_->evaluate(*lc);
 					} else if(left.is_map()) {
-						return left[variant(right_->str())];
+						if(member_.empty() == false) {
+							return left[map_key_];
+						}
+
+						return left[right_->str()];
 					}
 
 					ASSERT_LOG(!left.is_null(), "CALL OF DOT OPERATOR ON nullptr VALUE: '" << left_->str() << "': " << debugPinpointLocation());
@@ -1241,8 +1309,45 @@ namespace game_logic
 			
 					return left;
 				}
+
+				const FormulaCallable* callable = left.as_callable();
+				if(member_.empty() == false) {
+					const int layout_id = callable->getSlotLayoutId();
+					if(layout_id != 0) {
+						if(layout_id != cached_layout_id_) {
+							++formula_profiler::inline_cache_counts.misses;
+							cached_slot_ = callable->getSlotForKey(member_);
+							cached_layout_id_ = layout_id;
+						} else if(cached_slot_ >= 0) {
+							++formula_profiler::inline_cache_counts.hits;
+						} else {
+							++formula_profiler::inline_cache_counts.uncacheable;
+						}
+
+						if(cached_slot_ >= 0) {
+							return callable->queryValueBySlot(cached_slot_);
+						}
+					}
+				}
 		
-				return right_->evaluate(*left.as_callable());
+				return right_->evaluate(*callable);
+			}
+
+			//when the left side is known to be an object and the right side
+			//is a slot lookup we can read the slot directly.
+			int emitVM(formula_vm::Builder& builder) const {
+				const SlotIdentifierExpression* slot_expr = dynamic_cast<const SlotIdentifierExpression*>(right_.get());
+				variant_type_ptr left_type = left_->queryVariantType();
+				if(slot_expr == nullptr || variant_type::may_be_null(left_type) || !variant_types_compatible(variant_type::get_type(variant::VARIANT_TYPE_CALLABLE), left_type)) {
+					return FormulaExpression::emitVM(builder);
+				}
+
+				const int first_free = builder.nextRegister();
+				const int left = left_->emitVM(builder);
+				builder.releaseRegisters(first_free);
+				const int dst = builder.allocRegister();
+				builder.emit(*this, formula_vm::OP::LOAD_MEMBER_SLOT, dst, left, slot_expr->getSlot());
+				return dst;
 			}
 	
 			variant executeMember(const FormulaCallable& variables, std::string& id, variant* variant_id) const {
@@ -1311,6 +1416,18 @@ namespace game_logic
 			//the definition used to evaluate right_. i.e. the type of the value
 			//returned from left_.
 			ConstFormulaCallableDefinitionPtr right_def_;
+
+			//the member named by right_, if it's a plain identifier, and the
+			//same name interned for looking it up in maps.
+			std::string member_;
+			variant map_key_;
+
+			//the slot layout id of the last callable the member was read from,
+			//and the slot it was read from, or -1 if it isn't read by slot.
+			//Only the id is kept: holding the layout itself would keep a
+			//reloaded class alive through its own formulas.
+			mutable int cached_layout_id_;
+			mutable int cached_slot_;
 		};
 
 		class SquareBracketExpression : public FormulaExpression { //TODO
@@ -1490,6 +1607,17 @@ namespace game_logic
 				return right_->evaluate(variables);
 			}
 
+			int emitVM(formula_vm::Builder& builder) const {
+				const int dst = builder.allocRegister();
+				builder.moveTo(*this, left_->emitVM(builder), dst);
+				builder.releaseRegisters(dst+1);
+				const int jump = builder.emit(*this, formula_vm::OP::JMP_IF_FALSE, 0, dst);
+				builder.moveTo(*this, right_->emitVM(builder), dst);
+				builder.releaseRegisters(dst+1);
+				builder.patchJump(jump, builder.label());
+				return dst;
+			}
+
 			variant_type_ptr getVariantType() const {
 				return get_variant_type_and_or(left_, right_);
 			}
@@ -1547,6 +1675,17 @@ namespace game_logic
 				return right_->evaluate(variables);
 			}
 
+			int emitVM(formula_vm::Builder& builder) const {
+				const int dst = builder.allocRegister();
+				builder.moveTo(*this, left_->emitVM(builder), dst);
+				builder.releaseRegisters(dst+1);
+				const int jump = builder.emit(*this, formula_vm::OP::JMP_IF_TRUE, 0, dst);
+				builder.moveTo(*this, right_->emitVM(builder), dst);
+				builder.releaseRegisters(dst+1);
+				builder.patchJump(jump, builder.label());
+				return dst;
+			}
+
 			variant_type_ptr getVariantType() const {
 				return get_variant_type_and_or(left_, right_, true);
 			}
@@ -1587,6 +1726,10 @@ namespace game_logic
 				return variant();
 			}
 
+			int emitVM(formula_vm::Builder& builder) const {
+				return builder.constant(variant());
+			}
+
 			variant_type_ptr getVariantType() const {
 				return variant_type::get_type(variant::VARIANT_TYPE_NULL);
 			}
@@ -1627,6 +1770,36 @@ namespace game_logic
 
 			ExpressionPtr get_left() const { return left_; }
 			ExpressionPtr get_right() const { return right_; }
+
+			int emitVM(formula_vm::Builder& builder) const {
+				formula_vm::OP op;
+				switch(op_) {
+					case OP_IN: op = formula_vm::OP::IN; break;
+					case OP_NOT_IN: op = formula_vm::OP::NOT_IN; break;
+					case OP_ADD: op = formula_vm::OP::ADD; break;
+					case OP_SUB: op = formula_vm::OP::SUB; break;
+					case OP_MUL: op = formula_vm::OP::MUL; break;
+					case OP_DIV: op = formula_vm::OP::DIV; break;
+					case OP_POW: op = formula_vm::OP::POW; break;
+					case OP_MOD: op = formula_vm::OP::MOD; break;
+					case OP_EQ: op = formula_vm::OP::EQ; break;
+					case OP_NEQ: op = formula_vm::OP::NEQ; break;
+					case OP_LTE: op = formula_vm::OP::LTE; break;
+					case OP_GTE: op = formula_vm::OP::GTE; break;
+					case OP_LT: op = formula_vm::OP::LT; break;
+					case OP_GT: op = formula_vm::OP::GT; break;
+					default:
+						return FormulaExpression::emitVM(builder);
+				}
+
+				const int first_free = builder.nextRegister();
+				const int left = left_->emitVM(builder);
+				const int right = right_->emitVM(builder);
+				builder.releaseRegisters(first_free);
+				const int dst = builder.allocRegister();
+				builder.emit(*this, op, dst, left, right);
+				return dst;
+			}
 	
 		private:
 			variant execute(const FormulaCallable& variables) const {
@@ -2201,6 +2374,10 @@ namespace game_logic
 				return i_;
 			}
 
+			int emitVM(formula_vm::Builder& builder) const {
+				return builder.constant(i_);
+			}
+
 			variant_type_ptr getVariantType() const {
 				return variant_type::get_type(variant::VARIANT_TYPE_INT);
 			}
@@ -2217,6 +2394,10 @@ namespace game_logic
 				return v_;
 			}
 
+			int emitVM(formula_vm::Builder& builder) const {
+				return builder.constant(v_);
+			}
+
 			variant_type_ptr getVariantType() const {
 				return variant_type::get_type(variant::VARIANT_TYPE_DECIMAL);
 			}
@@ -3613,6 +3794,14 @@ Formula::Formula(const variant& val, FunctionSymbolTable* symbols, ConstFormulaC
 		expr_ = ExpressionPtr(new NullExpression());
 	}	
 
+	if(formula_vm::is_enabled()) {
+		expr_ = formula_vm::compile(expr_);
+		for(BaseCase& base : base_expr_) {
+			base.guard = formula_vm::compile(base.guard);
+			base.expr = formula_vm::compile(base.expr);
+		}
+	}
+
 	str_.add_formula_using_this(this);
 
 #ifndef NO_EDITOR
@@ -3894,6 +4083,13 @@ UNIT_TEST(dot_precedence) {
 	CHECK(result == variant(2), "test failed: " << result.to_debug_string());
 }
 
+UNIT_TEST(dot_map_member) {
+	//the same '.' expression reading maps of differing sizes and key orders.
+	Formula f(variant("map([{a: 1, b: 2}, {b: 3, a: 4}, {c: 5}, {a: 6, b: 7, c: 8, d: 9, e: 10, f: 11, g: 12, h: 13, i: 14}, {'a': 15}], value.a)"));
+	const variant result = f.execute();
+	CHECK_EQ(result, Formula(variant("[1, 4, null, 6, 15]")).execute());
+}
+
 UNIT_TEST(short_circuit) {
 	MapFormulaCallable* callable = new MapFormulaCallable;
 	variant ref(callable);
@@ -4014,7 +4210,47 @@ UNIT_TEST(formula_list_comprehension) {
 	CHECK_EQ(Formula(variant("[x | x <- [0,1,2,3], x%2 = 1]")).execute(), Formula(variant("[1,3]")).execute());
 }
 
-BENCHMARK(formula_list_comprehension_bench) {
+UNIT_TEST(formula_vm) {
+	static const char* Formulas[] = {
+		"1 + 2*3 - 4/2",
+		"x + 1",
+		"if(x > 0, 'pos', x < 0, 'neg', 'zero')",
+		"if(x = 5, 1)",
+		"x and y",
+		"x or y",
+		"not x",
+		"-x",
+		"[x, x+1, [x*2, y]]",
+		"x in [1, 2, 3]",
+		"x not in {1: 2}",
+		"x / 0",
+		"2^10 % 7",
+		"x >= 1 and x <= 10",
+		"[n*x | n <- range(3)]",
+		"def f(a, b) if(a > b, a - b, b - a); f(x, 3)",
+	};
+
+	for(const char* f : Formulas) {
+		const variant formula_str(f);
+		Formula tree_formula(formula_str);
+		const formula_vm::EnabledScope vm_scope;
+		Formula vm_formula(formula_str);
+
+		for(int n = -2; n != 6; ++n) {
+			MapFormulaCallable* callable = new MapFormulaCallable;
+			variant ref(callable);
+			callable->add("x", variant(n));
+			callable->add("y", variant(n%2 == 0));
+			CHECK_EQ(vm_formula.execute(*callable), tree_formula.execute(*callable));
+		}
+	}
+
+	const formula_vm::EnabledScope vm_scope;
+	CHECK_EQ(std::string(Formula(variant("x + 1")).expr()->name()), "_vm");
+}
+
+BENCHMARK_ARG(formula_list_comprehension_bench, bool use_vm) {
+	const formula_vm::EnabledScope vm_scope(use_vm);
 	Formula f(variant("[x*x + 5 | x <- range(input)]"));
 	static MapFormulaCallable* callable = new MapFormulaCallable;
 	callable->add("input", variant(1000));
@@ -4023,7 +4259,29 @@ BENCHMARK(formula_list_comprehension_bench) {
 	}
 }
 
-BENCHMARK(formula_map_bench) {
+BENCHMARK_ARG_CALL(formula_list_comprehension_bench, list_comprehension_tree, false);
+BENCHMARK_ARG_CALL(formula_list_comprehension_bench, list_comprehension_vm, true);
+
+//builds the same list by appending one element at a time, which should
+//scale like the comprehension rather than quadratically.
+BENCHMARK_ARG(formula_list_append_bench, int nitems) {
+	Formula f(variant(
+"def build(acc, n, count)"
+"base n >= count: acc "
+"recursive: build(acc + [n*n + 5], n+1, count);"
+"build([], 0, input)"));
+	static MapFormulaCallable* callable = new MapFormulaCallable;
+	callable->add("input", variant(nitems));
+	BENCHMARK_LOOP {
+		f.execute(*callable);
+	}
+}
+
+BENCHMARK_ARG_CALL(formula_list_append_bench, list_append_1000, 1000);
+BENCHMARK_ARG_CALL(formula_list_append_bench, list_append_10000, 10000);
+
+BENCHMARK_ARG(formula_map_bench, bool use_vm) {
+	const formula_vm::EnabledScope vm_scope(use_vm);
 	Formula f(variant("map(range(input), value*value + 5)"));
 	static MapFormulaCallable* callable = new MapFormulaCallable;
 	callable->add("input", variant(1000));
@@ -4032,7 +4290,28 @@ BENCHMARK(formula_map_bench) {
 	}
 }
 
-BENCHMARK(formula_recurse_sort) {
+BENCHMARK_ARG_CALL(formula_map_bench, map_tree, false);
+BENCHMARK_ARG_CALL(formula_map_bench, map_vm, true);
+
+BENCHMARK(formula_dot_map_bench) {
+	Formula f(variant("map(items, value.x*value.y + value.z)"));
+	static MapFormulaCallable* callable = new MapFormulaCallable;
+	std::vector<variant> items;
+	for(int n = 0; n != 1000; ++n) {
+		std::map<variant,variant> m;
+		m[variant("x")] = variant(n);
+		m[variant("y")] = variant(n+1);
+		m[variant("z")] = variant(n+2);
+		items.push_back(variant(&m));
+	}
+	callable->add("items", variant(&items));
+	BENCHMARK_LOOP {
+		f.execute(*callable);
+	}
+}
+
+BENCHMARK_ARG(formula_recurse_sort, bool use_vm) {
+	const formula_vm::EnabledScope vm_scope(use_vm);
 	Formula f(variant("def my_qsort(items) if(size(items) <= 1, items,"
 					  " my_qsort(filter(items, i, i < items[0])) +"
 					  "          filter(items, i, i = items[0]) +"
@@ -4055,7 +4334,36 @@ BENCHMARK(formula_recurse_sort) {
 	}
 }
 
-BENCHMARK(formula_recursion) {
+BENCHMARK_ARG_CALL(formula_recurse_sort, recurse_sort_tree, false);
+BENCHMARK_ARG_CALL(formula_recurse_sort, recurse_sort_vm, true);
+
+//a merge sort which builds its output by appending to an accumulator,
+//and splits its input with slices.
+BENCHMARK(formula_merge_sort) {
+	Formula f(variant("def merge(acc, a, b) if(a = [], acc + b, b = [], acc + a,"
+					  " a[0] < b[0], merge(acc + [a[0]], a[1:], b), merge(acc + [b[0]], a, b[1:]));"
+					  "def my_msort(items) if(size(items) <= 1, items,"
+					  " merge([], my_msort(items[0:size(items)/2]), my_msort(items[size(items)/2:size(items)])));"
+					  "my_msort(input)"));
+
+	std::vector<variant> input;
+	for(int n = 0; n != 10000; ++n) {
+		input.push_back(variant(n));
+	}
+
+	std::vector<variant> expected_result = input;
+	variant expected_result_v(&expected_result);
+
+	std::random_shuffle(input.begin(), input.end());
+	static MapFormulaCallable* callable = new MapFormulaCallable;
+	callable->add("input", variant(&input));
+	BENCHMARK_LOOP {
+		CHECK_EQ(f.execute(*callable), expected_result_v);
+	}
+}
+
+BENCHMARK_ARG(formula_recursion, bool use_vm) {
+	const formula_vm::EnabledScope vm_scope(use_vm);
 	Formula f(variant(
 "def my_index(ls, item, n)"
 "base ls = []: -1 "
@@ -4075,22 +4383,33 @@ BENCHMARK(formula_recursion) {
 	}
 }
 
-BENCHMARK(formula_if) {
+BENCHMARK_ARG_CALL(formula_recursion, recursion_tree, false);
+BENCHMARK_ARG_CALL(formula_recursion, recursion_vm, true);
+
+BENCHMARK_ARG(formula_if, bool use_vm) {
+	const formula_vm::EnabledScope vm_scope(use_vm);
 	static MapFormulaCallable* callable = new MapFormulaCallable;
 	callable->add("x", variant(1));
-	static Formula f(variant("if(x, 1, 0)"));
+	Formula f(variant("if(x, 1, 0)"));
 	BENCHMARK_LOOP {
 		f.execute(*callable);
 	}
 }
 
-BENCHMARK(formula_add) {
+BENCHMARK_ARG_CALL(formula_if, if_tree, false);
+BENCHMARK_ARG_CALL(formula_if, if_vm, true);
+
+BENCHMARK_ARG(formula_add, bool use_vm) {
+	const formula_vm::EnabledScope vm_scope(use_vm);
 	static MapFormulaCallable* callable = new MapFormulaCallable;
 	callable->add("x", variant(1));
-	static Formula f(variant("x+1"));
+	Formula f(variant("x+1"));
 	BENCHMARK_LOOP {
 		f.execute(*callable);
 	}
 }
 
+BENCHMARK_ARG_CALL(formula_add, add_tree, false);
+BENCHMARK_ARG_CALL(formula_add, add_vm, true);
+
 }
@@ -21,11 +21,138 @@
 	   distribution.
 */
 
+#include <algorithm>
+
+#include "SDL_atomic.h"
+
+#include "asserts.hpp"
 #include "formula_callable.hpp"
 #include "formula_callable_visitor.hpp"
+#include "unit_test.hpp"
 
 namespace game_logic
 {
+	namespace
+	{
+		int g_commands_executed[static_cast<int>(COMMAND_TYPE::NUM_TYPES)];
+
+		// Blocks are handed out in multiples of this size, which keeps them
+		// aligned for anything a command holds.
+		const size_t CommandBlockSize = 16;
+		const size_t MaxPooledCommandSize = 256;
+		const int CommandBlocksPerChunk = 64;
+
+		struct FreeCommandBlock
+		{
+			FreeCommandBlock* next;
+		};
+
+		struct CommandPool
+		{
+			CommandPool() : lock(0) {
+				std::fill(free_blocks, free_blocks + MaxPooledCommandSize/CommandBlockSize, static_cast<FreeCommandBlock*>(nullptr));
+			}
+
+			SDL_SpinLock lock;
+			FreeCommandBlock* free_blocks[MaxPooledCommandSize/CommandBlockSize];
+		};
+
+		CommandPool& get_command_pool()
+		{
+			// Never destroyed, since commands may still be released during exit.
+			static CommandPool* pool = new CommandPool;
+			return *pool;
+		}
+	}
+
+	const char* get_command_type_name(COMMAND_TYPE type)
+	{
+		switch(type) {
+		case COMMAND_TYPE::NONE:           return "none";
+		case COMMAND_TYPE::FORMULA:        return "formula";
+		case COMMAND_TYPE::ENTITY:         return "entity";
+		case COMMAND_TYPE::CUSTOM_OBJECT:  return "custom_object";
+		case COMMAND_TYPE::SWALLOW_OBJECT: return "swallow_object";
+		case COMMAND_TYPE::SWALLOW_MOUSE:  return "swallow_mouse";
+		default: break;
+		}
+		ASSERT_LOG(false, "Unknown command type: " << static_cast<int>(type));
+		return "";
+	}
+
+	void count_command_executed(COMMAND_TYPE type)
+	{
+		++g_commands_executed[static_cast<int>(type)];
+	}
+
+	std::vector<int> get_commands_executed()
+	{
+		return std::vector<int>(g_commands_executed, g_commands_executed + static_cast<int>(COMMAND_TYPE::NUM_TYPES));
+	}
+
+	void reset_commands_executed()
+	{
+		std::fill(g_commands_executed, g_commands_executed + static_cast<int>(COMMAND_TYPE::NUM_TYPES), 0);
+	}
+
+	int next_slot_layout_id()
+	{
+		//definitions may be created by background loading threads.
+		static SDL_atomic_t next_id;
+		return SDL_AtomicAdd(&next_id, 1) + 1;
+	}
+
+	void* allocate_command(size_t size)
+	{
+		if(size == 0 || size > MaxPooledCommandSize) {
+			return ::operator new(size);
+		}
+
+		const size_t index = (size - 1)/CommandBlockSize;
+		CommandPool& pool = get_command_pool();
+		SDL_AtomicLock(&pool.lock);
+		FreeCommandBlock* block = pool.free_blocks[index];
+		if(block != nullptr) {
+			pool.free_blocks[index] = block->next;
+			SDL_AtomicUnlock(&pool.lock);
+			return block;
+		}
+		SDL_AtomicUnlock(&pool.lock);
+
+		// Carve a new chunk into blocks, keeping the first one and putting
+		// the rest on the free list.
+		const size_t block_size = (index + 1)*CommandBlockSize;
+		char* chunk = static_cast<char*>(::operator new(block_size*CommandBlocksPerChunk));
+		SDL_AtomicLock(&pool.lock);
+		for(int n = CommandBlocksPerChunk - 1; n >= 1; --n) {
+			FreeCommandBlock* free_block = reinterpret_cast<FreeCommandBlock*>(chunk + n*block_size);
+			free_block->next = pool.free_blocks[index];
+			pool.free_blocks[index] = free_block;
+		}
+		SDL_AtomicUnlock(&pool.lock);
+		return chunk;
+	}
+
+	void free_command(void* p, size_t size)
+	{
+		if(p == nullptr) {
+			return;
+		}
+
+		if(size == 0 || size > MaxPooledCommandSize) {
+			::operator delete(p);
+			return;
+		}
+
+		const size_t index = (size - 1)/CommandBlockSize;
+		CommandPool& pool = get_command_pool();
+		FreeCommandBlock* block = static_cast<FreeCommandBlock*>(p);
+		SDL_AtomicLock(&pool.lock);
+		block->next = pool.free_blocks[index];
+		pool.free_blocks[index] = block;
+		SDL_AtomicUnlock(&pool.lock);
+	}
+
 	void MapFormulaCallable::visitValues(FormulaCallableVisitor& visitor)
 	{
 		for(std::map<std::string,variant>::iterator i = values_.begin();
@@ -50,3 +177,50 @@ namespace game_logic
 		fn_(&context);
 	}
 }
+
+namespace
+{
+	class test_command : public game_logic::CommandCallable
+	{
+	public:
+		explicit test_command(int* counter) : counter_(counter) {}
+	private:
+		void execute(game_logic::FormulaCallable& context) const override { ++*counter_; }
+		int* counter_;
+		char padding_[40];
+	};
+}
+
+UNIT_TEST(command_pool) {
+	int counter = 0;
+	std::vector<game_logic::FormulaCallablePtr> commands;
+	for(int n = 0; n != 200; ++n) {
+		commands.push_back(game_logic::FormulaCallablePtr(new test_command(&counter)));
+	}
+
+	game_logic::MapFormulaCallablePtr context(new game_logic::MapFormulaCallable);
+	for(const game_logic::FormulaCallablePtr& cmd : commands) {
+		CHECK(cmd->getCommandType() == game_logic::COMMAND_TYPE::FORMULA, "command has wrong type");
+		static_cast<const game_logic::CommandCallable*>(cmd.get())->runCommand(*context);
+	}
+	CHECK_EQ(counter, 200);
+	CHECK(context->getCommandType() == game_logic::COMMAND_TYPE::NONE, "callable has a command type");
+
+	// Released blocks are reused.
+	const void* released = commands.back().get();
+	commands.pop_back();
+	commands.push_back(game_logic::FormulaCallablePtr(new test_command(&counter)));
+	CHECK_EQ(static_cast<const void*>(commands.back().get()), released);
+}
+
+BENCHMARK(command_allocation) {
+	int counter = 0;
+	std::vector<game_logic::FormulaCallablePtr> commands;
+	commands.reserve(64);
+	BENCHMARK_LOOP {
+		for(int n = 0; n != 64; ++n) {
+			commands.push_back(game_logic::FormulaCallablePtr(new test_command(&counter)));
+		}
+		commands.clear();
+	}
+}
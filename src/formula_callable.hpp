@@ -27,6 +27,7 @@
 #include <iostream>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "formula_garbage_collector.hpp"
 #include "variant.hpp"
@@ -34,6 +35,37 @@
 namespace game_logic
 {
 	enum class FORMULA_ACCESS_TYPE { READ_ONLY, WRITE_ONLY, READ_WRITE };
+
+	// The kind of command a callable is. Objects executing commands switch
+	// on this rather than trying to convert the callable to each kind of
+	// command in turn.
+	enum class COMMAND_TYPE : unsigned char {
+		NONE,
+		FORMULA,
+		ENTITY,
+		CUSTOM_OBJECT,
+		SWALLOW_OBJECT,
+		SWALLOW_MOUSE,
+		NUM_TYPES
+	};
+
+	const char* get_command_type_name(COMMAND_TYPE type);
+
+	// Counts of the commands executed by type, since they were last reset.
+	void count_command_executed(COMMAND_TYPE type);
+	std::vector<int> get_commands_executed();
+	void reset_commands_executed();
+
+	// Commands are allocated in blocks of a few fixed sizes, which are kept
+	// for reuse when the commands are released. Event handlers create and
+	// release a lot of small commands every frame.
+	void* allocate_command(size_t size);
+	void free_command(void* p, size_t size);
+
+	// A new id for a slot layout, see FormulaCallable::getSlotLayoutId().
+	// Ids are never reused, so a cached id can't match a layout created
+	// after the one it was taken from was destroyed.
+	int next_slot_layout_id();
 	struct FormulaInput 
 	{
 		std::string name;
@@ -49,7 +81,7 @@ namespace game_logic
 	class FormulaCallable : public GarbageCollectible
 	{
 	public:
-		explicit FormulaCallable(bool has_self=false) : has_self_(has_self)
+		explicit FormulaCallable(bool has_self=false) : has_self_(has_self), command_type_(COMMAND_TYPE::NONE)
 		{}
 
 		std::string queryId() const { return getObjectId(); }
@@ -107,6 +139,16 @@ namespace game_logic
 
 		//is some kind of command to the engine.
 		virtual bool isCommand() const { return false; }
+		COMMAND_TYPE getCommandType() const { return command_type_; }
+
+		// Callables which keep their values in slots can say which slot a
+		// key is read from, so that an expression can remember the slot and
+		// use queryValueBySlot() the next time it sees the same layout. Any
+		// two callables returning the same layout id must read each key from
+		// the same slot. 0 means the callable has no slot layout.
+		virtual int getSlotLayoutId() const { return 0; }
+		// The slot queryValue(key) reads, or -1 if it doesn't read a slot.
+		virtual int getSlotForKey(const std::string& key) const { return -1; }
 		virtual bool isCairoOp() const { return false; }
 
 		void performVisitValues(FormulaCallableVisitor& visitor) {
@@ -116,6 +158,8 @@ namespace game_logic
 	protected:
 		virtual ~FormulaCallable() {}
 
+		void setCommandType(COMMAND_TYPE type) { command_type_ = type; }
+
 		virtual variant getValueDefault(const std::string& key) const { return variant(); }
 		virtual void setValueDefault(const std::string& key, const variant& value) {}
 
@@ -135,6 +179,7 @@ namespace game_logic
 		virtual std::string getObjectId() const { return "FormulaCallable"; }
 
 		bool has_self_;
+		COMMAND_TYPE command_type_;
 	};
 
 	class FormulaCallableNoRefCount : public FormulaCallable {
@@ -255,6 +300,9 @@ namespace game_logic
 		void setExpression(const FormulaExpression* expr);
 
 		bool isCommand() const { return true; }
+
+		static void* operator new(size_t size) { return allocate_command(size); }
+		static void operator delete(void* p, size_t size) { free_command(p, size); }
 	private:
 		virtual void execute(FormulaCallable& context) const = 0;
 		variant getValue(const std::string& key) const { return variant(); }
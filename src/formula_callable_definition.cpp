@@ -42,7 +42,7 @@ namespace game_logic
 		}
 	}
 
-	FormulaCallableDefinition::FormulaCallableDefinition() : is_strict_(false), supports_slot_lookups_(true)
+	FormulaCallableDefinition::FormulaCallableDefinition() : is_strict_(false), supports_slot_lookups_(true), slot_layout_id_(next_slot_layout_id())
 	{
 	}
 
@@ -91,6 +91,9 @@ namespace game_logic
 
 		bool supportsSlotLookups() const { return supports_slot_lookups_; }
 		void setSupportsSlotLookups(bool value) { supports_slot_lookups_ = value; }
+
+		//identifies the slots of this definition for inline caches.
+		int getSlotLayoutId() const { return slot_layout_id_; }
 	private:
 
 		virtual int getSubsetSlotBase(const FormulaCallableDefinition* subset) const = 0;
@@ -98,6 +101,7 @@ namespace game_logic
 		bool is_strict_;
 		bool supports_slot_lookups_;
 		std::string type_name_;
+		int slot_layout_id_;
 	};
 
 	FormulaCallableDefinitionPtr modify_formula_callable_definition(ConstFormulaCallableDefinitionPtr base_def, int slot, variant_type_ptr new_type, const FormulaCallableDefinition* new_def=nullptr);
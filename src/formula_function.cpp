@@ -55,6 +55,7 @@
 #include "formula_function.hpp"
 #include "formula_function_registry.hpp"
 #include "formula_object.hpp"
+#include "formula_vm.hpp"
 #include "lua_iface.hpp"
 #include "md5.hpp"
 #include "module.hpp"
@@ -115,6 +116,16 @@ namespace game_logic
 	FormulaExpression::FormulaExpression(const char* name) : name_(name), begin_str_(EmptyStr.begin()), end_str_(EmptyStr.end()), ntimes_called_(0)
 	{}
 
+	int FormulaExpression::emitVM(formula_vm::Builder& builder) const
+	{
+		variant literal;
+		if(isLiteral(literal)) {
+			return builder.constant(literal);
+		}
+
+		return builder.emitFallback(*this);
+	}
+
 	std::vector<ConstExpressionPtr> FormulaExpression::queryChildren() const {
 		std::vector<ConstExpressionPtr> result = getChildren();
 		result.erase(std::remove(result.begin(), result.end(), ConstExpressionPtr()), result.end());
@@ -472,10 +483,38 @@ namespace game_logic
 					return ExpressionPtr();
 				}
 
+				int emitVM(formula_vm::Builder& builder) const {
+					const int dst = builder.allocRegister();
+					std::vector<int> jumps_to_end;
+					const auto nargs = args().size();
+					for(size_t n = 0; n + 1 < nargs; n += 2) {
+						const int cond = args()[n]->emitVM(builder);
+						builder.releaseRegisters(dst+1);
+						const int skip = builder.emit(*this, formula_vm::OP::JMP_IF_FALSE, 0, cond);
+						builder.moveTo(*this, args()[n+1]->emitVM(builder), dst);
+						builder.releaseRegisters(dst+1);
+						jumps_to_end.push_back(builder.emit(*this, formula_vm::OP::JMP, 0));
+						builder.patchJump(skip, builder.label());
+					}
+
+					if((nargs % 2) == 0) {
+						builder.moveTo(*this, builder.constant(variant()), dst);
+					} else {
+						builder.moveTo(*this, args()[nargs-1]->emitVM(builder), dst);
+						builder.releaseRegisters(dst+1);
+					}
+
+					for(int jump : jumps_to_end) {
+						builder.patchJump(jump, builder.label());
+					}
+
+					return dst;
+				}
+
 			private:
 				variant execute(const FormulaCallable& variables) const {
 					const auto nargs = args().size();
-					for(auto n = 0; n < nargs-1; n += 2) {
+					for(size_t n = 0; n + 1 < nargs; n += 2) {
 						const bool result = args()[n]->evaluate(variables).as_bool();
 						if(result) {
 							return args()[n+1]->evaluate(variables);
@@ -494,7 +533,7 @@ namespace game_logic
 					std::vector<variant_type_ptr> types;
 					types.push_back(args()[1]->queryVariantType());
 					const auto nargs = args().size();
-					for(auto n = 1; n < nargs; n += 2) {
+					for(size_t n = 1; n < nargs; n += 2) {
 						types.push_back(args()[n]->queryVariantType());
 					}
 
@@ -1832,6 +1871,38 @@ FUNCTION_DEF_IMPL
 			RETURN_TYPE("list")
 		END_FUNCTION_DEF(a_star_search)
 
+		FUNCTION_DEF(grid_path, 5, 8, "grid_path(level, from_x, from_y, to_x, to_y, (optional) tile_size_x, (optional) tile_size_y, (optional) jump_points) -> list : Returns a list of points to get from (from_x, from_y) to (to_x, to_y), moving between the cells of a grid over the level's solid area. Recent paths are cached until the solid area they cross changes. If jump_points is true, jump point search is used, which is faster over open areas.")
+			int tile_size_x = TileSize;
+			int tile_size_y = TileSize;
+			bool jump_points = false;
+			variant curlevel = args()[0]->evaluate(variables);
+			LevelPtr lvl = curlevel.try_convert<Level>();
+			ASSERT_LOG(lvl, "The level parameter passed to the function was couldn't be converted.");
+			if(args().size() == 6) {
+				tile_size_y = tile_size_x = args()[5]->evaluate(variables).as_int();
+			} else if(args().size() >= 7) {
+				tile_size_x = args()[5]->evaluate(variables).as_int();
+				tile_size_y = args()[6]->evaluate(variables).as_int();
+			}
+			if(args().size() == 8) {
+				jump_points = args()[7]->evaluate(variables).as_bool();
+			}
+			ASSERT_LOG(tile_size_x > 0 && tile_size_y > 0, "The tile_size_x and tile_size_y values must be positive. (" << tile_size_x << "," << tile_size_y << ")");
+			point src(args()[1]->evaluate(variables).as_int(), args()[2]->evaluate(variables).as_int());
+			point dst(args()[3]->evaluate(variables).as_int(), args()[4]->evaluate(variables).as_int());
+			return pathfinding::grid_find_path(lvl, src, dst, tile_size_x, tile_size_y, jump_points);
+		FUNCTION_ARGS_DEF
+			ARG_TYPE("object")
+			ARG_TYPE("int")
+			ARG_TYPE("int")
+			ARG_TYPE("int")
+			ARG_TYPE("int")
+			ARG_TYPE("int")
+			ARG_TYPE("int")
+			ARG_TYPE("bool")
+			RETURN_TYPE("[[int]]")
+		END_FUNCTION_DEF(grid_path)
+
 		FUNCTION_DEF(path_cost_search, 3, 3, "path_cost_search(weighted_directed_graph, src_node, max_cost) -> A list of all possible points reachable from src_node within max_cost.")
 			variant graph = args()[0]->evaluate(variables);
 			pathfinding::WeightedDirectedGraphPtr wg = graph.try_convert<pathfinding::WeightedDirectedGraph>();
@@ -37,6 +37,11 @@
 #include "variant.hpp"
 #include "variant_type.hpp"
 
+namespace formula_vm
+{
+	class Builder;
+}
+
 namespace game_logic
 {
 	class FormulaExpression;
@@ -89,6 +94,11 @@ namespace game_logic
 			return ExpressionPtr();
 		}
 
+		//lowers this expression into bytecode, returning the operand which
+		//will hold the result. By default the expression is run by the tree
+		//walker from within the bytecode.
+		virtual int emitVM(formula_vm::Builder& builder) const;
+
 		virtual bool canReduceToVariant(variant& v) const {
 			return false;
 		}
@@ -1,49 +1,76 @@
 #include <assert.h>
 #include <algorithm>
 #include <map>
+#include <unordered_set>
 #include <vector>
 
 #include "asserts.hpp"
 #include "formula_garbage_collector.hpp"
 #include "logger.hpp"
 #include "profile_timer.hpp"
+#include "unit_test.hpp"
 
 #include "formula_object.hpp"
 
 	
 namespace {
-	GarbageCollectible* g_head;
-	int g_count;
+	GarbageCollectible* g_young_head;
+	GarbageCollectible* g_old_head;
+	int g_young_count;
+	int g_old_count;
+
+	//the next old object the incremental collector will scan.
+	GarbageCollectible* g_old_cursor;
+
+	//number of young collections an object must survive to be promoted.
+	const int PromotionAge = 2;
+
+	//the fewest old objects an incremental step will scan when it has any
+	//budget left over.
+	const int MinOldWindow = 64;
+
+	//running estimate of how long scanning one object takes.
+	double g_us_per_object = 1.0;
+
+	GarbageCollectionStats g_stats;
+}
+
+GarbageCollectionStats::GarbageCollectionStats()
+  : cycles(0), pause_us(0), scanned(0), reclaimed(0), max_pause_us(0), total_reclaimed(0), young_objects(0), old_objects(0)
+{
 }
 
-GarbageCollectible::GarbageCollectible() : reference_counted_object(), next_(g_head), prev_(nullptr)
+GarbageCollectible::GarbageCollectible() : reference_counted_object(), next_(g_young_head), prev_(nullptr), old_generation_(false), collections_survived_(0)
 {
 	insertAtHead();
 }
 
-GarbageCollectible::GarbageCollectible(const GarbageCollectible& o) : reference_counted_object(o), next_(g_head), prev_(nullptr)
+GarbageCollectible::GarbageCollectible(const GarbageCollectible& o) : reference_counted_object(o), next_(g_young_head), prev_(nullptr), old_generation_(false), collections_survived_(0)
 {
 	insertAtHead();
 }
 
 void GarbageCollectible::insertAtHead()
 {
-	++g_count;
-	if(g_head != nullptr) {
-		g_head->prev_ = this;
+	GarbageCollectible*& head = old_generation_ ? g_old_head : g_young_head;
+	++(old_generation_ ? g_old_count : g_young_count);
+	next_ = head;
+	prev_ = nullptr;
+	if(head != nullptr) {
+		head->prev_ = this;
 	}
 
-	g_head = this;
+	head = this;
 }
 
-GarbageCollectible& GarbageCollectible::operator=(const GarbageCollectible& o)
+void GarbageCollectible::unlink()
 {
-	return *this;
-}
+	GarbageCollectible*& head = old_generation_ ? g_old_head : g_young_head;
+	--(old_generation_ ? g_old_count : g_young_count);
+	if(g_old_cursor == this) {
+		g_old_cursor = next_;
+	}
 
-GarbageCollectible::~GarbageCollectible()
-{
-	--g_count;
 	if(prev_ != nullptr) {
 		prev_->next_ = next_;
 	}
@@ -52,9 +79,21 @@ GarbageCollectible::~GarbageCollectible()
 		next_->prev_ = prev_;
 	}
 
-	if(g_head == this) {
-		g_head = next_;
+	if(head == this) {
+		head = next_;
 	}
+
+	next_ = prev_ = nullptr;
+}
+
+GarbageCollectible& GarbageCollectible::operator=(const GarbageCollectible& o)
+{
+	return *this;
+}
+
+GarbageCollectible::~GarbageCollectible()
+{
+	unlink();
 }
 
 void GarbageCollectible::surrenderReferences(GarbageCollector* collector)
@@ -81,6 +120,57 @@ namespace {
 	};
 }
 
+//moves objects between generations.
+class GarbageCollectorGenerations
+{
+public:
+	static void collectAll(std::vector<GarbageCollectible*>& items) {
+		for(GarbageCollectible* p = g_young_head; p != nullptr; p = p->next_) {
+			items.push_back(p);
+		}
+
+		for(GarbageCollectible* p = g_old_head; p != nullptr; p = p->next_) {
+			items.push_back(p);
+		}
+	}
+
+	static void collectYoung(std::vector<GarbageCollectible*>& items) {
+		for(GarbageCollectible* p = g_young_head; p != nullptr; p = p->next_) {
+			items.push_back(p);
+		}
+	}
+
+	//gathers up to 'count' old objects starting from the cursor, wrapping
+	//around to the head of the old list at most once.
+	static void collectOldWindow(std::vector<GarbageCollectible*>& items, int count) {
+		if(g_old_cursor == nullptr) {
+			g_old_cursor = g_old_head;
+		}
+
+		count = std::min(count, g_old_count);
+		while(count-- > 0 && g_old_cursor != nullptr) {
+			items.push_back(g_old_cursor);
+			g_old_cursor = g_old_cursor->next_;
+		}
+	}
+
+	static void survived(GarbageCollectible* item, bool promote_now) {
+		if(item->old_generation_) {
+			return;
+		}
+
+		if(item->collections_survived_ < 255) {
+			++item->collections_survived_;
+		}
+
+		if(promote_now || item->collections_survived_ >= PromotionAge) {
+			item->unlink();
+			item->old_generation_ = true;
+			item->insertAtHead();
+		}
+	}
+};
+
 class GarbageCollectorImpl : public GarbageCollector
 {
 public:
@@ -88,17 +178,32 @@ public:
 	void surrenderVariant(const variant* v, const char* description) override;
 	void surrenderPtrInternal(boost::intrusive_ptr<GarbageCollectible>* ptr, const char* description) override;
 
-	void collect();
+	//collects garbage among 'items', which must each have had a reference
+	//added by the caller. References from anything outside of 'items' keep
+	//objects alive, and references to anything outside of 'items' are left
+	//alone, so 'items' may be just part of the heap. Returns the objects
+	//which survived, with the added reference still held.
+	std::vector<GarbageCollectible*> collect(std::vector<GarbageCollectible*> items);
+
+	int numReclaimed() const { return reclaimed_; }
 
 private:
 
-	void destroyReferences(GarbageCollectible* item);
-	void restoreReferences(GarbageCollectible* item);
+	void destroyReferences(int index);
+	void restoreReferences(int index);
+
+	//the objects being collected. Only references to these are surrendered.
+	//Surrendering a reference to anything else could free it in the middle
+	//of the pass.
+	std::unordered_set<const GarbageCollectible*> items_;
 
 	std::vector<variant*> variants_;
 	std::vector<PointerPair> pointers_;
 
-	std::map<GarbageCollectible*, ObjectRecord> records_;
+	//records, indexed the same as the items being collected.
+	std::vector<ObjectRecord> records_;
+
+	int reclaimed_;
 };
 
 void GarbageCollectorImpl::surrenderVariant(const variant* v, const char* description)
@@ -110,6 +215,10 @@ void GarbageCollectorImpl::surrenderVariant(const variant* v, const char* descri
 	case variant::VARIANT_TYPE_FUNCTION:
 	case variant::VARIANT_TYPE_GENERIC_FUNCTION:
 	case variant::VARIANT_TYPE_MULTI_FUNCTION:
+		if(items_.count(v->get_collectible()) == 0) {
+			break;
+		}
+
 		const_cast<variant*>(v)->release();
 		variants_.push_back(const_cast<variant*>(v));
 		break;
@@ -120,7 +229,7 @@ void GarbageCollectorImpl::surrenderVariant(const variant* v, const char* descri
 
 void GarbageCollectorImpl::surrenderPtrInternal(boost::intrusive_ptr<GarbageCollectible>* ptr, const char* description)
 {
-	if(ptr->get() == NULL) {
+	if(ptr->get() == NULL || items_.count(ptr->get()) == 0) {
 		return;
 	}
 
@@ -129,11 +238,9 @@ void GarbageCollectorImpl::surrenderPtrInternal(boost::intrusive_ptr<GarbageColl
 	ptr->reset();
 }
 
-void GarbageCollectorImpl::destroyReferences(GarbageCollectible* item)
+void GarbageCollectorImpl::destroyReferences(int index)
 {
-	auto itor = records_.find(item);
-	ASSERT_LOG(itor != records_.end(), "Could not find item in GC");
-	const ObjectRecord& record = itor->second;
+	const ObjectRecord& record = records_[index];
 	for(int n = record.begin_variant; n != record.end_variant; ++n) {
 		variants_[n]->increment_refcount();
 		*variants_[n] = variant();
@@ -141,11 +248,9 @@ void GarbageCollectorImpl::destroyReferences(GarbageCollectible* item)
 }
 
 
-void GarbageCollectorImpl::restoreReferences(GarbageCollectible* item)
+void GarbageCollectorImpl::restoreReferences(int index)
 {
-	auto itor = records_.find(item);
-	ASSERT_LOG(itor != records_.end(), "Could not find item in GC");
-	const ObjectRecord& record = itor->second;
+	const ObjectRecord& record = records_[index];
 	for(int n = record.begin_variant; n != record.end_variant; ++n) {
 		variants_[n]->increment_refcount();
 	}
@@ -155,64 +260,134 @@ void GarbageCollectorImpl::restoreReferences(GarbageCollectible* item)
 	}
 }
 
-void GarbageCollectorImpl::collect()
+std::vector<GarbageCollectible*> GarbageCollectorImpl::collect(std::vector<GarbageCollectible*> all_items)
 {
-	LOG_INFO("Beginning garbage collection of " << g_count << " items");
-	profile::timer timer;
-
-	std::vector<GarbageCollectible*> items, saved;
-	items.reserve(g_count);
+	records_.resize(all_items.size());
+	items_.insert(all_items.begin(), all_items.end());
 
-	int count = 0;
-	for(GarbageCollectible* p = g_head; p != nullptr; p = p->next_) {
-		p->add_ref();
-		ASSERT_LOG(p->refcount() > 1, "Object with bad refcount: " << p->refcount());
-		items.push_back(p);
-		++count;
-	}
-
-	for(GarbageCollectible* p : items) {
-		ObjectRecord& record = records_[p];
+	for(int n = 0; n != all_items.size(); ++n) {
+		ObjectRecord& record = records_[n];
 		record.begin_variant = variants_.size();
 		record.begin_pointer = pointers_.size();
-		p->surrenderReferences(this);
+		all_items[n]->surrenderReferences(this);
 		record.end_variant = variants_.size();
 		record.end_pointer = pointers_.size();
 	}
 
+	std::vector<int> items, saved;
+	items.reserve(all_items.size());
+	for(int n = 0; n != all_items.size(); ++n) {
+		items.push_back(n);
+	}
+
 	int nlast = -1;
 	while(nlast != items.size()) {
 		nlast = items.size();
 
-		int save_count = 0;
-		for(GarbageCollectible*& item : items) {
-			if(item->refcount() == 1) {
+		for(int& item : items) {
+			if(all_items[item]->refcount() == 1) {
 				continue;
 			}
 
-			++save_count;
-
 			restoreReferences(item);
 			saved.push_back(item);
-			item = nullptr;
+			item = -1;
 		}
 
-		items.erase(std::remove(items.begin(), items.end(), nullptr), items.end());
+		items.erase(std::remove(items.begin(), items.end(), -1), items.end());
 	}
 
-	for(auto item : items) {
+	for(int item : items) {
 		destroyReferences(item);
 	}
 
-	for(auto item : items) {
-		item->dec_ref();
+	for(int item : items) {
+		all_items[item]->dec_ref();
+	}
+
+	reclaimed_ = items.size();
+
+	std::vector<GarbageCollectible*> result;
+	result.reserve(saved.size());
+	for(int item : saved) {
+		result.push_back(all_items[item]);
+	}
+
+	return result;
+}
+
+namespace {
+	std::vector<GarbageCollectible*> add_refs(std::vector<GarbageCollectible*> items)
+	{
+		for(GarbageCollectible* p : items) {
+			p->add_ref();
+			ASSERT_LOG(p->refcount() > 1, "Object with bad refcount: " << p->refcount());
+		}
+
+		return items;
+	}
+
+	void record_pass(int pause_us, int scanned, int reclaimed)
+	{
+		++g_stats.cycles;
+		g_stats.pause_us = pause_us;
+		g_stats.scanned = scanned;
+		g_stats.reclaimed = reclaimed;
+		g_stats.max_pause_us = std::max(g_stats.max_pause_us, pause_us);
+		g_stats.total_reclaimed += reclaimed;
+		g_stats.young_objects = g_young_count;
+		g_stats.old_objects = g_old_count;
+
+		if(scanned > 0) {
+			g_us_per_object = g_us_per_object*0.75 + (double(pause_us)/scanned)*0.25;
+		}
+	}
+
+	//runs one collection pass over 'items', promoting young survivors.
+	//Returns the number of objects reclaimed.
+	int collect_pass(const std::vector<GarbageCollectible*>& items, bool promote_all)
+	{
+		GarbageCollectorImpl gc;
+		std::vector<GarbageCollectible*> survivors = gc.collect(add_refs(items));
+		for(GarbageCollectible* item : survivors) {
+			GarbageCollectorGenerations::survived(item, promote_all);
+		}
+
+		for(GarbageCollectible* item : survivors) {
+			item->dec_ref();
+		}
+
+		return gc.numReclaimed();
 	}
+}
+
+void runIncrementalGarbageCollection(int budget_us)
+{
+	profile::timer timer;
 
-	for(auto item : saved) {
-		item->dec_ref();
+	std::vector<GarbageCollectible*> items;
+	items.reserve(g_young_count);
+	GarbageCollectorGenerations::collectYoung(items);
+
+	int scanned = items.size();
+	int reclaimed = collect_pass(items, false);
+
+	const int remaining_us = budget_us - static_cast<int>(timer.get_time());
+	if(remaining_us > 0 && g_old_count > 0) {
+		const int window = std::max<int>(MinOldWindow, static_cast<int>(remaining_us/g_us_per_object));
+		items.clear();
+		GarbageCollectorGenerations::collectOldWindow(items, window);
+		scanned += items.size();
+		reclaimed += collect_pass(items, false);
 	}
 
-	LOG_INFO("Garbage collection complete in " << static_cast<int>(timer.get_time()) << "us. Collected " << items.size() << " objects. " << saved.size() << " objects remaining");
+	record_pass(static_cast<int>(timer.get_time()), scanned, reclaimed);
+	LOG_DEBUG("Incremental garbage collection scanned " << scanned << " objects in " << g_stats.pause_us << "us. Collected " << reclaimed << " objects. " << g_young_count << " young and " << g_old_count << " old objects remaining");
+}
+
+const GarbageCollectionStats& getGarbageCollectionStats()
+{
+	return g_stats;
 }
 
 namespace {
@@ -334,17 +509,16 @@ void GarbageCollectorAnalyzer::surrenderPtrInternal(boost::intrusive_ptr<Garbage
 void GarbageCollectorAnalyzer::run(const char* fname)
 {
 	FILE* out = fopen(fname, "w");
-	graph_ = Graph(g_count+1);
+	const int count = g_young_count + g_old_count;
+	graph_ = Graph(count+1);
 
 	items_.clear();
-	items_.reserve(g_count);
-
-	for(GarbageCollectible* p = g_head; p != nullptr; p = p->next_) {
-		graph_.setNode(items_.size(), p->debugObjectName());
-
-		itemIndexes_[p] = items_.size();
-		items_.push_back(p);
+	items_.reserve(count);
+	GarbageCollectorGenerations::collectAll(items_);
 
+	for(int i = 0; i != count; ++i) {
+		graph_.setNode(i, items_[i]->debugObjectName());
+		itemIndexes_[items_[i]] = i;
 	}
 
 	currentIndex_ = 0;
@@ -354,9 +528,9 @@ void GarbageCollectorAnalyzer::run(const char* fname)
 	}
 
 
-	int root_node = g_count;
+	int root_node = count;
 	graph_.setNode(root_node, "(root)");
-	for(int i = 0; i != g_count; ++i) {
+	for(int i = 0; i != count; ++i) {
 		const int refcount = items_[i]->refcount();
 		int refs = graph_.getNode(i).in_edges.size();
 		while(refs < refcount) {
@@ -368,7 +542,7 @@ void GarbageCollectorAnalyzer::run(const char* fname)
 	std::map<int, std::vector<int> > paths;
 	breadthFirstSearch(graph_, root_node, paths);
 
-	for(int i = 0; i != g_count; ++i) {
+	for(int i = 0; i != count; ++i) {
 		fprintf(out, "REFS: ");
 		fprintf(out, "[%s @%p (%d)] ", items_[i]->debugObjectName().c_str(), items_[i], items_[i]->refcount());
 
@@ -396,15 +570,74 @@ void GarbageCollectorAnalyzer::run(const char* fname)
 
 void runGarbageCollection()
 {
-	GarbageCollectorImpl gc;
-	gc.collect();
+	LOG_INFO("Beginning garbage collection of " << (g_young_count + g_old_count) << " items");
+	profile::timer timer;
+
+	std::vector<GarbageCollectible*> items;
+	items.reserve(g_young_count + g_old_count);
+	GarbageCollectorGenerations::collectAll(items);
+
+	const int reclaimed = collect_pass(items, true);
+	record_pass(static_cast<int>(timer.get_time()), items.size(), reclaimed);
+
+	LOG_INFO("Garbage collection complete in " << g_stats.pause_us << "us. Collected " << reclaimed << " objects. " << (g_young_count + g_old_count) << " objects remaining");
 }
 
 void runGarbageCollectionDebug(const char* fname)
 {
-	GarbageCollectorImpl gc;
-	gc.collect();
+	runGarbageCollection();
 
 	GarbageCollectorAnalyzer().run(fname);
 }
 
+
+namespace {
+	int g_num_test_collectibles = 0;
+
+	struct TestCollectible : public GarbageCollectible
+	{
+		TestCollectible() { ++g_num_test_collectibles; }
+		~TestCollectible() { --g_num_test_collectibles; }
+
+		void surrenderReferences(GarbageCollector* collector) override {
+			collector->surrenderPtr(&ref);
+			collector->surrenderVariant(&value);
+		}
+
+		boost::intrusive_ptr<TestCollectible> ref;
+		variant value;
+	};
+}
+
+UNIT_TEST(incremental_gc_keeps_old_objects_referenced_from_young)
+{
+	boost::intrusive_ptr<TestCollectible> old_obj(new TestCollectible);
+	GarbageCollectorGenerations::survived(old_obj.get(), true);
+
+	std::map<variant,variant> m;
+	m[variant("a")] = variant(1);
+	variant old_map(&m);
+	GarbageCollectorGenerations::survived(const_cast<GarbageCollectible*>(old_map.get_collectible()), true);
+
+	//the young object holds the only references to the old objects.
+	boost::intrusive_ptr<TestCollectible> young(new TestCollectible);
+	young->ref = old_obj;
+	young->value = old_map;
+	old_obj.reset();
+	old_map = variant();
+
+	//a step with no budget only collects the young generation, then one
+	//with plenty of budget collects the old objects too.
+	runIncrementalGarbageCollection(0);
+	CHECK_EQ(g_num_test_collectibles, 2);
+	CHECK_EQ(young->ref->refcount(), 1);
+	CHECK_EQ(young->value["a"], variant(1));
+
+	runIncrementalGarbageCollection(1000000);
+	CHECK_EQ(g_num_test_collectibles, 2);
+	CHECK_EQ(young->ref->refcount(), 1);
+	CHECK_EQ(young->value["a"], variant(1));
+
+	young.reset();
+	CHECK_EQ(g_num_test_collectibles, 0);
+}
@@ -22,10 +22,17 @@ public:
 
 	friend class GarbageCollectorImpl;
 	friend class GarbageCollectorAnalyzer;
+	friend class GarbageCollectorGenerations;
 private:
 	void insertAtHead();
+	void unlink();
 	GarbageCollectible* next_;
 	GarbageCollectible* prev_;
+
+	//objects start out young and are promoted to the old generation once
+	//they have survived a few collections of the young generation.
+	bool old_generation_;
+	unsigned char collections_survived_;
 };
 
 class GarbageCollector
@@ -43,5 +50,32 @@ private:
 	virtual void surrenderPtrInternal(boost::intrusive_ptr<GarbageCollectible>* ptr, const char* description) = 0;
 };
 
+struct GarbageCollectionStats
+{
+	GarbageCollectionStats();
+
+	int cycles;
+
+	//figures for the most recent pass.
+	int pause_us;
+	int scanned;
+	int reclaimed;
+
+	int max_pause_us;
+	int total_reclaimed;
+
+	int young_objects;
+	int old_objects;
+};
+
 void runGarbageCollection();
 void runGarbageCollectionDebug(const char* fname);
+
+//Runs a bounded collection step, intended to be called once per frame. The
+//young generation is collected every step, then a window of the old
+//generation sized to fit what remains of budget_us microseconds. Garbage
+//cycles which span more than one window of old objects are left for a full
+//runGarbageCollection().
+void runIncrementalGarbageCollection(int budget_us);
+
+const GarbageCollectionStats& getGarbageCollectionStats();
@@ -57,6 +57,9 @@ namespace game_logic
 
 	namespace 
 	{
+		//the version of the latest write to a FormulaObject's variables.
+		int g_formula_object_version = 0;
+
 		variant flatten_list_of_maps(variant v) {
 			if(v.is_list() && v.num_elements() >= 1) {
 				variant result = flatten_list_of_maps(v[0]);
@@ -499,6 +502,7 @@ std::map<std::string, std::string>& class_path_map()
 		bool isA(const std::string& name) const;
 
 		int getNstateSlots() const { return nstate_slots_; }
+		int slotLayoutId() const { return slot_layout_id_; }
 
 		void build_nested_classes();
 		void run_unit_tests();
@@ -524,6 +528,7 @@ std::map<std::string, std::string>& class_path_map()
 		variant nested_classes_;
 
 		int nstate_slots_;
+		int slot_layout_id_;
 	};
 
 	bool is_class_derived_from(const std::string& derived, const std::string& base)
@@ -548,7 +553,7 @@ std::map<std::string, std::string>& class_path_map()
 	}
 
 	FormulaClass::FormulaClass(const std::string& class_name, const variant& node)
-	  : name_(class_name), nstate_slots_(0)
+	  : name_(class_name), nstate_slots_(0), slot_layout_id_(next_slot_layout_id())
 	{
 		variant bases_v = node["bases"];
 		if(bases_v.is_null() == false) {
@@ -892,6 +897,7 @@ std::map<std::string, std::string>& class_path_map()
 
 		for(auto& i : mapping) {
 			*i.second = *i.first;
+			i.second->markAllModified();
 		}
 
 		for(auto& i : dst) {
@@ -906,6 +912,27 @@ std::map<std::string, std::string>& class_path_map()
 		}
 	}
 
+namespace
+{
+	//encodes the deltas and new objects making up a diff in the form
+	//applyDiff() expects.
+	variant pack_diff(std::vector<variant>& deltas, std::vector<variant>& new_objects)
+	{
+		variant_builder builder;
+		builder.add("deltas", variant(&deltas));
+		builder.add("objects", variant(&new_objects));
+
+		std::string res_doc = builder.build().write_json();
+		std::vector<char> data(res_doc.begin(), res_doc.end());
+		std::vector<char> compressed = base64::b64encode(zip::compress(data));
+
+		variant_builder result;
+		result.add("delta", std::string(compressed.begin(), compressed.end()));
+		result.add("size", static_cast<int>(res_doc.size()));
+		return result.build();
+	}
+}
+
 variant FormulaObject::generateDiff(variant before, variant b)
 {
 	variant a = deepClone(before);
@@ -977,19 +1004,71 @@ variant FormulaObject::generateDiff(variant before, variant b)
 		}
 	}
 
+	return pack_diff(deltas, new_objects);
+}
+
+int FormulaObject::currentVersion()
+{
+	return g_formula_object_version;
+}
 
-	variant_builder builder;
-	builder.add("deltas", variant(&deltas));
-	builder.add("objects", variant(&new_objects));
+int FormulaObject::advanceVersion()
+{
+	return ++g_formula_object_version;
+}
+
+variant FormulaObject::generateDiffSince(variant before, int version, variant b)
+{
+	std::map<boost::uuids::uuid, FormulaObject*> src, dst;
+	visitVariants(before, [&src](variant v) {
+		FormulaObject* obj = v.try_convert<FormulaObject>();
+		if(obj) {
+			src[obj->id_] = obj;
+		}});
+
+	visitVariants(b, [&dst](variant v) {
+		FormulaObject* obj = v.try_convert<FormulaObject>();
+		if(obj) {
+			dst[obj->id_] = obj;
+		}});
+
+	std::vector<variant> deltas, new_objects;
+	for(auto i = dst.begin(); i != dst.end(); ++i) {
+		const FormulaObject& obj = *i->second;
+		auto j = src.find(i->first);
+		if(j == src.end()) {
+			new_objects.push_back(obj.serializeToWml());
+			continue;
+		}
+
+		const FormulaObject& old_obj = *j->second;
+
+		std::map<variant, variant> node_delta;
+		for(int n = 0; n != obj.variable_versions_.size(); ++n) {
+			if(obj.variable_versions_[n] <= version) {
+				continue;
+			}
+
+			if(n < static_cast<int>(old_obj.variables_.size()) && old_obj.variables_[n] == obj.variables_[n]) {
+				//written, but with the value it already had.
+				continue;
+			}
+
+			for(const PropertyEntry& e : obj.class_->slots()) {
+				if(e.variable_slot == n) {
+					node_delta[e.name_variant] = obj.variables_[n];
+					break;
+				}
+			}
+		}
 
-	std::string res_doc = builder.build().write_json();
-	std::vector<char> data(res_doc.begin(), res_doc.end());
-	std::vector<char> compressed = base64::b64encode(zip::compress(data));
+		if(node_delta.empty() == false) {
+			node_delta[variant("_uuid")] = variant(write_uuid(obj.id_));
+			deltas.push_back(variant(&node_delta));
+		}
+	}
 
-	variant_builder result;
-	result.add("delta", std::string(compressed.begin(), compressed.end()));
-	result.add("size", static_cast<int>(res_doc.size()));
-	return result.build();
+	return pack_diff(deltas, new_objects);
 }
 
 void FormulaObject::applyDiff(variant delta)
@@ -1046,7 +1125,9 @@ void FormulaObject::applyDiff(variant delta)
 			auto prop_itor = obj_itor->second->class_->properties().find(attr);
 			ASSERT_LOG(prop_itor != obj_itor->second->class_->properties().end(), "Unknown property '" << attr << "' in delta: " << d.write_json());
 
-			obj_itor->second->variables_[obj_itor->second->class_->slots()[prop_itor->second].variable_slot] = p.second;
+			const int variable_slot = obj_itor->second->class_->slots()[prop_itor->second].variable_slot;
+			obj_itor->second->variables_[variable_slot] = p.second;
+			obj_itor->second->markModified(variable_slot);
 		}
 	}
 }
@@ -1396,6 +1477,22 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 		}
 	}
 
+	int FormulaObject::getSlotLayoutId() const
+	{
+		return class_->slotLayoutId();
+	}
+
+	int FormulaObject::getSlotForKey(const std::string& key) const
+	{
+		//the builtin keys are rare enough to leave to getValue().
+		std::map<std::string, int>::const_iterator itor = class_->properties().find(key);
+		if(itor == class_->properties().end() || key == "_data" || key == "value" || key == "self" || key == "me" || key == "_class" || key == "lib") {
+			return -1;
+		}
+
+		return itor->second + NUM_BASE_FIELDS;
+	}
+
 	variant FormulaObject::getValueBySlot(int slot) const
 	{
 		switch(slot) {
@@ -1440,6 +1537,7 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 	{
 		if(private_data_ != -1 && key == "_data") {
 			variables_[private_data_] = value;
+			markModified(private_data_);
 			return;
 		}
 
@@ -1457,6 +1555,7 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 			case FIELD_PRIVATE:
 				ASSERT_NE(private_data_, -1);
 				variables_[private_data_] = value;
+				markModified(private_data_);
 				return;
 			default:
 				ASSERT_LOG(false, "TRIED TO SET ILLEGAL KEY IN CLASS: " << BaseFields[slot]);
@@ -1480,6 +1579,7 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 			executeCommand(entry.setter->execute(*this));
 		} else if(entry.variable_slot != -1) {
 			variables_[entry.variable_slot] = value;
+			markModified(entry.variable_slot);
 		} else {
 			ASSERT_LOG(false, "ILLEGAL WRITE PROPERTY ACCESS OF NON-WRITABLE VARIABLE " << entry.name << " IN CLASS " << class_->name());
 		}
@@ -1508,6 +1608,20 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 		}
 	}
 
+	void FormulaObject::markModified(int variable_slot)
+	{
+		if(variable_versions_.size() <= static_cast<unsigned>(variable_slot)) {
+			variable_versions_.resize(variables_.size());
+		}
+
+		variable_versions_[variable_slot] = ++g_formula_object_version;
+	}
+
+	void FormulaObject::markAllModified()
+	{
+		variable_versions_.assign(variables_.size(), ++g_formula_object_version);
+	}
+
 	void FormulaObject::validate() const
 	{
 	#ifndef NO_FFL_TYPE_SAFETY_CHECKS
@@ -1718,3 +1832,41 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 		return g_library_obj;
 	}
 }
+
+//a TBS game's delta from the state it last sent must carry writes made into
+//a map held by an object, as set(doc.some_map.key, value) does. The game
+//counts such writes made by its handlers and uses the full diff for them.
+UNIT_TEST(formula_object_diff_in_place_map_write)
+{
+	using namespace game_logic;
+
+	class_node_map["diff_since_test_doc"] = json::parse("{properties: {some_map: {type: '{string -> int}', default: {key: 1}}}}");
+
+	boost::intrusive_ptr<FormulaObject> doc = FormulaObject::create("diff_since_test_doc", variant());
+	variant doc_v(doc.get());
+
+	variant before = FormulaObject::deepClone(doc_v);
+
+	variant some_map = doc->queryValue("some_map");
+	int mutations = 0;
+	{
+		const InPlaceMutationScope scope(&mutations);
+		some_map.add_attr_mutation(variant("key"), variant(2));
+	}
+
+	CHECK_EQ(mutations, 1);
+
+	//writes outside the scope belong to someone else.
+	variant other_map = json::parse("{a: 1}");
+	other_map.add_attr_mutation(variant("a"), variant(2));
+	CHECK_EQ(mutations, 1);
+
+	variant delta = FormulaObject::generateDiff(before, doc_v);
+	const std::string& data_str = delta["delta"].as_string();
+	std::vector<char> data_buf(data_str.begin(), data_str.end());
+	std::vector<char> data = zip::decompress_known_size(base64::b64decode(data_buf), delta["size"].as_int());
+	variant diff = json::parse(std::string(data.begin(), data.end()));
+
+	CHECK_EQ(diff["deltas"].num_elements(), 1);
+	CHECK_EQ(diff["deltas"][0]["some_map"]["key"], variant(2));
+}
@@ -56,6 +56,25 @@ namespace game_logic
 		static variant generateDiff(variant a, variant b);
 		void applyDiff(variant delta);
 
+		//every write to a variable of a FormulaObject is stamped with a
+		//version number which increases with each write. This returns the
+		//version of the latest write.
+		static int currentVersion();
+
+		//moves the version on without writing a variable, and returns the
+		//new version. For owners of a document which have seen it change
+		//in a way the variable versions don't show, such as a map or list
+		//changed in place (see InPlaceMutationScope).
+		static int advanceVersion();
+
+		//generates a delta equivalent to generateDiff(before, b), where
+		//'before' is a deep clone of b taken when currentVersion() returned
+		//'version'. Only the variables written since then are examined, so
+		//nothing has to be cloned or compared in full. Maps and lists
+		//changed in place aren't seen: if b may have had such a change
+		//since then, use generateDiff() instead.
+		static variant generateDiffSince(variant before, int version, variant b);
+
 
 		static void reloadClasses();
 		static void loadAllClasses();
@@ -91,8 +110,14 @@ namespace game_logic
 		void setValue(const std::string& key, const variant& value);
 		void setValueBySlot(int slot, const variant& value);
 
+		int getSlotLayoutId() const;
+		int getSlotForKey(const std::string& key) const;
+
 		void getInputs(std::vector<FormulaInput>* inputs) const;
 
+		void markModified(int variable_slot);
+		void markAllModified();
+
 		boost::uuids::uuid id_;
 
 		bool new_in_update_;
@@ -105,6 +130,9 @@ namespace game_logic
 
 		std::vector<variant> variables_;
 
+		//the version at which each variable was last written.
+		std::vector<int> variable_versions_;
+
 		boost::intrusive_ptr<const FormulaClass> class_;
 
 		variant tmp_value_;
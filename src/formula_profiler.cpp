@@ -21,6 +21,13 @@
 	   distribution.
 */
 
+#include "formula_profiler.hpp"
+
+namespace formula_profiler
+{
+	InlineCacheCounts inline_cache_counts;
+}
+
 #ifndef DISABLE_FORMULA_PROFILER
 
 #include <SDL_thread.h>
@@ -393,6 +400,10 @@ namespace formula_profiler
 			s << samples[n].second << " " << samples[n].first << " ";
 		}
 
+		static InlineCacheCounts last_inline_cache_counts;
+		s << "INLINE CACHE: " << (inline_cache_counts.hits - last_inline_cache_counts.hits) << " HITS " << (inline_cache_counts.misses - last_inline_cache_counts.misses) << " MISSES " << (inline_cache_counts.uncacheable - last_inline_cache_counts.uncacheable) << " UNCACHEABLE ";
+		last_inline_cache_counts = inline_cache_counts;
+
 		last_empty_samples = empty_samples;
 		last_num_samples = num_samples;
 
@@ -25,6 +25,23 @@
 
 #include <string>
 
+namespace formula_profiler
+{
+	//counts of member lookups by '.' expressions which found the member
+	//in the slot they remembered, those which had to look the slot up,
+	//and those on a known layout whose member isn't read from a slot and
+	//so still went through a lookup by name. These are kept whether or
+	//not the profiler is built.
+	struct InlineCacheCounts
+	{
+		unsigned hits;
+		unsigned misses;
+		unsigned uncacheable;
+	};
+
+	extern InlineCacheCounts inline_cache_counts;
+}
+
 #ifdef DISABLE_FORMULA_PROFILER
 
 namespace formula_profiler
@@ -25,6 +25,7 @@
 
 #include "formula.hpp"
 #include "formula_callable.hpp"
+#include "formula_vm.hpp"
 #include "unit_test.hpp"
 
 namespace 
@@ -155,3 +156,26 @@ BENCHMARK_ARG_CALL(formula, array_str, "['stand', 'walk', 'run', 'jump']");
 BENCHMARK_ARG_CALL(formula, string, "'blah'");
 BENCHMARK_ARG_CALL(formula, null_function, "null()");
 BENCHMARK_ARG_CALL(formula, if_function, "if(4 > 5, 7, 8)");
+
+BENCHMARK_ARG(formula_vm, const std::string& fm)
+{
+	static MockParty p;
+	const formula_vm::EnabledScope vm_scope;
+	const variant formula_str(fm);
+	Formula f(formula_str);
+	BENCHMARK_LOOP {
+		f.execute(p);
+	}
+}
+
+BENCHMARK_ARG_CALL(formula_vm, integer_vm, "0");
+BENCHMARK_ARG_CALL(formula_vm, where_vm, "x where x = 5");
+BENCHMARK_ARG_CALL(formula_vm, add_vm, "5 + 4");
+BENCHMARK_ARG_CALL(formula_vm, arithmetic_vm, "(5 + 4)*17 + 12*9 - 5/2");
+BENCHMARK_ARG_CALL(formula_vm, read_input_vm, "char");
+BENCHMARK_ARG_CALL(formula_vm, read_input_sub_vm, "char.strength");
+BENCHMARK_ARG_CALL(formula_vm, array_vm, "[4, 5, 8, 12, 17, 0, 19]");
+BENCHMARK_ARG_CALL(formula_vm, array_str_vm, "['stand', 'walk', 'run', 'jump']");
+BENCHMARK_ARG_CALL(formula_vm, string_vm, "'blah'");
+BENCHMARK_ARG_CALL(formula_vm, null_function_vm, "null()");
+BENCHMARK_ARG_CALL(formula_vm, if_function_vm, "if(4 > 5, 7, 8)");
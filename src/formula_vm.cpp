@@ -0,0 +1,425 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <sstream>
+
+#include "asserts.hpp"
+#include "formula_callable.hpp"
+#include "formula_callable_definition.hpp"
+#include "formula_vm.hpp"
+#include "preferences.hpp"
+
+PREF_BOOL(ffl_vm, false, "Compile FFL formulas to bytecode which is run by a register-based virtual machine");
+
+namespace formula_vm
+{
+	using namespace game_logic;
+
+	namespace
+	{
+		//register files up to this size live on the stack.
+		const int SmallRegisterFile = 16;
+
+		//thrown when a program is too large to be encoded.
+		struct CompileFailedException {};
+
+		const char* op_name(OP op)
+		{
+			switch(op) {
+			case OP::LOAD_SLOT: return "LOAD_SLOT";
+			case OP::LOAD_ID: return "LOAD_ID";
+			case OP::LOAD_MEMBER_SLOT: return "LOAD_MEMBER_SLOT";
+			case OP::EVAL: return "EVAL";
+			case OP::MOVE: return "MOVE";
+			case OP::ADD: return "ADD";
+			case OP::SUB: return "SUB";
+			case OP::MUL: return "MUL";
+			case OP::DIV: return "DIV";
+			case OP::MOD: return "MOD";
+			case OP::POW: return "POW";
+			case OP::EQ: return "EQ";
+			case OP::NEQ: return "NEQ";
+			case OP::LT: return "LT";
+			case OP::GT: return "GT";
+			case OP::LTE: return "LTE";
+			case OP::GTE: return "GTE";
+			case OP::IN: return "IN";
+			case OP::NOT_IN: return "NOT_IN";
+			case OP::NOT: return "NOT";
+			case OP::NEG: return "NEG";
+			case OP::JMP: return "JMP";
+			case OP::JMP_IF_FALSE: return "JMP_IF_FALSE";
+			case OP::JMP_IF_TRUE: return "JMP_IF_TRUE";
+			case OP::LIST: return "LIST";
+			case OP::RETURN: return "RETURN";
+			}
+
+			return "UNKNOWN";
+		}
+
+		//an expression which runs the bytecode compiled from another
+		//expression. Everything other than execution is answered by the
+		//original expression.
+		class VMExpression : public FormulaExpression
+		{
+		public:
+			VMExpression(ExpressionPtr original, ConstProgramPtr program)
+			  : FormulaExpression("_vm"), original_(original), program_(program)
+			{
+				copyDebugInfoFrom(*original);
+			}
+
+			bool isIdentifier(std::string* id) const override {
+				return original_->isIdentifier(id);
+			}
+
+			bool isLiteral(variant& result) const override {
+				return original_->isLiteral(result);
+			}
+
+			bool canReduceToVariant(variant& v) const override {
+				return original_->canReduceToVariant(v);
+			}
+
+			ConstFormulaCallableDefinitionPtr getTypeDefinition() const override {
+				return original_->getTypeDefinition();
+			}
+		private:
+			variant execute(const FormulaCallable& variables) const override {
+				return program_->execute(variables);
+			}
+
+			variant executeMember(const FormulaCallable& variables, std::string& id, variant* variant_id) const override {
+				return original_->evaluateWithMember(variables, id, variant_id);
+			}
+
+			variant_type_ptr getVariantType() const override {
+				return original_->queryVariantType();
+			}
+
+			variant_type_ptr getMutableType() const override {
+				return original_->queryMutableType();
+			}
+
+			ConstFormulaCallableDefinitionPtr getModifiedDefinitionBasedOnResult(bool result, ConstFormulaCallableDefinitionPtr current_def, variant_type_ptr expression_is_this_type) const override {
+				return original_->queryModifiedDefinitionBasedOnResult(result, current_def, expression_is_this_type);
+			}
+
+			std::vector<ConstExpressionPtr> getChildren() const override {
+				std::vector<ConstExpressionPtr> result;
+				result.push_back(original_);
+				return result;
+			}
+
+			ExpressionPtr original_;
+			ConstProgramPtr program_;
+		};
+	}
+
+	Program::Program() : num_registers_(0)
+	{
+	}
+
+	void Program::reportError(int pc, const std::string& msg) const
+	{
+		ASSERT_LOG(false, msg << " " << sources_[pc]->debugPinpointLocation());
+	}
+
+	variant Program::execute(const FormulaCallable& variables) const
+	{
+		variant small_regs[SmallRegisterFile];
+		std::vector<variant> large_regs;
+		variant* regs = small_regs;
+		if(num_registers_ > SmallRegisterFile) {
+			large_regs.resize(num_registers_);
+			regs = &large_regs[0];
+		}
+
+		const Instruction* code = &code_[0];
+		for(const Instruction* i = code; ; ++i) {
+			switch(i->op) {
+			case OP::LOAD_SLOT:
+				regs[i->dst] = variables.queryValueBySlot(i->a);
+				break;
+			case OP::LOAD_ID:
+				regs[i->dst] = variables.queryValue(names_[i->a]);
+				break;
+			case OP::LOAD_MEMBER_SLOT: {
+				const variant& obj = operand(regs, i->a);
+				if(!obj.is_callable()) {
+					reportError(static_cast<int>(i - code), obj.is_null() ? "CALL OF DOT OPERATOR ON nullptr VALUE" : "CALL OF DOT OPERATOR ON ILLEGAL VALUE: " + obj.write_json());
+				}
+
+				regs[i->dst] = obj.as_callable()->queryValueBySlot(i->b);
+				break;
+			}
+			case OP::EVAL:
+				regs[i->dst] = fallbacks_[i->a]->evaluate(variables);
+				break;
+			case OP::MOVE:
+				regs[i->dst] = operand(regs, i->a);
+				break;
+			case OP::ADD:
+				regs[i->dst] = operand(regs, i->a) + operand(regs, i->b);
+				break;
+			case OP::SUB:
+				regs[i->dst] = operand(regs, i->a) - operand(regs, i->b);
+				break;
+			case OP::MUL:
+				regs[i->dst] = operand(regs, i->a) * operand(regs, i->b);
+				break;
+			case OP::DIV: {
+				//same guard against division by zero as the tree walker.
+				const variant& right = operand(regs, i->b);
+				if(right == variant(0)) {
+					regs[i->dst] = operand(regs, i->a) / variant(decimal::epsilon());
+				} else {
+					regs[i->dst] = operand(regs, i->a) / right;
+				}
+				break;
+			}
+			case OP::MOD:
+				regs[i->dst] = operand(regs, i->a) % operand(regs, i->b);
+				break;
+			case OP::POW:
+				regs[i->dst] = operand(regs, i->a) ^ operand(regs, i->b);
+				break;
+			case OP::EQ:
+				regs[i->dst] = variant::from_bool(operand(regs, i->a) == operand(regs, i->b));
+				break;
+			case OP::NEQ:
+				regs[i->dst] = variant::from_bool(operand(regs, i->a) != operand(regs, i->b));
+				break;
+			case OP::LT:
+				regs[i->dst] = variant::from_bool(operand(regs, i->a) < operand(regs, i->b));
+				break;
+			case OP::GT:
+				regs[i->dst] = variant::from_bool(operand(regs, i->a) > operand(regs, i->b));
+				break;
+			case OP::LTE:
+				regs[i->dst] = variant::from_bool(operand(regs, i->a) <= operand(regs, i->b));
+				break;
+			case OP::GTE:
+				regs[i->dst] = variant::from_bool(operand(regs, i->a) >= operand(regs, i->b));
+				break;
+			case OP::IN:
+			case OP::NOT_IN: {
+				const variant& left = operand(regs, i->a);
+				const variant& right = operand(regs, i->b);
+				bool found = false;
+				if(right.is_list()) {
+					for(int n = 0; n != right.num_elements(); ++n) {
+						if(left == right[n]) {
+							found = true;
+							break;
+						}
+					}
+				} else if(right.is_map()) {
+					found = right.has_key(left);
+				} else {
+					reportError(static_cast<int>(i - code), "ILLEGAL OPERAND TO 'in': " + right.write_json());
+				}
+
+				regs[i->dst] = variant::from_bool(i->op == OP::IN ? found : !found);
+				break;
+			}
+			case OP::NOT:
+				regs[i->dst] = variant::from_bool(!operand(regs, i->a).as_bool());
+				break;
+			case OP::NEG:
+				regs[i->dst] = -operand(regs, i->a);
+				break;
+			case OP::JMP:
+				i = code + i->a - 1;
+				break;
+			case OP::JMP_IF_FALSE:
+				if(!operand(regs, i->a).as_bool()) {
+					i = code + i->b - 1;
+				}
+				break;
+			case OP::JMP_IF_TRUE:
+				if(operand(regs, i->a).as_bool()) {
+					i = code + i->b - 1;
+				}
+				break;
+			case OP::LIST: {
+				std::vector<variant> items(regs + i->a, regs + i->a + i->b);
+				regs[i->dst] = variant(&items);
+				break;
+			}
+			case OP::RETURN:
+				return operand(regs, i->a);
+			}
+		}
+	}
+
+	std::string Program::disassemble() const
+	{
+		std::ostringstream s;
+		for(int n = 0; n != code_.size(); ++n) {
+			const Instruction& i = code_[n];
+			s << n << ": " << op_name(i.op) << " " << i.dst << " " << i.a << " " << i.b;
+			if(i.op == OP::LOAD_ID) {
+				s << " ; " << names_[i.a];
+			} else if(i.op == OP::EVAL) {
+				s << " ; " << fallbacks_[i.a]->str();
+			}
+			s << "\n";
+		}
+
+		return s.str();
+	}
+
+	Builder::Builder() : program_(new Program), next_register_(0)
+	{
+	}
+
+	int Builder::constant(const variant& v)
+	{
+		if(program_->constants_.size() >= ConstantBit) {
+			throw CompileFailedException();
+		}
+
+		program_->constants_.push_back(v);
+		return static_cast<int>(program_->constants_.size() - 1) | ConstantBit;
+	}
+
+	int Builder::allocRegister()
+	{
+		if(next_register_ >= ConstantBit-1) {
+			throw CompileFailedException();
+		}
+
+		const int result = next_register_++;
+		if(next_register_ > program_->num_registers_) {
+			program_->num_registers_ = next_register_;
+		}
+
+		return result;
+	}
+
+	void Builder::releaseRegisters(int first_free)
+	{
+		if(first_free < next_register_) {
+			next_register_ = first_free;
+		}
+	}
+
+	void Builder::moveTo(const FormulaExpression& src, int operand, int dst)
+	{
+		if(operand != dst) {
+			emit(src, OP::MOVE, dst, operand);
+		}
+	}
+
+	int Builder::emit(const FormulaExpression& src, OP op, int dst, int a, int b)
+	{
+		if(program_->code_.size() >= 0xFFFF || dst > 0xFFFF || a > 0xFFFF || b > 0xFFFF) {
+			throw CompileFailedException();
+		}
+
+		const Instruction i = { op, static_cast<unsigned short>(dst), static_cast<unsigned short>(a), static_cast<unsigned short>(b) };
+		program_->code_.push_back(i);
+		program_->sources_.push_back(&src);
+		return label() - 1;
+	}
+
+	int Builder::emitFallback(const FormulaExpression& expr)
+	{
+		program_->fallbacks_.push_back(ConstExpressionPtr(&expr));
+		const int dst = allocRegister();
+		emit(expr, OP::EVAL, dst, static_cast<int>(program_->fallbacks_.size() - 1));
+		return dst;
+	}
+
+	int Builder::emitLoadId(const FormulaExpression& src, const std::string& id)
+	{
+		std::vector<std::string>& names = program_->names_;
+		auto itor = std::find(names.begin(), names.end(), id);
+		if(itor == names.end()) {
+			names.push_back(id);
+			itor = names.end() - 1;
+		}
+
+		const int dst = allocRegister();
+		emit(src, OP::LOAD_ID, dst, static_cast<int>(itor - names.begin()));
+		return dst;
+	}
+
+	void Builder::patchJump(int instruction, int target)
+	{
+		Instruction& i = program_->code_[instruction];
+		if(i.op == OP::JMP) {
+			i.a = static_cast<unsigned short>(target);
+		} else {
+			i.b = static_cast<unsigned short>(target);
+		}
+	}
+
+	ProgramPtr Builder::build(const FormulaExpression& src, int result)
+	{
+		emit(src, OP::RETURN, 0, result);
+		return program_;
+	}
+
+	ExpressionPtr compile(ExpressionPtr expr)
+	{
+		variant literal;
+		if(!expr || expr->canReduceToVariant(literal)) {
+			return expr;
+		}
+
+		ProgramPtr program;
+		try {
+			Builder builder;
+			const int result = expr->emitVM(builder);
+			program = builder.build(*expr, result);
+		} catch(CompileFailedException&) {
+			return expr;
+		}
+
+		//a program that does nothing but hand the whole expression back to
+		//the tree walker would only add overhead.
+		if(program->numInstructions() == 2 && program->numFallbacks() == 1) {
+			return expr;
+		}
+
+		return ExpressionPtr(new VMExpression(expr, program));
+	}
+
+	bool is_enabled()
+	{
+		return g_ffl_vm;
+	}
+
+	EnabledScope::EnabledScope(bool enabled) : old_value(g_ffl_vm)
+	{
+		g_ffl_vm = enabled;
+	}
+
+	EnabledScope::~EnabledScope()
+	{
+		g_ffl_vm = old_value;
+	}
+}
@@ -0,0 +1,153 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "formula_function.hpp"
+#include "reference_counted_object.hpp"
+#include "variant.hpp"
+
+//A compact bytecode representation of FFL expressions, executed by a
+//register-based interpreter. Formulas are lowered into bytecode after
+//they have been optimized. Any expression which doesn't know how to lower
+//itself is embedded in the bytecode as a call back into the tree walker,
+//so every formula can be compiled, it just runs faster the more of it
+//can be lowered.
+namespace formula_vm
+{
+	enum class OP : unsigned char {
+		LOAD_SLOT,         //dst = slot a of the variables
+		LOAD_ID,           //dst = value of the variable named names[a]
+		LOAD_MEMBER_SLOT,  //dst = slot b of the callable in a
+		EVAL,              //dst = fallback expression a run by the tree walker
+		MOVE,              //dst = a
+		ADD, SUB, MUL, DIV, MOD, POW,
+		EQ, NEQ, LT, GT, LTE, GTE,
+		IN, NOT_IN,        //dst = a op b
+		NOT, NEG,          //dst = op a
+		JMP,               //continue at instruction a
+		JMP_IF_FALSE,      //continue at instruction b if a is false
+		JMP_IF_TRUE,       //continue at instruction b if a is true
+		LIST,              //dst = [registers a .. a+b-1]
+		RETURN,            //result is a
+	};
+
+	//Operands of instructions refer to registers, unless they have
+	//ConstantBit set, in which case they index the constant table.
+	static const int ConstantBit = 0x8000;
+
+	struct Instruction
+	{
+		OP op;
+		unsigned short dst, a, b;
+	};
+
+	class Program : public reference_counted_object
+	{
+	public:
+		Program();
+
+		variant execute(const game_logic::FormulaCallable& variables) const;
+
+		int numInstructions() const { return static_cast<int>(code_.size()); }
+		int numRegisters() const { return num_registers_; }
+		int numFallbacks() const { return static_cast<int>(fallbacks_.size()); }
+
+		std::string disassemble() const;
+	private:
+		friend class Builder;
+
+		const variant& operand(const variant* regs, int n) const {
+			return (n&ConstantBit) ? constants_[n&~ConstantBit] : regs[n];
+		}
+
+		void reportError(int pc, const std::string& msg) const;
+
+		std::vector<Instruction> code_;
+
+		//the expression each instruction was generated from, used for
+		//error reporting.
+		std::vector<const game_logic::FormulaExpression*> sources_;
+
+		std::vector<variant> constants_;
+		std::vector<std::string> names_;
+		std::vector<game_logic::ConstExpressionPtr> fallbacks_;
+		int num_registers_;
+	};
+
+	typedef boost::intrusive_ptr<Program> ProgramPtr;
+	typedef boost::intrusive_ptr<const Program> ConstProgramPtr;
+
+	//Used by FormulaExpression::emitVM() to generate code. Values are
+	//referred to by operands as described above; expressions return the
+	//operand holding their result.
+	class Builder
+	{
+	public:
+		Builder();
+
+		int constant(const variant& v);
+		int allocRegister();
+
+		//registers are allocated like a stack. This frees every register
+		//from 'first_free' upwards.
+		void releaseRegisters(int first_free);
+		int nextRegister() const { return next_register_; }
+
+		//ensures the value in 'operand' ends up in register 'dst'.
+		void moveTo(const game_logic::FormulaExpression& src, int operand, int dst);
+
+		//emits an instruction, returning its position.
+		int emit(const game_logic::FormulaExpression& src, OP op, int dst, int a=0, int b=0);
+		int emitFallback(const game_logic::FormulaExpression& expr);
+		int emitLoadId(const game_logic::FormulaExpression& src, const std::string& id);
+
+		//the position the next instruction will be emitted at.
+		int label() const { return static_cast<int>(program_->code_.size()); }
+		void patchJump(int instruction, int target);
+
+		ProgramPtr build(const game_logic::FormulaExpression& src, int result);
+	private:
+		ProgramPtr program_;
+		int next_register_;
+	};
+
+	//returns an expression which runs 'expr' as bytecode, or 'expr' itself
+	//if compiling it wouldn't gain anything.
+	game_logic::ExpressionPtr compile(game_logic::ExpressionPtr expr);
+
+	//whether newly parsed formulas get compiled. Controlled by the ffl_vm
+	//preference.
+	bool is_enabled();
+
+	struct EnabledScope
+	{
+		explicit EnabledScope(bool enabled=true);
+		~EnabledScope();
+
+		bool old_value;
+	};
+}
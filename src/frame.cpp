@@ -29,6 +29,7 @@
 
 #include "DisplayDevice.hpp"
 #include "TextureUtils.hpp"
+#include "SpriteBatch.hpp"
 #include "WindowManager.hpp"
 
 #include "asserts.hpp"
@@ -47,6 +48,7 @@
 #include "variant_utils.hpp"
 
 PREF_FLOAT(global_frame_scale, 2.0, "Sets the global frame scales for all frames in all animations");
+PREF_BOOL(sprite_batching, true, "Merge consecutive frame draws which share a texture and shader into a single draw call");
 
 namespace 
 {
@@ -58,6 +60,28 @@ namespace
 	static unsigned int current_palette_mask = 0;
 
 	static const glm::vec3 z_axis(0, 0, 1.0f);
+
+	//adds the triangle strip to the current sprite batch, returning false
+	//if the blittable has to be drawn by itself.
+	bool add_to_sprite_batch(const KRE::Blittable& blit, const std::vector<KRE::vertex_texcoord>& strip)
+	{
+		return g_sprite_batching && KRE::SpriteBatch::add(blit, strip);
+	}
+
+	void draw_blittable(KRE::Blittable& blit)
+	{
+		auto wnd = KRE::WindowManager::getMainWindow();
+		if(g_sprite_batching) {
+			static std::vector<KRE::vertex_texcoord> vertices;
+			blit.getVertices(&vertices);
+			if(KRE::SpriteBatch::add(blit, vertices)) {
+				return;
+			}
+		}
+
+		blit.preRender(wnd);
+		wnd->render(&blit);
+	}
 }
 
 void Frame::buildPatterns(variant obj_variant)
@@ -633,15 +657,13 @@ void Frame::draw(graphics::AnuraShaderPtr shader, int x, int y, bool face_right,
 		blit_target_.setShader(shader->getShader());
 	}
 
-	auto wnd = KRE::WindowManager::getMainWindow();
 	blit_target_.setCentre(KRE::Blittable::Centre::MIDDLE);
 	blit_target_.setPosition(x + w/2, y + h/2);
 	blit_target_.setRotation(rotate, z_axis);
 	blit_target_.setDrawRect(rect(0, 0, w, h));
 	blit_target_.setMirrorHoriz(upside_down);
 	blit_target_.setMirrorVert(!face_right);
-	blit_target_.preRender(wnd);
-	wnd->render(&blit_target_);
+	draw_blittable(blit_target_);
 }
 
 void Frame::draw(graphics::AnuraShaderPtr shader, int x, int y, bool face_right, bool upside_down, int time, float rotate, float scale) const
@@ -667,7 +689,6 @@ void Frame::draw(graphics::AnuraShaderPtr shader, int x, int y, bool face_right,
 		blit_target_.setShader(shader->getShader());
 	}
 
-	auto wnd = KRE::WindowManager::getMainWindow();
 	blit_target_.setCentre(KRE::Blittable::Centre::MIDDLE);
 	blit_target_.setPosition(x + w/2, y + h/2);
 	blit_target_.setRotation(rotate, z_axis);
@@ -675,8 +696,7 @@ void Frame::draw(graphics::AnuraShaderPtr shader, int x, int y, bool face_right,
 	blit_target_.setDrawRect(rect(0, 0, w, h));
 	blit_target_.setMirrorHoriz(upside_down);
 	blit_target_.setMirrorVert(!face_right);
-	blit_target_.preRender(wnd);
-	wnd->render(&blit_target_);
+	draw_blittable(blit_target_);
 	blit_target_.setScale(1.0f, 1.0f);
 }
 
@@ -700,7 +720,6 @@ void Frame::draw(graphics::AnuraShaderPtr shader, int x, int y, const rect& area
 		blit_target_.setShader(shader->getShader());
 	}
 
-	auto wnd = KRE::WindowManager::getMainWindow();
 	blit_target_.setCentre(KRE::Blittable::Centre::MIDDLE);
 	blit_target_.setPosition(x + w/2, y + h/2);
 	blit_target_.setRotation(rotate, z_axis);
@@ -708,8 +727,7 @@ void Frame::draw(graphics::AnuraShaderPtr shader, int x, int y, const rect& area
 	blit_target_.getTexture()->setSourceRect(0, rect(src_rect.x() + x_adjust, src_rect.y() + y_adjust, src_rect.w() + x_adjust + w_adjust, src_rect.h() + y_adjust + h_adjust));
 	blit_target_.setMirrorHoriz(upside_down);
 	blit_target_.setMirrorVert(!face_right);
-	blit_target_.preRender(wnd);
-	wnd->render(&blit_target_);
+	draw_blittable(blit_target_);
 }
 
 
@@ -819,6 +837,10 @@ void Frame::drawCustom(graphics::AnuraShaderPtr shader, int x, int y, const std:
 
 	ASSERT_LOG(queue.size() > 4, "ILLEGAL CUSTOM BLIT: " << queue.size());
 
+	if(add_to_sprite_batch(blit, queue)) {
+		return;
+	}
+
 	auto wnd = KRE::WindowManager::getMainWindow();
 	blit.getAttributeSet().back()->setCount(queue.size());
 	blit.update(&queue);
@@ -863,8 +885,6 @@ void Frame::drawCustom(graphics::AnuraShaderPtr shader, int x, int y, const floa
 		uv += 2;
 	}
 
-	blit.getAttributeSet().back()->setCount(queue.size());
-	blit.update(&queue);
 	if(shader) {
 		shader->setDrawArea(rect(x, y, w, h));
 		shader->setSpriteArea(r);
@@ -874,6 +894,13 @@ void Frame::drawCustom(graphics::AnuraShaderPtr shader, int x, int y, const floa
 
 	blit.setMirrorHoriz(upside_down);
 	blit.setMirrorVert(!face_right);
+
+	if(!g_debug_custom_draw && add_to_sprite_batch(blit, queue)) {
+		return;
+	}
+
+	blit.getAttributeSet().back()->setCount(queue.size());
+	blit.update(&queue);
 	auto wnd = KRE::WindowManager::getMainWindow();
 	wnd->render(&blit);
 
@@ -0,0 +1,662 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <map>
+#include <stdint.h>
+#include <string.h>
+
+#include "asserts.hpp"
+#include "filesystem.hpp"
+#include "formula_constants.hpp"
+#include "json_cache.hpp"
+#include "md5.hpp"
+#include "module.hpp"
+#include "preferences.hpp"
+#include "unit_test.hpp"
+
+namespace json
+{
+	void DocumentDependencies::add(const DocumentDependencies& o)
+	{
+		files.insert(files.end(), o.files.begin(), o.files.end());
+		constants.insert(constants.end(), o.constants.begin(), o.constants.end());
+		cacheable = cacheable && o.cacheable;
+	}
+
+	namespace
+	{
+		//A variant is written as a table of the strings it uses, a table of
+		//the debug info of its nodes and then its nodes, in pre-order. Each
+		//node is a tag followed by its value. Integers are written as
+		//variable length 7-bit groups, signed ones zig-zag encoded.
+		enum BINARY_TAG { TAG_NULL, TAG_FALSE, TAG_TRUE, TAG_INT, TAG_DECIMAL, TAG_STRING, TAG_TRANSLATED_STRING, TAG_LIST, TAG_MAP };
+
+		void write_uint(std::string& out, uint64_t n)
+		{
+			while(n >= 0x80) {
+				out.push_back(static_cast<char>((n&0x7F) | 0x80));
+				n >>= 7;
+			}
+
+			out.push_back(static_cast<char>(n));
+		}
+
+		void write_int(std::string& out, int64_t n)
+		{
+			write_uint(out, (static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63));
+		}
+
+		class BinaryWriter
+		{
+		public:
+			BinaryWriter() : nnodes_(0), ndebug_entries_(0) {}
+
+			bool write(const variant& v) {
+				const int node = nnodes_++;
+
+				const variant::debug_info* info = v.get_debug_info();
+				if(info) {
+					write_uint(debug_, node);
+					write_uint(debug_, stringIndex(*info->filename));
+					write_int(debug_, info->line);
+					write_int(debug_, info->column);
+					write_int(debug_, info->end_line);
+					write_int(debug_, info->end_column);
+					++ndebug_entries_;
+				}
+
+				switch(v.type()) {
+				case variant::VARIANT_TYPE_NULL:
+					nodes_.push_back(TAG_NULL);
+					return true;
+				case variant::VARIANT_TYPE_BOOL:
+					nodes_.push_back(v.as_bool() ? TAG_TRUE : TAG_FALSE);
+					return true;
+				case variant::VARIANT_TYPE_INT:
+					nodes_.push_back(TAG_INT);
+					write_int(nodes_, v.as_int());
+					return true;
+				case variant::VARIANT_TYPE_DECIMAL:
+					nodes_.push_back(TAG_DECIMAL);
+					write_int(nodes_, v.as_decimal().value());
+					return true;
+				case variant::VARIANT_TYPE_STRING:
+					if(v.get_translated_from()) {
+						nodes_.push_back(TAG_TRANSLATED_STRING);
+						write_uint(nodes_, stringIndex(*v.get_translated_from()));
+					} else {
+						nodes_.push_back(TAG_STRING);
+						write_uint(nodes_, stringIndex(v.as_string()));
+					}
+					return true;
+				case variant::VARIANT_TYPE_LIST:
+					nodes_.push_back(TAG_LIST);
+					write_uint(nodes_, v.num_elements());
+					for(int n = 0; n != v.num_elements(); ++n) {
+						if(!write(v[n])) {
+							return false;
+						}
+					}
+					return true;
+				case variant::VARIANT_TYPE_MAP:
+					nodes_.push_back(TAG_MAP);
+					write_uint(nodes_, v.num_elements());
+					for(const auto& p : v.as_map()) {
+						if(!write(p.first) || !write(p.second)) {
+							return false;
+						}
+					}
+					return true;
+				default:
+					return false;
+				}
+			}
+
+			void output(std::string* out) const {
+				write_uint(*out, strings_.size());
+				for(const std::string* s : strings_) {
+					write_uint(*out, s->size());
+					*out += *s;
+				}
+
+				write_uint(*out, ndebug_entries_);
+				*out += debug_;
+				*out += nodes_;
+			}
+		private:
+			int stringIndex(const std::string& s) {
+				auto itor = string_indexes_.find(s);
+				if(itor == string_indexes_.end()) {
+					itor = string_indexes_.insert(std::make_pair(s, static_cast<int>(strings_.size()))).first;
+					strings_.push_back(&itor->first);
+				}
+
+				return itor->second;
+			}
+
+			std::map<std::string, int> string_indexes_;
+			std::vector<const std::string*> strings_;
+			std::string debug_, nodes_;
+			int nnodes_, ndebug_entries_;
+		};
+
+		class BinaryReader
+		{
+		public:
+			BinaryReader(const char* begin, const char* end)
+			  : p_(begin), end_(end), nnodes_(0), next_debug_(0), error_(false)
+			{}
+
+			bool read(variant* result) {
+				const uint64_t nstrings = readUInt();
+				for(uint64_t n = 0; n < nstrings && !error_; ++n) {
+					const uint64_t len = readUInt();
+					if(error_ || len > static_cast<uint64_t>(end_ - p_)) {
+						return false;
+					}
+
+					strings_.push_back(std::string(p_, p_ + len));
+					p_ += len;
+				}
+
+				const uint64_t ndebug = readUInt();
+				for(uint64_t n = 0; n < ndebug && !error_; ++n) {
+					DebugEntry entry;
+					entry.node = readUInt();
+					const std::string* fname = readString();
+					entry.info.filename = fname ? get_debug_filename(*fname) : nullptr;
+					entry.info.line = static_cast<int>(readInt());
+					entry.info.column = static_cast<int>(readInt());
+					entry.info.end_line = static_cast<int>(readInt());
+					entry.info.end_column = static_cast<int>(readInt());
+					debug_.push_back(entry);
+				}
+
+				if(error_) {
+					return false;
+				}
+
+				*result = readNode();
+				return !error_ && p_ == end_;
+			}
+		private:
+			struct DebugEntry {
+				uint64_t node;
+				variant::debug_info info;
+			};
+
+			uint64_t readUInt() {
+				uint64_t result = 0;
+				for(int shift = 0; shift < 64; shift += 7) {
+					if(p_ == end_) {
+						error_ = true;
+						return 0;
+					}
+
+					const unsigned char c = static_cast<unsigned char>(*p_++);
+					result |= static_cast<uint64_t>(c&0x7F) << shift;
+					if((c&0x80) == 0) {
+						return result;
+					}
+				}
+
+				error_ = true;
+				return 0;
+			}
+
+			int64_t readInt() {
+				const uint64_t n = readUInt();
+				return static_cast<int64_t>(n >> 1) ^ -static_cast<int64_t>(n&1);
+			}
+
+			const std::string* readString() {
+				const uint64_t n = readUInt();
+				if(n >= strings_.size()) {
+					error_ = true;
+					return nullptr;
+				}
+
+				return &strings_[static_cast<size_t>(n)];
+			}
+
+			variant readNode() {
+				//the debug info is in the order of the nodes, which are
+				//numbered in pre-order.
+				const variant::debug_info* info = nullptr;
+				if(next_debug_ != debug_.size() && debug_[next_debug_].node == nnodes_) {
+					info = &debug_[next_debug_++].info;
+				}
+
+				++nnodes_;
+				if(p_ == end_) {
+					error_ = true;
+					return variant();
+				}
+
+				variant result;
+				switch(*p_++) {
+				case TAG_NULL:
+					break;
+				case TAG_FALSE:
+					result = variant::from_bool(false);
+					break;
+				case TAG_TRUE:
+					result = variant::from_bool(true);
+					break;
+				case TAG_INT:
+					result = variant(static_cast<int>(readInt()));
+					break;
+				case TAG_DECIMAL:
+					result = variant(readInt(), variant::DECIMAL_VARIANT);
+					break;
+				case TAG_STRING: {
+					const std::string* s = readString();
+					if(s) {
+						result = variant(*s);
+					}
+					break;
+				}
+				case TAG_TRANSLATED_STRING: {
+					const std::string* s = readString();
+					if(s) {
+						result = variant::create_translated_string(*s);
+					}
+					break;
+				}
+				case TAG_LIST: {
+					const uint64_t n = readUInt();
+					if(n > static_cast<uint64_t>(end_ - p_)) {
+						error_ = true;
+						break;
+					}
+
+					std::vector<variant> items;
+					items.reserve(static_cast<size_t>(n));
+					for(uint64_t i = 0; i < n && !error_; ++i) {
+						items.push_back(readNode());
+					}
+
+					result = variant(&items);
+					break;
+				}
+				case TAG_MAP: {
+					const uint64_t n = readUInt();
+					if(n > static_cast<uint64_t>(end_ - p_)) {
+						error_ = true;
+						break;
+					}
+
+					std::map<variant, variant> items;
+					for(uint64_t i = 0; i < n && !error_; ++i) {
+						variant key = readNode();
+						key.intern_string();
+						items[key] = readNode();
+					}
+
+					result = variant(&items);
+					break;
+				}
+				default:
+					error_ = true;
+					break;
+				}
+
+				if(info && info->filename) {
+					result.setDebugInfo(*info);
+				}
+
+				return result;
+			}
+
+			const char* p_;
+			const char* end_;
+			std::vector<std::string> strings_;
+			std::vector<DebugEntry> debug_;
+			uint64_t nnodes_;
+			size_t next_debug_;
+			bool error_;
+		};
+
+		const char CacheMagic[] = "ANURAJC1";
+		const size_t CacheMagicSize = 8;
+
+		std::string cache_file_name(const std::string& fname, JSON_PARSE_OPTIONS options)
+		{
+			const std::string path = module::map_file(fname);
+			return md5::sum(options == JSON_PARSE_OPTIONS::USE_PREPROCESSOR ? path : path + "#raw") + ".bin";
+		}
+
+		std::string user_cache_dir()
+		{
+			return std::string(preferences::user_data_path()) + "/json_cache/";
+		}
+
+		//a cache built by --utility=compile_json_cache for shipping with
+		//a module.
+		std::string module_cache_dir()
+		{
+			return module::get_module_path() + "json_cache/";
+		}
+
+		bool building_module_cache = false;
+
+		bool read_cache_file(const std::string& path, const std::string& md5sum, variant* result, DocumentDependencies* deps)
+		{
+			if(!sys::file_exists(path)) {
+				return false;
+			}
+
+			const std::string contents = sys::read_file(path);
+			if(contents.size() < CacheMagicSize + 4 || memcmp(contents.c_str(), CacheMagic, CacheMagicSize) != 0) {
+				return false;
+			}
+
+			const char* p = contents.c_str() + CacheMagicSize;
+			const char* end = contents.c_str() + contents.size();
+
+			size_t header_len = 0;
+			for(int n = 0; n != 4; ++n) {
+				header_len |= static_cast<size_t>(static_cast<unsigned char>(p[n])) << (n*8);
+			}
+
+			p += 4;
+			if(header_len > static_cast<size_t>(end - p)) {
+				return false;
+			}
+
+			//the header is [engine version, md5 sum, [[file, md5 sum]...], {constant: value}]
+			//A header of any other shape is from an old or corrupt cache,
+			//and is treated as a miss rather than asserting on its types.
+			variant header;
+			if(!read_binary_variant(p, p + header_len, &header) || !header.is_list() || header.num_elements() != 4) {
+				return false;
+			}
+
+			if(!header[0].is_string() || !header[1].is_string() || !header[2].is_list() || !header[3].is_map()) {
+				return false;
+			}
+
+			if(header[0].as_string() != preferences::version() || header[1].as_string() != md5sum) {
+				return false;
+			}
+
+			DocumentDependencies result_deps;
+			for(const variant& f : header[2].as_list()) {
+				if(!f.is_list() || f.num_elements() != 2 || !f[0].is_string() || !f[1].is_string()) {
+					return false;
+				}
+
+				const std::string fname = f[0].as_string();
+				const std::string dep_md5 = f[1].as_string();
+				if(get_file_md5(fname) != dep_md5) {
+					return false;
+				}
+
+				result_deps.files.push_back(std::make_pair(fname, dep_md5));
+			}
+
+			for(const auto& c : header[3].as_map()) {
+				if(!c.first.is_string()) {
+					return false;
+				}
+
+				const std::string name = c.first.as_string();
+				if(game_logic::get_constant(name) != c.second) {
+					return false;
+				}
+
+				result_deps.constants.push_back(std::make_pair(name, c.second));
+			}
+
+			if(!read_binary_variant(p + header_len, end, result)) {
+				LOG_ERROR("Corrupt cached document: " << path);
+				return false;
+			}
+
+			*deps = result_deps;
+			return true;
+		}
+	}
+
+	bool write_binary_variant(const variant& v, std::string* out)
+	{
+		BinaryWriter writer;
+		if(!writer.write(v)) {
+			return false;
+		}
+
+		writer.output(out);
+		return true;
+	}
+
+	bool read_binary_variant(const char* begin, const char* end, variant* result)
+	{
+		BinaryReader reader(begin, end);
+		return reader.read(result);
+	}
+
+	namespace cache
+	{
+		bool read(const std::string& fname, JSON_PARSE_OPTIONS options, const std::string& md5sum, variant* result, DocumentDependencies* deps)
+		{
+			if(building_module_cache) {
+				return false;
+			}
+
+			const std::string name = cache_file_name(fname, options);
+			return read_cache_file(user_cache_dir() + name, md5sum, result, deps) ||
+			       read_cache_file(module_cache_dir() + name, md5sum, result, deps);
+		}
+
+		void write(const std::string& fname, JSON_PARSE_OPTIONS options, const std::string& md5sum, const variant& doc, const DocumentDependencies& deps)
+		{
+			if(!deps.cacheable) {
+				return;
+			}
+
+			//a file included many times is only checked once.
+			const std::map<std::string, std::string> unique_files(deps.files.begin(), deps.files.end());
+
+			std::vector<variant> files;
+			for(const auto& f : unique_files) {
+				std::vector<variant> item;
+				item.push_back(variant(f.first));
+				item.push_back(variant(f.second));
+				files.push_back(variant(&item));
+			}
+
+			std::map<variant, variant> constants;
+			for(const auto& c : deps.constants) {
+				constants[variant(c.first)] = c.second;
+			}
+
+			std::vector<variant> header;
+			header.push_back(variant(preferences::version()));
+			header.push_back(variant(md5sum));
+			header.push_back(variant(&files));
+			header.push_back(variant(&constants));
+
+			std::string header_data, doc_data;
+			if(!write_binary_variant(variant(&header), &header_data) || !write_binary_variant(doc, &doc_data)) {
+				return;
+			}
+
+			std::string output(CacheMagic, CacheMagicSize);
+			for(int n = 0; n != 4; ++n) {
+				output.push_back(static_cast<char>((header_data.size() >> (n*8))&0xFF));
+			}
+
+			output += header_data;
+			output += doc_data;
+
+			sys::write_file((building_module_cache ? module_cache_dir() : user_cache_dir()) + cache_file_name(fname, options), output);
+		}
+
+		BuildScope::BuildScope()
+		{
+			building_module_cache = true;
+		}
+
+		BuildScope::~BuildScope()
+		{
+			building_module_cache = false;
+		}
+
+		bool BuildScope::active()
+		{
+			return building_module_cache;
+		}
+	}
+}
+
+UNIT_TEST(binary_variant)
+{
+	const variant doc = json::parse("{a: [1, 2.5, null, true, false, \"x\"], b: {c: \"d\"}, e: -7, f: ~hello~}");
+
+	std::string data;
+	CHECK_EQ(json::write_binary_variant(doc, &data), true);
+
+	variant result;
+	CHECK_EQ(json::read_binary_variant(data.c_str(), data.c_str() + data.size(), &result), true);
+	CHECK_EQ(result, doc);
+	CHECK_EQ(result["e"].as_int(), -7);
+	CHECK_EQ(result["a"][1].as_decimal(), decimal::from_string("2.5"));
+	CHECK(result["f"].get_translated_from() != nullptr, "translated string was lost");
+
+	//debug info of both maps and their keys is kept.
+	CHECK(result["b"].get_debug_info() != nullptr, "no debug info");
+	CHECK_EQ(result["b"].get_debug_info()->line, doc["b"].get_debug_info()->line);
+	CHECK_EQ(result["b"].get_debug_info()->column, doc["b"].get_debug_info()->column);
+	CHECK_EQ(result.getKeys()[0].get_debug_info()->column, doc.getKeys()[0].get_debug_info()->column);
+
+	//truncated data is rejected.
+	CHECK_EQ(json::read_binary_variant(data.c_str(), data.c_str() + data.size() - 1, &result), false);
+}
+
+UNIT_TEST(json_cache_malformed_header)
+{
+	const std::string path = json::user_cache_dir() + "unit_test.bin";
+	const std::string md5sum = md5::sum("json_cache_malformed_header");
+
+	//caches with headers of the wrong shape are a miss, not an assert.
+	const char* headers[] = {
+		"[1, 2, [], {}]",
+		"[\"v\", \"m\", {}, []]",
+		"[\"VERSION\", \"MD5\", [\"file\"], {}]",
+		"[\"VERSION\", \"MD5\", [[\"file\"]], {}]",
+		"[\"VERSION\", \"MD5\", [[1, 2]], {}]",
+		"[\"VERSION\", \"MD5\", [], \"CONSTANTS\"]",
+	};
+
+	for(const char* h : headers) {
+		std::string header_str = h;
+		const size_t version_pos = header_str.find("VERSION");
+		if(version_pos != std::string::npos) {
+			header_str.replace(version_pos, 7, preferences::version());
+			header_str.replace(header_str.find("MD5"), 3, md5sum);
+		}
+
+		variant header = json::parse(header_str);
+		if(header.is_list() && header.num_elements() == 4 && header[3].is_string()) {
+			//constants keyed by something other than a name.
+			std::map<variant, variant> constants;
+			constants[variant(1)] = variant(2);
+			std::vector<variant> items = header.as_list();
+			items[3] = variant(&constants);
+			header = variant(&items);
+		}
+
+		std::string header_data, doc_data;
+		CHECK_EQ(json::write_binary_variant(header, &header_data), true);
+		CHECK_EQ(json::write_binary_variant(variant(1), &doc_data), true);
+
+		std::string output(json::CacheMagic, json::CacheMagicSize);
+		for(int n = 0; n != 4; ++n) {
+			output.push_back(static_cast<char>((header_data.size() >> (n*8))&0xFF));
+		}
+
+		sys::write_file(path, output + header_data + doc_data);
+
+		variant result;
+		json::DocumentDependencies deps;
+		CHECK(json::read_cache_file(path, md5sum, &result, &deps) == false, "malformed cache header accepted: " << header_str);
+	}
+
+	sys::remove_file(path);
+}
+
+namespace
+{
+	void get_cfg_files(const std::string& dir, std::vector<std::string>* result)
+	{
+		std::vector<std::string> files, dirs;
+		module::get_files_in_dir(dir, &files, &dirs);
+		for(const std::string& d : dirs) {
+			if(d.empty() == false && d[0] != '.') {
+				get_cfg_files(dir + d + "/", result);
+			}
+		}
+
+		for(const std::string& f : files) {
+			if(f.size() > 4 && f.compare(f.size() - 4, 4, ".cfg") == 0) {
+				result->push_back(dir + f);
+			}
+		}
+	}
+}
+
+//Parses every document under data/ and stores it in the cache shipped
+//with the module, in <module>/json_cache/, so the first run of a release
+//doesn't need to parse them.
+UTILITY(compile_json_cache)
+{
+	std::vector<std::string> files;
+	get_cfg_files("data/", &files);
+
+	json::cache::BuildScope build_scope;
+
+	int nfailed = 0;
+	for(const std::string& f : files) {
+		try {
+			json::parse_from_file(f);
+		} catch(json::ParseError& e) {
+			LOG_ERROR("Could not parse " << f << ": " << e.errorMessage());
+			++nfailed;
+		}
+	}
+
+	LOG_INFO("Compiled " << (files.size() - nfailed) << " documents to " << module::get_module_path() << "json_cache/");
+}
+
+BENCHMARK(binary_variant_read)
+{
+	static std::string data;
+	if(data.empty()) {
+		json::write_binary_variant(json::parse_from_file("data/objects/playable/frogatto_playable.cfg"), &data);
+	}
+
+	BENCHMARK_LOOP {
+		variant result;
+		json::read_binary_variant(data.c_str(), data.c_str() + data.size(), &result);
+	}
+}
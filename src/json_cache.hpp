@@ -0,0 +1,92 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json_parser.hpp"
+#include "variant.hpp"
+
+//A cache of parsed documents, stored in a compact binary form so that
+//documents which haven't changed since they were last parsed are loaded
+//without tokenizing them or running the preprocessor again.
+namespace json
+{
+	//What a parsed document depends on other than its own text. A cached
+	//document is only used if all of these are unchanged.
+	struct DocumentDependencies
+	{
+		DocumentDependencies() : cacheable(true) {}
+
+		//(file name, md5 sum) of every file included by the document.
+		std::vector<std::pair<std::string, std::string>> files;
+
+		//(name, value) of every constant used by the document.
+		std::vector<std::pair<std::string, variant>> constants;
+
+		//false if the document can't be cached, because it evaluates
+		//formulas or contains values which can't be stored.
+		bool cacheable;
+
+		void add(const DocumentDependencies& o);
+	};
+
+	//Writes 'v' in binary form to 'out'. Only null, bool, int, decimal,
+	//string, list and map values can be written; returns false if 'v'
+	//contains anything else. Debug info is kept.
+	bool write_binary_variant(const variant& v, std::string* out);
+
+	//Reads a variant written by write_binary_variant(). Returns false if
+	//the data is corrupt.
+	bool read_binary_variant(const char* begin, const char* end, variant* result);
+
+	//the md5 sum of a file, as used for cached documents.
+	std::string get_file_md5(const std::string& fname);
+
+	//the pointer used to refer to a file name in debug info.
+	const std::string* get_debug_filename(const std::string& fname);
+
+	namespace cache
+	{
+		//finds the cached parse of 'fname', which has the given md5 sum.
+		bool read(const std::string& fname, JSON_PARSE_OPTIONS options, const std::string& md5sum, variant* result, DocumentDependencies* deps);
+
+		//stores the parse of 'fname' in the cache in the user's data
+		//directory.
+		void write(const std::string& fname, JSON_PARSE_OPTIONS options, const std::string& md5sum, const variant& doc, const DocumentDependencies& deps);
+
+		//While one of these exists documents are always parsed, rather than
+		//being found in any cache, and are written to the cache shipped with
+		//the current module instead of the user's cache.
+		struct BuildScope
+		{
+			BuildScope();
+			~BuildScope();
+
+			static bool active();
+		};
+	}
+}
@@ -26,12 +26,14 @@
 #include "asserts.hpp"
 #include "code_editor_dialog.hpp"
 #include "checksum.hpp"
+#include "file_archive.hpp"
 #include "filesystem.hpp"
 #include "formatter.hpp"
 #include "formula_callable.hpp"
 #include "formula_constants.hpp"
 #include "formula_function.hpp"
 #include "formula_object.hpp"
+#include "json_cache.hpp"
 #include "json_parser.hpp"
 #include "json_tokenizer.hpp"
 #include "md5.hpp"
@@ -48,11 +50,36 @@ namespace game_logic
 	void remove_formula_function_cached_doc(const std::string& name);
 }
 
+PREF_BOOL(json_cache, true, "Keep parsed documents in a binary cache and load them from it when they haven't changed");
+
 namespace json 
 {
 	namespace 
 	{
 		std::map<std::string, std::string> pseudo_file_contents;
+
+		//the dependencies of the documents currently being parsed, the
+		//innermost last. Anything a document depends on, the documents
+		//including it depend on too.
+		std::vector<DocumentDependencies*> dependency_stack;
+
+		struct DependencyScope
+		{
+			explicit DependencyScope(DocumentDependencies* deps) {
+				dependency_stack.push_back(deps);
+			}
+
+			~DependencyScope() {
+				dependency_stack.pop_back();
+			}
+		};
+
+		void add_dependencies(const DocumentDependencies& deps)
+		{
+			for(DocumentDependencies* d : dependency_stack) {
+				d->add(deps);
+			}
+		}
 	}
 
 	void set_file_contents(const std::string& path, const std::string& contents)
@@ -61,6 +88,16 @@ namespace json
 		pseudo_file_contents[path] = contents;
 	}
 
+	std::string get_file_md5(const std::string& fname)
+	{
+		sys::ArchivedFile archived;
+		if(pseudo_file_contents.count(fname) == 0 && sys::find_archived_file(module::map_file(fname), &archived)) {
+			return archived.md5sum();
+		}
+
+		return md5::sum(get_file_contents(fname));
+	}
+
 	std::string get_file_contents(const std::string& path)
 	{
 		std::map<std::string, std::string>::const_iterator i = pseudo_file_contents.find(path);
@@ -263,6 +300,15 @@ namespace json
 		};
 
 		std::set<std::string> filename_registry;
+	}
+
+	const std::string* get_debug_filename(const std::string& fname)
+	{
+		return &*filename_registry.insert(fname).first;
+	}
+
+	namespace
+	{
 
 		variant parse_internal(const std::string& doc, const std::string& fname,
 							   JSON_PARSE_OPTIONS options,
@@ -443,12 +489,26 @@ namespace json
 								CHECK_PARSE(false, "Preprocessor error: " + s, t.begin - doc.c_str());
 							}
 
+							//the result of evaluating a formula could change
+							//without the document changing.
+							if(s.size() >= 5 && std::equal(s.begin(), s.begin() + 5, "@eval")) {
+								DocumentDependencies deps;
+								deps.cacheable = false;
+								add_dependencies(deps);
+							}
+
 							if(t.type == Token::TYPE::IDENTIFIER) {
 								const variant constant = game_logic::get_constant(s);
+								const bool constant_name = std::count_if(s.begin(), s.end(), util::c_isupper) + std::count(s.begin(), s.end(), '_') == s.size();
+								if(constant_name) {
+									DocumentDependencies deps;
+									deps.constants.push_back(std::make_pair(s, constant));
+									add_dependencies(deps);
+								}
+
 								if(constant.is_null() == false) {
 									v = constant;
-								} else if(stack.back().type != VAL_TYPE::OBJ &&
-										  std::count_if(s.begin(), s.end(), util::c_isupper) + std::count(s.begin(), s.end(), '_') == s.size()) {
+								} else if(stack.back().type != VAL_TYPE::OBJ && constant_name) {
 									CHECK_PARSE(false, "Preprocessor error: symbol not found: " + s, t.begin - doc.c_str());
 								}
 							}
@@ -482,6 +542,7 @@ namespace json
 						}
 
 						if(stack.back().type == VAL_TYPE::OBJ) {
+							v.intern_string();
 							if(!stack.back().obj_already_seen.insert(v).second) {
 								CHECK_PARSE(false, "Repeated attribute: " + v.write_json(), t.begin - doc.c_str());
 							}
@@ -587,55 +648,95 @@ namespace json
 	variant parse_from_file(const std::string& fname, JSON_PARSE_OPTIONS options)
 	{
 		try {
-			std::string data = get_file_contents(fname);
+			struct CachedDocument {
+				variant doc;
+				DocumentDependencies deps;
+			};
 
 			typedef std::pair<std::string, JSON_PARSE_OPTIONS> CacheKey;
-			static std::map<CacheKey, variant> cache;
-
-			CacheKey key(md5::sum(data), options);
-			std::map<CacheKey, variant>::iterator cache_itor = cache.find(key);
-			if(cache_itor != cache.end()) {
-				return cache_itor->second;
+			static std::map<CacheKey, CachedDocument> cache;
+
+			//files in archives have their md5 sum stored alongside them, so
+			//a cached document is found without reading or hashing the file.
+			std::string data;
+			CacheKey key;
+			key.second = options;
+
+			const bool is_pseudo_file = pseudo_file_contents.count(fname) != 0;
+			sys::ArchivedFile archived;
+			const bool is_archived = !is_pseudo_file && sys::find_archived_file(module::map_file(fname), &archived);
+			if(is_archived) {
+				key.first = archived.md5sum();
+			} else {
+				data = get_file_contents(fname);
+				key.first = md5::sum(data);
 			}
 
-			checksum::verify_file(fname, data);
+			DocumentDependencies file_deps;
+			file_deps.files.push_back(std::make_pair(fname, key.first));
+			add_dependencies(file_deps);
 
-			if(data.empty()) {
-				throw ParseError(formatter() << "Could not find file " << fname);
+			std::map<CacheKey, CachedDocument>::iterator cache_itor = cache.find(key);
+			if(cache_itor != cache.end() && cache::BuildScope::active() == false) {
+				add_dependencies(cache_itor->second.deps);
+				return cache_itor->second.doc;
 			}
 
-			variant result;
-		
-			try {
-				result = parse_internal(data, fname, options, nullptr, nullptr);
-			} catch(ParseError& e) {
-				if(!preferences::edit_and_continue()) {
-					throw e;
+			if(is_archived) {
+				checksum::verify_file_sum(fname, key.first, archived.size == 0);
+			} else {
+				checksum::verify_file(fname, data);
+			}
+
+			CachedDocument parsed;
+			const bool use_binary_cache = g_json_cache && !is_pseudo_file;
+			if(use_binary_cache == false || cache::read(fname, options, key.first, &parsed.doc, &parsed.deps) == false) {
+				if(is_archived) {
+					data = archived.contents();
 				}
 
-				static bool in_edit_and_continue = false;
-				if(in_edit_and_continue) {
-					throw e;
+				if(data.empty()) {
+					throw ParseError(formatter() << "Could not find file " << fname);
 				}
 
-				in_edit_and_continue = true;
-				edit_and_continue_fn(module::map_file(fname), 
-					formatter() << "At " << module::map_file(fname) << " " << e.line << ": " << e.message, 
-					[=](){ parse_from_file(fname, options); });
-				in_edit_and_continue = false;
-				return parse_from_file(fname, options);
+				try {
+					DependencyScope dependency_scope(&parsed.deps);
+					parsed.doc = parse_internal(data, fname, options, nullptr, nullptr);
+				} catch(ParseError& e) {
+					if(!preferences::edit_and_continue()) {
+						throw e;
+					}
+
+					static bool in_edit_and_continue = false;
+					if(in_edit_and_continue) {
+						throw e;
+					}
+
+					in_edit_and_continue = true;
+					edit_and_continue_fn(module::map_file(fname), 
+						formatter() << "At " << module::map_file(fname) << " " << e.line << ": " << e.message, 
+						[=](){ parse_from_file(fname, options); });
+					in_edit_and_continue = false;
+					return parse_from_file(fname, options);
+				}
+
+				if(use_binary_cache) {
+					cache::write(fname, options, key.first, parsed.doc, parsed.deps);
+				}
 			}
 
-			for(std::map<CacheKey, variant>::iterator i = cache.begin(); i != cache.end(); ) {
-				if(i->second.refcount() == 1) {
+			add_dependencies(parsed.deps);
+
+			for(std::map<CacheKey, CachedDocument>::iterator i = cache.begin(); i != cache.end(); ) {
+				if(i->second.doc.refcount() == 1) {
 					cache.erase(i++);
 				} else {
 					++i;
 				}
 			}
 
-			cache[key] = result;
-			return result;
+			cache[key] = parsed;
+			return parsed.doc;
 		} catch(ParseError& e) {
 			//std::cerr << e.errorMessage() << "\n";
 			e.fname = fname;
@@ -24,6 +24,7 @@
 #include "asserts.hpp"
 #include "Blend.hpp"
 #include "DisplayDevice.hpp"
+#include "SpriteBatch.hpp"
 
 namespace KRE
 {
@@ -274,11 +275,13 @@ namespace KRE
 		: impl_(DisplayDevice::getCurrent()->getBlendEquationImpl()),
 		  eqn_(eqn)
 	{
+		SpriteBatch::flush();
 		impl_->apply(eqn_);
 	}
 
 	BlendEquation::Manager::~Manager()
 	{
+		SpriteBatch::flush();
 		impl_->clear(eqn_);
 	}
 
@@ -22,6 +22,7 @@
 */
 
 #include "BlendModeScope.hpp"
+#include "SpriteBatch.hpp"
 
 namespace KRE
 {
@@ -42,16 +43,19 @@ namespace KRE
 
 	BlendModeScope::BlendModeScope(const BlendMode& bm)
 	{
+		SpriteBatch::flush();
 		it_ = get_mode_stack().emplace(get_mode_stack().end(), bm);
 	}
 
 	BlendModeScope::BlendModeScope(const BlendModeConstants& src, const BlendModeConstants& dst)
 	{
+		SpriteBatch::flush();
 		it_ = get_mode_stack().emplace(get_mode_stack().end(), BlendMode(src, dst));
 	}
 
 	BlendModeScope::~BlendModeScope()
 	{
+		SpriteBatch::flush();
 		get_mode_stack().erase(it_);
 	}
 
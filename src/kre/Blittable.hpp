@@ -56,6 +56,9 @@ namespace KRE
 
 		void preRender(const WindowPtr& wm) override;
 
+		// The vertices preRender() draws, as a triangle strip.
+		void getVertices(std::vector<vertex_texcoord>* vertices) const;
+
 		Centre getCentre() const { return centre_; }
 		void setCentre(Centre c);
 		const pointf& getCentreCoords() const { return centre_offset_; }
@@ -43,6 +43,7 @@
 #include "ModelMatrixScope.hpp"
 #include "ScissorOGL.hpp"
 #include "ShadersOGL.hpp"
+#include "SpriteBatch.hpp"
 #include "StencilScopeOGL.hpp"
 #include "TextureOGL.hpp"
 #include "WindowManager.hpp"
@@ -218,6 +219,7 @@ namespace KRE
 
 	void DisplayDeviceOpenGL::clear(ClearFlags clr)
 	{
+		SpriteBatch::flush();
 		glClear((clr & ClearFlags::COLOR ? GL_COLOR_BUFFER_BIT : 0) 
 			| (clr & ClearFlags::DEPTH ? GL_DEPTH_BUFFER_BIT : 0) 
 			| (clr & ClearFlags::STENCIL ? GL_STENCIL_BUFFER_BIT : 0));
@@ -245,11 +247,17 @@ namespace KRE
 
 	CameraPtr DisplayDeviceOpenGL::setDefaultCamera(const CameraPtr& cam)
 	{
+		SpriteBatch::flush();
 		auto old_cam = get_default_camera();
 		get_default_camera() = cam;
 		return old_cam;
 	}
 
+	CameraPtr DisplayDeviceOpenGL::getDefaultCamera() const
+	{
+		return get_default_camera();
+	}
+
 	void DisplayDeviceOpenGL::render(const Renderable* r) const
 	{
 		if(!r->isEnabled()) {
@@ -21,12 +21,15 @@
 	   distribution.
 */
 
+#include <list>
 #include <map>
 
 #include <cairo.h>
 #include <cairo-ft.h>
 
+#include "Canvas.hpp"
 #include "Font.hpp"
+#include "utf8_to_codepoint.hpp"
 
 namespace KRE
 {
@@ -123,13 +126,123 @@ namespace KRE
 		}	
 		};
 
-		typedef std::map<CacheKey, TexturePtr> RenderCache;
+		// Textures rendered by renderText, kept in least recently used order
+		// so that the oldest can be dropped once there are too many.
+		struct RenderCache
+		{
+			RenderCache() : max_entries(512) {}
+
+			struct Entry
+			{
+				TexturePtr texture;
+				std::list<CacheKey>::iterator order;
+			};
+
+			std::map<CacheKey, Entry> entries;
+			std::list<CacheKey> order;
+			size_t max_entries;
+
+			void trim()
+			{
+				while(entries.size() > max_entries) {
+					entries.erase(order.back());
+					order.pop_back();
+				}
+			}
+		};
+
 		RenderCache& get_render_cache()
 		{
 			static RenderCache res;
 			return res;
 		}
 
+		int texture_uploads = 0;
+		int last_frame_texture_uploads = 0;
+
+		// Glyphs are packed into pages in rows, each row as tall as the
+		// tallest glyph in it. A pixel of padding is left between glyphs so
+		// that filtering doesn't pick up their neighbours.
+		const int AtlasPageSize = 512;
+		const int AtlasPadding = 1;
+
+		struct AtlasPage
+		{
+			TexturePtr texture;
+			int row_x;
+			int row_y;
+			int row_height;
+		};
+
+		std::vector<AtlasPage>& get_atlas_pages()
+		{
+			static std::vector<AtlasPage> res;
+			return res;
+		}
+
+		struct AtlasGlyph
+		{
+			// area is empty for glyphs with nothing to draw, such as spaces.
+			int page;
+			rect area;
+			int advance;
+			int x_offset;
+			int height;
+		};
+
+		typedef std::map<std::pair<std::string, int>, std::map<char32_t, AtlasGlyph>> GlyphCache;
+		GlyphCache& get_glyph_cache()
+		{
+			static GlyphCache res;
+			return res;
+		}
+
+		bool is_blank(const GlyphBitmap& glyph)
+		{
+			for(size_t n = 3; n < glyph.pixels.size(); n += 4) {
+				if(glyph.pixels[n] != 0) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Finds room for a w x h glyph, starting a new row or page if needed.
+		bool allocate_atlas_area(int w, int h, int* page, rect* area)
+		{
+			if(w + AtlasPadding > AtlasPageSize || h + AtlasPadding > AtlasPageSize) {
+				return false;
+			}
+
+			auto& pages = get_atlas_pages();
+			if(pages.empty() == false) {
+				AtlasPage& p = pages.back();
+				if(p.row_x + w + AtlasPadding > AtlasPageSize) {
+					p.row_x = 0;
+					p.row_y += p.row_height;
+					p.row_height = 0;
+				}
+			}
+
+			if(pages.empty() || pages.back().row_y + h + AtlasPadding > AtlasPageSize) {
+				AtlasPage p;
+				p.texture = Texture::createTexture2D(AtlasPageSize, AtlasPageSize, PixelFormat::PF::PIXELFORMAT_ABGR8888);
+				p.texture->setAddressModes(-1, Texture::AddressMode::CLAMP, Texture::AddressMode::CLAMP);
+				std::vector<unsigned char> blank(AtlasPageSize*AtlasPageSize*4, 0);
+				p.texture->update2D(0, 0, 0, AtlasPageSize, AtlasPageSize, AtlasPageSize, &blank[0]);
+				++texture_uploads;
+				p.row_x = p.row_y = p.row_height = 0;
+				pages.push_back(p);
+			}
+
+			AtlasPage& p = pages.back();
+			*page = static_cast<int>(pages.size()) - 1;
+			*area = rect(p.row_x, p.row_y, w, h);
+			p.row_x += w + AtlasPadding;
+			p.row_height = std::max(p.row_height, h + AtlasPadding);
+			return true;
+		}
+
 		std::string& get_default_font()
 		{
 			static std::string res;
@@ -169,16 +282,148 @@ namespace KRE
 	TexturePtr Font::renderText(const std::string& text, const Color& color, int size, bool cache, const std::string& font_name) const
 	{
 		if(!cache) {
+			++texture_uploads;
 			return doRenderText(text, color, size, font_name);
 		}
+		RenderCache& render_cache = get_render_cache();
 		CacheKey key = {text, color, size, font_name};
-		auto it = get_render_cache().find(key);
-		if(it == get_render_cache().end()) {
+		auto it = render_cache.entries.find(key);
+		if(it == render_cache.entries.end()) {
+			++texture_uploads;
 			TexturePtr t = doRenderText(text, color, size, font_name);
-			get_render_cache()[key] = t;
+			render_cache.order.push_front(key);
+			RenderCache::Entry& entry = render_cache.entries[key];
+			entry.texture = t;
+			entry.order = render_cache.order.begin();
+			render_cache.trim();
 			return t;
 		}
-		return it->second;
+		render_cache.order.splice(render_cache.order.begin(), render_cache.order, it->second.order);
+		return it->second.texture;
+	}
+
+	bool Font::layoutText(const std::string& text, int size, const std::string& font_name, std::vector<TextQuads>* result, int* width, int* height) const
+	{
+		auto& glyphs = get_glyph_cache()[std::make_pair(font_name.empty() ? getDefaultFont() : font_name, size)];
+
+		std::map<int, int> page_quads;
+		int x = 0, y = 0, line_height = 0, max_width = 0;
+		for(char32_t cp : utils::utf8_to_codepoint(text)) {
+			if(cp == '\n') {
+				y += line_height;
+				x = 0;
+				continue;
+			}
+
+			auto it = glyphs.find(cp);
+			if(it == glyphs.end()) {
+				GlyphBitmap bitmap;
+				if(!rasterizeGlyph(cp, size, font_name, &bitmap)) {
+					return false;
+				}
+
+				AtlasGlyph glyph = { 0, rect(), bitmap.advance, bitmap.x_offset, bitmap.height };
+				if(bitmap.width > 0 && bitmap.height > 0 && !is_blank(bitmap)) {
+					if(!allocate_atlas_area(bitmap.width, bitmap.height, &glyph.page, &glyph.area)) {
+						return false;
+					}
+
+					get_atlas_pages()[glyph.page].texture->update2D(0, glyph.area.x(), glyph.area.y(), glyph.area.w(), glyph.area.h(), glyph.area.w(), &bitmap.pixels[0]);
+					++texture_uploads;
+				}
+
+				it = glyphs.insert(std::make_pair(cp, glyph)).first;
+			}
+
+			const AtlasGlyph& glyph = it->second;
+			line_height = std::max(line_height, glyph.height);
+
+			if(glyph.area.w() > 0) {
+				auto pq = page_quads.find(glyph.page);
+				if(pq == page_quads.end()) {
+					pq = page_quads.insert(std::make_pair(glyph.page, static_cast<int>(result->size()))).first;
+					result->push_back(TextQuads());
+					result->back().texture = get_atlas_pages()[glyph.page].texture;
+				}
+
+				const float vx1 = static_cast<float>(x + glyph.x_offset);
+				const float vy1 = static_cast<float>(y);
+				const float vx2 = static_cast<float>(x + glyph.x_offset + glyph.area.w());
+				const float vy2 = static_cast<float>(y + glyph.area.h());
+				const float tx1 = glyph.area.x() / static_cast<float>(AtlasPageSize);
+				const float ty1 = glyph.area.y() / static_cast<float>(AtlasPageSize);
+				const float tx2 = glyph.area.x2() / static_cast<float>(AtlasPageSize);
+				const float ty2 = glyph.area.y2() / static_cast<float>(AtlasPageSize);
+
+				std::vector<vertex_texcoord>& v = (*result)[pq->second].vertices;
+				v.emplace_back(glm::vec2(vx1, vy1), glm::vec2(tx1, ty1));
+				v.emplace_back(glm::vec2(vx2, vy1), glm::vec2(tx2, ty1));
+				v.emplace_back(glm::vec2(vx1, vy2), glm::vec2(tx1, ty2));
+				v.emplace_back(glm::vec2(vx1, vy2), glm::vec2(tx1, ty2));
+				v.emplace_back(glm::vec2(vx2, vy1), glm::vec2(tx2, ty1));
+				v.emplace_back(glm::vec2(vx2, vy2), glm::vec2(tx2, ty2));
+			}
+
+			x += glyph.advance;
+			max_width = std::max(max_width, x);
+		}
+
+		if(width) {
+			*width = max_width;
+		}
+		if(height) {
+			*height = y + line_height;
+		}
+		return true;
+	}
+
+	rect Font::drawText(const std::string& text, const Color& color, int size, int x, int y, const std::string& font_name) const
+	{
+		auto canvas = Canvas::getInstance();
+
+		std::vector<TextQuads> quads;
+		int width = 0, height = 0;
+		if(!layoutText(text, size, font_name, &quads, &width, &height)) {
+			auto t = renderText(text, color, size, true, font_name);
+			canvas->blitTexture(t, 0, x, y);
+			return rect(x, y, t->surfaceWidth(), t->surfaceHeight());
+		}
+
+		const glm::vec2 offset(static_cast<float>(x), static_cast<float>(y));
+		for(TextQuads& q : quads) {
+			for(vertex_texcoord& v : q.vertices) {
+				v.vtx += offset;
+			}
+			canvas->blitTexture(q.texture, q.vertices, 0, color);
+		}
+		return rect(x, y, width, height);
+	}
+
+	void Font::setRenderCacheSize(int entries)
+	{
+		get_render_cache().max_entries = static_cast<size_t>(std::max(entries, 0));
+		get_render_cache().trim();
+	}
+
+	int Font::getAtlasPages()
+	{
+		return static_cast<int>(get_atlas_pages().size());
+	}
+
+	int Font::getTextureUploads()
+	{
+		return last_frame_texture_uploads;
+	}
+
+	void Font::endFrame()
+	{
+		last_frame_texture_uploads = texture_uploads;
+		texture_uploads = 0;
+	}
+
+	bool Font::rasterizeGlyph(char32_t codepoint, int size, const std::string& font_name, GlyphBitmap* result) const
+	{
+		return false;
 	}
 
 	void Font::getTextSize(const std::string& text, int* width, int* height, int size, const std::string& font_name) const
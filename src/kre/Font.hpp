@@ -25,6 +25,8 @@
 
 #include <exception>
 
+#include "geometry.hpp"
+#include "SceneUtil.hpp"
 #include "Texture.hpp"
 #include "Util.hpp"
 
@@ -40,11 +42,54 @@ namespace KRE
 
 	typedef std::map<std::string, std::string> font_path_cache;
 
+	// A single rasterized glyph, white with its coverage in the alpha
+	// channel so it can be tinted to any color. Pixels are RGBA, tightly
+	// packed. The bitmap is the full line height, positioned as it would
+	// be if the glyph was rendered on its own.
+	struct GlyphBitmap
+	{
+		GlyphBitmap() : width(0), height(0), advance(0), x_offset(0) {}
+		int width;
+		int height;
+		int advance;
+		int x_offset;
+		std::vector<unsigned char> pixels;
+	};
+
+	// The triangles to draw for a string laid out by Font::layoutText, using
+	// one atlas page texture.
+	struct TextQuads
+	{
+		TexturePtr texture;
+		std::vector<vertex_texcoord> vertices;
+	};
+
 	class Font
 	{
 	public:
 		virtual ~Font();
 		TexturePtr renderText(const std::string& text, const Color& color, int size, bool cache=true, const std::string& font_name="") const;
+
+		// Draws text from glyphs kept in atlas textures shared by all strings,
+		// so that text which changes every frame doesn't create a texture for
+		// each string. Glyphs are tinted by color. Returns the area drawn.
+		rect drawText(const std::string& text, const Color& color, int size, int x, int y, const std::string& font_name="") const;
+
+		// Lays out text at the origin using the glyph atlas. Returns false if
+		// the font can't rasterize individual glyphs, in which case renderText
+		// must be used instead.
+		bool layoutText(const std::string& text, int size, const std::string& font_name, std::vector<TextQuads>* result, int* width, int* height) const;
+
+		// The number of entries kept in the cache used by renderText. When
+		// it is full the least recently used texture is dropped.
+		static void setRenderCacheSize(int entries);
+
+		// Statistics on text rendering: the number of glyph atlas pages, and
+		// the number of textures created or updated to draw text in the last
+		// frame. endFrame() must be called once a frame to collect them.
+		static int getAtlasPages();
+		static int getTextureUploads();
+		static void endFrame();
 		static void setDefaultFont(const std::string& font_name);
 		static const std::string& getDefaultFont();
 		void getTextSize(const std::string& text, int* width, int* height, int size, const std::string& font_name="") const;
@@ -64,6 +109,10 @@ namespace KRE
 		virtual void calcTextSize(const std::string& text, int size, const std::string& font_name, int* width, int* height) const = 0;
 		virtual int getCharWidth(int size, const std::string& fn) = 0;
 		virtual int getCharHeight(int size, const std::string& fn) = 0;
+
+		// Rasterizes a single glyph for the atlas. Fonts which can't do this
+		// return false.
+		virtual bool rasterizeGlyph(char32_t codepoint, int size, const std::string& font_name, GlyphBitmap* result) const;
 	};
 
 	template<class T>
@@ -175,4 +175,54 @@ namespace KRE
 		height = h;
 		return height;
 	}
+
+	bool FontSDL::rasterizeGlyph(char32_t codepoint, int size, const std::string& font_name, GlyphBitmap* result) const
+	{
+		// SDL_ttf only takes glyphs from the basic multilingual plane.
+		if(codepoint > 0xffff) {
+			return false;
+		}
+
+		TTF_Font* font = getFont(size, font_name);
+		int minx, maxx, miny, maxy, advance;
+		if(TTF_GlyphMetrics(font, static_cast<Uint16>(codepoint), &minx, &maxx, &miny, &maxy, &advance) != 0) {
+			return false;
+		}
+
+		result->advance = advance;
+		result->height = TTF_FontHeight(font);
+
+		// A glyph rendered alone is shifted right by any amount it extends
+		// to the left of the origin.
+		result->x_offset = std::min(minx, 0);
+
+		SDL_Surface* surf = TTF_RenderGlyph_Blended(font, static_cast<Uint16>(codepoint), to_SDL_Color(Color::colorWhite()));
+		if(surf == nullptr) {
+			// nothing to draw, such as a zero width glyph.
+			return true;
+		}
+
+		result->width = surf->w;
+		result->height = surf->h;
+		result->pixels.resize(surf->w * surf->h * 4);
+
+		SDL_LockSurface(surf);
+		unsigned char* dst = &result->pixels[0];
+		for(int y = 0; y != surf->h; ++y) {
+			const unsigned char* row = static_cast<const unsigned char*>(surf->pixels) + y*surf->pitch;
+			for(int x = 0; x != surf->w; ++x) {
+				Uint32 pixel;
+				memcpy(&pixel, row + x*surf->format->BytesPerPixel, sizeof(pixel));
+				Uint8 r, g, b, a;
+				SDL_GetRGBA(pixel, surf->format, &r, &g, &b, &a);
+				*dst++ = 255;
+				*dst++ = 255;
+				*dst++ = 255;
+				*dst++ = a;
+			}
+		}
+		SDL_UnlockSurface(surf);
+		SDL_FreeSurface(surf);
+		return true;
+	}
 }
@@ -40,5 +40,6 @@ namespace KRE
 		TTF_Font* getFont(int size, const std::string& font_name) const;
 		int getCharWidth(int size, const std::string& fn) override;
 		int getCharHeight(int size, const std::string& fn) override;
+		bool rasterizeGlyph(char32_t codepoint, int size, const std::string& font_name, GlyphBitmap* result) const override;
 	};
 }
@@ -152,51 +152,23 @@ namespace KRE
 	// Returns 0 if cube intersects.
 	int Frustum::doesCubeIntersect(const glm::vec3& pt, float xlen, float ylen, float zlen) const
 	{
-		int in = 0;
-		int out = 0;
+		// The cube is outside if all its corners are behind one plane, and
+		// inside if all of them are in front of every plane.
+		bool inside = true;
 		for(int n = NEAR_PLANE; n < MAX_PLANES; ++n) {
-			if(glm::dot(planes_[n], glm::vec4(pt.x, pt.y, pt.z, 1.0)) >= 0.0f) {
-				++in;
-			} else {
-				++out;
-			}
-			if(glm::dot(planes_[n], glm::vec4(pt.x + xlen, pt.y, pt.z, 1.0)) >= 0.0f) {
-				++in;
-			} else {
-				++out;
-			}
-			if(glm::dot(planes_[n], glm::vec4(pt.x, pt.y + ylen, pt.z, 1.0)) >= 0.0f) {
-				++in;
-			} else {
-				++out;
-			}
-			if(glm::dot(planes_[n], glm::vec4(pt.x, pt.y, pt.z + zlen, 1.0)) >= 0.0f) {
-				++in;
-			} else {
-				++out;
-			}
-			if(glm::dot(planes_[n], glm::vec4(pt.x + xlen, pt.y + ylen, pt.z, 1.0)) >= 0.0f) {
-				++in;
-			} else {
-				++out;
-			}
-			if(glm::dot(planes_[n], glm::vec4(pt.x + xlen, pt.y, pt.z + zlen, 1.0)) >= 0.0f) {
-				++in;
-			} else {
-				++out;
-			}
-			if(glm::dot(planes_[n], glm::vec4(pt.x, pt.y + ylen, pt.z + zlen, 1.0)) >= 0.0f) {
-				++in;
-			} else {
-				++out;
-			}
-			if(glm::dot(planes_[n], glm::vec4(pt.x + xlen, pt.y + ylen, pt.z + zlen, 1.0)) >= 0.0f) {
-				++in;
-			} else {
-				++out;
+			int in = 0;
+			for(int corner = 0; corner != 8; ++corner) {
+				const glm::vec4 v(pt.x + ((corner&1) ? xlen : 0.0f), pt.y + ((corner&2) ? ylen : 0.0f), pt.z + ((corner&4) ? zlen : 0.0f), 1.0f);
+				if(glm::dot(planes_[n], v) >= 0.0f) {
+					++in;
+				}
+			}
+			if(in == 0) {
+				return -1;
+			} else if(in != 8) {
+				inside = false;
 			}
 		}
-		//std::cerr << "pt: " << pt.x << "," << pt.y << "," << pt.z << " : in: " << in << ", out: " << out << std::endl;
-		return in == 0 ? -1 : out != 0 ? 0 : 1;
+		return inside ? 1 : 0;
 	}
 }
@@ -411,18 +411,14 @@ namespace KRE
 			}
 
 			// Decrement the ttl on particles
-			for(auto& p : active_particles_) {
-				p.current.time_to_live -= t;
-			}
+			active_particles_.decayTimeToLive(t);
 			// Decrement the ttl on instanced emitters
 			for(auto e : instanced_emitters_) {
 				e->current.time_to_live -= t;
 			}
 
 			// Kill end-of-life particles
-			active_particles_.erase(std::remove_if(active_particles_.begin(), active_particles_.end(),
-				[](decltype(active_particles_[0]) p){return p.current.time_to_live < 0.0f;}), 
-				active_particles_.end());
+			active_particles_.removeDead();
 			// Kill end-of-life emitters
 			instanced_emitters_.erase(std::remove_if(instanced_emitters_.begin(), instanced_emitters_.end(),
 				[](decltype(instanced_emitters_[0]) e){return e->current.time_to_live < 0.0f;}), 
@@ -438,14 +434,18 @@ namespace KRE
 			}
 
 			// update particle positions
-			for(auto& p : active_particles_) {
-				if(max_velocity_ && p.current.velocity*glm::length(p.current.direction) > *max_velocity_) {
-					p.current.direction *= *max_velocity_ / glm::length(p.current.direction);
-				}
-
-				p.current.position += p.current.direction * /*scale_velocity * */ static_cast<float>(t);
+			if(max_velocity_) {
+				active_particles_.clampVelocities(*max_velocity_);
+			}
+			active_particles_.integratePositions(t);
 
-				//std::cerr << p << std::endl;
+			// Lets the scene cull the technique when its particles are out
+			// of view.
+			glm::vec3 min_corner, max_corner;
+			if(active_particles_.getBounds(&min_corner, &max_corner)) {
+				setBounds(min_corner, max_corner - min_corner);
+			} else {
+				clearBounds();
 			}
 
 			//std::cerr << "XXX: Active Particle Count: " << active_particles_.size() << std::endl;
@@ -480,14 +480,20 @@ namespace KRE
 			//LOG_DEBUG("Technique::preRender, particle count: " << active_particles_.size());
 			std::vector<vertex_texture_color3> vtc;
 			vtc.reserve(active_particles_.size() * 6);
-			for(auto& p : active_particles_) {
-				vtc.emplace_back(glm::vec3(p.current.position.x,p.current.position.y,p.current.position.z), glm::vec2(0.0f,0.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x,p.current.position.y+p.current.dimensions.y,p.current.position.z), glm::vec2(0.0f,1.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x+p.current.dimensions.x,p.current.position.y,p.current.position.z), glm::vec2(1.0f,0.0f), p.current.color);
-
-				vtc.emplace_back(glm::vec3(p.current.position.x+p.current.dimensions.x,p.current.position.y,p.current.position.z), glm::vec2(1.0f,0.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x,p.current.position.y+p.current.dimensions.y,p.current.position.z), glm::vec2(0.0f,1.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x+p.current.dimensions.x,p.current.position.y+p.current.dimensions.y,p.current.position.z), glm::vec2(1.0f,1.0f), p.current.color);
+			const float* px = active_particles_.getPositions(0);
+			const float* py = active_particles_.getPositions(1);
+			const float* pz = active_particles_.getPositions(2);
+			const float* dx = active_particles_.getDimensions(0);
+			const float* dy = active_particles_.getDimensions(1);
+			const color_vector* color = active_particles_.getColors();
+			for(size_t n = 0; n != active_particles_.size(); ++n) {
+				vtc.emplace_back(glm::vec3(px[n],py[n],pz[n]), glm::vec2(0.0f,0.0f), color[n]);
+				vtc.emplace_back(glm::vec3(px[n],py[n]+dy[n],pz[n]), glm::vec2(0.0f,1.0f), color[n]);
+				vtc.emplace_back(glm::vec3(px[n]+dx[n],py[n],pz[n]), glm::vec2(1.0f,0.0f), color[n]);
+
+				vtc.emplace_back(glm::vec3(px[n]+dx[n],py[n],pz[n]), glm::vec2(1.0f,0.0f), color[n]);
+				vtc.emplace_back(glm::vec3(px[n],py[n]+dy[n],pz[n]), glm::vec2(0.0f,1.0f), color[n]);
+				vtc.emplace_back(glm::vec3(px[n]+dx[n],py[n]+dy[n],pz[n]), glm::vec2(1.0f,1.0f), color[n]);
 			}
 			arv_->update(&vtc);
 
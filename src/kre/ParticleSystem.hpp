@@ -26,6 +26,8 @@
 #include <memory>
 #include <random>
 #include <sstream>
+#include <utility>
+#include <vector>
 #include <glm/glm.hpp>
 
 #include "asserts.hpp"
@@ -74,6 +76,81 @@ namespace KRE
 			Emitter* emitted_by;
 		};
 
+		// The particles of a technique. The current parameters which are updated
+		// every frame are stored as a structure of arrays, so that the updates
+		// which touch every particle work through contiguous runs of floats, four
+		// at a time where SSE2 is available. The initial parameters are only
+		// needed by a few affectors and are kept together, out of the way.
+		class ParticleBuffer
+		{
+		public:
+			size_t size() const { return emitted_by_.size(); }
+			bool empty() const { return emitted_by_.empty(); }
+			void reserve(size_t n);
+			void clear();
+
+			void push_back(const Particle& p);
+
+			// Copies particle n out of or back into the buffer, for updates which
+			// work on one particle at a time.
+			Particle get(size_t n) const;
+			void set(size_t n, const Particle& p);
+
+			Emitter* getEmittedBy(size_t n) const { return emitted_by_[n]; }
+			glm::vec3 getPosition(size_t n) const { return glm::vec3(pos_[0][n], pos_[1][n], pos_[2][n]); }
+			glm::vec3 getDimensions(size_t n) const { return glm::vec3(dim_[0][n], dim_[1][n], dim_[2][n]); }
+			const color_vector& getColor(size_t n) const { return color_[n]; }
+			// The fraction of its life which particle n has lived.
+			float getLifeFraction(size_t n) const { return 1.0f - time_to_live_[n] / initial_time_to_live_[n]; }
+
+			// current.time_to_live -= t
+			void decayTimeToLive(float t);
+			// Limits current.velocity * |current.direction| to max_velocity.
+			void clampVelocities(float max_velocity);
+			// current.position += current.direction * t
+			void integratePositions(float t);
+			// current.direction += v
+			void addToDirections(const glm::vec3& v);
+			// current.direction = (current.direction + v) / 2
+			void averageDirections(const glm::vec3& v);
+			// Adds scale[n] to the selected dimensions of particle n. A dimension
+			// which would no longer be positive is left unchanged.
+			void addToDimensions(const float* scale, bool x, bool y, bool z);
+			void addToDimensions(float scale, bool x, bool y, bool z);
+			// Sets the colors from the interpolated (time, color) keys, where time
+			// is the fraction of its life that the particle has lived. Keys are
+			// sorted by time and hold colors in the range [0,1]. If multiply is
+			// set the result is multiplied with the initial color of the particle.
+			void interpolateColors(const std::vector<std::pair<float, glm::vec4>>& keys, bool multiply);
+
+			// Removes the particles whose time to live has run out, keeping the
+			// rest in the order they were in.
+			void removeDead();
+
+			// Gets the box containing the quads the particles are drawn as.
+			// Returns false if there are no particles.
+			bool getBounds(glm::vec3* min_corner, glm::vec3* max_corner) const;
+
+			const float* getPositions(int axis) const { return pos_[axis].data(); }
+			const float* getDimensions(int axis) const { return dim_[axis].data(); }
+			const color_vector* getColors() const { return color_.data(); }
+		private:
+			void resize(size_t n);
+			void move(size_t from, size_t to);
+
+			std::vector<float> pos_[3];
+			std::vector<float> dir_[3];
+			std::vector<float> dim_[3];
+			std::vector<float> time_to_live_;
+			std::vector<float> initial_time_to_live_;
+			std::vector<float> mass_;
+			std::vector<float> velocity_;
+			std::vector<color_vector> color_;
+			std::vector<glm::quat> orientation_;
+			std::vector<PhysicsParameters> initial_;
+			std::vector<Emitter*> emitted_by_;
+		};
+
 		// General class for emitter objects which encapsulate and exposes physical parameters
 		// Used as a base class for everything that is not 
 		class EmitObject : public Particle
@@ -119,7 +196,7 @@ namespace KRE
 			EmitObjectPtr getEmitObject(const std::string& name);
 			void setParent(std::weak_ptr<ParticleSystem> parent);
 			// Direct access here for *speed* reasons.
-			std::vector<Particle>& getActiveParticles() { return active_particles_; }
+			ParticleBuffer& getActiveParticles() { return active_particles_; }
 			std::vector<EmitterPtr>& getInstancedEmitters() { return instanced_emitters_; }
 			std::vector<AffectorPtr>& getInstancedAffectors() { return instanced_affectors_; }
 			void addEmitter(EmitterPtr e);
@@ -154,7 +231,7 @@ namespace KRE
 			std::weak_ptr<ParticleSystem> particle_system_;
 
 			// List of particles currently active.
-			std::vector<Particle> active_particles_;
+			ParticleBuffer active_particles_;
 
 			Technique();
 		};
@@ -39,6 +39,7 @@ namespace KRE
 			explicit TimeColorAffector(std::weak_ptr<ParticleSystemContainer> parent, const variant& node);
 		protected:
 			virtual void internalApply(Particle& p, float t);
+			void applyToParticles(ParticleBuffer& particles, float t) override;
 			AffectorPtr clone() const override {
 				return std::make_shared<TimeColorAffector>(*this);
 			}
@@ -69,13 +70,29 @@ namespace KRE
 			ParameterPtr acceleration_;
 			JetAffector();
 		};
+		// Adds a constant force to the direction of the particles, scaled by the
+		// time step, or averages the direction with the force.
+		class LinearForceAffector : public Affector
+		{
+		public:
+			explicit LinearForceAffector(std::weak_ptr<ParticleSystemContainer> parent, const variant& node);
+		protected:
+			virtual void internalApply(Particle& p, float t);
+			void applyToParticles(ParticleBuffer& particles, float t) override;
+			AffectorPtr clone() const override {
+				return std::make_shared<LinearForceAffector>(*this);
+			}
+		private:
+			glm::vec3 force_vector_;
+			bool average_;
+			LinearForceAffector();
+		};
+
 		// affectors to add: box_collider (width,height,depth, inner or outer collide, friction)
 		// forcefield (delta, force, octaves, frequency, amplitude, persistence, size, worldsize(w,h,d), movement(x,y,z),movement_frequency)
 		// geometry_rotator (use own rotation, speed(parameter), axis(x,y,z))
 		// inter_particle_collider (sounds like a lot of calculations)
 		// line
-		// linear_force
-		// path_follower
 		// plane_collider
 		// scale_velocity (parameter_ptr scale; bool since_system_start, bool stop_at_flip)
 		// sphere_collider
@@ -89,6 +106,7 @@ namespace KRE
 			explicit ScaleAffector(std::weak_ptr<ParticleSystemContainer> parent, const variant& node);
 		protected:
 			virtual void internalApply(Particle& p, float t);
+			void applyToParticles(ParticleBuffer& particles, float t) override;
 			AffectorPtr clone() const override {
 				return std::make_shared<ScaleAffector>(*this);
 			}
@@ -99,6 +117,8 @@ namespace KRE
 			ParameterPtr scale_xyz_;
 			bool since_system_start_;
 			float calculateScale(ParameterPtr s, const Particle& p);
+			void applyScale(ParticleBuffer& particles, ParameterPtr s, bool x, bool y, bool z);
+			std::vector<float> scales_;
 			ScaleAffector();
 		};
 
@@ -141,21 +161,23 @@ namespace KRE
 			}
 		protected:
 			virtual void handleEmitProcess(float t) override {
-				std::vector<Particle>& particles = getTechnique()->getActiveParticles();
+				ParticleBuffer& particles = getTechnique()->getActiveParticles();
 				// keeps particles following wihin [min_distance, max_distance]
 				if(particles.size() < 1) {
 					return;
 				}
-				prev_particle_ = particles.begin();
-				for(auto p = particles.begin(); p != particles.end(); ++p) {
-					internalApply(*p, t);
-					prev_particle_ = p;
+				prev_position_ = particles.getPosition(0);
+				for(size_t n = 0; n != particles.size(); ++n) {
+					Particle p = particles.get(n);
+					internalApply(p, t);
+					particles.set(n, p);
+					prev_position_ = p.current.position;
 				}
 			}
 			virtual void internalApply(Particle& p, float t) override {
-				auto distance = glm::length(p.current.position - prev_particle_->current.position);
+				auto distance = glm::length(p.current.position - prev_position_);
 				if(distance > min_distance_ && distance < max_distance_) {
-					p.current.position = prev_particle_->current.position + (min_distance_/distance)*(p.current.position-prev_particle_->current.position);
+					p.current.position = prev_position_ + (min_distance_/distance)*(p.current.position-prev_position_);
 				}
 			}
 			AffectorPtr clone() const override {
@@ -164,7 +186,7 @@ namespace KRE
 		private:
 			float min_distance_;
 			float max_distance_;
-			std::vector<Particle>::iterator prev_particle_;
+			glm::vec3 prev_position_;
 			ParticleFollowerAffector();
 		};
 
@@ -178,7 +200,7 @@ namespace KRE
 			}
 		protected:
 			virtual void internalApply(Particle& p, float t) override {
-				glm::vec3 distance = prev_particle_->current.position - p.current.position;
+				glm::vec3 distance = prev_position_ - p.current.position;
 				if(resize_) {
 					p.current.dimensions.y = glm::length(distance);
 				}
@@ -190,14 +212,16 @@ namespace KRE
 				p.current.orientation.z = distance.z;
 			}
 			virtual void handleEmitProcess(float t) override {
-				std::vector<Particle>& particles = getTechnique()->getActiveParticles();
+				ParticleBuffer& particles = getTechnique()->getActiveParticles();
 				if(particles.size() < 1) {
 					return;
 				}
-				prev_particle_ = particles.begin();				
-				for(auto p = particles.begin(); p != particles.end(); ++p) {
-					internalApply(*p, t);
-					prev_particle_ = p;
+				prev_position_ = particles.getPosition(0);
+				for(size_t n = 0; n != particles.size(); ++n) {
+					Particle p = particles.get(n);
+					internalApply(p, t);
+					particles.set(n, p);
+					prev_position_ = p.current.position;
 				}
 			}
 			virtual AffectorPtr clone() const override {
@@ -205,7 +229,7 @@ namespace KRE
 			}
 		private:
 			bool resize_;			
-			std::vector<Particle>::iterator prev_particle_;
+			glm::vec3 prev_position_;
 			AlignAffector();
 		};
 
@@ -222,21 +246,21 @@ namespace KRE
 				p.current.direction = (average_ - p.current.position) * t;
 			}
 			virtual void handleEmitProcess(float t) override {
-				std::vector<Particle>& particles = getTechnique()->getActiveParticles();
+				ParticleBuffer& particles = getTechnique()->getActiveParticles();
 				if(particles.size() < 1) {
 					return;
 				}
 				auto count = particles.size();
 				glm::vec3 sum(0.0f);
-				for(const auto& p : particles) {
-					sum += p.current.position;
+				for(size_t n = 0; n != count; ++n) {
+					sum += particles.getPosition(n);
 				}
 				average_ /= static_cast<float>(count);
 
-				prev_particle_ = particles.begin();				
-				for(auto p = particles.begin(); p != particles.end(); ++p) {
-					internalApply(*p, t);
-					prev_particle_ = p;
+				for(size_t n = 0; n != count; ++n) {
+					Particle p = particles.get(n);
+					internalApply(p, t);
+					particles.set(n, p);
 				}
 			}
 			AffectorPtr clone() const override {
@@ -244,7 +268,6 @@ namespace KRE
 			}
 		private:
 			glm::vec3 average_;
-			std::vector<Particle>::iterator prev_particle_;
 			FlockCenteringAffector();
 		};
 
@@ -309,15 +332,11 @@ namespace KRE
 				p.current.position += spl_->interpolate(time_fraction_next) - spl_->interpolate(time_fraction);
 			}
 			virtual void handleEmitProcess(float t) override {
-				std::vector<Particle>& particles = getTechnique()->getActiveParticles();
-				if(particles.size() < 1) {
-					return;
-				}
-
-				prev_particle_ = particles.begin();				
-				for(auto p = particles.begin(); p != particles.end(); ++p) {
-					internalApply(*p, t);
-					prev_particle_ = p;
+				ParticleBuffer& particles = getTechnique()->getActiveParticles();
+				for(size_t n = 0; n != particles.size(); ++n) {
+					Particle p = particles.get(n);
+					internalApply(p, t);
+					particles.set(n, p);
 				}
 			}
 			AffectorPtr clone() const override {
@@ -326,7 +345,6 @@ namespace KRE
 		private:
 			std::shared_ptr<geometry::spline3d<float>> spl_;
 			std::vector<glm::vec3> points_;
-			std::vector<Particle>::iterator prev_particle_;
 			PathFollowerAffector();
 		};
 
@@ -364,12 +382,14 @@ namespace KRE
 						get_random_float(-max_deviation_.z, max_deviation_.z));
 				}
 			}
-			void handle_apply(std::vector<Particle>& particles, float t) {
+			void handle_apply(ParticleBuffer& particles, float t) {
 				last_update_time_[0] += t;
 				if(last_update_time_[0] > time_step_) {
 					last_update_time_[0] -= time_step_;
-					for(auto& p : particles) {
+					for(size_t n = 0; n != particles.size(); ++n) {
+						Particle p = particles.get(n);
 						internalApply(p, t);
+						particles.set(n, p);
 					}
 				}
 			}
@@ -456,6 +476,13 @@ namespace KRE
 					p.current.direction = (p.current.direction + force_vector_)/2.0f;
 				}
 			}
+			void applyToParticles(ParticleBuffer& particles, float t) override {
+				if(fa_ == FA_ADD) {
+					particles.addToDirections(scale_vector_);
+				} else {
+					particles.averageDirections(force_vector_);
+				}
+			}
 			AffectorPtr clone() const {
 				return std::make_shared<SineForceAffector>(*this);
 			}
@@ -513,10 +540,26 @@ namespace KRE
 					internalApply(*e,t);
 				}
 			}
-			for(auto& p : tq->getActiveParticles()) {
-				ASSERT_LOG(p.emitted_by != nullptr, "p.emitted_by is null");
-				if(!isEmitterExcluded(p.emitted_by->name())) {
+			if(excluded_emitters_.empty()) {
+				applyToParticles(tq->getActiveParticles(), t);
+			} else {
+				applyToEachParticle(tq->getActiveParticles(), t);
+			}
+		}
+
+		void Affector::applyToParticles(ParticleBuffer& particles, float t)
+		{
+			applyToEachParticle(particles, t);
+		}
+
+		void Affector::applyToEachParticle(ParticleBuffer& particles, float t)
+		{
+			for(size_t n = 0; n != particles.size(); ++n) {
+				ASSERT_LOG(particles.getEmittedBy(n) != nullptr, "p.emitted_by is null");
+				if(!isEmitterExcluded(particles.getEmittedBy(n)->name())) {
+					Particle p = particles.get(n);
 					internalApply(p,t);
+					particles.set(n, p);
 				}
 			}
 		}
@@ -554,6 +597,8 @@ namespace KRE
 				return std::make_shared<BlackHoleAffector>(parent, node);
 			} else if(ntype == "flock_centering") {
 				return std::make_shared<FlockCenteringAffector>(parent, node);
+			} else if(ntype == "linear_force") {
+				return std::make_shared<LinearForceAffector>(parent, node);
 			} else {
 				ASSERT_LOG(false, "Unrecognised affector type: " << ntype);
 			}
@@ -646,6 +691,11 @@ namespace KRE
 			}
 		}
 
+		void TimeColorAffector::applyToParticles(ParticleBuffer& particles, float t)
+		{
+			particles.interpolateColors(tc_data_, operation_ == COLOR_OP_MULTIPLY);
+		}
+
 		// Find nearest iterator to the time fraction "dt"
 		std::vector<TimeColorAffector::tc_pair>::iterator TimeColorAffector::find_nearest_color(float dt)
 		{
@@ -682,6 +732,42 @@ namespace KRE
 			}
 		}
 
+		LinearForceAffector::LinearForceAffector(std::weak_ptr<ParticleSystemContainer> parent, const variant& node)
+			: Affector(parent, node), 
+			  force_vector_(0.0f),
+			  average_(false)
+		{
+			if(node.has_key("force_vector")) {
+				force_vector_ = variant_to_vec3(node["force_vector"]);
+			}
+			if(node.has_key("force_application")) {
+				const std::string& fa = node["force_application"].as_string();
+				if(fa == "average") {
+					average_ = true;
+				} else {
+					ASSERT_LOG(fa == "add", "'force_application' attribute should have value average or add");
+				}
+			}
+		}
+
+		void LinearForceAffector::internalApply(Particle& p, float t)
+		{
+			if(average_) {
+				p.current.direction = (p.current.direction + force_vector_)/2.0f;
+			} else {
+				p.current.direction += force_vector_ * t;
+			}
+		}
+
+		void LinearForceAffector::applyToParticles(ParticleBuffer& particles, float t)
+		{
+			if(average_) {
+				particles.averageDirections(force_vector_);
+			} else {
+				particles.addToDirections(force_vector_ * t);
+			}
+		}
+
 		VortexAffector::VortexAffector(std::weak_ptr<ParticleSystemContainer> parent, const variant& node)
 			: Affector(parent, node), 
 			  rotation_axis_(1.0f, 0.0f, 0.0f, 0.0f)
@@ -776,7 +862,7 @@ namespace KRE
 				}
 				if(scale_y_) {
 					float calc_scale = calculateScale(scale_y_, p);
-					float value = p.current.dimensions.x + calc_scale /** affector_scale.y*/;
+					float value = p.current.dimensions.y + calc_scale /** affector_scale.y*/;
 					if(value > 0) {
 						p.current.dimensions.y = value;
 					}
@@ -790,5 +876,44 @@ namespace KRE
 				}
 			}
 		}
+
+		void ScaleAffector::applyToParticles(ParticleBuffer& particles, float t)
+		{
+			if(scale_xyz_) {
+				applyScale(particles, scale_xyz_, true, true, true);
+			} else {
+				if(scale_x_) {
+					applyScale(particles, scale_x_, true, false, false);
+				}
+				if(scale_y_) {
+					applyScale(particles, scale_y_, false, true, false);
+				}
+				if(scale_z_) {
+					applyScale(particles, scale_z_, false, false, true);
+				}
+			}
+		}
+
+		void ScaleAffector::applyScale(ParticleBuffer& particles, ParameterPtr s, bool x, bool y, bool z)
+		{
+			if(s->type() == ParameterType::FIXED) {
+				particles.addToDimensions(s->getValue(), x, y, z);
+				return;
+			}
+			// Other parameters may give a different value each time they're
+			// evaluated, so they're evaluated once per particle.
+			scales_.resize(particles.size());
+			if(since_system_start_) {
+				const float elapsed = getTechnique()->getParticleSystem()->getElapsedTime();
+				for(size_t n = 0; n != particles.size(); ++n) {
+					scales_[n] = s->getValue(elapsed);
+				}
+			} else {
+				for(size_t n = 0; n != particles.size(); ++n) {
+					scales_[n] = s->getValue(particles.getLifeFraction(n));
+				}
+			}
+			particles.addToDimensions(scales_.data(), x, y, z);
+		}
 	}
 }
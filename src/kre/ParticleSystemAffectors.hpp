@@ -51,6 +51,11 @@ namespace KRE
 		protected:
 			virtual void handleEmitProcess(float t);
 			virtual void internalApply(Particle& p, float t) = 0;
+			// Applies the affector to all the particles of the technique. By
+			// default this calls internalApply() on each particle in turn;
+			// affectors which can update the whole buffer at once override it.
+			virtual void applyToParticles(ParticleBuffer& particles, float t);
+			void applyToEachParticle(ParticleBuffer& particles, float t);
 		private:
 			bool enabled_;
 			float mass_;
@@ -0,0 +1,598 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARTICLES_USE_SSE2
+#endif
+
+#include "asserts.hpp"
+#include "ParticleSystem.hpp"
+#include "unit_test.hpp"
+
+// The update kernels below process four particles at a time when SSE2 is
+// available, then finish off any remainder one at a time. The arrays aren't
+// aligned, so unaligned loads and stores are used throughout.
+namespace KRE
+{
+	namespace Particles
+	{
+		namespace
+		{
+			unsigned char to_color_component(float c)
+			{
+				return static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, c)));
+			}
+
+#ifdef PARTICLES_USE_SSE2
+			// mask ? a : b
+			inline __m128 select(__m128 mask, __m128 a, __m128 b)
+			{
+				return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+			}
+
+			void add_if_positive(float* dim, const float* scale, size_t count, size_t* n)
+			{
+				const __m128 zero = _mm_setzero_ps();
+				for(; *n + 4 <= count; *n += 4) {
+					const __m128 d = _mm_loadu_ps(dim + *n);
+					const __m128 v = _mm_add_ps(d, _mm_loadu_ps(scale + *n));
+					_mm_storeu_ps(dim + *n, select(_mm_cmpgt_ps(v, zero), v, d));
+				}
+			}
+
+			void add_if_positive(float* dim, float scale, size_t count, size_t* n)
+			{
+				const __m128 zero = _mm_setzero_ps();
+				const __m128 s = _mm_set1_ps(scale);
+				for(; *n + 4 <= count; *n += 4) {
+					const __m128 d = _mm_loadu_ps(dim + *n);
+					const __m128 v = _mm_add_ps(d, s);
+					_mm_storeu_ps(dim + *n, select(_mm_cmpgt_ps(v, zero), v, d));
+				}
+			}
+#endif
+
+			void add_to_dimension(float* dim, const float* scale, size_t count)
+			{
+				size_t n = 0;
+#ifdef PARTICLES_USE_SSE2
+				add_if_positive(dim, scale, count, &n);
+#endif
+				for(; n < count; ++n) {
+					const float value = dim[n] + scale[n];
+					if(value > 0) {
+						dim[n] = value;
+					}
+				}
+			}
+
+			void add_to_dimension(float* dim, float scale, size_t count)
+			{
+				size_t n = 0;
+#ifdef PARTICLES_USE_SSE2
+				add_if_positive(dim, scale, count, &n);
+#endif
+				for(; n < count; ++n) {
+					const float value = dim[n] + scale;
+					if(value > 0) {
+						dim[n] = value;
+					}
+				}
+			}
+
+			// The color of the keys at the time fraction f. The keys are searched
+			// the same way as TimeColorAffector::find_nearest_color(), so a time
+			// before the first key extrapolates the first pair of keys and a time
+			// after the last key gives the last color.
+			glm::vec4 interpolate_keys(const std::vector<std::pair<float, glm::vec4>>& keys, float f)
+			{
+				size_t k = 0;
+				for(size_t i = 1; i < keys.size(); ++i) {
+					if(f >= keys[i].first) {
+						k = i;
+					}
+				}
+				if(k + 1 == keys.size()) {
+					return keys[k].second;
+				}
+				return keys[k].second + (keys[k+1].second - keys[k].second) * ((f - keys[k].first) / (keys[k+1].first - keys[k].first));
+			}
+		}
+
+		void ParticleBuffer::reserve(size_t n)
+		{
+			for(int axis = 0; axis != 3; ++axis) {
+				pos_[axis].reserve(n);
+				dir_[axis].reserve(n);
+				dim_[axis].reserve(n);
+			}
+			time_to_live_.reserve(n);
+			initial_time_to_live_.reserve(n);
+			mass_.reserve(n);
+			velocity_.reserve(n);
+			color_.reserve(n);
+			orientation_.reserve(n);
+			initial_.reserve(n);
+			emitted_by_.reserve(n);
+		}
+
+		void ParticleBuffer::clear()
+		{
+			resize(0);
+		}
+
+		void ParticleBuffer::resize(size_t n)
+		{
+			for(int axis = 0; axis != 3; ++axis) {
+				pos_[axis].resize(n);
+				dir_[axis].resize(n);
+				dim_[axis].resize(n);
+			}
+			time_to_live_.resize(n);
+			initial_time_to_live_.resize(n);
+			mass_.resize(n);
+			velocity_.resize(n);
+			color_.resize(n);
+			orientation_.resize(n);
+			initial_.resize(n);
+			emitted_by_.resize(n);
+		}
+
+		void ParticleBuffer::push_back(const Particle& p)
+		{
+			resize(size() + 1);
+			set(size() - 1, p);
+		}
+
+		Particle ParticleBuffer::get(size_t n) const
+		{
+			Particle p;
+			p.current.position = getPosition(n);
+			p.current.color = color_[n];
+			p.current.dimensions = getDimensions(n);
+			p.current.time_to_live = time_to_live_[n];
+			p.current.mass = mass_[n];
+			p.current.velocity = velocity_[n];
+			p.current.direction = glm::vec3(dir_[0][n], dir_[1][n], dir_[2][n]);
+			p.current.orientation = orientation_[n];
+			p.initial = initial_[n];
+			p.emitted_by = emitted_by_[n];
+			return p;
+		}
+
+		void ParticleBuffer::set(size_t n, const Particle& p)
+		{
+			for(int axis = 0; axis != 3; ++axis) {
+				pos_[axis][n] = p.current.position[axis];
+				dir_[axis][n] = p.current.direction[axis];
+				dim_[axis][n] = p.current.dimensions[axis];
+			}
+			color_[n] = p.current.color;
+			time_to_live_[n] = p.current.time_to_live;
+			initial_time_to_live_[n] = p.initial.time_to_live;
+			mass_[n] = p.current.mass;
+			velocity_[n] = p.current.velocity;
+			orientation_[n] = p.current.orientation;
+			initial_[n] = p.initial;
+			emitted_by_[n] = p.emitted_by;
+		}
+
+		void ParticleBuffer::move(size_t from, size_t to)
+		{
+			for(int axis = 0; axis != 3; ++axis) {
+				pos_[axis][to] = pos_[axis][from];
+				dir_[axis][to] = dir_[axis][from];
+				dim_[axis][to] = dim_[axis][from];
+			}
+			color_[to] = color_[from];
+			time_to_live_[to] = time_to_live_[from];
+			initial_time_to_live_[to] = initial_time_to_live_[from];
+			mass_[to] = mass_[from];
+			velocity_[to] = velocity_[from];
+			orientation_[to] = orientation_[from];
+			initial_[to] = initial_[from];
+			emitted_by_[to] = emitted_by_[from];
+		}
+
+		void ParticleBuffer::decayTimeToLive(float t)
+		{
+			float* ttl = time_to_live_.data();
+			const size_t count = size();
+			size_t n = 0;
+#ifdef PARTICLES_USE_SSE2
+			const __m128 dt = _mm_set1_ps(t);
+			for(; n + 4 <= count; n += 4) {
+				_mm_storeu_ps(ttl + n, _mm_sub_ps(_mm_loadu_ps(ttl + n), dt));
+			}
+#endif
+			for(; n < count; ++n) {
+				ttl[n] -= t;
+			}
+		}
+
+		void ParticleBuffer::clampVelocities(float max_velocity)
+		{
+			float* dx = dir_[0].data();
+			float* dy = dir_[1].data();
+			float* dz = dir_[2].data();
+			const float* velocity = velocity_.data();
+			const size_t count = size();
+			size_t n = 0;
+#ifdef PARTICLES_USE_SSE2
+			const __m128 max_v = _mm_set1_ps(max_velocity);
+			for(; n + 4 <= count; n += 4) {
+				const __m128 x = _mm_loadu_ps(dx + n);
+				const __m128 y = _mm_loadu_ps(dy + n);
+				const __m128 z = _mm_loadu_ps(dz + n);
+				const __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+				const __m128 too_fast = _mm_cmpgt_ps(_mm_mul_ps(_mm_loadu_ps(velocity + n), len), max_v);
+				const __m128 scale = _mm_div_ps(max_v, len);
+				_mm_storeu_ps(dx + n, select(too_fast, _mm_mul_ps(x, scale), x));
+				_mm_storeu_ps(dy + n, select(too_fast, _mm_mul_ps(y, scale), y));
+				_mm_storeu_ps(dz + n, select(too_fast, _mm_mul_ps(z, scale), z));
+			}
+#endif
+			for(; n < count; ++n) {
+				const float len = std::sqrt(dx[n]*dx[n] + dy[n]*dy[n] + dz[n]*dz[n]);
+				if(velocity[n] * len > max_velocity) {
+					const float scale = max_velocity / len;
+					dx[n] *= scale;
+					dy[n] *= scale;
+					dz[n] *= scale;
+				}
+			}
+		}
+
+		void ParticleBuffer::integratePositions(float t)
+		{
+			const size_t count = size();
+			for(int axis = 0; axis != 3; ++axis) {
+				float* pos = pos_[axis].data();
+				const float* dir = dir_[axis].data();
+				size_t n = 0;
+#ifdef PARTICLES_USE_SSE2
+				const __m128 dt = _mm_set1_ps(t);
+				for(; n + 4 <= count; n += 4) {
+					_mm_storeu_ps(pos + n, _mm_add_ps(_mm_loadu_ps(pos + n), _mm_mul_ps(_mm_loadu_ps(dir + n), dt)));
+				}
+#endif
+				for(; n < count; ++n) {
+					pos[n] += dir[n] * t;
+				}
+			}
+		}
+
+		void ParticleBuffer::addToDirections(const glm::vec3& v)
+		{
+			const size_t count = size();
+			for(int axis = 0; axis != 3; ++axis) {
+				float* dir = dir_[axis].data();
+				const float value = v[axis];
+				size_t n = 0;
+#ifdef PARTICLES_USE_SSE2
+				const __m128 add = _mm_set1_ps(value);
+				for(; n + 4 <= count; n += 4) {
+					_mm_storeu_ps(dir + n, _mm_add_ps(_mm_loadu_ps(dir + n), add));
+				}
+#endif
+				for(; n < count; ++n) {
+					dir[n] += value;
+				}
+			}
+		}
+
+		void ParticleBuffer::averageDirections(const glm::vec3& v)
+		{
+			const size_t count = size();
+			for(int axis = 0; axis != 3; ++axis) {
+				float* dir = dir_[axis].data();
+				const float value = v[axis];
+				size_t n = 0;
+#ifdef PARTICLES_USE_SSE2
+				const __m128 add = _mm_set1_ps(value);
+				const __m128 half = _mm_set1_ps(0.5f);
+				for(; n + 4 <= count; n += 4) {
+					_mm_storeu_ps(dir + n, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(dir + n), add), half));
+				}
+#endif
+				for(; n < count; ++n) {
+					dir[n] = (dir[n] + value) / 2.0f;
+				}
+			}
+		}
+
+		void ParticleBuffer::addToDimensions(const float* scale, bool x, bool y, bool z)
+		{
+			const bool axes[] = { x, y, z };
+			for(int axis = 0; axis != 3; ++axis) {
+				if(axes[axis]) {
+					add_to_dimension(dim_[axis].data(), scale, size());
+				}
+			}
+		}
+
+		void ParticleBuffer::addToDimensions(float scale, bool x, bool y, bool z)
+		{
+			const bool axes[] = { x, y, z };
+			for(int axis = 0; axis != 3; ++axis) {
+				if(axes[axis]) {
+					add_to_dimension(dim_[axis].data(), scale, size());
+				}
+			}
+		}
+
+		void ParticleBuffer::interpolateColors(const std::vector<std::pair<float, glm::vec4>>& keys, bool multiply)
+		{
+			if(keys.empty()) {
+				return;
+			}
+
+			const size_t count = size();
+			const float* ttl = time_to_live_.data();
+			const float* initial_ttl = initial_time_to_live_.data();
+
+			auto store = [&](size_t n, const glm::vec4& c) {
+				const glm::vec4 scale = multiply
+					? glm::vec4(initial_[n].color.r, initial_[n].color.g, initial_[n].color.b, initial_[n].color.a)
+					: glm::vec4(255.0f);
+				color_[n] = color_vector(to_color_component(c.r * scale.r),
+					to_color_component(c.g * scale.g),
+					to_color_component(c.b * scale.b),
+					to_color_component(c.a * scale.a));
+			};
+
+			size_t n = 0;
+#ifdef PARTICLES_USE_SSE2
+			// Every segment between keys is evaluated for all four particles and
+			// the result kept for the lanes whose time is at or past the start of
+			// the segment, so each lane ends up with the last segment it reached.
+			const __m128 one = _mm_set1_ps(1.0f);
+			for(; n + 4 <= count; n += 4) {
+				const __m128 f = _mm_sub_ps(one, _mm_div_ps(_mm_loadu_ps(ttl + n), _mm_loadu_ps(initial_ttl + n)));
+				__m128 result[4];
+				for(size_t k = 0; k != keys.size(); ++k) {
+					const __m128 mask = k == 0 ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : _mm_cmpge_ps(f, _mm_set1_ps(keys[k].first));
+					__m128 frac = _mm_setzero_ps();
+					if(k + 1 != keys.size()) {
+						frac = _mm_div_ps(_mm_sub_ps(f, _mm_set1_ps(keys[k].first)), _mm_set1_ps(keys[k+1].first - keys[k].first));
+					}
+					for(int channel = 0; channel != 4; ++channel) {
+						const float c0 = keys[k].second[channel];
+						const float c1 = k + 1 != keys.size() ? keys[k+1].second[channel] : c0;
+						const __m128 c = _mm_add_ps(_mm_set1_ps(c0), _mm_mul_ps(_mm_set1_ps(c1 - c0), frac));
+						result[channel] = k == 0 ? c : select(mask, c, result[channel]);
+					}
+				}
+				float values[4][4];
+				for(int channel = 0; channel != 4; ++channel) {
+					_mm_storeu_ps(values[channel], result[channel]);
+				}
+				for(int lane = 0; lane != 4; ++lane) {
+					store(n + lane, glm::vec4(values[0][lane], values[1][lane], values[2][lane], values[3][lane]));
+				}
+			}
+#endif
+			for(; n < count; ++n) {
+				store(n, interpolate_keys(keys, 1.0f - ttl[n] / initial_ttl[n]));
+			}
+		}
+
+		bool ParticleBuffer::getBounds(glm::vec3* min_corner, glm::vec3* max_corner) const
+		{
+			const size_t count = size();
+			if(count == 0) {
+				return false;
+			}
+
+			// Each particle is drawn as a quad from its position to its
+			// position plus its width and height.
+			for(int axis = 0; axis != 3; ++axis) {
+				const float* pos = pos_[axis].data();
+				const float* dim = dim_[axis].data();
+				const bool has_extent = axis != 2;
+				float lo = pos[0], hi = pos[0];
+				for(size_t n = 0; n != count; ++n) {
+					const float a = pos[n];
+					const float b = has_extent ? a + dim[n] : a;
+					lo = std::min(lo, std::min(a, b));
+					hi = std::max(hi, std::max(a, b));
+				}
+				(*min_corner)[axis] = lo;
+				(*max_corner)[axis] = hi;
+			}
+
+			return true;
+		}
+
+		void ParticleBuffer::removeDead()
+		{
+			const size_t count = size();
+			size_t live = 0;
+			for(size_t n = 0; n != count; ++n) {
+				if(!(time_to_live_[n] < 0.0f)) {
+					if(live != n) {
+						move(n, live);
+					}
+					++live;
+				}
+			}
+			if(live != count) {
+				resize(live);
+			}
+		}
+	}
+}
+
+namespace
+{
+	using namespace KRE::Particles;
+
+	Particle make_test_particle(int n)
+	{
+		Particle p;
+		init_physics_parameters(p.initial);
+		p.initial.position = glm::vec3(float(n), float(n % 7), -float(n % 3));
+		p.initial.direction = glm::vec3(float(n % 5) - 2.0f, 1.0f, float(n % 11) * 0.25f);
+		p.initial.dimensions = glm::vec3(1.0f + float(n % 4), 2.0f, 0.5f);
+		p.initial.time_to_live = 1.0f + float(n % 13);
+		p.initial.velocity = float(n % 9);
+		p.initial.color = color_vector(n % 256, (n * 3) % 256, 200, 255);
+		p.current = p.initial;
+		p.current.time_to_live = p.initial.time_to_live * float(n % 10) / 10.0f;
+		p.emitted_by = nullptr;
+		return p;
+	}
+
+	bool close(float a, float b)
+	{
+		return std::abs(a - b) <= 1e-4f * std::max(1.0f, std::abs(a));
+	}
+}
+
+UNIT_TEST(particle_buffer_kernels)
+{
+	// 103 particles so that the kernels also have a remainder to handle
+	// one at a time.
+	ParticleBuffer buf;
+	std::vector<Particle> expected;
+	for(int n = 0; n != 103; ++n) {
+		expected.push_back(make_test_particle(n));
+		buf.push_back(expected.back());
+	}
+
+	std::vector<std::pair<float, glm::vec4>> keys;
+	keys.push_back(std::make_pair(0.2f, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f)));
+	keys.push_back(std::make_pair(0.5f, glm::vec4(0.0f, 1.0f, 0.0f, 0.5f)));
+	keys.push_back(std::make_pair(0.9f, glm::vec4(0.0f, 0.0f, 1.0f, 0.0f)));
+
+	buf.decayTimeToLive(0.25f);
+	buf.clampVelocities(4.0f);
+	buf.addToDirections(glm::vec3(0.5f, -1.0f, 2.0f));
+	buf.averageDirections(glm::vec3(1.0f, 1.0f, 1.0f));
+	buf.integratePositions(0.1f);
+	buf.addToDimensions(-1.5f, true, false, true);
+	buf.interpolateColors(keys, false);
+
+	for(auto& p : expected) {
+		p.current.time_to_live -= 0.25f;
+		const float len = glm::length(p.current.direction);
+		if(p.current.velocity * len > 4.0f) {
+			p.current.direction *= 4.0f / len;
+		}
+		p.current.direction += glm::vec3(0.5f, -1.0f, 2.0f);
+		p.current.direction = (p.current.direction + glm::vec3(1.0f, 1.0f, 1.0f)) / 2.0f;
+		p.current.position += p.current.direction * 0.1f;
+		if(p.current.dimensions.x - 1.5f > 0) {
+			p.current.dimensions.x -= 1.5f;
+		}
+		if(p.current.dimensions.z - 1.5f > 0) {
+			p.current.dimensions.z -= 1.5f;
+		}
+	}
+
+	for(size_t n = 0; n != expected.size(); ++n) {
+		const Particle p = buf.get(n);
+		const Particle& e = expected[n];
+		for(int axis = 0; axis != 3; ++axis) {
+			CHECK(close(p.current.position[axis], e.current.position[axis]), "position " << n);
+			CHECK(close(p.current.direction[axis], e.current.direction[axis]), "direction " << n);
+			CHECK(close(p.current.dimensions[axis], e.current.dimensions[axis]), "dimensions " << n);
+		}
+		CHECK(close(p.current.time_to_live, e.current.time_to_live), "time to live " << n);
+
+		const glm::vec4 c = interpolate_keys(keys, 1.0f - e.current.time_to_live / e.initial.time_to_live) * 255.0f;
+		for(int channel = 0; channel != 4; ++channel) {
+			CHECK(std::abs(int(p.current.color[channel]) - int(to_color_component(c[channel]))) <= 1, "color " << n);
+		}
+	}
+}
+
+UNIT_TEST(particle_buffer_remove_dead)
+{
+	ParticleBuffer buf;
+	for(int n = 0; n != 50; ++n) {
+		Particle p = make_test_particle(n);
+		p.current.time_to_live = n % 3 == 0 ? -1.0f : float(n);
+		buf.push_back(p);
+	}
+	buf.removeDead();
+
+	CHECK_EQ(buf.size(), size_t(33));
+	float last = -1.0f;
+	for(size_t n = 0; n != buf.size(); ++n) {
+		const Particle p = buf.get(n);
+		CHECK_NE(int(p.current.time_to_live) % 3, 0);
+		CHECK_GT(p.current.time_to_live, last);
+		CHECK_EQ(p.current.position.x, p.current.time_to_live);
+		last = p.current.time_to_live;
+	}
+}
+
+UNIT_TEST(particle_buffer_bounds)
+{
+	ParticleBuffer buf;
+	glm::vec3 min_corner, max_corner;
+	CHECK(!buf.getBounds(&min_corner, &max_corner), "empty buffer has bounds");
+
+	for(int n = 0; n != 10; ++n) {
+		buf.push_back(make_test_particle(n));
+	}
+
+	CHECK(buf.getBounds(&min_corner, &max_corner), "buffer has no bounds");
+	CHECK_EQ(min_corner.x, 0.0f);
+	CHECK_EQ(max_corner.x, 11.0f);
+	CHECK_EQ(min_corner.y, 0.0f);
+	CHECK_EQ(max_corner.y, 8.0f);
+	CHECK_EQ(min_corner.z, -2.0f);
+	CHECK_EQ(max_corner.z, 0.0f);
+}
+
+BENCHMARK(particle_buffer_update)
+{
+	// One frame of updating 100,000 particles with the common affectors.
+	ParticleBuffer buf;
+	buf.reserve(100000);
+	for(int n = 0; n != 100000; ++n) {
+		Particle p = make_test_particle(n);
+		p.current.time_to_live = p.initial.time_to_live = 1e9f;
+		buf.push_back(p);
+	}
+
+	std::vector<std::pair<float, glm::vec4>> keys;
+	keys.push_back(std::make_pair(0.0f, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)));
+	keys.push_back(std::make_pair(0.5f, glm::vec4(1.0f, 0.5f, 0.0f, 0.8f)));
+	keys.push_back(std::make_pair(1.0f, glm::vec4(0.2f, 0.2f, 0.2f, 0.0f)));
+
+	BENCHMARK_LOOP {
+		buf.addToDirections(glm::vec3(0.0f, -9.8f / 60.0f, 0.0f));
+		buf.addToDimensions(0.01f, true, true, true);
+		buf.interpolateColors(keys, false);
+		buf.decayTimeToLive(1.0f / 60.0f);
+		buf.removeDead();
+		buf.integratePositions(1.0f / 60.0f);
+	}
+}
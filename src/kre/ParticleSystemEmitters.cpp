@@ -335,33 +335,26 @@ namespace KRE
 		void Emitter::handleEmitProcess(float t) 
 		{
 			auto tq = getTechnique();
-			std::vector<Particle>& particles = tq->getActiveParticles();
+			ParticleBuffer& particles = tq->getActiveParticles();
 
 			float duration = duration_->getValue(static_cast<float>(t));
 			if(duration == 0.0f || duration_remaining_ >= 0.0f) {
 				if(emits_type_ == EmitsType::VISUAL) {
-					std::vector<Particle>::iterator start;
-
 					//create_particles(particles, start, end, t);
 					size_t cnt = calculateParticlesToEmit(t, tq->getQuota(), particles.size());
-					// XXX: techincally this shouldn't be needed as we reserve the default quota upon initialising
-					// the particle list. We could hit some pathological case where we allocate particles past
-					// the quota (since it isn't enforced yet). This saves us from start from being invalidated
-					// if push_back were to cause a reallocation.
-					auto last_index = particles.size();
-					particles.resize(particles.size() + cnt);
-					//start = particles.end();
-					for(size_t n = 0; n != cnt; ++n) {
-						Particle p;
+					// New particles are set up as whole particles, since the emitters
+					// initialise them one at a time, then moved into the buffer.
+					created_particles_.resize(cnt);
+					for(auto& p : created_particles_) {
 						initParticle(p, t);
-						particles[n+last_index] = p;
 					}
-
-                    start = particles.begin() + last_index;
-					for(auto it = start; it != particles.end(); ++it) {
-						internalCreate(*it, t);
+					for(auto& p : created_particles_) {
+						internalCreate(p, t);
+					}
+					setParticleStartingValues(created_particles_.begin(), created_particles_.end());
+					for(const auto& p : created_particles_) {
+						particles.push_back(p);
 					}
-					setParticleStartingValues(start, particles.end());
 				} else {
 					if(emits_type_ == EmitsType::EMITTER) {
 						size_t cnt = calculateParticlesToEmit(t, tq->getEmitterQuota(), tq->getInstancedEmitters().size());
@@ -100,6 +100,8 @@ namespace KRE
 			float duration_remaining_;
 			// time remaining till a stopped emitter restarts.
 			float repeat_delay_remaining_;
+			// particles created this frame, before they're added to the technique.
+			std::vector<Particle> created_particles_;
 
 			Emitter();
 		};
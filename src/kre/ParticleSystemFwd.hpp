@@ -44,6 +44,7 @@ namespace KRE
 		typedef std::shared_ptr<ParticleSystem> ParticleSystemPtr;
 		class Technique;
 		typedef std::shared_ptr<Technique> TechniquePtr;
+		class ParticleBuffer;
 		class Parameter;
 		typedef std::shared_ptr<Parameter> ParameterPtr;
 		class Emitter;
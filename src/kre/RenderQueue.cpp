@@ -21,15 +21,19 @@
 	   distribution.
 */
 
+#include <algorithm>
+
 #include "asserts.hpp"
 #include "Renderable.hpp"
 #include "RenderQueue.hpp"
+#include "unit_test.hpp"
 #include "WindowManager.hpp"
 
 namespace KRE
 {
 	RenderQueue::RenderQueue(const std::string& name) 
-		: name_(name)
+		: sorted_(true),
+		  name_(name)
 	{
 	}
 
@@ -40,35 +44,109 @@ namespace KRE
 
 	void RenderQueue::enQueue(uint64_t order, RenderablePtr p)
 	{
-		renderables_[order] = p;
+		if(!renderables_.empty() && renderables_.back().order > order) {
+			sorted_ = false;
+		}
+		Entry e = { order, p };
+		renderables_.push_back(e);
 	}
 
 	void RenderQueue::deQueue(uint64_t order)
 	{
-		auto it = renderables_.find(order);
+		auto it = std::remove_if(renderables_.begin(), renderables_.end(), [order](const Entry& e) { return e.order == order; });
 		ASSERT_LOG(it != renderables_.end(), "RenderQueue(" << name() << ") nothing to dequeue at order: " << order);
-		renderables_.erase(it);
+		renderables_.erase(it, renderables_.end());
+	}
+
+	void RenderQueue::sortEntries(std::vector<Entry>* entries, std::vector<Entry>* scratch)
+	{
+		// A least significant digit radix sort, a byte at a time. Bytes
+		// which are the same in every key, which is most of them for the
+		// small orders normally used, are skipped.
+		uint64_t all_or = 0, all_and = ~uint64_t(0);
+		for(const Entry& e : *entries) {
+			all_or |= e.order;
+			all_and &= e.order;
+		}
+
+		const uint64_t varying = all_or ^ all_and;
+		scratch->resize(entries->size());
+		for(int shift = 0; shift != 64; shift += 8) {
+			if(((varying >> shift) & 0xff) == 0) {
+				continue;
+			}
+
+			size_t offsets[256] = {};
+			for(const Entry& e : *entries) {
+				++offsets[(e.order >> shift) & 0xff];
+			}
+
+			size_t total = 0;
+			for(size_t& offset : offsets) {
+				const size_t count = offset;
+				offset = total;
+				total += count;
+			}
+
+			for(Entry& e : *entries) {
+				Entry& dst = (*scratch)[offsets[(e.order >> shift) & 0xff]++];
+				dst.order = e.order;
+				dst.r.swap(e.r);
+			}
+
+			entries->swap(*scratch);
+		}
+
+		scratch->clear();
 	}
 
 	void RenderQueue::preRender(const WindowPtr& wm)
 	{
-		for(auto r : renderables_) {
-			r.second->preRender(wm);
+		if(!sorted_) {
+			sortEntries(&renderables_, &scratch_);
+			sorted_ = true;
+		}
+
+		for(auto& r : renderables_) {
+			r.r->preRender(wm);
 		}
 	}
 
 	void RenderQueue::render(const WindowPtr& wm) const 
 	{
-		for(auto r : renderables_) {
-			wm->render(r.second.get());
+		for(auto& r : renderables_) {
+			wm->render(r.r.get());
 		}
 	}
 
 	void RenderQueue::postRender(const WindowPtr& wm)
 	{
-		for(auto r : renderables_) {
-			r.second->postRender(wm);
+		for(auto& r : renderables_) {
+			r.r->postRender(wm);
 		}
 		renderables_.clear();
+		sorted_ = true;
+	}
+}
+
+UNIT_TEST(render_queue_sort)
+{
+	using KRE::RenderQueue;
+	std::vector<RenderQueue::Entry> entries, scratch;
+	std::vector<uint64_t> expected;
+	uint64_t seed = 1;
+	for(int n = 0; n != 1000; ++n) {
+		seed = seed*6364136223846793005ULL + 1442695040888963407ULL;
+		const uint64_t order = n%3 == 0 ? (seed >> 60) : seed;
+		RenderQueue::Entry e = { order, KRE::RenderablePtr() };
+		entries.push_back(e);
+		expected.push_back(order);
+	}
+
+	std::sort(expected.begin(), expected.end());
+	RenderQueue::sortEntries(&entries, &scratch);
+	CHECK_EQ(entries.size(), expected.size());
+	for(size_t n = 0; n != entries.size(); ++n) {
+		CHECK_EQ(entries[n].order, expected[n]);
 	}
 }
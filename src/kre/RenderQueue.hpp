@@ -23,8 +23,8 @@
 
 #pragma once
 
-#include <map>
 #include <cstdint>
+#include <vector>
 
 #include "RenderFwd.hpp"
 #include "WindowManagerFwd.hpp"
@@ -45,8 +45,21 @@ namespace KRE
 		void postRender(const WindowPtr& wm);
 
 		static RenderQueuePtr create(const std::string& name);
+
+		// Sorts entries by their order, keeping entries with the same order
+		// in the order they were queued. Exposed for testing.
+		struct Entry
+		{
+			uint64_t order;
+			RenderablePtr r;
+		};
+		static void sortEntries(std::vector<Entry>* entries, std::vector<Entry>* scratch);
 	private:
-		std::map<uint64_t, RenderablePtr> renderables_;
+		// Renderables are appended as they're queued, and sorted once before
+		// the queue is drawn.
+		std::vector<Entry> renderables_;
+		std::vector<Entry> scratch_;
+		bool sorted_;
 		std::string name_;
 		RenderQueue();
 		RenderQueue(const RenderQueue&);
@@ -24,10 +24,33 @@
 #include "asserts.hpp"
 #include "DisplayDevice.hpp"
 #include "RenderTarget.hpp"
+#include "Shaders.hpp"
+#include "SpriteBatch.hpp"
 #include "variant_utils.hpp"
 
 namespace KRE
 {
+	namespace
+	{
+		int allocation_count = 0;
+
+		// Keeps at most this many render targets. If every one is in use
+		// when another is wanted the new one isn't pooled.
+		const size_t max_pooled_render_targets = 8;
+
+		struct PooledRenderTarget
+		{
+			RenderTargetPtr rt;
+			int last_used;
+		};
+
+		std::vector<PooledRenderTarget>& get_render_target_pool()
+		{
+			static std::vector<PooledRenderTarget> res;
+			return res;
+		}
+	}
+
 	RenderTarget::RenderTarget(int width, int height, 
 		int color_plane_count, 
 		bool depth, 
@@ -85,21 +108,25 @@ namespace KRE
 
 	void RenderTarget::on_create()
 	{
+		++allocation_count;
 		handleCreate();
 	}
 	
 	void RenderTarget::apply(const rect& r) const
 	{
+		SpriteBatch::flush();
 		handleApply(r);
 	}
 
 	void RenderTarget::unapply() const
 	{
+		SpriteBatch::flush();
 		handleUnapply();
 	}
 
 	void RenderTarget::clear() const
 	{
+		SpriteBatch::flush();
 		handleClear();
 	}
 
@@ -159,4 +186,49 @@ namespace KRE
 		return DisplayDevice::renderTargetInstance(width, height, color_plane_count, depth, stencil, use_multi_sampling, multi_samples);
 	}
 
+	RenderTargetPtr RenderTarget::acquire(int width, int height, 
+		unsigned color_plane_count, 
+		bool depth, 
+		bool stencil)
+	{
+		static int use_count = 0;
+		++use_count;
+
+		auto& pool = get_render_target_pool();
+		PooledRenderTarget* oldest_free = nullptr;
+		for(auto& entry : pool) {
+			if(entry.rt.use_count() != 1) {
+				continue;
+			}
+
+			const RenderTarget& rt = *entry.rt;
+			if(rt.width() == width && rt.height() == height && rt.getColorPlanes() == static_cast<int>(color_plane_count) && rt.getDepthPlane() == depth && rt.getStencilPlane() == stencil) {
+				entry.last_used = use_count;
+				entry.rt->setClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+				entry.rt->setShader(ShaderProgram::getSystemDefault());
+				return entry.rt;
+			}
+
+			if(oldest_free == nullptr || entry.last_used < oldest_free->last_used) {
+				oldest_free = &entry;
+			}
+		}
+
+		RenderTargetPtr rt = create(width, height, color_plane_count, depth, stencil);
+		if(pool.size() < max_pooled_render_targets) {
+			PooledRenderTarget entry = { rt, use_count };
+			pool.push_back(entry);
+		} else if(oldest_free != nullptr) {
+			oldest_free->rt = rt;
+			oldest_free->last_used = use_count;
+		}
+
+		return rt;
+	}
+
+	int RenderTarget::getAllocationCount()
+	{
+		return allocation_count;
+	}
+
 }
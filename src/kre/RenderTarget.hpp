@@ -76,6 +76,19 @@ namespace KRE
 			bool use_multi_sampling=false, 
 			unsigned multi_samples=0);
 		static RenderTargetPtr create(const variant& node);
+
+		// Render targets which are only needed for a pass, such as one drawn
+		// every frame, can be taken from a pool rather than created each time.
+		// A pooled render target is free again once the pool holds the only
+		// reference to it. Its clear color and shader are reset when it is
+		// handed out.
+		static RenderTargetPtr acquire(int width, int height, 
+			unsigned color_plane_count=1, 
+			bool depth=false, 
+			bool stencil=false);
+		// The number of render targets which have been created, used to
+		// report how often they're being allocated.
+		static int getAllocationCount();
 	protected:
 		explicit RenderTarget(int width, int height, 
 			int color_plane_count, 
@@ -23,7 +23,9 @@
 
 #include "asserts.hpp"
 #include "CameraObject.hpp"
+#include "DisplayDevice.hpp"
 #include "LightObject.hpp"
+#include "ModelMatrixScope.hpp"
 #include "RenderManager.hpp"
 #include "RenderTarget.hpp"
 #include "SceneGraph.hpp"
@@ -41,13 +43,41 @@ namespace KRE
 			return res;
 		}
 
+		int objects_culled = 0;
+		int objects_queued = 0;
+
+		struct ObjectBounds
+		{
+			glm::vec3 min_corner;
+			glm::vec3 max_corner;
+		};
+
+		// Replaces the box with the smallest axis aligned box containing it
+		// once transformed by m.
+		void transform_bounds(const glm::mat4& m, ObjectBounds* b)
+		{
+			const glm::vec3 size = b->max_corner - b->min_corner;
+			for(int n = 0; n != 8; ++n) {
+				const glm::vec4 corner(b->min_corner.x + ((n&1) ? size.x : 0.0f), 
+					b->min_corner.y + ((n&2) ? size.y : 0.0f), 
+					b->min_corner.z + ((n&4) ? size.z : 0.0f), 1.0f);
+				const glm::vec3 p(m * corner);
+				if(n == 0) {
+					b->min_corner = b->max_corner = p;
+				} else {
+					b->min_corner = glm::min(b->min_corner, p);
+					b->max_corner = glm::max(b->max_corner, p);
+				}
+			}
+		}
 	}
 
 	SceneNode::SceneNode(std::weak_ptr<SceneGraph> sg)
 		: scene_graph_(sg),
 		  position_(0.0f),
 		  rotation_(1.0f, 0.0f, 0.0f, 0.0f),
-		  scale_(1.0f)
+		  scale_(1.0f),
+		  has_bounds_(false)
 	{
 		ASSERT_LOG(scene_graph_.lock() != nullptr, "scene_graph_ was null.");
 	}
@@ -57,7 +87,8 @@ namespace KRE
 		  parent_(),
 		  position_(0.0f),
 		  rotation_(1.0f, 0.0f, 0.0f, 0.0f),
-		  scale_(1.0f)
+		  scale_(1.0f),
+		  has_bounds_(false)
 	{
 		ASSERT_LOG(scene_graph_.lock() != nullptr, "scene_graph_ was null.");
 		if(node.has_key("camera")) {
@@ -98,6 +129,7 @@ namespace KRE
 		  position_(op.position_),
 		  rotation_(op.rotation_),
 		  scale_(op.scale_),
+		  has_bounds_(false),
 		// Should we copy the pointers or create new instances ?
 		objects_(op.objects_)
 	{
@@ -166,12 +198,98 @@ namespace KRE
 			render_target_->clear();
 		}
 		
-		for(auto o : objects_) {
+		// Objects are culled against the view of the camera they'll be drawn
+		// with, which is the display's default camera if the scene has none.
+		// The box around all of the node's objects is tested first, so that
+		// when the whole node is in or out of view its objects don't need
+		// testing one at a time.
+		CameraPtr cull_camera = rp->camera ? rp->camera : DisplayDevice::getCurrent()->getDefaultCamera();
+		const Frustum* frustum = nullptr;
+		if(cull_camera) {
+			frustum = cull_camera->getFrustum().get();
+			if(frustum == nullptr) {
+				static Frustum* camera_frustum = new Frustum;
+				camera_frustum->updateMatrices(cull_camera->getProjectionMat(), cull_camera->getViewMat());
+				frustum = camera_frustum;
+			}
+		}
+
+		// Objects are drawn with the global model matrix applied as well as
+		// their own.
+		const bool use_global_model = is_global_model_matrix_valid();
+
+		static std::vector<ObjectBounds> object_bounds;
+		object_bounds.resize(objects_.size());
+		has_bounds_ = false;
+		int n = 0;
+		for(auto& o : objects_) {
+			if(o->hasBounds()) {
+				ObjectBounds& b = object_bounds[n];
+				o->getWorldBounds(&b.min_corner, &b.max_corner);
+				if(use_global_model) {
+					transform_bounds(get_global_model_matrix(), &b);
+				}
+				if(has_bounds_) {
+					bounds_min_ = glm::min(bounds_min_, b.min_corner);
+					bounds_max_ = glm::max(bounds_max_, b.max_corner);
+				} else {
+					bounds_min_ = b.min_corner;
+					bounds_max_ = b.max_corner;
+					has_bounds_ = true;
+				}
+			}
+			++n;
+		}
+
+		int node_visibility = 1;
+		if(frustum != nullptr && has_bounds_) {
+			const glm::vec3 size = bounds_max_ - bounds_min_;
+			node_visibility = frustum->doesCubeIntersect(bounds_min_, size.x, size.y, size.z);
+		}
+
+		n = 0;
+		for(auto& o : objects_) {
+			const ObjectBounds& b = object_bounds[n++];
+			if(o->hasBounds() && node_visibility <= 0) {
+				const glm::vec3 size = b.max_corner - b.min_corner;
+				if(node_visibility < 0 || !frustum->isCubeInside(b.min_corner, size.x, size.y, size.z)) {
+					++objects_culled;
+					continue;
+				}
+			}
+
 			o->setCamera(rp->camera);
 			o->setLights(rp->lights);
 			o->setRenderTarget(rp->render_target);
 			renderer->addRenderableToQueue(o->getQueue(), o->getOrder(), o);
+			++objects_queued;
+		}
+	}
+
+	bool SceneNode::getBounds(glm::vec3* min_corner, glm::vec3* max_corner) const
+	{
+		if(!has_bounds_) {
+			return false;
 		}
+		*min_corner = bounds_min_;
+		*max_corner = bounds_max_;
+		return true;
+	}
+
+	int SceneNode::getObjectsCulled()
+	{
+		return objects_culled;
+	}
+
+	int SceneNode::getObjectsQueued()
+	{
+		return objects_queued;
+	}
+
+	void SceneNode::resetObjectCounts()
+	{
+		objects_culled = 0;
+		objects_queued = 0;
 	}
 
 	void SceneNode::setPosition(const glm::vec3& position) 
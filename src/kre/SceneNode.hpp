@@ -74,6 +74,18 @@ namespace KRE
 
 		glm::mat4 getModelMatrix() const;
 
+		// The box containing the world bounds of the node's objects which
+		// have bounds, as of the last time the node was rendered. Returns
+		// false if none of them had bounds.
+		bool getBounds(glm::vec3* min_corner, glm::vec3* max_corner) const;
+
+		// The number of objects which have been left out of the render queue
+		// because they were out of view, and the number which were queued,
+		// since the counts were last reset.
+		static int getObjectsCulled();
+		static int getObjectsQueued();
+		static void resetObjectCounts();
+
 		static void registerObjectType(const std::string& type, ObjectTypeFunction fn);
 	private:
 		// No default or assignment constructors
@@ -91,6 +103,10 @@ namespace KRE
 		glm::quat rotation_;
 		glm::vec3 scale_;
 
+		bool has_bounds_;
+		glm::vec3 bounds_min_;
+		glm::vec3 bounds_max_;
+
 		friend std::ostream& operator<<(std::ostream& os, const SceneNode& node);
 	};
 
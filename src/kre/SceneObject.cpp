@@ -29,13 +29,15 @@ namespace KRE
 {
 	SceneObject::SceneObject(const std::string& name)
 		: name_(name), 
-		  queue_(0)
+		  queue_(0),
+		  has_bounds_(false)
 	{
 	}
 
 	SceneObject::SceneObject(const variant& node)
 		: Renderable(node),
-		  queue_(0)
+		  queue_(0),
+		  has_bounds_(false)
 	{
 		if(node.has_key("name")) {
 			name_ = node["name"].as_string();
@@ -48,4 +50,29 @@ namespace KRE
 	SceneObject::~SceneObject()
 	{
 	}
+
+	void SceneObject::setBounds(const glm::vec3& corner, const glm::vec3& size)
+	{
+		bounds_corner_ = corner;
+		bounds_size_ = size;
+		has_bounds_ = true;
+	}
+
+	void SceneObject::getWorldBounds(glm::vec3* min_corner, glm::vec3* max_corner) const
+	{
+		ASSERT_LOG(has_bounds_, "Asked for the bounds of an object without bounds: " << objectName());
+		const glm::mat4 model = getModelMatrix();
+		for(int n = 0; n != 8; ++n) {
+			const glm::vec3 corner(bounds_corner_.x + ((n&1) ? bounds_size_.x : 0.0f), 
+				bounds_corner_.y + ((n&2) ? bounds_size_.y : 0.0f), 
+				bounds_corner_.z + ((n&4) ? bounds_size_.z : 0.0f));
+			const glm::vec3 pt(model * glm::vec4(corner, 1.0f));
+			if(n == 0) {
+				*min_corner = *max_corner = pt;
+			} else {
+				*min_corner = glm::min(*min_corner, pt);
+				*max_corner = glm::max(*max_corner, pt);
+			}
+		}
+	}
 }
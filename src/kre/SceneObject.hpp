@@ -39,9 +39,22 @@ namespace KRE
 		void setQueue(size_t q) { queue_ = q; }
 		const std::string& objectName() const { return name_; }
 		void setObjectName(const std::string& name) { name_ = name; }
+
+		// A box, in the object's own coordinates, containing everything the
+		// object draws. It's used to skip objects which are out of view.
+		// Objects without bounds are always drawn.
+		void setBounds(const glm::vec3& corner, const glm::vec3& size);
+		void clearBounds() { has_bounds_ = false; }
+		bool hasBounds() const { return has_bounds_; }
+		// The bounds transformed by the model matrix, as the smallest axis
+		// aligned box containing them.
+		void getWorldBounds(glm::vec3* min_corner, glm::vec3* max_corner) const;
 	private:
 		size_t queue_;
 		std::string name_;
+		bool has_bounds_;
+		glm::vec3 bounds_corner_;
+		glm::vec3 bounds_size_;
 
 		SceneObject();
 	};
@@ -28,6 +28,7 @@
 #include "AttributeSet.hpp"
 #include "DisplayDevice.hpp"
 #include "ShadersOGL.hpp"
+#include "SpriteBatch.hpp"
 #include "TextureOGL.hpp"
 #include "UniformBufferOGL.hpp"
 
@@ -671,6 +672,7 @@ namespace KRE
 			//if(get_current_active_shader() == object_) {
 			//	return;
 			//}
+			KRE::SpriteBatch::flushForDraw();
 			glUseProgram(object_);
 			get_current_active_shader() = object_;
 		}
@@ -0,0 +1,181 @@
+/*
+	Copyright (C) 2003-2013 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include "ColorScope.hpp"
+#include "DisplayDevice.hpp"
+#include "ModelMatrixScope.hpp"
+#include "Shaders.hpp"
+#include "SpriteBatch.hpp"
+#include "WindowManager.hpp"
+
+namespace KRE
+{
+	namespace
+	{
+		int draw_calls = 0;
+		int sprites_batched = 0;
+		int batches_drawn = 0;
+
+		int last_frame_draw_calls = 0;
+		int last_frame_unbatched_draw_calls = 0;
+	}
+
+	SpriteBatch::SpriteBatch()
+		: SceneObject("sprite_batch")
+	{
+		auto as = DisplayDevice::createAttributeSet();
+		attribs_.reset(new Attribute<vertex_texcoord>(AccessFreqHint::DYNAMIC, AccessTypeHint::DRAW));
+		attribs_->addAttributeDesc(AttributeDesc(AttrType::POSITION, 2, AttrFormat::FLOAT, false, sizeof(vertex_texcoord), offsetof(vertex_texcoord, vtx)));
+		attribs_->addAttributeDesc(AttributeDesc(AttrType::TEXTURE,  2, AttrFormat::FLOAT, false, sizeof(vertex_texcoord), offsetof(vertex_texcoord, tc)));
+		as->addAttribute(AttributeBasePtr(attribs_));
+		as->setDrawMode(DrawMode::TRIANGLES);
+
+		addAttributeSet(as);
+	}
+
+	SpriteBatch& SpriteBatch::get()
+	{
+		static SpriteBatch* res = new SpriteBatch;
+		return *res;
+	}
+
+	bool SpriteBatch::matches(const Renderable& r, const Color& color) const
+	{
+		return r.getTexture() == getTexture()
+			&& r.getShader() == getShader()
+			&& r.getCamera() == getCamera()
+			&& r.isBlendModeSet() == isBlendModeSet()
+			&& (!r.isBlendModeSet() || r.getBlendMode() == getBlendMode())
+			&& r.isBlendStateSet() == isBlendStateSet()
+			&& r.isBlendEnabled() == isBlendEnabled()
+			&& color == getColor();
+	}
+
+	bool SpriteBatch::add(const Renderable& r, const std::vector<vertex_texcoord>& strip)
+	{
+		// Shaders with a uniform draw function set uniforms for each object
+		// drawn, which would all be lost but the first. Paletted textures
+		// can have their palette changed between objects.
+		const TexturePtr& tex = r.getTexture();
+		if(!r.isEnabled() || tex == nullptr || tex->isPaletteized()
+			|| r.getShader() == nullptr || r.getShader()->getUniformDrawFunction()
+			|| r.getRenderTarget() || r.isBlendEquationSet() || strip.size() < 3) {
+			return false;
+		}
+
+		SpriteBatch& batch = get();
+		const Color& color = r.isColorSet() ? r.getColor() : ColorScope::getCurrentColor();
+		if(batch.vertices_.empty() == false && !batch.matches(r, color)) {
+			flush();
+		}
+
+		if(batch.vertices_.empty()) {
+			batch.setTexture(tex);
+			batch.setShader(r.getShader());
+			batch.setCamera(r.getCamera());
+			if(r.isBlendModeSet()) {
+				batch.setBlendMode(r.getBlendMode());
+			} else {
+				batch.clearBlendMode();
+			}
+			if(r.isBlendStateSet()) {
+				batch.setBlendState(r.isBlendEnabled());
+			} else {
+				batch.clearblendState();
+			}
+			batch.setColor(color);
+		}
+
+		// The batch is drawn without a model matrix, so the vertices are
+		// transformed here by the one they would have been drawn with.
+		glm::mat4 model = r.getModelMatrix();
+		if(is_global_model_matrix_valid()) {
+			model = get_global_model_matrix() * model;
+		}
+
+		std::vector<vertex_texcoord> transformed;
+		transformed.reserve(strip.size());
+		for(const vertex_texcoord& v : strip) {
+			const glm::vec4 pos = model * glm::vec4(v.vtx, 0.0f, 1.0f);
+			transformed.emplace_back(glm::vec2(pos.x, pos.y), v.tc);
+		}
+
+		for(size_t n = 2; n < transformed.size(); ++n) {
+			batch.vertices_.push_back(transformed[n-2]);
+			batch.vertices_.push_back(transformed[n-1]);
+			batch.vertices_.push_back(transformed[n]);
+		}
+
+		++sprites_batched;
+		return true;
+	}
+
+	void SpriteBatch::flush()
+	{
+		SpriteBatch& batch = get();
+		if(batch.vertices_.empty() == false) {
+			batch.render();
+		}
+	}
+
+	void SpriteBatch::render()
+	{
+		// Hand the vertices over to the attribute before rendering, so that
+		// the batch is empty if anything flushes it while it is drawn. The
+		// attribute swaps back its previous buffer, which is re-used.
+		const size_t count = vertices_.size();
+		attribs_->update(&vertices_);
+		getAttributeSet().back()->setCount(count);
+		vertices_.clear();
+
+		ModelManager2D identity;
+		identity.setIdentity();
+
+		++batches_drawn;
+		WindowManager::getMainWindow()->render(this);
+	}
+
+	void SpriteBatch::flushForDraw()
+	{
+		flush();
+		++draw_calls;
+	}
+
+	void SpriteBatch::endFrame()
+	{
+		flush();
+		last_frame_draw_calls = draw_calls;
+		last_frame_unbatched_draw_calls = draw_calls - batches_drawn + sprites_batched;
+		draw_calls = sprites_batched = batches_drawn = 0;
+	}
+
+	int SpriteBatch::getDrawCalls()
+	{
+		return last_frame_draw_calls;
+	}
+
+	int SpriteBatch::getUnbatchedDrawCalls()
+	{
+		return last_frame_unbatched_draw_calls;
+	}
+}
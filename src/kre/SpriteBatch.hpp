@@ -0,0 +1,69 @@
+/*
+	Copyright (C) 2003-2013 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include "AttributeSet.hpp"
+#include "SceneObject.hpp"
+
+namespace KRE
+{
+	// Collects the vertices of consecutive sprite draws which share a
+	// texture, shader, color and blend mode, so they can be drawn with a
+	// single render call. The sprites are drawn when a sprite with different
+	// state is added, or when anything else is about to draw or change GL
+	// state, which must call flush() first so that drawing order is kept.
+	class SpriteBatch : public SceneObject
+	{
+	public:
+		// Adds the geometry of r, given as a triangle strip in r's model
+		// space. Returns false, leaving r to be rendered normally, if r uses
+		// state which the batch can't represent.
+		static bool add(const Renderable& r, const std::vector<vertex_texcoord>& strip);
+
+		// Draws any sprites which have been added.
+		static void flush();
+
+		// Flushes the batch and counts a draw call. Called whenever a shader
+		// is activated to draw something.
+		static void flushForDraw();
+
+		// Called when a frame has been presented, to record the draw call
+		// counts for it.
+		static void endFrame();
+
+		// The number of draw calls made in the last frame, and the number
+		// which would have been made without batching.
+		static int getDrawCalls();
+		static int getUnbatchedDrawCalls();
+	private:
+		SpriteBatch();
+		static SpriteBatch& get();
+
+		bool matches(const Renderable& r, const Color& color) const;
+		void render();
+
+		std::shared_ptr<Attribute<vertex_texcoord>> attribs_;
+		std::vector<vertex_texcoord> vertices_;
+	};
+}
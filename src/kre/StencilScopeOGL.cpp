@@ -24,6 +24,7 @@
 #include <GL/glew.h>
 
 #include <stack>
+#include "SpriteBatch.hpp"
 #include "StencilScopeOGL.hpp"
 
 namespace KRE
@@ -87,12 +88,14 @@ namespace KRE
 	StencilScopeOGL::StencilScopeOGL(const StencilSettings& settings)
 		: StencilScope(settings)
 	{
+		SpriteBatch::flush();
 		get_stencil_stack().emplace(settings);
 		applySettings(settings);
 	}
 
 	StencilScopeOGL::~StencilScopeOGL()
 	{
+		SpriteBatch::flush();
 		get_stencil_stack().pop();
 		if(get_stencil_stack().empty()) {
 			glDisable(GL_STENCIL_TEST);
@@ -123,6 +126,7 @@ namespace KRE
 
 	void StencilScopeOGL::handleUpdatedMask()
 	{
+		SpriteBatch::flush();
 		if(getSettings().enabled()) {
 			glStencilMaskSeparate(convert_face(getSettings().face()), getSettings().mask());
 		}
@@ -24,6 +24,7 @@
 #include <tuple>
 
 #include "Surface.hpp"
+#include "SurfaceKernels.hpp"
 
 namespace KRE
 {
@@ -189,10 +190,15 @@ namespace KRE
 			uint32_t alpha_mask = pf->getAlphaMask();
 			if(bytesPerPixel() == 4 && rowPitch() % 4 == 0) {
 				// Optimization for a common case. Operates ~25 faster than default case.
-				const uint32_t* px = reinterpret_cast<const uint32_t*>(pixels());
+				const int w = width();
+				std::vector<uint32_t> bits((w + 31) / 32);
 				auto it = alpha_map_->begin();
-				for(int n = 0; n != npixels; ++n) {
-					*it++ = (*px++ & alpha_mask) ? false : true;
+				for(int y = 0; y != height(); ++y) {
+					const uint32_t* px = reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(pixels()) + y * rowPitch());
+					SurfaceKernels::alpha_row_to_bits(px, w, alpha_mask, &bits[0]);
+					for(int x = 0; x != w; ++x) {
+						*it++ = ((bits[x >> 5] >> (x & 31)) & 1) != 0;
+					}
 				}
 			} else {
 				std::fill(alpha_map_->begin(), alpha_map_->end(), false);
@@ -268,6 +274,17 @@ namespace KRE
 	color_histogram_type Surface::getColorHistogram(ColorCountFlags flags)
 	{
 		color_histogram_type res;
+		SurfaceKernels::Layout32 layout;
+		if(SurfaceKernels::get_layout(*getPixelFormat(), &layout)) {
+			SurfaceLock lck(shared_from_this());
+			std::vector<uint32_t> row(width());
+			for(int y = 0; y != height(); ++y) {
+				const uint32_t* px = reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(pixels()) + y * rowPitch());
+				SurfaceKernels::decode_row(px, width(), layout, row.data());
+				SurfaceKernels::count_colors(row.data(), width(), &res);
+			}
+			return res;
+		}
 		iterateOverSurface([&res](int x, int y, int r, int g, int b, int a) {
 			//Color color(r, g, b, a);
 			color_histogram_type::key_type color = (static_cast<uint32_t>(r) << 24)
@@ -300,6 +317,24 @@ namespace KRE
 		return getColorHistogram(flags).size();
 	}
 
+	void Surface::premultiplyAlpha()
+	{
+		SurfaceKernels::Layout32 layout;
+		const bool supported = SurfaceKernels::get_layout(*getPixelFormat(), &layout);
+		ASSERT_LOG(supported, "premultiplyAlpha needs a surface with 32-bit pixels.");
+		if(!getPixelFormat()->hasAlphaChannel()) {
+			return;
+		}
+		SurfaceLock lck(shared_from_this());
+		std::vector<uint32_t> row(width());
+		for(int y = 0; y != height(); ++y) {
+			uint32_t* px = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(pixelsWriteable()) + y * rowPitch());
+			SurfaceKernels::decode_row(px, width(), layout, row.data());
+			SurfaceKernels::premultiply_row(row.data(), width());
+			SurfaceKernels::encode_row(row.data(), width(), layout, px);
+		}
+	}
+
 	namespace 
 	{
 		std::map<FileFilterType, file_filter>& get_file_filter_map()
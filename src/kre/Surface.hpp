@@ -164,6 +164,9 @@ namespace KRE
 		void convertInPlace(PixelFormat::PF fmt, SurfaceConvertFn convert=nullptr);
 
 		color_histogram_type getColorHistogram(ColorCountFlags flags=ColorCountFlags::NONE);
+		// Multiplies the color channels of each pixel by its alpha. Only
+		// surfaces with 32-bit pixels are supported.
+		void premultiplyAlpha();
 		size_t getColorCount(ColorCountFlags flags=ColorCountFlags::NONE);
 
 		virtual const std::vector<Color>& getPalette() = 0;
@@ -0,0 +1,436 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SURFACE_KERNELS_USE_SSE2
+#endif
+
+#include "asserts.hpp"
+#include "SurfaceKernels.hpp"
+#include "unit_test.hpp"
+
+namespace KRE
+{
+	namespace SurfaceKernels
+	{
+		bool get_layout(const PixelFormat& pf, Layout32* layout)
+		{
+			switch(pf.getFormat()) {
+				case PixelFormat::PF::PIXELFORMAT_RGBX8888:
+				case PixelFormat::PF::PIXELFORMAT_BGRX8888:
+				case PixelFormat::PF::PIXELFORMAT_ARGB8888:
+				case PixelFormat::PF::PIXELFORMAT_XRGB8888:
+				case PixelFormat::PF::PIXELFORMAT_RGBA8888:
+				case PixelFormat::PF::PIXELFORMAT_ABGR8888:
+				case PixelFormat::PF::PIXELFORMAT_BGRA8888:
+					break;
+				default:
+					return false;
+			}
+			if(pf.bytesPerPixel() != 4) {
+				return false;
+			}
+
+			const bool has[] = { pf.hasRedChannel(), pf.hasGreenChannel(), pf.hasBlueChannel(), pf.hasAlphaChannel() };
+			const uint32_t mask[] = { pf.getRedMask(), pf.getGreenMask(), pf.getBlueMask(), pf.getAlphaMask() };
+			const uint32_t shift[] = { pf.getRedShift(), pf.getGreenShift(), pf.getBlueShift(), pf.getAlphaShift() };
+			for(int n = 0; n != 4; ++n) {
+				layout->mask[n] = has[n] ? mask[n] : 0;
+				layout->shift[n] = has[n] ? shift[n] : 0;
+			}
+			layout->fill = has[3] ? 0 : 0xff;
+			return true;
+		}
+
+		void decode_row(const uint32_t* src, int width, const Layout32& layout, uint32_t* rgba)
+		{
+			int x = 0;
+#ifdef SURFACE_KERNELS_USE_SSE2
+			const __m128i rm = _mm_set1_epi32(layout.mask[0]);
+			const __m128i gm = _mm_set1_epi32(layout.mask[1]);
+			const __m128i bm = _mm_set1_epi32(layout.mask[2]);
+			const __m128i am = _mm_set1_epi32(layout.mask[3]);
+			const __m128i rs = _mm_cvtsi32_si128(layout.shift[0]);
+			const __m128i gs = _mm_cvtsi32_si128(layout.shift[1]);
+			const __m128i bs = _mm_cvtsi32_si128(layout.shift[2]);
+			const __m128i as = _mm_cvtsi32_si128(layout.shift[3]);
+			const __m128i fill = _mm_set1_epi32(layout.fill);
+			for(; x + 4 <= width; x += 4) {
+				const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+				const __m128i r = _mm_slli_epi32(_mm_srl_epi32(_mm_and_si128(px, rm), rs), 24);
+				const __m128i g = _mm_slli_epi32(_mm_srl_epi32(_mm_and_si128(px, gm), gs), 16);
+				const __m128i b = _mm_slli_epi32(_mm_srl_epi32(_mm_and_si128(px, bm), bs), 8);
+				const __m128i a = _mm_srl_epi32(_mm_and_si128(px, am), as);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + x), _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(_mm_or_si128(b, a), fill)));
+			}
+#endif
+			for(; x < width; ++x) {
+				const uint32_t px = src[x];
+				rgba[x] = (((px & layout.mask[0]) >> layout.shift[0]) << 24)
+					| (((px & layout.mask[1]) >> layout.shift[1]) << 16)
+					| (((px & layout.mask[2]) >> layout.shift[2]) << 8)
+					| ((px & layout.mask[3]) >> layout.shift[3])
+					| layout.fill;
+			}
+		}
+
+		void encode_row(const uint32_t* rgba, int width, const Layout32& layout, uint32_t* dst)
+		{
+			int x = 0;
+#ifdef SURFACE_KERNELS_USE_SSE2
+			const __m128i ff = _mm_set1_epi32(0xff);
+			const __m128i rm = _mm_set1_epi32(layout.mask[0]);
+			const __m128i gm = _mm_set1_epi32(layout.mask[1]);
+			const __m128i bm = _mm_set1_epi32(layout.mask[2]);
+			const __m128i am = _mm_set1_epi32(layout.mask[3]);
+			const __m128i rs = _mm_cvtsi32_si128(layout.shift[0]);
+			const __m128i gs = _mm_cvtsi32_si128(layout.shift[1]);
+			const __m128i bs = _mm_cvtsi32_si128(layout.shift[2]);
+			const __m128i as = _mm_cvtsi32_si128(layout.shift[3]);
+			for(; x + 4 <= width; x += 4) {
+				const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + x));
+				const __m128i r = _mm_and_si128(_mm_sll_epi32(_mm_srli_epi32(c, 24), rs), rm);
+				const __m128i g = _mm_and_si128(_mm_sll_epi32(_mm_and_si128(_mm_srli_epi32(c, 16), ff), gs), gm);
+				const __m128i b = _mm_and_si128(_mm_sll_epi32(_mm_and_si128(_mm_srli_epi32(c, 8), ff), bs), bm);
+				const __m128i a = _mm_and_si128(_mm_sll_epi32(_mm_and_si128(c, ff), as), am);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a)));
+			}
+#endif
+			for(; x < width; ++x) {
+				const uint32_t c = rgba[x];
+				dst[x] = (((c >> 24) << layout.shift[0]) & layout.mask[0])
+					| ((((c >> 16) & 0xff) << layout.shift[1]) & layout.mask[1])
+					| ((((c >> 8) & 0xff) << layout.shift[2]) & layout.mask[2])
+					| (((c & 0xff) << layout.shift[3]) & layout.mask[3]);
+			}
+		}
+
+		void alpha_row_to_bits(const uint32_t* src, int width, uint32_t alpha_mask, uint32_t* bits)
+		{
+			std::fill(bits, bits + (width + 31) / 32, 0);
+			int x = 0;
+#ifdef SURFACE_KERNELS_USE_SSE2
+			// x only advances in steps of four from zero, so the four bits of a
+			// step never straddle two words.
+			const __m128i am = _mm_set1_epi32(alpha_mask);
+			const __m128i zero = _mm_setzero_si128();
+			for(; x + 4 <= width; x += 4) {
+				const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+				const int transparent = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(px, am), zero)));
+				bits[x >> 5] |= static_cast<uint32_t>(transparent) << (x & 31);
+			}
+#endif
+			for(; x < width; ++x) {
+				if((src[x] & alpha_mask) == 0) {
+					bits[x >> 5] |= 1u << (x & 31);
+				}
+			}
+		}
+
+		void premultiply_row(uint32_t* rgba, int width)
+		{
+			// c*a/255 rounded to nearest is (t + (t >> 8)) >> 8 where t = c*a + 128,
+			// which is exact over the whole range of c and a.
+			int x = 0;
+#ifdef SURFACE_KERNELS_USE_SSE2
+			const __m128i ff = _mm_set1_epi32(0xff);
+			const __m128i half = _mm_set1_epi32(128);
+			for(; x + 4 <= width; x += 4) {
+				const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + x));
+				const __m128i a = _mm_and_si128(c, ff);
+				__m128i result = a;
+				for(int channel = 1; channel != 4; ++channel) {
+					const __m128i v = _mm_and_si128(_mm_srl_epi32(c, _mm_cvtsi32_si128(channel * 8)), ff);
+					// both values are below 256, so the 16-bit multiply gives the
+					// whole product in the low half of each lane.
+					__m128i t = _mm_add_epi32(_mm_mullo_epi16(v, a), half);
+					t = _mm_srli_epi32(_mm_add_epi32(t, _mm_srli_epi32(t, 8)), 8);
+					result = _mm_or_si128(result, _mm_sll_epi32(t, _mm_cvtsi32_si128(channel * 8)));
+				}
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + x), result);
+			}
+#endif
+			for(; x < width; ++x) {
+				const uint32_t c = rgba[x];
+				const uint32_t a = c & 0xff;
+				uint32_t result = a;
+				for(int channel = 1; channel != 4; ++channel) {
+					const uint32_t t = ((c >> (channel * 8)) & 0xff) * a + 128;
+					result |= ((t + (t >> 8)) >> 8) << (channel * 8);
+				}
+				rgba[x] = result;
+			}
+		}
+
+		void count_colors(const uint32_t* rgba, int width, color_histogram_type* histogram)
+		{
+			int x = 0;
+			while(x < width) {
+				const uint32_t color = rgba[x];
+				int run = 1;
+				while(x + run < width && rgba[x + run] == color) {
+					++run;
+				}
+				(*histogram)[color] += run;
+				x += run;
+			}
+		}
+
+		ColorLookup::ColorLookup()
+			: keys_(16),
+			  values_(16),
+			  used_(16, false),
+			  size_(0)
+		{
+		}
+
+		size_t ColorLookup::slot(uint32_t key) const
+		{
+			const size_t mask = keys_.size() - 1;
+			size_t n = (key * 2654435761u) & mask;
+			while(used_[n] && keys_[n] != key) {
+				n = (n + 1) & mask;
+			}
+			return n;
+		}
+
+		void ColorLookup::add(uint32_t from, uint32_t to)
+		{
+			if((size_ + 1) * 2 > keys_.size()) {
+				grow();
+			}
+			const size_t n = slot(from);
+			if(!used_[n]) {
+				used_[n] = true;
+				keys_[n] = from;
+				++size_;
+			}
+			values_[n] = to;
+		}
+
+		bool ColorLookup::find(uint32_t from, uint32_t* to) const
+		{
+			const size_t n = slot(from);
+			if(!used_[n]) {
+				return false;
+			}
+			*to = values_[n];
+			return true;
+		}
+
+		void ColorLookup::grow()
+		{
+			std::vector<uint32_t> keys, values;
+			std::vector<bool> used;
+			keys.swap(keys_);
+			values.swap(values_);
+			used.swap(used_);
+
+			keys_.resize(keys.size() * 2);
+			values_.resize(keys.size() * 2);
+			used_.resize(keys.size() * 2, false);
+			size_ = 0;
+			for(size_t n = 0; n != keys.size(); ++n) {
+				if(used[n]) {
+					add(keys[n], values[n]);
+				}
+			}
+		}
+
+		void remap_row(uint32_t* rgba, int width, const ColorLookup& lookup)
+		{
+			// Sprite sheets are mostly runs of the same color, so the last
+			// lookup is remembered.
+			bool have_last = false;
+			uint32_t last_from = 0, last_to = 0;
+			bool last_found = false;
+			for(int x = 0; x != width; ++x) {
+				const uint32_t color = rgba[x];
+				if(!have_last || color != last_from) {
+					last_from = color;
+					last_found = lookup.find(color, &last_to);
+					have_last = true;
+				}
+				if(last_found) {
+					rgba[x] = last_to;
+				}
+			}
+		}
+	}
+}
+
+namespace
+{
+	using namespace KRE::SurfaceKernels;
+
+	// A sprite sheet like image: a grid of sprites in a few colors on a
+	// transparent background.
+	std::vector<uint32_t> make_test_sheet(int width, int height)
+	{
+		std::vector<uint32_t> pixels(width * height);
+		for(int y = 0; y != height; ++y) {
+			for(int x = 0; x != width; ++x) {
+				const bool in_sprite = (x % 64) > 8 && (x % 64) < 56 && (y % 64) > 4 && (y % 64) < 60;
+				const uint32_t color = 0x20406000u + ((x / 7 + y / 5) % 12) * 0x0a0a0a00u;
+				pixels[x + y * width] = in_sprite ? (color | 0xff) : 0;
+			}
+		}
+		return pixels;
+	}
+
+	Layout32 rgba8888_layout()
+	{
+		Layout32 layout = { { 0xff000000, 0x00ff0000, 0x0000ff00, 0x000000ff }, { 24, 16, 8, 0 }, 0 };
+		return layout;
+	}
+
+	Layout32 bgra8888_layout()
+	{
+		Layout32 layout = { { 0x0000ff00, 0x00ff0000, 0xff000000, 0x000000ff }, { 8, 16, 24, 0 }, 0 };
+		return layout;
+	}
+}
+
+UNIT_TEST(surface_kernels_convert)
+{
+	// 37 pixels so the scalar tail is exercised as well.
+	const int width = 37;
+	std::vector<uint32_t> src(width), rgba(width), back(width);
+	for(int n = 0; n != width; ++n) {
+		src[n] = 0x01020304u * (n + 1) + (n << 20);
+	}
+	const Layout32 layout = bgra8888_layout();
+	decode_row(&src[0], width, layout, &rgba[0]);
+	for(int n = 0; n != width; ++n) {
+		const uint32_t px = src[n];
+		const uint32_t expected = (((px >> 8) & 0xff) << 24) | (((px >> 16) & 0xff) << 16) | ((px >> 24) << 8) | (px & 0xff);
+		CHECK_EQ(rgba[n], expected);
+	}
+	encode_row(&rgba[0], width, layout, &back[0]);
+	CHECK(src == back, "encoding didn't reverse decoding");
+
+	Layout32 no_alpha = rgba8888_layout();
+	no_alpha.mask[3] = 0;
+	no_alpha.fill = 0xff;
+	decode_row(&src[0], width, no_alpha, &rgba[0]);
+	for(int n = 0; n != width; ++n) {
+		CHECK_EQ(rgba[n], src[n] | 0xff);
+	}
+}
+
+UNIT_TEST(surface_kernels_alpha_bits)
+{
+	const int width = 70;
+	std::vector<uint32_t> src(width);
+	for(int n = 0; n != width; ++n) {
+		src[n] = (n % 3 == 0) ? 0x11223300u : 0x112233ffu;
+	}
+	std::vector<uint32_t> bits((width + 31) / 32, 0xdeadbeef);
+	alpha_row_to_bits(&src[0], width, 0xff, &bits[0]);
+	for(int n = 0; n != width; ++n) {
+		CHECK_EQ(((bits[n / 32] >> (n % 32)) & 1) != 0, n % 3 == 0);
+	}
+	CHECK_EQ(bits[2] >> (width % 32), 0u);
+}
+
+UNIT_TEST(surface_kernels_premultiply)
+{
+	std::vector<uint32_t> rgba;
+	for(uint32_t a = 0; a < 256; a += 15) {
+		for(uint32_t c = 0; c < 256; c += 17) {
+			rgba.push_back((c << 24) | ((255 - c) << 16) | ((c / 2) << 8) | a);
+		}
+	}
+	std::vector<uint32_t> result = rgba;
+	premultiply_row(&result[0], static_cast<int>(result.size()));
+	for(size_t n = 0; n != rgba.size(); ++n) {
+		const uint32_t a = rgba[n] & 0xff;
+		CHECK_EQ(result[n] & 0xff, a);
+		for(int channel = 1; channel != 4; ++channel) {
+			const uint32_t c = (rgba[n] >> (channel * 8)) & 0xff;
+			const uint32_t expected = static_cast<uint32_t>(c * a / 255.0 + 0.5);
+			CHECK_EQ((result[n] >> (channel * 8)) & 0xff, expected);
+		}
+	}
+}
+
+UNIT_TEST(surface_kernels_histogram_and_remap)
+{
+	const uint32_t row[] = { 1, 1, 1, 2, 3, 3, 1, 2, 2, 2 };
+	const int width = sizeof(row) / sizeof(row[0]);
+	KRE::color_histogram_type histogram;
+	count_colors(row, width, &histogram);
+	CHECK_EQ(histogram.size(), 3u);
+	CHECK_EQ(histogram[1], 4);
+	CHECK_EQ(histogram[2], 4);
+	CHECK_EQ(histogram[3], 2);
+
+	ColorLookup lookup;
+	for(uint32_t n = 0; n != 100; ++n) {
+		lookup.add(n * 7919u, n);
+	}
+	lookup.add(2, 20);
+	CHECK_EQ(lookup.size(), 101u);
+	uint32_t value = 0;
+	CHECK(lookup.find(99 * 7919u, &value) && value == 99, "lookup failed");
+	CHECK(!lookup.find(5, &value), "found a color which was never added");
+
+	uint32_t remapped[width];
+	std::copy(row, row + width, remapped);
+	remap_row(remapped, width, lookup);
+	for(int n = 0; n != width; ++n) {
+		CHECK_EQ(remapped[n], row[n] == 2 ? 20u : row[n]);
+	}
+}
+
+BENCHMARK(surface_kernels_sheet)
+{
+	// The load time work done on a 4096x4096 sprite sheet: building its alpha
+	// map and color histogram and applying a palette to it.
+	const int width = 4096, height = 4096;
+	const std::vector<uint32_t> sheet = make_test_sheet(width, height);
+	const Layout32 layout = bgra8888_layout();
+
+	ColorLookup lookup;
+	for(uint32_t n = 0; n != 12; ++n) {
+		const uint32_t color = (0x20406000u + n * 0x0a0a0a00u) | 0xff;
+		lookup.add(color, color ^ 0xffffff00u);
+	}
+
+	std::vector<uint32_t> row(width), out(width * height);
+	std::vector<uint32_t> bits((width + 31) / 32);
+	BENCHMARK_LOOP {
+		KRE::color_histogram_type histogram;
+		for(int y = 0; y != height; ++y) {
+			const uint32_t* src = &sheet[y * width];
+			alpha_row_to_bits(src, width, layout.mask[3], &bits[0]);
+			decode_row(src, width, layout, &row[0]);
+			count_colors(&row[0], width, &histogram);
+			remap_row(&row[0], width, lookup);
+			encode_row(&row[0], width, layout, &out[y * width]);
+		}
+	}
+}
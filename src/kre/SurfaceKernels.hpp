@@ -0,0 +1,91 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Surface.hpp"
+
+namespace KRE
+{
+	// Kernels which work on a row of 32-bit pixels at a time, four pixels at a
+	// time where SSE2 is available. They're used in place of iterateOverSurface()
+	// for the surfaces they can handle, which avoids a std::function call and a
+	// virtual pixel decode for every pixel.
+	//
+	// Colors are passed between kernels as RGBA keys, 0xRRGGBBAA, which is the
+	// form used for keys in color histograms and palette maps.
+	namespace SurfaceKernels
+	{
+		// The position of each channel in a 32-bit pixel, in the order red,
+		// green, blue, alpha. A channel the format doesn't have has a mask of
+		// zero; a missing alpha channel decodes as 255.
+		struct Layout32
+		{
+			uint32_t mask[4];
+			uint32_t shift[4];
+			uint32_t fill;
+		};
+
+		// Gets the layout of the pixel format, returning false if its pixels
+		// aren't 32-bit RGB pixels with 8-bit channels.
+		bool get_layout(const PixelFormat& pf, Layout32* layout);
+
+		void decode_row(const uint32_t* src, int width, const Layout32& layout, uint32_t* rgba);
+		void encode_row(const uint32_t* rgba, int width, const Layout32& layout, uint32_t* dst);
+
+		// Sets bit x of the bitset for each pixel x whose alpha is zero. The
+		// bitset has (width+31)/32 words, all of which are written.
+		void alpha_row_to_bits(const uint32_t* src, int width, uint32_t alpha_mask, uint32_t* bits);
+
+		// Multiplies the color channels by alpha, keeping the alpha.
+		void premultiply_row(uint32_t* rgba, int width);
+
+		// Adds the colors in the row to the histogram. Runs of the same color
+		// are counted together.
+		void count_colors(const uint32_t* rgba, int width, color_histogram_type* histogram);
+
+		// A map from one color to another, used to apply palettes.
+		class ColorLookup
+		{
+		public:
+			ColorLookup();
+			void add(uint32_t from, uint32_t to);
+			bool find(uint32_t from, uint32_t* to) const;
+			size_t size() const { return size_; }
+		private:
+			void grow();
+			size_t slot(uint32_t key) const;
+
+			std::vector<uint32_t> keys_;
+			std::vector<uint32_t> values_;
+			std::vector<bool> used_;
+			size_t size_;
+		};
+
+		// Replaces each color in the row which is in the lookup.
+		void remap_row(uint32_t* rgba, int width, const ColorLookup& lookup);
+	}
+}
@@ -32,6 +32,7 @@
 
 #include "asserts.hpp"
 #include "SurfaceSDL.hpp"
+#include "SurfaceKernels.hpp"
 
 enum {
 	SDL_PIXELFORMAT_XRGB8888 = 
@@ -878,6 +879,27 @@ namespace KRE
 		void* dst_pixels = new uint8_t[dst_size];
 
 		int dst_bpp = dst->getPixelFormat()->bytesPerPixel();
+		SurfaceKernels::Layout32 src_layout, dst_layout;
+		if(SurfaceKernels::get_layout(*getPixelFormat(), &src_layout) && SurfaceKernels::get_layout(*dst->getPixelFormat(), &dst_layout)) {
+			// Decode and encode whole rows, leaving only the conversion function
+			// to be called for each pixel.
+			SurfaceLock lck(shared_from_this());
+			std::vector<uint32_t> row(width());
+			for(int y = 0; y != height(); ++y) {
+				const uint32_t* src_row = reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(pixels()) + y * rowPitch());
+				SurfaceKernels::decode_row(src_row, width(), src_layout, row.data());
+				for(auto& c : row) {
+					int r = c >> 24, g = (c >> 16) & 0xff, b = (c >> 8) & 0xff, a = c & 0xff;
+					convert(r, g, b, a);
+					c = ((r & 0xff) << 24) | ((g & 0xff) << 16) | ((b & 0xff) << 8) | (a & 0xff);
+				}
+				uint32_t* dst_row = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(dst_pixels) + y * dst->rowPitch());
+				SurfaceKernels::encode_row(row.data(), width(), dst_layout, dst_row);
+			}
+			dst->writePixels(dst_pixels, dst_size);
+			delete[] static_cast<uint8_t*>(dst_pixels);
+			return dst;
+		}
 		iterateOverSurface([&](int x, int y, int r, int g, int b, int a) {
 			uint8_t* dst_pixel_ptr = static_cast<uint8_t*>(dst_pixels) + y * dst->rowPitch() + x * dst_bpp;
 			convert(r, g, b, a);
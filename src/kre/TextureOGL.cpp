@@ -24,6 +24,7 @@
 #include "asserts.hpp"
 #include "profile_timer.hpp"
 #include "DisplayDevice.hpp"
+#include "SurfaceKernels.hpp"
 #include "TextureOGL.hpp"
 
 namespace KRE
@@ -285,23 +286,47 @@ namespace KRE
 
 			auto& td = texture_data_[0];
 			td.palette.clear();
-			getSurface(0)->iterateOverSurface([&new_pixels, rp, &td](int x, int y, int r, int g, int b, int a){
-				color_histogram_type::key_type color = (static_cast<uint32_t>(r) << 24)
-					| (static_cast<uint32_t>(g) << 16)
-					| (static_cast<uint32_t>(b) << 8)
-					| (static_cast<uint32_t>(a));
-
+			auto color_index = [&td](color_histogram_type::key_type color) {
 				auto it = td.color_index_map.find(color);
 				if(it == td.color_index_map.end()) {
 					const auto index = td.palette.size();
 					td.color_index_map[color] = static_cast<uint8_t>(index);
-					new_pixels[x + y * rp] = static_cast<uint8_t>(index);
 					td.palette.emplace_back(color);
-				} else {
-					new_pixels[x + y * rp] = static_cast<uint8_t>(it->second);
+					ASSERT_LOG(td.palette.size() < 256, "Can't convert surface to palettized version. Too many colors in source image > 256");
+					return static_cast<uint8_t>(index);
 				}
-				ASSERT_LOG(td.palette.size() < 256, "Can't convert surface to palettized version. Too many colors in source image > 256");
-			});
+				return static_cast<uint8_t>(it->second);
+			};
+
+			auto src = getSurface(0);
+			SurfaceKernels::Layout32 layout;
+			if(SurfaceKernels::get_layout(*src->getPixelFormat(), &layout)) {
+				SurfaceLock lck(src);
+				std::vector<uint32_t> row(src->width());
+				for(int y = 0; y != src->height(); ++y) {
+					const uint32_t* px = reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(src->pixels()) + y * src->rowPitch());
+					SurfaceKernels::decode_row(px, src->width(), layout, row.data());
+					// Only look up the index when the color changes, since most
+					// pixels are in runs of the same color.
+					uint32_t last_color = 0;
+					uint8_t last_index = 0;
+					for(int x = 0; x != src->width(); ++x) {
+						if(x == 0 || row[x] != last_color) {
+							last_color = row[x];
+							last_index = color_index(last_color);
+						}
+						new_pixels[x + y * rp] = last_index;
+					}
+				}
+			} else {
+				src->iterateOverSurface([&new_pixels, rp, &color_index](int x, int y, int r, int g, int b, int a){
+					color_histogram_type::key_type color = (static_cast<uint32_t>(r) << 24)
+						| (static_cast<uint32_t>(g) << 16)
+						| (static_cast<uint32_t>(b) << 8)
+						| (static_cast<uint32_t>(a));
+					new_pixels[x + y * rp] = color_index(color);
+				});
+			}
 			surf->writePixels(&new_pixels[0], static_cast<int>(new_pixels.size()));
 			surf->setAlphaMap(getSurface(0)->getAlphaMap());
 
@@ -30,9 +30,11 @@
 
 #include "asserts.hpp"
 #include "DisplayDevice.hpp"
+#include "Font.hpp"
 #include "SurfaceSDL.hpp"
 #include "SDL.h"
 #include "SDL_image.h"
+#include "SpriteBatch.hpp"
 #include "WindowManager.hpp"
 
 namespace KRE
@@ -216,6 +218,9 @@ namespace KRE
 		}
 
 		void swap() override {
+			SpriteBatch::endFrame();
+			Font::endFrame();
+
 			// This is a little bit hacky -- ideally the display device should swap buffers.
 			// But SDL provides a device independent way of doing it which is really nice.
 			// So we use that.
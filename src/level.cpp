@@ -25,6 +25,8 @@
 #include <iostream>
 #include <math.h>
 
+#include <boost/functional/hash.hpp>
+
 #include "BlendModeScope.hpp"
 #include "CameraObject.hpp"
 #include "ColorScope.hpp"
@@ -35,6 +37,7 @@
 #include "WindowManager.hpp"
 
 #include "asserts.hpp"
+#include "background_task_pool.hpp"
 #include "collision_utils.hpp"
 #include "controls.hpp"
 #include "draw_scene.hpp"
@@ -52,6 +55,7 @@
 #include "module.hpp"
 #include "multiplayer.hpp"
 #include "object_events.hpp"
+#include "pathfinding.hpp"
 #include "player_info.hpp"
 #include "playable_custom_object.hpp"
 #include "preferences.hpp"
@@ -60,6 +64,7 @@
 #include "random.hpp"
 #include "rect_renderable.hpp"
 #include "screen_handling.hpp"
+#include "solid_map.hpp"
 #include "sound.hpp"
 #include "stats.hpp"
 #include "string_utils.hpp"
@@ -74,6 +79,8 @@
 #	define strtoll _strtoi64
 #endif
 
+extern int g_tile_rebuild_band_rows;
+
 #ifndef NO_EDITOR
 std::set<Level*>& get_all_levels_set() 
 {
@@ -85,6 +92,7 @@ std::set<Level*>& get_all_levels_set()
 namespace 
 {
 	PREF_BOOL(debug_shadows, false, "Show debug visualization of shadow drawing");
+	PREF_INT(backup_keyframe_interval, 10, "Number of cycles between full copies of the level's objects in the rewind history. Cycles in between record only what changed in each object since the cycle before");
 
 	LevelPtr& get_current_level() 
 	{
@@ -109,6 +117,51 @@ namespace
 	{
 		return t.x < r.x() || t.y < r.y() || t.x >= r.x2() || t.y >= r.y2();
 	}
+
+	//a request to build the tiles of one layer: either all of them, or
+	//only those positioned within 'area'.
+	struct tile_build_job
+	{
+		explicit tile_build_job(int layer_num) : layer(layer_num), partial(false)
+		{}
+
+		tile_build_job(int layer_num, const rect& r) : layer(layer_num), partial(true), area(r)
+		{}
+
+		int layer;
+		bool partial;
+		rect area;
+		std::vector<LevelTile> tiles;
+	};
+
+	//builds the tiles for each job, with the layers built in parallel on
+	//the background task pool unless tile_rebuild_band_rows is 0.
+	//preparePatterns() must have been called on the maps beforehand.
+	void build_tile_jobs(const std::map<int, TileMap>& tile_maps, std::vector<tile_build_job>& jobs)
+	{
+		std::vector<int> tasks;
+		for(tile_build_job& job : jobs) {
+			auto itor = tile_maps.find(job.layer);
+			if(itor == tile_maps.end()) {
+				continue;
+			}
+
+			const TileMap* m = &itor->second;
+			if(g_tile_rebuild_band_rows <= 0) {
+				m->buildTiles(&job.tiles, job.partial ? &job.area : nullptr);
+				continue;
+			}
+
+			tile_build_job* j = &job;
+			tasks.push_back(background_task_pool::submit([m, j]() {
+				m->buildTiles(&j->tiles, j->partial ? &j->area : nullptr);
+			}, std::function<void()>(), background_task_pool::PRIORITY::LEVEL_LOAD));
+		}
+
+		for(int task : tasks) {
+			background_task_pool::wait(task);
+		}
+	}
 }
 
 void Level::clearCurrentLevel()
@@ -208,7 +261,8 @@ Level::Level(const std::string& level_cfg, variant node)
 	  mouselook_inverted_(false),
 	  allow_touch_controls_(true),
 	  show_builtin_settings_(false),
-	  have_render_to_texture_(false)
+	  have_render_to_texture_(false),
+	  force_backup_keyframes_(false)
 {
 #ifndef NO_EDITOR
 	get_all_levels_set().insert(this);
@@ -217,7 +271,7 @@ Level::Level(const std::string& level_cfg, variant node)
 	if(KRE::DisplayDevice::checkForFeature(KRE::DisplayDeviceCapabilties::RENDER_TO_TEXTURE)) {
 		have_render_to_texture_ = true;
 		auto& gs = graphics::GameScreen::get();
-		rt_ = KRE::RenderTarget::create(gs.getWidth(), gs.getHeight());
+		rt_ = KRE::RenderTarget::acquire(gs.getWidth(), gs.getHeight());
 		//rt_->setCamera(std::make_shared<KRE::Camera>("render_target"));
 	}
 
@@ -338,6 +392,7 @@ Level::Level(const std::string& level_cfg, variant node)
 	LOG_INFO("done building..." << profile::get_tick_time());
 
 	auto begin_tile_index = tiles_.size();
+	std::vector<tile_build_job> tile_jobs;
 	for(variant tile_node : node["tile_map"].as_list()) {
 		variant tiles_value = tile_node["tiles"];
 		if(!tiles_value.is_string()) {
@@ -360,9 +415,14 @@ Level::Level(const std::string& level_cfg, variant node)
 		TileMap m(tile_node);
 		ASSERT_LOG(tile_maps_.count(m.zorder()) == 0, "repeated zorder in tile map: " << m.zorder());
 		tile_maps_[m.zorder()] = m;
-		const auto before = tiles_.size();
-		tile_maps_[m.zorder()].buildTiles(&tiles_);
-		LOG_INFO("LAYER " << m.zorder() << " BUILT " << (tiles_.size() - before) << " tiles");
+		tile_maps_[m.zorder()].preparePatterns();
+		tile_jobs.emplace_back(m.zorder());
+	}
+
+	build_tile_jobs(tile_maps_, tile_jobs);
+	for(const tile_build_job& job : tile_jobs) {
+		tiles_.insert(tiles_.end(), job.tiles.begin(), job.tiles.end());
+		LOG_INFO("LAYER " << job.layer << " BUILT " << job.tiles.size() << " tiles");
 	}
 
 	LOG_INFO("done building tile_map..." << profile::get_tick_time());
@@ -497,6 +557,8 @@ Level::Level(const std::string& level_cfg, variant node)
 
 Level::~Level()
 {
+	pathfinding::invalidate_grid_paths(this);
+
 #ifndef NO_EDITOR
 	get_all_levels_set().erase(this);
 #endif
@@ -821,7 +883,8 @@ namespace
 	{
 		level_tile_rebuild_info() : tile_rebuild_in_progress(false),
 									tile_rebuild_queued(false),
-									rebuild_tile_thread(nullptr),
+									rebuild_tile_task(-1),
+									rebuild_all_layers(false),
 									tile_rebuild_complete(false)
 		{}
 
@@ -830,42 +893,35 @@ namespace
 		bool tile_rebuild_in_progress;
 		bool tile_rebuild_queued;
 
-		threading::thread* rebuild_tile_thread;
+		//the background task building the tiles, or -1 if there is none.
+		int rebuild_tile_task;
 
 		//an unsynchronized buffer only accessed by the main thread with layers
 		//that will be rebuilt.
 		std::vector<int> rebuild_tile_layers_buffer;
 
-		//buffer accessed by the worker thread which contains layers that will
-		//be rebuilt.
-		std::vector<int> rebuild_tile_layers_worker_buffer;
+		//the area of each layer which has had tiles changed since it was
+		//last rebuilt. Only accessed by the main thread. When a layer is
+		//rebuilt only the tiles near this area are built again; layers
+		//without an entry are built in full.
+		std::map<int, rect> dirty_areas;
+
+		//jobs for the layers the worker thread is rebuilding. If
+		//rebuild_all_layers is set there is a job for every layer and all
+		//existing tiles are replaced.
+		std::vector<tile_build_job> worker_jobs;
+		bool rebuild_all_layers;
 
 		//a locked flag which is polled to see if tile rebuilding has been completed.
 		bool tile_rebuild_complete;
 
 		threading::mutex tile_rebuild_complete_mutex;
-
-		//the tiles where the thread will store the new tiles.
-		std::vector<LevelTile> task_tiles;
 	};
 
 	std::map<const Level*, level_tile_rebuild_info> tile_rebuild_map;
 
-	void build_tiles_thread_function(level_tile_rebuild_info* info, std::map<int, TileMap> tile_maps, threading::mutex& sync) {
-		info->task_tiles.clear();
-
-		if(info->rebuild_tile_layers_worker_buffer.empty()) {
-			for(auto& i : tile_maps) {
-				i.second.buildTiles(&info->task_tiles);
-			}
-		} else {
-			for(int layer : info->rebuild_tile_layers_worker_buffer) {
-				auto itor = tile_maps.find(layer);
-				if(itor != tile_maps.end()) {
-					itor->second.buildTiles(&info->task_tiles);
-				}
-			}
-		}
+	void build_tiles_thread_function(level_tile_rebuild_info* info, std::map<int, TileMap> tile_maps) {
+		build_tile_jobs(tile_maps, info->worker_jobs);
 
 		threading::lock l(info->tile_rebuild_complete_mutex);
 		info->tile_rebuild_complete = true;
@@ -894,18 +950,56 @@ void Level::start_rebuild_tiles_in_background(const std::vector<int>& layers)
 	info.tile_rebuild_in_progress = true;
 	info.tile_rebuild_complete = false;
 
-	info.rebuild_tile_layers_worker_buffer = info.rebuild_tile_layers_buffer;
+	info.worker_jobs.clear();
+	info.rebuild_all_layers = info.rebuild_tile_layers_buffer.empty();
+	if(info.rebuild_all_layers) {
+		info.dirty_areas.clear();
+		for(auto& i : tile_maps_) {
+			info.worker_jobs.emplace_back(i.first);
+		}
+	} else {
+		for(int layer : info.rebuild_tile_layers_buffer) {
+			auto itor = info.dirty_areas.find(layer);
+			auto map_itor = tile_maps_.find(layer);
+			if(itor == info.dirty_areas.end() || map_itor == tile_maps_.end()) {
+				info.worker_jobs.emplace_back(layer);
+				continue;
+			}
+
+			const int reach = map_itor->second.getPatternReach();
+			if(reach < 0) {
+				info.worker_jobs.emplace_back(layer);
+				info.dirty_areas.erase(itor);
+				continue;
+			}
+
+			//widen the changed area to take in every tile whose pattern
+			//could have looked at a changed tile.
+			const int border = reach*TileSize;
+			const rect& r = itor->second;
+			info.worker_jobs.emplace_back(layer, rect(r.x() - border, r.y() - border, r.w() + border*2, r.h() + border*2));
+			info.dirty_areas.erase(itor);
+		}
+	}
+
 	info.rebuild_tile_layers_buffer.clear();
 
-	std::map<int, TileMap> worker_tile_maps = tile_maps_;
-	for(auto& i : worker_tile_maps) {
+	std::map<int, TileMap> worker_tile_maps;
+	for(const tile_build_job& job : info.worker_jobs) {
+		auto itor = tile_maps_.find(job.layer);
+		if(itor == tile_maps_.end()) {
+			continue;
+		}
+
+		itor->second.preparePatterns();
+
 		//make the tile maps safe to go into a worker thread.
-		i.second.prepareForCopyToWorkerThread();
+		TileMap& m = worker_tile_maps[job.layer];
+		m = itor->second;
+		m.prepareForCopyToWorkerThread();
 	}
 
-	static threading::mutex* sync = new threading::mutex;
-
-	info.rebuild_tile_thread = new threading::thread("rebuild_tiles", std::bind(build_tiles_thread_function, &info, worker_tile_maps, *sync));
+	info.rebuild_tile_task = background_task_pool::submit(std::bind(build_tiles_thread_function, &info, worker_tile_maps), std::function<void()>(), background_task_pool::PRIORITY::LEVEL_LOAD);
 }
 
 void Level::freeze_rebuild_tiles_in_background()
@@ -917,7 +1011,7 @@ void Level::freeze_rebuild_tiles_in_background()
 void Level::unfreeze_rebuild_tiles_in_background()
 {
 	level_tile_rebuild_info& info = tile_rebuild_map[this];
-	if(info.rebuild_tile_thread != nullptr) {
+	if(info.rebuild_tile_task != -1) {
 		//a thread is actually in flight calculating tiles, so any requests
 		//would have been queued up anyway.
 		return;
@@ -977,27 +1071,48 @@ void Level::complete_rebuild_tiles_in_background()
 
 	const int begin_time = profile::get_tick_time();
 
-//	ASSERT_LOG(rebuild_tile_thread, "REBUILD TILE THREAD IS nullptr");
-	delete info.rebuild_tile_thread;
-	info.rebuild_tile_thread = nullptr;
+	background_task_pool::wait(info.rebuild_tile_task);
+	info.rebuild_tile_task = -1;
 
-	if(info.rebuild_tile_layers_worker_buffer.empty()) {
+	bool partial = !info.rebuild_all_layers;
+	rect refresh_area;
+	if(info.rebuild_all_layers) {
 		tiles_.clear();
 	} else {
-		for(int layer : info.rebuild_tile_layers_worker_buffer) {
-			using namespace std::placeholders;
-			tiles_.erase(std::remove_if(tiles_.begin(), tiles_.end(), std::bind(level_tile_from_layer, _1, layer)), tiles_.end());
+		for(const tile_build_job& job : info.worker_jobs) {
+			const int layer = job.layer;
+			if(job.partial) {
+				const rect& area = job.area;
+				tiles_.erase(std::remove_if(tiles_.begin(), tiles_.end(), [layer, &area](const LevelTile& t) {
+					return t.layer_from == layer && pointInRect(t.x, t.y, area);
+				}), tiles_.end());
+				refresh_area = rect_union(refresh_area, area);
+			} else {
+				using namespace std::placeholders;
+				tiles_.erase(std::remove_if(tiles_.begin(), tiles_.end(), std::bind(level_tile_from_layer, _1, layer)), tiles_.end());
+				partial = false;
+			}
 		}
 	}
 
-	tiles_.insert(tiles_.end(), info.task_tiles.begin(), info.task_tiles.end());
-	info.task_tiles.clear();
+	const auto begin_new_tiles = tiles_.size();
+	for(const tile_build_job& job : info.worker_jobs) {
+		tiles_.insert(tiles_.end(), job.tiles.begin(), job.tiles.end());
+	}
 
-	complete_tiles_refresh();
+	info.worker_jobs.clear();
 
-	LOG_INFO("COMPLETE TILE REBUILD: " << (profile::get_tick_time() - begin_time));
+	if(partial) {
+		//the remaining tiles are still sorted, so just merge the new ones
+		//in rather than sorting everything.
+		std::sort(tiles_.begin() + begin_new_tiles, tiles_.end(), level_tile_zorder_pos_comparer());
+		std::inplace_merge(tiles_.begin(), tiles_.begin() + begin_new_tiles, tiles_.end(), level_tile_zorder_pos_comparer());
+		complete_tiles_refresh(&refresh_area);
+	} else {
+		complete_tiles_refresh();
+	}
 
-	info.rebuild_tile_layers_worker_buffer.clear();
+	LOG_INFO("COMPLETE TILE REBUILD: " << (profile::get_tick_time() - begin_time));
 
 	info.tile_rebuild_in_progress = false;
 	if(info.tile_rebuild_queued) {
@@ -1014,24 +1129,54 @@ void Level::rebuildTiles()
 		return;
 	}
 
-	tiles_.clear();
+	tile_rebuild_map[this].dirty_areas.clear();
+
+	std::vector<tile_build_job> jobs;
 	for(auto& i : tile_maps_) {
-		i.second.buildTiles(&tiles_);
+		i.second.preparePatterns();
+		jobs.emplace_back(i.first);
+	}
+
+	build_tile_jobs(tile_maps_, jobs);
+
+	tiles_.clear();
+	for(const tile_build_job& job : jobs) {
+		tiles_.insert(tiles_.end(), job.tiles.begin(), job.tiles.end());
 	}
 
 	complete_tiles_refresh();
 }
 
-void Level::complete_tiles_refresh()
+void Level::complete_tiles_refresh(const rect* area)
 {
 	const int start = profile::get_tick_time();
 	LOG_INFO("adding solids..." << (profile::get_tick_time() - start));
-	solid_.clear();
-	standable_.clear();
+	pathfinding::invalidate_grid_paths(this, area);
+	if(area) {
+		//only solids within the area can have changed, but they may come
+		//from any tile which overlaps it.
+		for(int x = area->x(); x < area->x2(); x += TileSize) {
+			for(int y = area->y(); y < area->y2(); y += TileSize) {
+				tile_pos pos(x/TileSize, y/TileSize);
+				solid_.erase(pos);
+				standable_.erase(pos);
+			}
+		}
 
-	for(LevelTile& t : tiles_) {
-		add_tile_solid(t);
-		layers_.insert(t.zorder);
+		for(LevelTile& t : tiles_) {
+			if(rects_intersect(rect(t.x, t.y, t.object->width(), t.object->height()), *area)) {
+				add_tile_solid(t);
+				layers_.insert(t.zorder);
+			}
+		}
+	} else {
+		solid_.clear();
+		standable_.clear();
+
+		for(LevelTile& t : tiles_) {
+			add_tile_solid(t);
+			layers_.insert(t.zorder);
+		}
 	}
 
 	LOG_INFO("sorting..." << (profile::get_tick_time() - start));
@@ -1039,7 +1184,7 @@ void Level::complete_tiles_refresh()
 	if(std::adjacent_find(tiles_.rbegin(), tiles_.rend(), level_tile_zorder_pos_comparer()) != tiles_.rend()) {
 		std::sort(tiles_.begin(), tiles_.end(), level_tile_zorder_pos_comparer());
 	}
-	prepare_tiles_for_drawing();
+	prepare_tiles_for_drawing(area);
 	LOG_INFO("done..." << (profile::get_tick_time() - start));
 
 	const std::vector<EntityPtr> chars = chars_;
@@ -1100,6 +1245,8 @@ void Level::rebuild_tiles_rect(const rect& r)
 		}
 	}
 
+	pathfinding::invalidate_grid_paths(this, &r);
+
 	tiles_.erase(std::remove_if(tiles_.begin(), tiles_.end(), TileInRect(r)), tiles_.end());
 
 	std::vector<LevelTile> tiles;
@@ -1116,7 +1263,7 @@ void Level::rebuild_tiles_rect(const rect& r)
 	if(std::adjacent_find(tiles_.rbegin(), tiles_.rend(), level_tile_zorder_pos_comparer()) != tiles_.rend()) {
 		std::sort(tiles_.begin(), tiles_.end(), level_tile_zorder_pos_comparer());
 	}
-	prepare_tiles_for_drawing();
+	prepare_tiles_for_drawing(&r);
 }
 
 std::string Level::package() const
@@ -1533,6 +1680,30 @@ namespace
 {
 	//counter incremented every time the level is drawn.
 	int draw_count = 0;
+
+	//the width and height of the chunks tile layers are split into, in
+	//tiles.
+	const int TileChunkTiles = 16;
+
+	int tile_chunk_index(int pos)
+	{
+		const int size = TileSize*TileChunkTiles;
+		return pos >= 0 ? pos/size : -((size - 1 - pos)/size);
+	}
+
+	std::pair<int, int> tile_chunk_key(int x, int y)
+	{
+		return std::make_pair(tile_chunk_index(y), tile_chunk_index(x));
+	}
+
+	int tile_chunks_drawn = 0, tile_chunks_total = 0;
+	int last_frame_tile_chunks_drawn = 0, last_frame_tile_chunks_total = 0;
+}
+
+void Level::getTileChunkStats(int* visible, int* total)
+{
+	*visible = last_frame_tile_chunks_drawn;
+	*total = last_frame_tile_chunks_total;
 }
 
 void Level::draw_layer(int layer, int x, int y, int w, int h) const
@@ -1590,10 +1761,27 @@ void Level::draw_layer(int layer, int x, int y, int w, int h) const
 	}
 
 	draw_layer_solid(layer, x, y, w, h);
-	
-	auto& blit_cache_info = *layer_itor->second;
+
+	const rect screen_area(x, y, w, h);
+	std::vector<const TileChunk*> visible_chunks;
+	for(const auto& chunk : layer_itor->second) {
+		if(rects_intersect(chunk.second.area, screen_area)) {
+			visible_chunks.push_back(&chunk.second);
+		}
+	}
+
+	tile_chunks_drawn += static_cast<int>(visible_chunks.size());
+	tile_chunks_total += static_cast<int>(layer_itor->second.size());
+
+	//all the opaque tiles of a layer are drawn before any transparent ones.
+	auto wnd = KRE::WindowManager::getMainWindow();
 	KRE::ModelManager2D model_matrix_scope(position.x, position.y);
-	KRE::WindowManager::getMainWindow()->render(&blit_cache_info);
+	for(const TileChunk* chunk : visible_chunks) {
+		wnd->render(chunk->opaque.get());
+	}
+	for(const TileChunk* chunk : visible_chunks) {
+		wnd->render(chunk->transparent.get());
+	}
 }
 
 void Level::draw_layer_solid(int layer, int x, int y, int w, int h) const
@@ -1624,47 +1812,42 @@ void Level::draw_layer_solid(int layer, int x, int y, int w, int h) const
 	}
 }
 
-void Level::prepare_tiles_for_drawing()
+void Level::prepare_tiles_for_drawing(const rect* area)
 {
-	auto main_wnd = KRE::WindowManager::getMainWindow();
 	LevelObject::setCurrentPalette(palettes_used_);
 
 	solid_color_rects_.clear();
-	blit_cache_.clear();
-
-	for(int n = 0; n != tiles_.size(); ++n) {
-		if(!is_arcade_level() && tiles_[n].object->getSolidColor()) {
-			continue;
-		}
-
-		//in the editor we want to draw the whole level, so don't exclude
-		//things outside the level bounds.
-		if(!editor_ && (tiles_[n].x <= boundaries().x() - TileSize || tiles_[n].y <= boundaries().y() - TileSize || tiles_[n].x >= boundaries().x2() || tiles_[n].y >= boundaries().y2())) {
-			continue;
-		}
-
-		std::shared_ptr<LayerBlitInfo>& blit_cache_info_ptr = blit_cache_[tiles_[n].zorder];
-		if(blit_cache_info_ptr == nullptr) {
-			blit_cache_info_ptr = std::make_shared<LayerBlitInfo>();
-		}
 
-		if(!blit_cache_info_ptr->isInitialised()) {
-			//LOG_DEBUG("zorder: " << tiles_[n].zorder << ", set texture with id: "<< tiles_[n].object->texture()->id());
-			blit_cache_info_ptr->setTexture(tiles_[n].object->texture());
-			blit_cache_info_ptr->setBase(tiles_[n].x, tiles_[n].y);
+	//the chunks which are being rebuilt. Chunks are rebuilt whole, so any
+	//chunk which has a position within area is included.
+	std::set<std::pair<int, int>> dirty_chunks;
+	if(area) {
+		for(int row = tile_chunk_index(area->y()); row <= tile_chunk_index(area->y2() - 1); ++row) {
+			for(int col = tile_chunk_index(area->x()); col <= tile_chunk_index(area->x2() - 1); ++col) {
+				dirty_chunks.insert(std::make_pair(row, col));
+			}
 		}
 
-		if(tiles_[n].x < blit_cache_info_ptr->xbase()) {
-			blit_cache_info_ptr->setXbase(tiles_[n].x);
-		}
-		if(tiles_[n].y < blit_cache_info_ptr->ybase()) {
-			blit_cache_info_ptr->setYbase(tiles_[n].y);
+		for(auto& layer : blit_cache_) {
+			for(const std::pair<int, int>& key : dirty_chunks) {
+				layer.second.erase(key);
+			}
 		}
+	} else {
+		blit_cache_.clear();
 	}
 
-	std::map<int, std::pair<std::vector<tile_corner>, std::vector<tile_corner>>> vertices_ot;
+	struct ChunkVertices {
+		rect area;
+		std::vector<tile_corner> opaque, transparent;
+	};
+
+	std::map<int, std::map<std::pair<int, int>, ChunkVertices>> vertices;
+	std::map<int, KRE::TexturePtr> layer_textures;
 
 	for(int n = 0; n != tiles_.size(); ++n) {
+		//in the editor we want to draw the whole level, so don't exclude
+		//things outside the level bounds.
 		if(!editor_ && (tiles_[n].x <= boundaries().x() - TileSize || tiles_[n].y <= boundaries().y() - TileSize || tiles_[n].x >= boundaries().x2() || tiles_[n].y >= boundaries().y2())) {
 			continue;
 		}
@@ -1687,23 +1870,54 @@ void Level::prepare_tiles_for_drawing()
 			continue;
 		}
 
-		auto blit_cache_info_ptr = blit_cache_[tiles_[n].zorder];
+		const std::pair<int, int> key = tile_chunk_key(tiles_[n].x, tiles_[n].y);
+		if(area && dirty_chunks.count(key) == 0) {
+			continue;
+		}
 
 		tiles_[n].draw_disabled = false;
 
-		const int npoints = LevelObject::calculateTileCorners(tiles_[n].object->isOpaque() ? &vertices_ot[tiles_[n].zorder].first : &vertices_ot[tiles_[n].zorder].second, tiles_[n]);
+		const int zorder = tiles_[n].zorder;
+		KRE::TexturePtr& texture = layer_textures[zorder];
+		if(texture == nullptr) {
+			auto layer_itor = blit_cache_.find(zorder);
+			if(layer_itor != blit_cache_.end() && layer_itor->second.empty() == false) {
+				texture = layer_itor->second.begin()->second.opaque->getTexture();
+			} else {
+				texture = tiles_[n].object->texture();
+			}
+		}
+
+		ChunkVertices& chunk = vertices[zorder][key];
+		const int npoints = LevelObject::calculateTileCorners(tiles_[n].object->isOpaque() ? &chunk.opaque : &chunk.transparent, tiles_[n]);
 		if(npoints > 0) {
-			if(*tiles_[n].object->texture() != *blit_cache_info_ptr->getTexture()) {
+			if(*tiles_[n].object->texture() != *texture) {
 				ASSERT_LOG(false, "Will not deal with multiple textures per level per zorder -- is a stupid case to have to handle. level '" 
 					<< this->id() << "' zorder: " << tiles_[n].zorder
-					<< " ; " << tiles_[n].object->texture()->isPaletteized() << " " << blit_cache_info_ptr->getTexture()->isPaletteized());
+					<< " ; " << tiles_[n].object->texture()->isPaletteized() << " " << texture->isPaletteized());
 			}
+
+			const rect tile_area(tiles_[n].x, tiles_[n].y, tiles_[n].object->width(), tiles_[n].object->height());
+			chunk.area = chunk.area.w() == 0 ? tile_area : rect_union(chunk.area, tile_area);
 		}
 	}
 
-	for(auto& v_ot : vertices_ot) {
-		auto blit_cache_info_ptr = blit_cache_[v_ot.first];
-		blit_cache_info_ptr->setVertices(&v_ot.second.first, &v_ot.second.second);
+	for(auto& layer : vertices) {
+		TileChunkMap& chunks = blit_cache_[layer.first];
+		for(auto& v : layer.second) {
+			if(v.second.area.w() == 0) {
+				continue;
+			}
+
+			TileChunk& chunk = chunks[v.first];
+			chunk.area = v.second.area;
+			chunk.opaque = std::make_shared<LayerBlitInfo>();
+			chunk.opaque->setTexture(layer_textures[layer.first]);
+			chunk.opaque->setVertices(&v.second.opaque, nullptr);
+			chunk.transparent = std::make_shared<LayerBlitInfo>();
+			chunk.transparent->setTexture(layer_textures[layer.first]);
+			chunk.transparent->setVertices(nullptr, &v.second.transparent);
+		}
 	}
 
 	for(int n = 1; n < static_cast<int>(solid_color_rects_.size()); ++n) {
@@ -1717,7 +1931,8 @@ void Level::prepare_tiles_for_drawing()
 
 	solid_color_rects_.erase(std::remove_if(solid_color_rects_.begin(), solid_color_rects_.end(), solid_color_rect_empty()), solid_color_rects_.end());
 
-	//remove tiles that are obscured by other tiles.
+	//remove tiles that are obscured by other tiles. Tiles only obscure
+	//tiles at the same position, which are in the same chunk.
 	std::set<std::pair<int, int> > opaque;
 	for(auto n = tiles_.size(); n > 0; --n) {
 		LevelTile& t = tiles_[n-1];
@@ -1731,6 +1946,10 @@ void Level::prepare_tiles_for_drawing()
 			continue;
 		}
 
+		if(area && dirty_chunks.count(tile_chunk_key(t.x, t.y)) == 0) {
+			continue;
+		}
+
 		if(!t.draw_disabled && opaque.count(std::pair<int,int>(t.x, t.y))) {
 			t.draw_disabled = true;
 			continue;
@@ -1830,6 +2049,10 @@ void Level::draw(int x, int y, int w, int h) const
 	}
 	++draw_count;
 
+	last_frame_tile_chunks_drawn = tile_chunks_drawn;
+	last_frame_tile_chunks_total = tile_chunks_total;
+	tile_chunks_drawn = tile_chunks_total = 0;
+
 	const int start_x = x;
 	const int start_y = y;
 	const int start_w = w;
@@ -2111,6 +2334,9 @@ void Level::calculateLighting(int x, int y, int w, int h) const
 {
 	bool fbo = KRE::DisplayDevice::checkForFeature(KRE::DisplayDeviceCapabilties::RENDER_TO_TEXTURE);
 	if(!dark_ || editor_ || !fbo) {
+		//give the render target back to the pool.
+		light_rt_.reset();
+		light_state_.clear();
 		return;
 	}
 	auto wnd = KRE::WindowManager::getMainWindow();
@@ -2124,13 +2350,40 @@ void Level::calculateLighting(int x, int y, int w, int h) const
 		}
 	}
 
-	auto rt = KRE::RenderTarget::create(w, h);
+	//the state the lighting is drawn with: the area, the transform, the
+	//darkness and each light.
+	static std::vector<size_t> state;
+	state.clear();
+	state.push_back(x);
+	state.push_back(y);
+	state.push_back(w);
+	state.push_back(h);
+	state.push_back(dark_color_.applyBlack().asRGBA());
 
-	{
+	size_t transform_hash = 0;
+	const glm::mat4& model = KRE::get_global_model_matrix();
+	for(int col = 0; col != 4; ++col) {
+		for(int row = 0; row != 4; ++row) {
+			boost::hash_combine(transform_hash, model[col][row]);
+		}
+	}
+	state.push_back(transform_hash);
+
+	for(const Light* lt : lights) {
+		state.push_back(reinterpret_cast<size_t>(lt));
+		state.push_back(lt->getDrawHash());
+	}
+
+	if(!light_rt_ || light_rt_->width() != w || light_rt_->height() != h) {
+		light_rt_ = KRE::RenderTarget::acquire(w, h);
+		light_state_.clear();
+	}
+
+	if(state != light_state_) {
 		KRE::BlendModeScope blend_scope(KRE::BlendModeConstants::BM_ONE, KRE::BlendModeConstants::BM_ONE);
 		rect screen_area(x, y, w, h);
 		
-		KRE::RenderTarget::RenderScope scope(rt);
+		KRE::RenderTarget::RenderScope scope(light_rt_);
 
 		wnd->setClearColor(dark_color_.applyBlack());
 		wnd->clear(KRE::ClearFlags::COLOR);
@@ -2139,9 +2392,11 @@ void Level::calculateLighting(int x, int y, int w, int h) const
 		for(auto& lt : lights) {
 			wnd->render(lt);
 		}
+
+		light_state_ = state;
 	}
 
-	wnd->render(rt.get());
+	wnd->render(light_rt_.get());
 }
 
 void Level::draw_debug_solid(int x, int y, int w, int h) const
@@ -2173,7 +2428,7 @@ void Level::draw_debug_solid(int x, int y, int w, int h) const
 
 				for(int suby = 0; suby != TileSize; ++suby) {
 					for(int subx = 0; subx != TileSize; ++subx) {
-						if(info->bitmap.test(suby*TileSize + subx)) {
+						if(info->bitmap.test(subx, suby)) {
 							v.emplace_back(xpixel + subx + 1, ypixel + suby + 1);
 						}
 					}
@@ -2493,8 +2748,7 @@ bool Level::isSolid(const LevelSolidMap& map, const Entity& e, const std::vector
 				return true;
 			}
 		
-			const int index = y*TileSize + x;
-			if(info->bitmap.test(index)) {
+			if(info->bitmap.test(x, y)) {
 				if(surf_info) {
 					*surf_info = &info->info;
 				}
@@ -2510,6 +2764,100 @@ bool Level::isSolid(const LevelSolidMap& map, const Entity& e, const std::vector
 	return false;
 }
 
+namespace {
+	int floor_div(int n, int d)
+	{
+		return n >= 0 ? n/d : -((d - 1 - n)/d);
+	}
+}
+
+bool Level::isSolid(const LevelSolidMap& map, const Entity& e, const PackedSolidEdge& edge, const SurfaceInfo** surf_info) const
+{
+	if(edge.rows.empty()) {
+		return false;
+	}
+
+	const bool facing_right = e.isFacingRight();
+	const int frame_width = e.getCurrentFrame().width();
+	const uint64_t* bits = facing_right ? &edge.bits[0] : &edge.mirrored_bits[0];
+
+	//edges which run down the side of an object will look at the same tile
+	//for many rows in a row.
+	tile_pos prev_pos(std::numeric_limits<int>::min(), std::numeric_limits<int>::min());
+	const TileSolidInfo* info = nullptr;
+
+	//the tile coordinates of the previous row's first point, which are
+	//stepped along rather than recalculated, since rows are usually only a
+	//pixel apart.
+	const PackedSolidEdge::Row& front = edge.rows.front();
+	int prev_y = e.y() + front.y;
+	int tile_y = floor_div(prev_y, TileSize);
+	int suby = prev_y - tile_y*TileSize;
+
+	int prev_xbegin = e.x() + (facing_right ? front.x1 : frame_width - 1 - front.x2);
+	int first_tile = floor_div(prev_xbegin, TileSize);
+	int subx = prev_xbegin - first_tile*TileSize;
+
+	for(const PackedSolidEdge::Row& row : edge.rows) {
+		const uint64_t* row_bits = bits + row.word;
+		const int width = row.x2 - row.x1 + 1;
+		const int xbegin = e.x() + (facing_right ? row.x1 : frame_width - 1 - row.x2);
+		const int xend = xbegin + width;
+
+		const int y = e.y() + row.y;
+		suby += y - prev_y;
+		if(suby < 0 || suby >= TileSize) {
+			tile_y = floor_div(y, TileSize);
+			suby = y - tile_y*TileSize;
+		}
+
+		prev_y = y;
+
+		subx += xbegin - prev_xbegin;
+		if(subx < 0 || subx >= TileSize) {
+			first_tile = floor_div(xbegin, TileSize);
+			subx = xbegin - first_tile*TileSize;
+		}
+
+		prev_xbegin = xbegin;
+
+		const int last_tile = subx + width <= TileSize ? first_tile : first_tile + (subx + width - 1)/TileSize;
+
+		//walk the tiles in the same order as the points in the row are
+		//listed in, so the surface info we find is the one for the first
+		//solid point.
+		const int step = facing_right ? 1 : -1;
+		for(int tile_x = facing_right ? first_tile : last_tile; tile_x != (facing_right ? last_tile : first_tile) + step; tile_x += step) {
+			if(tile_x != prev_pos.first || tile_y != prev_pos.second) {
+				prev_pos = tile_pos(tile_x, tile_y);
+				info = map.find(prev_pos);
+			}
+
+			if(info == nullptr) {
+				continue;
+			}
+
+			const int tile_begin = tile_x*TileSize;
+			const int begin = std::max(xbegin, tile_begin);
+			const int end = std::min(xend, tile_begin + TileSize);
+			const uint64_t points = extract_bits(row_bits, row.nwords, begin - xbegin, end - begin);
+			if(points == 0) {
+				continue;
+			}
+
+			if(info->all_solid || ((points << (begin - tile_begin)) & info->bitmap.row(suby)) != 0) {
+				if(surf_info) {
+					*surf_info = &info->info;
+				}
+
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
 bool Level::isSolid(const LevelSolidMap& map, int x, int y, const SurfaceInfo** surf_info) const
 {
 	tile_pos pos(x/TileSize, y/TileSize);
@@ -2535,8 +2883,7 @@ bool Level::isSolid(const LevelSolidMap& map, int x, int y, const SurfaceInfo**
 			return true;
 		}
 		
-		const int index = y*TileSize + x;
-		if(info->bitmap.test(index)) {
+		if(info->bitmap.test(x, y)) {
 			if(surf_info) {
 				*surf_info = &info->info;
 			}
@@ -2597,6 +2944,16 @@ bool Level::solid(const Entity& e, const std::vector<point>& points, const Surfa
 	return isSolid(solid_, e, points, info);
 }
 
+bool Level::solid(const Entity& e, const SolidMap& m, MOVE_DIRECTION dir, const SurfaceInfo** info) const
+{
+	const PackedSolidEdge& edge = m.packedDir(dir);
+	if(edge.dense) {
+		return isSolid(solid_, e, edge, info);
+	}
+
+	return isSolid(solid_, e, m.dir(dir), info);
+}
+
 bool Level::solid(int xbegin, int ybegin, int w, int h, const SurfaceInfo** info) const
 {
 	const int xend = xbegin + w;
@@ -2671,6 +3028,8 @@ void Level::set_solid_area(const rect& r, bool solid)
 			setSolid(solid_, x, y, 100, 100, 0, empty_info, solid);
 		}
 	}
+
+	pathfinding::invalidate_grid_paths(this, &r);
 }
 
 EntityPtr Level::board(int x, int y) const
@@ -2692,7 +3051,9 @@ void Level::add_tile(const LevelTile& t)
 	tiles_.insert(itor, t);
 	add_tile_solid(t);
 	layers_.insert(t.zorder);
-	prepare_tiles_for_drawing();
+
+	const rect area(t.x, t.y, 1, 1);
+	prepare_tiles_for_drawing(&area);
 }
 
 bool Level::add_tile_rect(int zorder, int x1, int y1, int x2, int y2, const std::string& str)
@@ -2771,6 +3132,11 @@ bool Level::add_tile_rect_vector_internal(int zorder, int x1, int y1, int x2, in
 		}
 	}
 
+	if(changed) {
+		rect& dirty = tile_rebuild_map[this].dirty_areas[zorder];
+		dirty = rect_union(dirty, rect(x1, y1, x2 - x1, y2 - y1));
+	}
+
 	return changed;
 }
 
@@ -3107,7 +3473,6 @@ void Level::setSolid(LevelSolidMap& map, int x, int y, int friction, int tractio
 		pos.second--;
 		y += TileSize;
 	}
-	const int index = y*TileSize + x;
 	TileSolidInfo& info = map.insertOrFind(pos);
 
 	if(info.info.damage >= 0) {
@@ -3119,14 +3484,14 @@ void Level::setSolid(LevelSolidMap& map, int x, int y, int friction, int tractio
 	if(solid) {
 		info.info.friction = friction;
 		info.info.traction = traction;
-		info.bitmap.set(index);
+		info.bitmap.set(x, y);
 	} else {
 		if(info.all_solid) {
 			info.all_solid = false;
 			info.bitmap.set();
 		}
 
-		info.bitmap.reset(index);
+		info.bitmap.reset(x, y);
 	}
 
 	if(info_str.empty() == false) {
@@ -3740,6 +4105,15 @@ const std::vector<EntityPtr>& Level::get_solid_chars() const
 	return solid_chars_;
 }
 
+UserCollisionBroadphase& Level::user_collision_broadphase()
+{
+	if(!user_collision_broadphase_) {
+		user_collision_broadphase_.reset(new UserCollisionBroadphase);
+	}
+
+	return *user_collision_broadphase_;
+}
+
 bool Level::can_interact(const rect& body) const
 {
 	for(const portal& p : portals_) {
@@ -3768,71 +4142,196 @@ void Level::replay_from_cycle(int ncycle)
 	int index = static_cast<int>(backups_.size()) - cycles_ago;
 	ASSERT_GE(index, 0);
 
+	//if the history can't be restored to ncycle, this falls back to an
+	//earlier keyframe, and there are more cycles to play.
 	const int cycle_to_play_until = cycle_;
-	restore_from_backup(*backups_[index]);
-	ASSERT_EQ(cycle_, ncycle);
-	backups_.erase(backups_.begin() + index, backups_.end());
+	restore_from_backup_index(index);
 	while(cycle_ < cycle_to_play_until) {
 		backup();
 		do_processing();
 	}
 }
 
-void Level::backup()
+void Level::backup(bool force_keyframe)
 {
 	if(backups_.empty() == false && backups_.back()->cycle == cycle_) {
-		return;
+		if(backups_.back()->keyframe || !force_keyframe) {
+			return;
+		}
+
+		backups_.pop_back();
 	}
 
-	std::map<EntityPtr, EntityPtr> entity_map;
+	int cycles_since_keyframe = -1;
+	for(auto i = backups_.rbegin(); i != backups_.rend(); ++i) {
+		if((*i)->keyframe) {
+			cycles_since_keyframe = cycle_ - (*i)->cycle;
+			break;
+		}
+	}
 
 	backup_snapshot_ptr snapshot(new backup_snapshot);
 	snapshot->rng_seed = rng::get_seed();
 	snapshot->cycle = cycle_;
-	snapshot->chars.reserve(chars_.size());
 
+	//changes are recorded against the previous snapshot, so one is needed
+	//to follow on from.
+	const bool follows_previous = backups_.empty() == false && backups_.back() == backup_prev_snapshot_;
+	snapshot->keyframe = force_keyframe || force_backup_keyframes_ || !follows_previous || cycles_since_keyframe < 0 || cycles_since_keyframe >= g_backup_keyframe_interval;
+	snapshot->copied_objects = 0;
+	snapshot->bytes = sizeof(backup_snapshot);
 
-	for(const EntityPtr& e : chars_) {
-		snapshot->chars.push_back(e->backup());
-		entity_map[e] = snapshot->chars.back();
+	if(backups_.empty() == false && *backups_.back()->live_chars == chars_) {
+		snapshot->live_chars = backups_.back()->live_chars;
+	} else {
+		snapshot->live_chars.reset(new std::vector<EntityPtr>(chars_));
+		snapshot->bytes += chars_.size()*sizeof(EntityPtr);
+	}
 
-		if(snapshot->chars.back()->isHuman()) {
-			snapshot->players.push_back(snapshot->chars.back());
-			if(e == player_) {
-				snapshot->player = snapshot->players.back();
+	//predict_future() takes a keyframe every cycle, so has no use for the
+	//state to record changes against.
+	const bool record_prev_state = !force_backup_keyframes_;
+	std::map<EntityPtr, backup_prev_state> prev_state;
+
+	if(snapshot->keyframe) {
+		std::map<EntityPtr, EntityPtr> entity_map;
+
+		snapshot->chars.reserve(chars_.size());
+
+		for(const EntityPtr& e : chars_) {
+			snapshot->chars.push_back(e->backup());
+			entity_map[e] = snapshot->chars.back();
+
+			if(snapshot->chars.back() != e) {
+				++snapshot->copied_objects;
+				snapshot->bytes += e->backupBytes();
+			}
+
+			if(record_prev_state) {
+				//the copy in the snapshot has its references mapped, so
+				//changes are recorded against a copy of its own.
+				backup_prev_state& prev = prev_state[e];
+				prev.state = e->backup();
+				prev.shared = false;
+			}
+
+			if(snapshot->chars.back()->isHuman()) {
+				snapshot->players.push_back(snapshot->chars.back());
+				if(e == player_) {
+					snapshot->player = snapshot->players.back();
+				}
 			}
 		}
-	}
 
-	for(entity_group& g : groups_) {
-		snapshot->groups.push_back(entity_group());
+		snapshot->bytes += snapshot->chars.size()*sizeof(EntityPtr);
+
+		for(entity_group& g : groups_) {
+			snapshot->groups.push_back(entity_group());
 
-		for(EntityPtr e : g) {
-			std::map<EntityPtr, EntityPtr>::iterator i = entity_map.find(e);
-			if(i != entity_map.end()) {
-				snapshot->groups.back().push_back(i->second);
+			for(EntityPtr e : g) {
+				std::map<EntityPtr, EntityPtr>::iterator i = entity_map.find(e);
+				if(i != entity_map.end()) {
+					snapshot->groups.back().push_back(i->second);
+				}
 			}
 		}
-	}
 
-	for(const EntityPtr& e : snapshot->chars) {
-		e->mapEntities(entity_map);
+		for(const EntityPtr& e : snapshot->chars) {
+			e->mapEntities(entity_map);
+		}
+	} else {
+		for(int n = 0; n != static_cast<int>(chars_.size()); ++n) {
+			const EntityPtr& e = chars_[n];
+			backup_prev_state& prev = prev_state[e];
+
+			auto i = backup_prev_state_.find(e);
+			ConstEntityBackupDeltaPtr delta;
+			if(i != backup_prev_state_.end() && e->diffBackup(*i->second.state, &delta)) {
+				prev = i->second;
+				if(!delta) {
+					continue;
+				}
+
+				if(prev.shared) {
+					prev.state = prev.state->backup();
+					prev.shared = false;
+				}
+
+				prev.state->applyBackupDelta(*delta);
+
+				backup_snapshot::change change;
+				change.index = n;
+				change.delta = delta;
+				snapshot->changes.push_back(change);
+				snapshot->bytes += delta->bytes();
+			} else {
+				backup_snapshot::change change;
+				change.index = n;
+				change.copy = e->backup();
+				snapshot->changes.push_back(change);
+
+				if(change.copy != e) {
+					++snapshot->copied_objects;
+					snapshot->bytes += e->backupBytes();
+				}
+
+				prev.state = change.copy;
+				prev.shared = true;
+			}
+		}
+
+		snapshot->bytes += snapshot->changes.size()*sizeof(backup_snapshot::change);
+
+		snapshot->player = player_;
+		snapshot->groups = groups_;
+		for(const entity_group& g : groups_) {
+			snapshot->bytes += g.size()*sizeof(EntityPtr);
+		}
 	}
 
 	snapshot->last_touched_player = last_touched_player_;
 
+	backup_stats_.last_snapshot_bytes = snapshot->bytes;
+	backup_stats_.last_snapshot_copied_objects = snapshot->copied_objects;
+
 	backups_.push_back(snapshot);
+
+	if(record_prev_state) {
+		backup_prev_state_.swap(prev_state);
+		backup_prev_snapshot_ = snapshot;
+	} else {
+		backup_prev_state_.clear();
+		backup_prev_snapshot_.reset();
+	}
+
 	if(backups_.size() > 250) {
+		//drop the oldest keyframe along with the snapshots which depend on it.
+		do {
+			//kill off any references the copies hold, to workaround
+			//circular references causing things to stick around. Objects
+			//which don't copy themselves, and the states the next snapshot
+			//records changes against, are left alone.
+			const backup_snapshot& oldest = *backups_.front();
+			for(size_t n = 0; n != oldest.chars.size(); ++n) {
+				if(oldest.chars[n] != (*oldest.live_chars)[n]) {
+					oldest.chars[n]->cleanup_references();
+				}
+			}
+
+			for(const backup_snapshot::change& change : oldest.changes) {
+				const EntityPtr& e = (*oldest.live_chars)[change.index];
+				if(!change.copy || change.copy == e) {
+					continue;
+				}
 
-		for(std::deque<backup_snapshot_ptr>::iterator i = backups_.begin();
-		    i != backups_.begin() + 1; ++i) {
-			for(const EntityPtr& e : (*i)->chars) {
-				//kill off any references this entity holds, to workaround
-				//circular references causing things to stick around.
-				e->cleanup_references();
+				auto prev = backup_prev_state_.find(e);
+				if(prev == backup_prev_state_.end() || prev->second.state != change.copy) {
+					change.copy->cleanup_references();
+				}
 			}
-		}
-		backups_.erase(backups_.begin(), backups_.begin() + 1);
+
+			backups_.pop_front();
+		} while(backups_.empty() == false && backups_.front()->keyframe == false);
 	}
 }
 
@@ -3845,14 +4344,35 @@ int Level::earliest_backup_cycle() const
 	}
 }
 
+Level::BackupStats::BackupStats()
+  : snapshots(0), keyframes(0), bytes(0), last_snapshot_bytes(0),
+    copied_objects(0), last_snapshot_copied_objects(0),
+    restores(0), last_restore_us(0), max_restore_us(0)
+{
+}
+
+const Level::BackupStats& Level::backup_stats() const
+{
+	backup_stats_.snapshots = static_cast<int>(backups_.size());
+	backup_stats_.keyframes = 0;
+	backup_stats_.bytes = 0;
+	backup_stats_.copied_objects = 0;
+	for(const backup_snapshot_ptr& snapshot : backups_) {
+		backup_stats_.keyframes += snapshot->keyframe ? 1 : 0;
+		backup_stats_.bytes += snapshot->bytes;
+		backup_stats_.copied_objects += snapshot->copied_objects;
+	}
+
+	return backup_stats_;
+}
+
 void Level::reverse_one_cycle()
 {
 	if(backups_.empty()) {
 		return;
 	}
 
-	restore_from_backup(*backups_.back());
-	backups_.pop_back();
+	restore_from_backup_index(static_cast<int>(backups_.size()) - 1);
 }
 
 void Level::reverse_to_cycle(int ncycle)
@@ -3871,6 +4391,149 @@ void Level::reverse_to_cycle(int ncycle)
 	LOG_INFO("GOT TO CYCLE: " << backups_.back()->cycle);
 
 	reverse_one_cycle();
+
+	LOG_INFO("RESTORED IN " << backup_stats_.last_restore_us << "us");
+}
+
+bool Level::rebuild_backup(int index, backup_snapshot* result) const
+{
+	int keyframe = index;
+	while(keyframe > 0 && backups_[keyframe]->keyframe == false) {
+		--keyframe;
+	}
+
+	const backup_snapshot& key = *backups_[keyframe];
+	if(key.keyframe == false) {
+		return false;
+	}
+
+	//each object's state as of the snapshot replayed so far, keyed by the
+	//live object, and the live object each copy in the history is of.
+	std::map<EntityPtr, EntityPtr> state, copy_of;
+
+	for(size_t n = 0; n != key.chars.size(); ++n) {
+		const EntityPtr& e = (*key.live_chars)[n];
+		state[e] = key.chars[n]->backup();
+		copy_of[key.chars[n]] = e;
+	}
+
+	for(int i = keyframe + 1; i <= index; ++i) {
+		const backup_snapshot& snapshot = *backups_[i];
+		for(const backup_snapshot::change& change : snapshot.changes) {
+			const EntityPtr& e = (*snapshot.live_chars)[change.index];
+			if(change.copy) {
+				state[e] = change.copy->backup();
+				copy_of[change.copy] = e;
+				continue;
+			}
+
+			auto j = state.find(e);
+			if(j == state.end() || j->second == e) {
+				LOG_ERROR("Rewind history at cycle " << snapshot.cycle << " has changes for " << e->getDebugDescription() << " with no earlier state to apply them to");
+				return false;
+			}
+
+			j->second->applyBackupDelta(*change.delta);
+		}
+	}
+
+	const backup_snapshot& target = *backups_[index];
+	result->rng_seed = target.rng_seed;
+	result->cycle = target.cycle;
+	result->keyframe = true;
+	result->live_chars = target.live_chars;
+	result->copied_objects = 0;
+	result->bytes = 0;
+
+	std::map<EntityPtr, EntityPtr> entity_map;
+	for(const EntityPtr& e : *target.live_chars) {
+		auto j = state.find(e);
+		if(j == state.end()) {
+			LOG_ERROR("Rewind history at cycle " << target.cycle << " has no state for " << e->getDebugDescription());
+			return false;
+		}
+
+		result->chars.push_back(j->second);
+		entity_map[e] = j->second;
+	}
+
+	//references between copies in keyframes are to the other copies.
+	for(const auto& p : copy_of) {
+		auto j = entity_map.find(p.second);
+		if(j != entity_map.end()) {
+			entity_map[p.first] = j->second;
+		}
+	}
+
+	for(const EntityPtr& e : result->chars) {
+		if(e->isHuman()) {
+			result->players.push_back(e);
+		}
+	}
+
+	for(const entity_group& g : target.groups) {
+		result->groups.push_back(entity_group());
+		for(const EntityPtr& e : g) {
+			auto j = entity_map.find(e);
+			if(j != entity_map.end()) {
+				result->groups.back().push_back(j->second);
+			}
+		}
+	}
+
+	if(target.player) {
+		auto j = entity_map.find(target.player);
+		if(j != entity_map.end()) {
+			result->player = j->second;
+		}
+	}
+
+	result->last_touched_player = target.last_touched_player;
+	if(target.last_touched_player) {
+		auto j = entity_map.find(target.last_touched_player);
+		if(j != entity_map.end()) {
+			result->last_touched_player = j->second;
+		}
+	}
+
+	for(const EntityPtr& e : result->chars) {
+		e->mapEntities(entity_map);
+	}
+
+	return true;
+}
+
+void Level::restore_from_backup_index(int index)
+{
+	ASSERT_LOG(index >= 0 && index < static_cast<int>(backups_.size()), "Illegal backup index: " << index << "/" << backups_.size());
+
+	profile::timer timer;
+
+	backup_snapshot snapshot;
+	if(!rebuild_backup(index, &snapshot)) {
+		//something the deltas depend on wasn't recorded. Fall back to the
+		//keyframe, which holds a full copy of every object.
+		const int target_cycle = backups_[index]->cycle;
+		while(index > 0 && backups_[index]->keyframe == false) {
+			--index;
+		}
+
+		LOG_ERROR("Could not restore cycle " << target_cycle << " from the rewind history. Restoring the keyframe at cycle " << backups_[index]->cycle << " instead");
+
+		snapshot = backup_snapshot();
+		if(!rebuild_backup(index, &snapshot)) {
+			LOG_ERROR("Could not restore the keyframe at cycle " << backups_[index]->cycle);
+			return;
+		}
+	}
+
+	backups_.erase(backups_.begin() + index, backups_.end());
+	restore_from_backup(snapshot);
+
+	const int restore_us = static_cast<int>(timer.get_time());
+	++backup_stats_.restores;
+	backup_stats_.last_restore_us = restore_us;
+	backup_stats_.max_restore_us = std::max(backup_stats_.max_restore_us, restore_us);
 }
 
 void Level::restore_from_backup(backup_snapshot& snapshot)
@@ -3886,6 +4549,10 @@ void Level::restore_from_backup(backup_snapshot& snapshot)
 
 	solid_chars_.clear();
 
+	//the level's objects are replaced, so the next snapshot is a keyframe.
+	backup_prev_state_.clear();
+	backup_prev_snapshot_.reset();
+
 	chars_by_label_.clear();
 	for(const EntityPtr& e : chars_) {
 		if(e->label().empty() == false) {
@@ -3913,6 +4580,7 @@ std::vector<EntityPtr> Level::trace_past(EntityPtr e, int ncycle)
 
 		prev_cycle = snapshot.cycle;
 
+		//only keyframes hold copies of the objects.
 		for(const EntityPtr& ghost : snapshot.chars) {
 			if(ghost->label() == e->label()) {
 				result.push_back(ghost);
@@ -3930,7 +4598,7 @@ std::vector<EntityPtr> Level::predict_future(EntityPtr e, int ncycles)
 	disable_flashes_scope flashes_disabled_scope;
 	const controls::control_backup_scope ctrl_backup_scope;
 
-	backup();
+	backup(true);
 	backup_snapshot_ptr snapshot = backups_.back();
 	backups_.pop_back();
 
@@ -3941,6 +4609,9 @@ std::vector<EntityPtr> Level::predict_future(EntityPtr e, int ncycles)
 
 	const int controls_end = controls::local_controls_end();
 	LOG_INFO("PREDICT FUTURE: " << cycle_ << "/" << controls_end);
+
+	//every cycle needs a copy of the objects for the trail.
+	force_backup_keyframes_ = true;
 	while(cycle_ < controls_end) {
 		try {
 			const assert_recover_scope safe_scope;
@@ -3953,6 +4624,8 @@ std::vector<EntityPtr> Level::predict_future(EntityPtr e, int ncycles)
 		}
 	}
 
+	force_backup_keyframes_ = false;
+
 	LOG_INFO("TOOK " << (profile::get_tick_time() - begin_time) << "ms TO MOVE FORWARD " << nframes << " frames");
 
 	begin_time = profile::get_tick_time();
@@ -3969,7 +4642,7 @@ std::vector<EntityPtr> Level::predict_future(EntityPtr e, int ncycles)
 
 void Level::transfer_state_to(Level& lvl)
 {
-	backup();
+	backup(true);
 	lvl.restore_from_backup(*backups_.back());
 	backups_.pop_back();
 }
@@ -4132,6 +4805,7 @@ void Level::build_solid_data_from_sub_levels()
 	standable_ = standable_base_;
 	solid_.clear();
 	standable_.clear();
+	pathfinding::invalidate_grid_paths(this);
 
 	for(auto i : sub_levels_) {
 		if(!i.second.active) {
@@ -4343,9 +5017,10 @@ bool Level::executeCommand(const variant& var)
 			}
 		}
 	} else {
-		game_logic::CommandCallable* cmd = var.try_convert<game_logic::CommandCallable>();
-		if(cmd != nullptr) {
-			cmd->runCommand(*this);
+		const game_logic::FormulaCallable* callable = var.is_callable() ? var.as_callable() : nullptr;
+		if(callable && callable->getCommandType() == game_logic::COMMAND_TYPE::FORMULA) {
+			static_cast<const game_logic::CommandCallable*>(callable)->runCommand(*this);
+			game_logic::count_command_executed(game_logic::COMMAND_TYPE::FORMULA);
 		}
 	}
 	return result;
@@ -4467,6 +5142,109 @@ BENCHMARK(level_solid)
 	}
 }
 
+BENCHMARK_ARG(level_solid_edge, bool packed)
+{
+	//benchmark of testing the edges of objects against the level, as is
+	//done for every step an object moves. Compares testing the points of
+	//an edge one at a time with testing the packed edge.
+	static Level* lvl = new Level("stairway-to-heaven.cfg");
+	const std::vector<EntityPtr>& chars = lvl->get_chars();
+	BENCHMARK_LOOP {
+		for(const EntityPtr& e : chars) {
+			if(e->solid() == nullptr) {
+				continue;
+			}
+
+			for(const ConstSolidMapPtr& m : e->solid()->solid()) {
+				for(int dir = 0; dir != 4; ++dir) {
+					if(packed) {
+						lvl->solid(*e, *m, static_cast<MOVE_DIRECTION>(dir));
+					} else {
+						lvl->solid(*e, m->dir(static_cast<MOVE_DIRECTION>(dir)));
+					}
+				}
+			}
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(level_solid_edge, points, false);
+BENCHMARK_ARG_CALL(level_solid_edge, packed, true);
+
+BENCHMARK_ARG(level_rebuild_tiles, const std::string& mode)
+{
+	//benchmark of building the tiles of a large level. 'serial' builds
+	//everything on one thread and 'parallel' spreads layers and bands of
+	//rows over the background workers. 'edit' changes a single tile and
+	//rebuilds in the background, as the editor does, which only builds
+	//the tiles around the change.
+	static Level* lvl = new Level("stairway-to-heaven.cfg");
+
+	const int band_rows = g_tile_rebuild_band_rows;
+	if(mode == "serial") {
+		g_tile_rebuild_band_rows = 0;
+	}
+
+	if(mode == "edit") {
+		const int x = 512, y = 512;
+		std::map<int, std::vector<std::string>> tiles;
+		lvl->getAllTilesRect(x, y, x, y, tiles);
+		ASSERT_LOG(tiles.empty() == false, "No tiles to edit in benchmark level");
+
+		const int layer = tiles.begin()->first;
+		const std::string original = tiles.begin()->second.front();
+
+		bool cleared = false;
+		BENCHMARK_LOOP {
+			cleared = !cleared;
+			lvl->add_tile_rect(layer, x, y, x, y, cleared ? "" : original);
+
+			const int state_id = Level::tileRebuildStateId();
+			lvl->start_rebuild_tiles_in_background(std::vector<int>(1, layer));
+			while(Level::tileRebuildStateId() == state_id) {
+				lvl->complete_rebuild_tiles_in_background();
+			}
+		}
+
+		if(cleared) {
+			lvl->add_tile_rect(layer, x, y, x, y, original);
+			lvl->rebuildTiles();
+		}
+	} else {
+		BENCHMARK_LOOP {
+			lvl->rebuildTiles();
+		}
+	}
+
+	g_tile_rebuild_band_rows = band_rows;
+}
+
+BENCHMARK_ARG_CALL(level_rebuild_tiles, serial, "serial");
+BENCHMARK_ARG_CALL(level_rebuild_tiles, parallel, "parallel");
+BENCHMARK_ARG_CALL(level_rebuild_tiles, edit, "edit");
+
+BENCHMARK(level_backup)
+{
+	//benchmark of recording rewind history and stepping back through it.
+	static LevelPtr lvl;
+	if(!lvl) {
+		lvl.reset(new Level("to-nenes-house.cfg"));
+		lvl->finishLoading();
+		lvl->setAsCurrentLevel();
+	}
+
+	BENCHMARK_LOOP {
+		lvl->backup();
+		lvl->process();
+		if(lvl->cycle()%50 == 0) {
+			lvl->reverse_to_cycle(lvl->cycle() - 25);
+		}
+	}
+
+	const Level::BackupStats& stats = lvl->backup_stats();
+	LOG_INFO("level_backup: " << stats.snapshots << " snapshots (" << stats.keyframes << " keyframes) holding " << stats.bytes << " bytes in " << stats.copied_objects << " object copies and deltas; last snapshot " << stats.last_snapshot_bytes << " bytes; restores took up to " << stats.max_restore_us << "us");
+}
+
 BENCHMARK(load_nene)
 {
 	BENCHMARK_LOOP {
@@ -47,6 +47,7 @@
 #include "level_object.hpp"
 #include "level_solid_map.hpp"
 #include "random.hpp"
+#include "solid_map.hpp"
 #include "speech_dialog.hpp"
 #include "tile_map.hpp"
 #include "variant.hpp"
@@ -55,6 +56,10 @@
 class Level;
 typedef boost::intrusive_ptr<Level> LevelPtr;
 
+class UserCollisionBroadphase;
+class SolidMap;
+struct PackedSolidEdge;
+
 class CurrentLevelScope 
 {
 	LevelPtr old_;
@@ -79,6 +84,10 @@ public:
 
 	static int tileRebuildStateId();
 
+	//the number of chunks of tiles which were drawn in the last frame, and
+	//the number which make up the layers that were drawn.
+	static void getTileChunkStats(int* visible, int* total);
+
 	static void setPlayerVariantType(variant type);
 
 	explicit Level(const std::string& level_cfg, variant node=variant());
@@ -119,6 +128,9 @@ public:
 	bool standable_tile(int x, int y, const SurfaceInfo** info=nullptr) const;
 	bool solid(int x, int y, const SurfaceInfo** info=nullptr) const;
 	bool solid(const Entity& e, const std::vector<point>& points, const SurfaceInfo** info=nullptr) const;
+
+	//tests one side of one of an object's solid maps against the level.
+	bool solid(const Entity& e, const SolidMap& m, MOVE_DIRECTION dir, const SurfaceInfo** info=nullptr) const;
 	bool solid(const rect& r, const SurfaceInfo** info=nullptr) const;
 	bool solid(int xbegin, int ybegin, int w, int h, const SurfaceInfo** info=nullptr) const;
 	bool may_be_solid_in_rect(const rect& r) const;
@@ -291,6 +303,8 @@ public:
 	void swap_chars(std::vector<EntityPtr>& v) { chars_.swap(v); solid_chars_.clear(); }
 	int num_active_chars() const { return static_cast<int>(active_chars_.size()); }
 
+	UserCollisionBroadphase& user_collision_broadphase();
+
 	//function which, given the rect of the player's body will return true iff
 	//the player can currently "interact" with a portal or object. i.e. if
 	//pressing up will talk to someone or enter a door etc.
@@ -298,7 +312,12 @@ public:
 
 	int earliest_backup_cycle() const;
 	void replay_from_cycle(int ncycle);
-	void backup();
+
+	//records the state of the level for the current cycle. Every few
+	//cycles a full copy of the objects is taken (a keyframe); the
+	//snapshots in between record only what changed in each object since
+	//the snapshot before.
+	void backup(bool force_keyframe=false);
 	void reverse_one_cycle();
 	void reverse_to_cycle(int ncycle);
 
@@ -311,6 +330,24 @@ public:
 
 	bool is_multiplayer() const { return players_.size() > 1; }
 
+	struct BackupStats {
+		BackupStats();
+
+		int snapshots, keyframes;
+
+		//the approximate memory held by all snapshots, and by the most
+		//recent, in bytes.
+		size_t bytes, last_snapshot_bytes;
+
+		//the object copies held by all snapshots, and by the most recent.
+		int copied_objects, last_snapshot_copied_objects;
+
+		int restores;
+		int last_restore_us, max_restore_us;
+	};
+
+	const BackupStats& backup_stats() const;
+
 	void get_tile_layers(std::set<int>* all_layers, std::set<int>* hidden_layers=nullptr);
 	void hide_tile_layer(int layer, bool is_hidden);
 
@@ -391,8 +428,13 @@ private:
 
 	void read_compiled_tiles(variant node, std::vector<LevelTile>::iterator& out);
 
-	void complete_tiles_refresh();
-	void prepare_tiles_for_drawing();
+	//adds the solids for the tiles and prepares them for drawing. If
+	//area is given only tiles within it have changed.
+	void complete_tiles_refresh(const rect* area=nullptr);
+
+	//builds the geometry for drawing the tiles. If area is given only the
+	//chunks holding tiles positioned within it are rebuilt.
+	void prepare_tiles_for_drawing(const rect* area=nullptr);
 
 	void do_processing();
 
@@ -437,6 +479,7 @@ private:
 
 	bool isSolid(const LevelSolidMap& map, int x, int y, const SurfaceInfo** surf_info) const;
 	bool isSolid(const LevelSolidMap& map, const Entity& e, const std::vector<point>& points, const SurfaceInfo** surf_info) const;
+	bool isSolid(const LevelSolidMap& map, const Entity& e, const PackedSolidEdge& edge, const SurfaceInfo** surf_info) const;
 
 	void setSolid(LevelSolidMap& map, int x, int y, int friction, int traction, int damage, const std::string& info, bool solid=true);
 
@@ -563,17 +606,70 @@ private:
 	struct backup_snapshot {
 		rng::Seed rng_seed;
 		int cycle;
+
+		//keyframes hold a copy of every object. Other snapshots hold what
+		//changed in each object since the snapshot before.
+		bool keyframe;
+
+		//the level's objects when the snapshot was taken. Snapshots share
+		//the list until an object is added or removed.
+		std::shared_ptr<const std::vector<EntityPtr>> live_chars;
+
+		//in keyframes, a copy of each of live_chars, with references
+		//between them mapped to the copies.
 		std::vector<EntityPtr> chars;
+
+		//in other snapshots, the objects which changed, by their index in
+		//live_chars. An object whose changes couldn't be recorded as a
+		//delta has a copy instead.
+		struct change {
+			int index;
+			EntityPtr copy;
+			ConstEntityBackupDeltaPtr delta;
+		};
+
+		std::vector<change> changes;
+
+		//keyframes refer to their copies here; other snapshots to the
+		//live objects.
 		std::vector<EntityPtr> players;
 		std::vector<entity_group> groups;
 		EntityPtr player, last_touched_player;
+
+		int copied_objects;
+		size_t bytes;
 	};
 
 	void restore_from_backup(backup_snapshot& snapshot);
 
+	//builds a keyframe holding the state recorded by backups_[index] into
+	//*result, from the keyframe before it and the changes since. Returns
+	//false if the changes don't apply to the objects they were recorded
+	//for.
+	bool rebuild_backup(int index, backup_snapshot* result) const;
+
+	//brings the level to the state recorded by backups_[index], discarding
+	//that snapshot and every one after it.
+	void restore_from_backup_index(int index);
+
 	typedef std::shared_ptr<backup_snapshot> backup_snapshot_ptr;
 
 	std::deque<backup_snapshot_ptr> backups_;
+	mutable BackupStats backup_stats_;
+	bool force_backup_keyframes_;
+
+	//each object's state as of backup_prev_snapshot_, which the next
+	//snapshot records its changes against. Keyed by the live object.
+	struct backup_prev_state {
+		EntityPtr state;
+
+		//true if state is also a copy held by a snapshot, so it must be
+		//copied before a delta is applied to it.
+		bool shared;
+	};
+
+	std::map<EntityPtr, backup_prev_state> backup_prev_state_;
+	backup_snapshot_ptr backup_prev_snapshot_;
 
 	int editor_tile_updates_frozen_;
 	bool editor_dragging_objects_;
@@ -626,11 +722,31 @@ private:
 
 	LevelPtr suspended_level_;
 
-	mutable std::map<int, std::shared_ptr<LayerBlitInfo>> blit_cache_;
+	//each layer of tiles is split into square chunks, keyed by their row
+	//and column, so that only chunks which are on screen are drawn and
+	//only those which are edited are rebuilt. A tile belongs to the chunk
+	//its position is in.
+	struct TileChunk
+	{
+		//the area covered by the chunk's tiles.
+		rect area;
+		std::shared_ptr<LayerBlitInfo> opaque;
+		std::shared_ptr<LayerBlitInfo> transparent;
+	};
+
+	typedef std::map<std::pair<int, int>, TileChunk> TileChunkMap;
+	mutable std::map<int, TileChunkMap> blit_cache_;
+
+	std::shared_ptr<UserCollisionBroadphase> user_collision_broadphase_;
 
 	KRE::RenderTargetPtr rt_;
 	bool have_render_to_texture_;
 
+	//the lighting drawn in an earlier frame, and the state of the lights
+	//and the view it was drawn with. It's only redrawn when that changes.
+	mutable KRE::RenderTargetPtr light_rt_;
+	mutable std::vector<size_t> light_state_;
+
 	void surrenderReferences(GarbageCollector* gc) override;
 };
 
@@ -29,6 +29,9 @@
 #include "Font.hpp"
 #include "DisplayDevice.hpp"
 #include "ModelMatrixScope.hpp"
+#include "RenderTarget.hpp"
+#include "SceneNode.hpp"
+#include "SpriteBatch.hpp"
 #include "WindowManager.hpp"
 
 #include "background_task_pool.hpp"
@@ -47,6 +50,7 @@
 #include "formatter.hpp"
 #include "formula_profiler.hpp"
 #include "formula_callable.hpp"
+#include "formula_garbage_collector.hpp"
 #include "http_client.hpp"
 #ifdef TARGET_BLACKBERRY
 #include "userevents.h"
@@ -83,6 +87,8 @@ namespace
 
 	PREF_FLOAT(global_scale, 1.0f, "Global scale value.");
 
+	PREF_INT(incremental_gc_budget, 0, "Microseconds per frame to spend on incremental garbage collection of FFL objects. Only idle frame time is used. 0 disables it");
+
 	LevelRunner* current_level_runner = nullptr;
 
 	class current_level_runner_scope 
@@ -675,6 +681,11 @@ LevelRunner::LevelRunner(LevelPtr& lvl, std::string& level_cfg, std::string& ori
 	current_process_ = 0;
 	next_process_ = 0;
 	current_events_ = 0;
+	current_render_target_allocations_ = 0;
+	render_target_allocations_at_second_ = KRE::RenderTarget::getAllocationCount();
+	current_scene_objects_culled_ = 0;
+	current_scene_objects_queued_ = 0;
+	KRE::SceneNode::resetObjectCounts();
 
 	nskip_draw_ = 0;
 
@@ -719,6 +730,7 @@ void LevelRunner::close_editor()
 {
 	LOG_DEBUG("LevelRunner::close_editor()");
 #ifndef NO_EDITOR
+	editor_->flush_autosave();
 	if(editor_->mouselook_mode()) {
 		SDL_SetRelativeMouseMode(SDL_FALSE);
 	}
@@ -805,7 +817,14 @@ bool LevelRunner::play_cycle()
 
 	background_task_pool::pump();
 
-	performance_data current_perf(current_fps_,50,0,0,0,0,0,CustomObject::events_handled_per_second,"");
+	int tile_chunks_visible = 0, tile_chunks_total = 0;
+	Level::getTileChunkStats(&tile_chunks_visible, &tile_chunks_total);
+
+	performance_data current_perf(current_fps_,50,0,0,0,0,0,CustomObject::events_handled_per_second,KRE::SpriteBatch::getDrawCalls(),KRE::SpriteBatch::getUnbatchedDrawCalls(),KRE::Font::getAtlasPages(),KRE::Font::getTextureUploads(),tile_chunks_visible,tile_chunks_total,"");
+	current_perf.commands = current_commands_;
+	current_perf.render_target_allocations = current_render_target_allocations_;
+	current_perf.scene_objects_culled = current_scene_objects_culled_;
+	current_perf.scene_objects_queued = current_scene_objects_queued_;
 
 	if(preferences::internal_tbs_server()) {
 		tbs::internal_server::process();
@@ -1553,7 +1572,12 @@ bool LevelRunner::play_cycle()
 	}
 #endif
 
-		performance_data perf(current_fps_, current_cycles_, current_delay_, current_draw_, current_process_, current_flip_, cycle, current_events_, profiling_summary_);
+		Level::getTileChunkStats(&tile_chunks_visible, &tile_chunks_total);
+		performance_data perf(current_fps_, current_cycles_, current_delay_, current_draw_, current_process_, current_flip_, cycle, current_events_, KRE::SpriteBatch::getDrawCalls(), KRE::SpriteBatch::getUnbatchedDrawCalls(), KRE::Font::getAtlasPages(), KRE::Font::getTextureUploads(), tile_chunks_visible, tile_chunks_total, profiling_summary_);
+		perf.commands = current_commands_;
+		perf.render_target_allocations = current_render_target_allocations_;
+		perf.scene_objects_culled = current_scene_objects_culled_;
+		perf.scene_objects_queued = current_scene_objects_queued_;
 	
 		if(!is_skipping_game() && preferences::show_fps()) {
 			draw_fps(*lvl_, perf);
@@ -1594,6 +1618,13 @@ bool LevelRunner::play_cycle()
 		current_flip_ = next_flip_;
 		current_process_ = next_process_;
 		current_events_ = CustomObject::events_handled_per_second;
+		current_commands_ = game_logic::get_commands_executed();
+		game_logic::reset_commands_executed();
+		current_render_target_allocations_ = KRE::RenderTarget::getAllocationCount() - render_target_allocations_at_second_;
+		render_target_allocations_at_second_ = KRE::RenderTarget::getAllocationCount();
+		current_scene_objects_culled_ = KRE::SceneNode::getObjectsCulled();
+		current_scene_objects_queued_ = KRE::SceneNode::getObjectsQueued();
+		KRE::SceneNode::resetObjectCounts();
 		next_fps_ = 0;
 		next_cycles_ = 0;
 		next_delay_ = 0;
@@ -1607,6 +1638,13 @@ bool LevelRunner::play_cycle()
 
 	formula_profiler::pump();
 
+	if(g_incremental_gc_budget > 0 && !is_skipping_game()) {
+		const int idle_time = desired_end_time - profile::get_tick_time();
+		if(idle_time > 0) {
+			runIncrementalGarbageCollection(std::min<int>(g_incremental_gc_budget, idle_time*1000));
+		}
+	}
+
 	const int raw_wait_time = desired_end_time - profile::get_tick_time();
 	const int wait_time = std::max<int>(1, desired_end_time - profile::get_tick_time());
 	next_delay_ += wait_time;
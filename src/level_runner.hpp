@@ -26,6 +26,7 @@
 #include <boost/intrusive_ptr.hpp>
 
 #include <string>
+#include <vector>
 
 #include "button.hpp"
 #include "debug_console.hpp"
@@ -89,6 +90,13 @@ private:
 	int current_fps_, next_fps_, current_cycles_, next_cycles_, current_delay_, next_delay_,
 	    current_draw_, next_draw_, current_process_, next_process_,
 		current_flip_, next_flip_, current_events_;
+	// Commands executed in the last second, by type.
+	std::vector<int> current_commands_;
+	// Render targets created in the last second, and the count of render
+	// targets created at the start of this second.
+	int current_render_target_allocations_, render_target_allocations_at_second_;
+	// Scene objects culled and queued to be drawn in the last second.
+	int current_scene_objects_culled_, current_scene_objects_queued_;
 	std::string profiling_summary_;
 	int nskip_draw_;
 
@@ -22,11 +22,14 @@
 */
 
 
+#include <algorithm>
 #include <iostream>
 #include <set>
 
+#include "asserts.hpp"
 #include "level_solid_map.hpp"
 #include "preferences.hpp"
+#include "unit_test.hpp"
 
 namespace 
 {
@@ -47,11 +50,51 @@ const std::string* SurfaceInfo::get_info_str(const std::string& key)
 	return &*info_set.insert(key).first;
 }
 
+tile_bitmap::tile_bitmap() : rows_(TileSize)
+{
+	ASSERT_LOG(TileSize <= MAX_TILE_SIZE, "Tile size " << TileSize << " is larger than the maximum of " << MAX_TILE_SIZE);
+}
+
+void tile_bitmap::set()
+{
+	const uint64_t full_row = TileSize >= 64 ? ~uint64_t(0) : (uint64_t(1) << TileSize) - 1;
+	for(uint64_t& row : rows_) {
+		row = full_row;
+	}
+}
+
+bool tile_bitmap::any() const
+{
+	for(uint64_t row : rows_) {
+		if(row) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+tile_bitmap& tile_bitmap::operator|=(const tile_bitmap& o)
+{
+	for(int n = 0; n != rows_.size(); ++n) {
+		rows_[n] |= o.rows_[n];
+	}
+
+	return *this;
+}
+
+LevelSolidMap::Chunk::Chunk()
+{
+	std::fill(cells, cells + ChunkSize*ChunkSize, static_cast<TileSolidInfo*>(nullptr));
+}
+
 LevelSolidMap::LevelSolidMap()
+  : chunks_x_(0), chunks_y_(0), chunks_w_(0), chunks_h_(0)
 {
 }
 
 LevelSolidMap::LevelSolidMap(const LevelSolidMap& m)
+  : chunks_x_(0), chunks_y_(0), chunks_w_(0), chunks_h_(0)
 {
 }
 
@@ -75,72 +118,46 @@ TileSolidInfo& LevelSolidMap::insertOrFind(const tile_pos& pos)
 	return **result;
 }
 
-TileSolidInfo** LevelSolidMap::insertRaw(const tile_pos& pos)
+void LevelSolidMap::growToInclude(int chunk_x, int chunk_y)
 {
-	row* r = nullptr;
-	if(pos.second >= 0) {
-		if(positive_rows_.size() <= static_cast<unsigned>(pos.second)) {
-			positive_rows_.resize(pos.second + 1);
-		}
-
-		r = &positive_rows_[pos.second];
-	} else {
-		const int index = -(pos.second+1);
-		if(negative_rows_.size() <= static_cast<unsigned>(index)) {
-			negative_rows_.resize(index + 1);
-		}
-
-		r = &negative_rows_[index];
+	int x1 = chunk_x, y1 = chunk_y, x2 = chunk_x + 1, y2 = chunk_y + 1;
+	if(chunks_w_ > 0) {
+		//grow by some slack in the direction we're growing so levels which
+		//are built up a tile at a time don't reallocate every chunk.
+		x1 = chunk_x < chunks_x_ ? chunk_x - chunks_w_/2 : chunks_x_;
+		y1 = chunk_y < chunks_y_ ? chunk_y - chunks_h_/2 : chunks_y_;
+		x2 = chunk_x >= chunks_x_ + chunks_w_ ? chunk_x + 1 + chunks_w_/2 : chunks_x_ + chunks_w_;
+		y2 = chunk_y >= chunks_y_ + chunks_h_ ? chunk_y + 1 + chunks_h_/2 : chunks_y_ + chunks_h_;
 	}
 
-	if(pos.first >= 0) {
-		if(r->positive_cells.size() <= static_cast<unsigned>(pos.first)) {
-			r->positive_cells.resize(pos.first + 1);
-		}
-
-		return &r->positive_cells[pos.first];
-	} else {
-		const int index = -(pos.first+1);
-		if(r->negative_cells.size() <= static_cast<unsigned>(index)) {
-			r->negative_cells.resize(index + 1);
+	std::vector<Chunk*> chunks((x2 - x1)*(y2 - y1));
+	for(int y = 0; y != chunks_h_; ++y) {
+		for(int x = 0; x != chunks_w_; ++x) {
+			chunks[(y + chunks_y_ - y1)*(x2 - x1) + (x + chunks_x_ - x1)] = chunks_[y*chunks_w_ + x];
 		}
-
-		return &r->negative_cells[index];
 	}
+
+	chunks_.swap(chunks);
+	chunks_x_ = x1;
+	chunks_y_ = y1;
+	chunks_w_ = x2 - x1;
+	chunks_h_ = y2 - y1;
 }
 
-const TileSolidInfo* LevelSolidMap::find(const tile_pos& pos) const
+TileSolidInfo** LevelSolidMap::insertRaw(const tile_pos& pos)
 {
-	const row* r = nullptr;
-	if(pos.second >= 0) {
-		if(static_cast<unsigned>(pos.second) < positive_rows_.size()) {
-			r = &positive_rows_[pos.second];
-		} else {
-			return nullptr;
-		}
-	} else {
-		const int index = -(pos.second+1);
-		if(static_cast<unsigned>(index) < negative_rows_.size()) {
-			r = &negative_rows_[index];
-		} else {
-			return nullptr;
+	const int chunk_x = pos.first >> ChunkShift;
+	const int chunk_y = pos.second >> ChunkShift;
+	if(findChunk(chunk_x, chunk_y) == nullptr) {
+		if(chunk_x < chunks_x_ || chunk_y < chunks_y_ || chunk_x >= chunks_x_ + chunks_w_ || chunk_y >= chunks_y_ + chunks_h_) {
+			growToInclude(chunk_x, chunk_y);
 		}
-	}
 
-	if(pos.first >= 0) {
-		if(static_cast<unsigned>(pos.first) < r->positive_cells.size()) {
-			return r->positive_cells[pos.first];
-		} else {
-			return nullptr;
-		}
-	} else {
-		const int index = -(pos.first+1);
-		if(static_cast<unsigned>(index) < r->negative_cells.size()) {
-			return r->negative_cells[index];
-		} else {
-			return nullptr;
-		}
+		chunks_[(chunk_y - chunks_y_)*chunks_w_ + (chunk_x - chunks_x_)] = new Chunk;
 	}
+
+	Chunk* chunk = chunks_[(chunk_y - chunks_y_)*chunks_w_ + (chunk_x - chunks_x_)];
+	return &chunk->cells[(pos.second&(ChunkSize-1))*ChunkSize + (pos.first&(ChunkSize-1))];
 }
 
 void LevelSolidMap::erase(const tile_pos& pos)
@@ -152,94 +169,74 @@ void LevelSolidMap::erase(const tile_pos& pos)
 
 void LevelSolidMap::clear()
 {
-	for(row& r : positive_rows_) {
-		for(TileSolidInfo* info : r.positive_cells) {
-			delete info;
-		}
-
-		for(TileSolidInfo* info : r.negative_cells) {
-			delete info;
-		}
-	}
-
-	for(row& r : negative_rows_) {
-		for(TileSolidInfo* info : r.positive_cells) {
-			delete info;
-		}
+	for(Chunk* chunk : chunks_) {
+		if(chunk) {
+			for(TileSolidInfo* info : chunk->cells) {
+				delete info;
+			}
 
-		for(TileSolidInfo* info : r.negative_cells) {
-			delete info;
+			delete chunk;
 		}
 	}
 
-	positive_rows_.clear();
-	negative_rows_.clear();
+	chunks_.clear();
+	chunks_x_ = chunks_y_ = chunks_w_ = chunks_h_ = 0;
 }
 
 void LevelSolidMap::merge(const LevelSolidMap& map, int xoffset, int yoffset)
 {
-	for(int n = 0; n != map.negative_rows_.size(); ++n) {
-		for(int m = 0; m != map.negative_rows_[n].negative_cells.size(); ++m) {
-			const tile_pos pos(-m - 1 + xoffset, -n - 1 + yoffset);
-			TileSolidInfo& dst = insertOrFind(pos);
-			const TileSolidInfo* src = map.negative_rows_[n].negative_cells[m];
-			if(!src) {
-				continue;
-			}
-
-			dst.all_solid = dst.all_solid || src->all_solid;
-			merge_SurfaceInfo(dst.info, src->info);
-			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
-			}
+	for(int n = 0; n != map.chunks_.size(); ++n) {
+		const Chunk* chunk = map.chunks_[n];
+		if(!chunk) {
+			continue;
 		}
 
-		for(int m = 0; m != map.negative_rows_[n].positive_cells.size(); ++m) {
-			const tile_pos pos(m + xoffset, -n - 1 + yoffset);
-			TileSolidInfo& dst = insertOrFind(pos);
-			const TileSolidInfo* src = map.negative_rows_[n].positive_cells[m];
+		const int chunk_x = map.chunks_x_ + n%map.chunks_w_;
+		const int chunk_y = map.chunks_y_ + n/map.chunks_w_;
+
+		for(int m = 0; m != ChunkSize*ChunkSize; ++m) {
+			const TileSolidInfo* src = chunk->cells[m];
 			if(!src) {
 				continue;
 			}
 
-			dst.all_solid = dst.all_solid || src->all_solid;
-			merge_SurfaceInfo(dst.info, src->info);
-			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
-			}
-		}
-	}
-
-	for(int n = 0; n != map.positive_rows_.size(); ++n) {
-		for(int m = 0; m != map.positive_rows_[n].negative_cells.size(); ++m) {
-			const tile_pos pos(-m - 1 + xoffset, n + yoffset);
+			const tile_pos pos(chunk_x*ChunkSize + m%ChunkSize + xoffset, chunk_y*ChunkSize + m/ChunkSize + yoffset);
 			TileSolidInfo& dst = insertOrFind(pos);
-			const TileSolidInfo* src = map.positive_rows_[n].negative_cells[m];
-			if(!src) {
-				continue;
-			}
 
 			dst.all_solid = dst.all_solid || src->all_solid;
 			merge_SurfaceInfo(dst.info, src->info);
 			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
+				dst.bitmap |= src->bitmap;
 			}
 		}
+	}
+}
 
-		for(int m = 0; m != map.positive_rows_[n].positive_cells.size(); ++m) {
-			const tile_pos pos(m + xoffset, n + yoffset);
-			const TileSolidInfo* src = map.positive_rows_[n].positive_cells[m];
-			if(!src) {
-				continue;
-			}
+UNIT_TEST(level_solid_map)
+{
+	LevelSolidMap map;
+	const tile_pos positions[] = { tile_pos(0, 0), tile_pos(-1, -1), tile_pos(100, -37), tile_pos(-70, 45), tile_pos(15, 16), tile_pos(16, 15) };
+	for(const tile_pos& pos : positions) {
+		CHECK(map.find(pos) == nullptr, "tile found in empty map");
+		map.insertOrFind(pos).bitmap.set(pos.first&3, pos.second&3);
+	}
 
-			TileSolidInfo& dst = insertOrFind(pos);
+	for(const tile_pos& pos : positions) {
+		const TileSolidInfo* info = map.find(pos);
+		CHECK(info != nullptr, "tile not found: " << pos.first << "," << pos.second);
+		CHECK(info->bitmap.test(pos.first&3, pos.second&3), "tile bit lost: " << pos.first << "," << pos.second);
+	}
 
-			dst.all_solid = dst.all_solid || src->all_solid;
-			merge_SurfaceInfo(dst.info, src->info);
-			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
-			}
-		}
+	CHECK(map.find(tile_pos(1, 0)) == nullptr, "tile found that was never inserted");
+	CHECK(map.find(tile_pos(-1000, 1000)) == nullptr, "tile found outside of map");
+
+	LevelSolidMap merged;
+	merged.merge(map, 3, -2);
+	for(const tile_pos& pos : positions) {
+		const TileSolidInfo* info = merged.find(tile_pos(pos.first + 3, pos.second - 2));
+		CHECK(info != nullptr && info->bitmap.test(pos.first&3, pos.second&3), "tile not merged: " << pos.first << "," << pos.second);
 	}
+
+	map.erase(tile_pos(0, 0));
+	CHECK(map.find(tile_pos(0, 0)) == nullptr, "tile not erased");
 }
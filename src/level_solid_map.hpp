@@ -23,21 +23,45 @@
 
 #pragma once
 
-#include <boost/dynamic_bitset.hpp>
 #include <map>
+#include <stdint.h>
 #include <vector>
 
 #ifndef MAX_TILE_SIZE
 #define MAX_TILE_SIZE 64
 #endif
 
+//tile_bitmap keeps a row of a tile in a single word.
+static_assert(MAX_TILE_SIZE <= 64, "tile rows must fit in a uint64_t");
+
 extern int g_tile_scale;
 extern int g_tile_size;
 
 #define TileSize (g_tile_size*g_tile_scale)
 
 typedef std::pair<int,int> tile_pos;
-typedef boost::dynamic_bitset<> tile_bitmap;
+
+//the solidity of the pixels of a tile, packed one row to a word so that a
+//whole row of a tile can be tested at once. Bit x of row y is pixel (x,y).
+class tile_bitmap
+{
+public:
+	tile_bitmap();
+
+	uint64_t row(int y) const { return rows_[y]; }
+	bool test(int x, int y) const { return ((rows_[y] >> x)&1) != 0; }
+	void set(int x, int y) { rows_[y] |= uint64_t(1) << x; }
+	void reset(int x, int y) { rows_[y] &= ~(uint64_t(1) << x); }
+
+	//sets every pixel in the tile.
+	void set();
+
+	bool any() const;
+
+	tile_bitmap& operator|=(const tile_bitmap& o);
+private:
+	std::vector<uint64_t> rows_;
+};
 
 struct SurfaceInfo 
 {
@@ -50,7 +74,7 @@ struct SurfaceInfo
 
 struct TileSolidInfo 
 {
-	TileSolidInfo() : bitmap(TileSize*TileSize), all_solid(false)
+	TileSolidInfo() : all_solid(false)
 	{}
 	tile_bitmap bitmap;
 	SurfaceInfo info;
@@ -74,9 +98,38 @@ private:
 
 	TileSolidInfo** insertRaw(const tile_pos& pos);
 
-	struct row {
-		std::vector<TileSolidInfo*> positive_cells, negative_cells;
+	//tiles are stored in square chunks, which are laid out in a flat grid
+	//that grows to cover every chunk that has been inserted into.
+	enum { ChunkShift = 4, ChunkSize = 1 << ChunkShift };
+
+	struct Chunk {
+		Chunk();
+		TileSolidInfo* cells[ChunkSize*ChunkSize];
 	};
 
-	std::vector<row> positive_rows_, negative_rows_;
+	const Chunk* findChunk(int chunk_x, int chunk_y) const {
+		const int x = chunk_x - chunks_x_;
+		const int y = chunk_y - chunks_y_;
+		if(static_cast<unsigned>(x) >= static_cast<unsigned>(chunks_w_) ||
+		   static_cast<unsigned>(y) >= static_cast<unsigned>(chunks_h_)) {
+			return nullptr;
+		}
+
+		return chunks_[y*chunks_w_ + x];
+	}
+
+	void growToInclude(int chunk_x, int chunk_y);
+
+	std::vector<Chunk*> chunks_;
+	int chunks_x_, chunks_y_, chunks_w_, chunks_h_;
 };
+
+inline const TileSolidInfo* LevelSolidMap::find(const tile_pos& pos) const
+{
+	const Chunk* chunk = findChunk(pos.first >> ChunkShift, pos.second >> ChunkShift);
+	if(chunk == nullptr) {
+		return nullptr;
+	}
+
+	return chunk->cells[(pos.second&(ChunkSize-1))*ChunkSize + (pos.first&(ChunkSize-1))];
+}
@@ -23,6 +23,8 @@
 
 #include <math.h>
 
+#include <boost/functional/hash.hpp>
+
 #include "DisplayDevice.hpp"
 #include "Shaders.hpp"
 
@@ -55,6 +57,22 @@ Light::~Light()
 {
 }
 
+size_t Light::getDrawHash() const
+{
+	size_t seed = 0;
+	const glm::mat4 model = getModelMatrix();
+	for(int col = 0; col != 4; ++col) {
+		for(int row = 0; row != 4; ++row) {
+			boost::hash_combine(seed, model[col][row]);
+		}
+	}
+
+	boost::hash_combine(seed, getColor().asRGBA());
+	boost::hash_combine(seed, isColorSet());
+	boost::hash_combine(seed, getShader().get());
+	return seed;
+}
+
 BEGIN_DEFINE_CALLABLE(Light, SceneObjectCallable)
 	DEFINE_FIELD(dummy, "null")
 		return variant();
@@ -173,6 +191,16 @@ bool CircleLight::onScreen(const rect& screen_area) const
 	return true;
 }
 
+size_t CircleLight::getDrawHash() const
+{
+	size_t seed = Light::getDrawHash();
+	boost::hash_combine(seed, center_.x);
+	boost::hash_combine(seed, center_.y);
+	boost::hash_combine(seed, radius_);
+	boost::hash_combine(seed, fade_length);
+	return seed;
+}
+
 BEGIN_DEFINE_CALLABLE(CircleLight, Light)
 	DEFINE_FIELD(center, "[int,int]")
 		std::vector<variant> v;
@@ -44,6 +44,10 @@ public:
 	virtual ~Light();
 	virtual void process() = 0;
 	virtual bool onScreen(const rect& screen_area) const = 0;
+
+	//a hash of everything which affects how the light is drawn, so that
+	//lighting only needs to be redrawn when a light's hash changes.
+	virtual size_t getDrawHash() const;
 protected:
 	const CustomObject& object() const { return obj_; }
 private:
@@ -59,6 +63,7 @@ public:
 	variant write() const;
 	void process();
 	bool onScreen(const rect& screen_area) const;
+	size_t getDrawHash() const override;
 	void preRender(const KRE::WindowPtr& wnd) override;
 private:
 	DECLARE_CALLABLE(CircleLight);
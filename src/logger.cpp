@@ -21,23 +21,322 @@
 	   distribution.
 */
 
+#include <map>
+#include <memory>
+
 #include "logger.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
 
 namespace
 {
 	const int max_log_packet_length = 3072;
+
+	void write_message(SDL_LogPriority priority, const std::string& str)
+	{
+		std::string s(str);
+		// break up long strings into something about max_log_packet_length in size.
+		while(s.size() > max_log_packet_length) {
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, priority, "%s\n", s.substr(0, max_log_packet_length).c_str());
+			s = s.substr(max_log_packet_length+1);
+		}
+		if(!s.empty()) {
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, priority, "%s\n", s.c_str());
+		}
+	}
+
+	struct module_level
+	{
+		module_level() : level(SDL_LOG_PRIORITY_INFO), has_own_level(false) {}
+		int level;
+		bool has_own_level;
+	};
+
+	struct log_levels
+	{
+		log_levels() : default_level(SDL_LOG_PRIORITY_INFO) {}
+		threading::mutex mutex;
+		int default_level;
+
+		//nodes of a map are never moved, so call sites can keep pointers
+		//to the levels.
+		std::map<std::string, module_level> modules;
+
+		//SDL filters messages too, so it has to let through anything we do.
+		void update_sdl_priority()
+		{
+			int lowest = default_level;
+			for(const auto& m : modules) {
+				lowest = std::min(lowest, m.second.level);
+			}
+			SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, static_cast<SDL_LogPriority>(lowest));
+		}
+	};
+
+	log_levels& get_log_levels()
+	{
+		static log_levels* res = new log_levels;
+		return *res;
+	}
+
+	std::string module_name(const char* file)
+	{
+		const char* begin = file;
+		for(const char* p = file; *p; ++p) {
+			if(*p == '/' || *p == '\\') {
+				begin = p + 1;
+			}
+		}
+
+		const char* end = strrchr(begin, '.');
+		return end ? std::string(begin, end) : std::string(begin);
+	}
+
+	//A bounded queue of messages which any thread may add to without
+	//taking a lock, and which the writer thread takes from. Each slot's
+	//sequence says whether it is ready to be filled or to be read, for the
+	//position in the queue which will next use it.
+	const int RingSize = 4096;
+
+	struct log_slot
+	{
+		SDL_atomic_t sequence;
+		SDL_LogPriority priority;
+		std::string message;
+	};
+
+	log_slot* ring = nullptr;
+	SDL_atomic_t enqueue_pos;
+	SDL_atomic_t dequeue_pos;
+	SDL_atomic_t async_enabled;
+	SDL_atomic_t stop_writer;
+	SDL_atomic_t dropped_messages;
+
+	int sequence_diff(int a, int b)
+	{
+		return static_cast<int>(static_cast<unsigned>(a) - static_cast<unsigned>(b));
+	}
+
+	bool enqueue(SDL_LogPriority priority, const std::string& message)
+	{
+		log_slot* slot = nullptr;
+		int pos = SDL_AtomicGet(&enqueue_pos);
+		for(;;) {
+			slot = &ring[pos&(RingSize-1)];
+			const int diff = sequence_diff(SDL_AtomicGet(&slot->sequence), pos);
+			if(diff == 0) {
+				if(SDL_AtomicCAS(&enqueue_pos, pos, pos+1)) {
+					break;
+				}
+			} else if(diff < 0) {
+				//full.
+				return false;
+			}
+
+			pos = SDL_AtomicGet(&enqueue_pos);
+		}
+
+		slot->priority = priority;
+		slot->message = message;
+		SDL_AtomicSet(&slot->sequence, pos+1);
+		return true;
+	}
+
+	//only called by the writer.
+	bool dequeue(SDL_LogPriority* priority, std::string* message)
+	{
+		const int pos = SDL_AtomicGet(&dequeue_pos);
+		log_slot& slot = ring[pos&(RingSize-1)];
+		if(sequence_diff(SDL_AtomicGet(&slot.sequence), pos+1) != 0) {
+			return false;
+		}
+
+		*priority = slot.priority;
+		message->swap(slot.message);
+		slot.message.clear();
+		SDL_AtomicSet(&slot.sequence, pos+RingSize);
+		SDL_AtomicSet(&dequeue_pos, pos+1);
+		return true;
+	}
+
+	void write_queued_messages()
+	{
+		SDL_LogPriority priority;
+		std::string message;
+		while(dequeue(&priority, &message)) {
+			write_message(priority, message);
+		}
+
+		const int dropped = SDL_AtomicSet(&dropped_messages, 0);
+		if(dropped) {
+			std::ostringstream s;
+			s << "logger: " << dropped << " messages dropped because the log queue was full";
+			write_message(SDL_LOG_PRIORITY_WARN, s.str());
+		}
+	}
+
+	void writer_thread()
+	{
+		while(!SDL_AtomicGet(&stop_writer)) {
+			const int pos = SDL_AtomicGet(&dequeue_pos);
+			write_queued_messages();
+			if(SDL_AtomicGet(&dequeue_pos) == pos) {
+				SDL_Delay(2);
+			}
+		}
+	}
+
+	std::unique_ptr<threading::thread> writer;
+
+	void stop_writer_thread()
+	{
+		if(!writer) {
+			return;
+		}
+
+		SDL_AtomicSet(&async_enabled, 0);
+		SDL_AtomicSet(&stop_writer, 1);
+		writer->join();
+		writer.reset();
+
+		//anything queued after the writer last looked.
+		write_queued_messages();
+	}
 }
 
 void log_internal(SDL_LogPriority priority, const std::string& str)
 {
-	std::string s(str);
-	// break up long strings into something about max_log_packet_length in size.
-	while(s.size() > max_log_packet_length) {
-		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, priority, "%s\n", s.substr(0, max_log_packet_length).c_str());
-		s = s.substr(max_log_packet_length+1);
+	if(SDL_AtomicGet(&async_enabled)) {
+		if(enqueue(priority, str)) {
+			if(priority >= SDL_LOG_PRIORITY_ERROR) {
+				log_flush();
+			}
+			return;
+		}
+
+		//the queue is full. Rather than wait for the writer, drop
+		//anything less than a warning.
+		if(priority < SDL_LOG_PRIORITY_WARN) {
+			SDL_AtomicAdd(&dropped_messages, 1);
+			return;
+		}
 	}
-	if(!s.empty()) {
-		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, priority, "%s\n", s.c_str());
+
+	write_message(priority, str);
+}
+
+const int* log_module_level(const char* file)
+{
+	log_levels& levels = get_log_levels();
+	threading::lock lck(levels.mutex);
+	auto itor = levels.modules.find(module_name(file));
+	if(itor == levels.modules.end()) {
+		itor = levels.modules.insert(std::make_pair(module_name(file), module_level())).first;
+		itor->second.level = levels.default_level;
+	}
+
+	return &itor->second.level;
+}
+
+void log_set_default_level(SDL_LogPriority priority)
+{
+	log_levels& levels = get_log_levels();
+	threading::lock lck(levels.mutex);
+	levels.default_level = priority;
+	for(auto& m : levels.modules) {
+		if(!m.second.has_own_level) {
+			m.second.level = priority;
+		}
+	}
+	levels.update_sdl_priority();
+}
+
+void log_set_module_level(const std::string& module, SDL_LogPriority priority)
+{
+	log_levels& levels = get_log_levels();
+	threading::lock lck(levels.mutex);
+	module_level& m = levels.modules[module];
+	m.level = priority;
+	m.has_own_level = true;
+	levels.update_sdl_priority();
+}
+
+bool log_parse_priority(const std::string& name, SDL_LogPriority* priority)
+{
+	static const struct { const char* name; SDL_LogPriority priority; } names[] = {
+		{ "verbose", SDL_LOG_PRIORITY_VERBOSE },
+		{ "debug", SDL_LOG_PRIORITY_DEBUG },
+		{ "info", SDL_LOG_PRIORITY_INFO },
+		{ "warn", SDL_LOG_PRIORITY_WARN },
+		{ "error", SDL_LOG_PRIORITY_ERROR },
+		{ "critical", SDL_LOG_PRIORITY_CRITICAL },
+	};
+
+	for(const auto& n : names) {
+		if(name == n.name) {
+			*priority = n.priority;
+			return true;
+		}
+	}
+	return false;
+}
+
+void log_flush()
+{
+	if(!SDL_AtomicGet(&async_enabled)) {
+		return;
+	}
+
+	const int target = SDL_AtomicGet(&enqueue_pos);
+	while(sequence_diff(SDL_AtomicGet(&dequeue_pos), target) < 0 && writer) {
+		SDL_Delay(1);
 	}
 }
 
+async_log_manager::async_log_manager()
+{
+	if(ring == nullptr) {
+		ring = new log_slot[RingSize];
+		//exit() doesn't run the manager's destructor, but still has to
+		//write out anything queued and stop the writer.
+		atexit(stop_writer_thread);
+	}
+
+	for(int n = 0; n != RingSize; ++n) {
+		SDL_AtomicSet(&ring[n].sequence, n);
+	}
+
+	SDL_AtomicSet(&enqueue_pos, 0);
+	SDL_AtomicSet(&dequeue_pos, 0);
+	SDL_AtomicSet(&stop_writer, 0);
+	writer.reset(new threading::thread("log_writer", writer_thread));
+	SDL_AtomicSet(&async_enabled, 1);
+}
+
+async_log_manager::~async_log_manager()
+{
+	stop_writer_thread();
+}
+
+UNIT_TEST(log_module_levels)
+{
+	const int* level = log_module_level("src/log_test_module.cpp");
+	CHECK_EQ(level, log_module_level("log_test_module.hpp"));
+
+	log_set_module_level("log_test_module", SDL_LOG_PRIORITY_DEBUG);
+	CHECK_EQ(*level, SDL_LOG_PRIORITY_DEBUG);
+
+	const int* other_level = log_module_level("log_test_other_module.cpp");
+	CHECK_NE(*other_level, SDL_LOG_PRIORITY_DEBUG);
+
+	SDL_LogPriority priority;
+	CHECK(log_parse_priority("warn", &priority) && priority == SDL_LOG_PRIORITY_WARN, "could not parse log priority");
+	CHECK(!log_parse_priority("loud", &priority), "parsed invalid log priority");
+}
+
+BENCHMARK(log_disabled)
+{
+	BENCHMARK_LOOP {
+		LOG_VERBOSE("disabled message " << benchmark_iterations);
+	}
+}
@@ -42,47 +42,58 @@
 	)
 #endif
 
-void log_internal(SDL_LogPriority priority, const std::string& s);
-
-#define LOG_VERBOSE(_a)																\
-	do {																			\
-		std::ostringstream _s;														\
-		_s << __SHORT_FORM_OF_FILE__ << ":" << __LINE__ << " : " << _a;				\
-		log_internal(SDL_LOG_PRIORITY_VERBOSE, _s.str());							\
-	} while(0)
-
-#define LOG_INFO(_a)																\
-	do {																			\
-		std::ostringstream _s;														\
-		_s << __SHORT_FORM_OF_FILE__ << ":" << __LINE__ << " : " << _a;				\
-		log_internal(SDL_LOG_PRIORITY_INFO, _s.str());								\
-	} while(0)
-
-#define LOG_DEBUG(_a)																\
-	do {																			\
-		std::ostringstream _s;														\
-		_s << __SHORT_FORM_OF_FILE__ << ":" << __LINE__ << " : " << _a;				\
-		log_internal(SDL_LOG_PRIORITY_DEBUG, _s.str());								\
-	} while(0)
-
-#define LOG_WARN(_a)																\
-	do {																			\
-		std::ostringstream _s;														\
-		_s << __SHORT_FORM_OF_FILE__ << ":" << __LINE__ << " : " << _a;				\
-		log_internal(SDL_LOG_PRIORITY_WARN, _s.str());								\
-	} while(0)
+//Messages below this priority are compiled out entirely. Builds may
+//define it, e.g. as SDL_LOG_PRIORITY_INFO to drop verbose and debug logs.
+#ifndef LOG_MIN_PRIORITY
+#define LOG_MIN_PRIORITY SDL_LOG_PRIORITY_VERBOSE
+#endif
 
-#define LOG_ERROR(_a)																\
-	do {																			\
-		std::ostringstream _s;														\
-		_s << __SHORT_FORM_OF_FILE__ << ":" << __LINE__ << " : " << _a;				\
-		log_internal(SDL_LOG_PRIORITY_ERROR, _s.str());								\
-	} while(0)
+void log_internal(SDL_LogPriority priority, const std::string& s);
 
-#define LOG_CRITICAL(_a)															\
+//The lowest priority logged from the source file 'file', given as
+//__FILE__. Each source file is a module named after the file without its
+//directory or extension. The returned value stays valid, and changes as
+//levels are set, so call sites look it up once.
+const int* log_module_level(const char* file);
+
+//Sets the level of all modules which don't have their own level.
+void log_set_default_level(SDL_LogPriority priority);
+void log_set_module_level(const std::string& module, SDL_LogPriority priority);
+
+//Parses a priority name such as "debug" or "warn". Returns false if the
+//name isn't recognised.
+bool log_parse_priority(const std::string& name, SDL_LogPriority* priority);
+
+//Waits until every message logged so far has been written.
+void log_flush();
+
+//While one of these exists, messages are handed to a background thread to
+//be written, so that logging doesn't wait on I/O. Messages of error
+//priority or higher are still flushed before the call logging them
+//returns. Outside its lifetime messages are written immediately.
+struct async_log_manager
+{
+	async_log_manager();
+	~async_log_manager();
+};
+
+//Checks the priority before anything is formatted, so a disabled message
+//costs a comparison.
+#define LOG_AT_PRIORITY(_priority, _a)												\
 	do {																			\
-		std::ostringstream _s;														\
-		_s << __SHORT_FORM_OF_FILE__ << ":" << __LINE__ << " : " << _a;				\
-		log_internal(SDL_LOG_PRIORITY_CRITICAL, _s.str());							\
+		if((_priority) >= LOG_MIN_PRIORITY) {										\
+			static const int* _log_level = log_module_level(__FILE__);				\
+			if((_priority) >= *_log_level) {										\
+				std::ostringstream _s;												\
+				_s << __SHORT_FORM_OF_FILE__ << ":" << __LINE__ << " : " << _a;		\
+				log_internal(_priority, _s.str());									\
+			}																		\
+		}																			\
 	} while(0)
 
+#define LOG_VERBOSE(_a) LOG_AT_PRIORITY(SDL_LOG_PRIORITY_VERBOSE, _a)
+#define LOG_INFO(_a) LOG_AT_PRIORITY(SDL_LOG_PRIORITY_INFO, _a)
+#define LOG_DEBUG(_a) LOG_AT_PRIORITY(SDL_LOG_PRIORITY_DEBUG, _a)
+#define LOG_WARN(_a) LOG_AT_PRIORITY(SDL_LOG_PRIORITY_WARN, _a)
+#define LOG_ERROR(_a) LOG_AT_PRIORITY(SDL_LOG_PRIORITY_ERROR, _a)
+#define LOG_CRITICAL(_a) LOG_AT_PRIORITY(SDL_LOG_PRIORITY_CRITICAL, _a)
@@ -298,27 +298,28 @@ void auto_select_resolution(const KRE::WindowPtr& wm, int *width, int *height)
 	*height = best_mode.height;
 }
 
+//handles --log-level=LEVEL, where LEVEL is a comma separated list of
+//priorities, either on their own to set the default level, or given as
+//module:priority to set the level of one module, e.g.
+//--log-level=info,tbs_game:debug
 void process_log_level(const std::string& argstr)
 {
-	SDL_LogPriority log_priority = SDL_LOG_PRIORITY_INFO;
 	std::string::size_type pos = argstr.find('=');
-	if(pos != std::string::npos) {
-		std::string level = argstr.substr(pos+1);
-		if(level == "verbose") {
-			log_priority = SDL_LOG_PRIORITY_INFO;
-		} else if(level == "debug") {
-			log_priority = SDL_LOG_PRIORITY_DEBUG;
-		} else if(level == "info") {
-			log_priority = SDL_LOG_PRIORITY_INFO;
-		} else if(level == "warn") {
-			log_priority = SDL_LOG_PRIORITY_WARN;
-		} else if(level == "error") {
-			log_priority = SDL_LOG_PRIORITY_ERROR;
-		} else if(level == "critical") {
-			log_priority = SDL_LOG_PRIORITY_CRITICAL;
+	if(pos == std::string::npos) {
+		return;
+	}
+
+	for(const std::string& item : util::split(argstr.substr(pos+1), ',')) {
+		SDL_LogPriority log_priority = SDL_LOG_PRIORITY_INFO;
+		std::string::size_type colon = item.find(':');
+		if(colon == std::string::npos) {
+			if(log_parse_priority(item, &log_priority)) {
+				log_set_default_level(log_priority);
+			}
+		} else if(log_parse_priority(item.substr(colon+1), &log_priority)) {
+			log_set_module_level(item.substr(0, colon), log_priority);
 		}
 	}
-	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, log_priority);
 }
 
 extern int g_tile_scale;
@@ -326,7 +327,7 @@ extern int g_tile_size;
 
 int main(int argcount, char* argvec[])
 {
-	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
+	log_set_default_level(SDL_LOG_PRIORITY_INFO);
 
 	{
 		std::vector<std::string> args;
@@ -371,6 +372,8 @@ int main(int argcount, char* argvec[])
 	std::cerr.sync_with_stdio(true);
 #endif
 
+	async_log_manager log_manager;
+
 	LOG_INFO("Anura engine version " << preferences::version());
 
 #if defined(TARGET_BLACKBERRY)
@@ -947,7 +950,7 @@ int main(int argcount, char* argvec[])
 			}
 		}
 	}
-	LOG_INFO("finishloading()");
+	LOG_INFO("finishloading() " << profile::get_tick_time() << "ms after startup");
 
 	formula_profiler::Manager profiler(profile_output);
 
@@ -28,6 +28,7 @@
 #include "compress.hpp"
 #include "custom_object_type.hpp"
 #include "i18n.hpp"
+#include "file_archive.hpp"
 #include "filesystem.hpp"
 #include "formula_constants.hpp"
 #include "http_client.hpp"
@@ -40,6 +41,8 @@
 #include "uri.hpp"
 #include "variant_utils.hpp"
 
+PREF_BOOL(module_archives, true, "Read module data from a module.pak archive, built with --utility=pack_module, when the module has one");
+
 namespace module 
 {
 	using std::placeholders::_1;
@@ -121,6 +124,15 @@ namespace module
 				continue;
 			}
 
+			//files in archives are found without touching the disk.
+			sys::ArchivedFile archived;
+			for(const std::string& base_path : p.base_path_) {
+				const std::string path = base_path + fname;
+				if(sys::find_archived_file(path, &archived)) {
+					return path;
+				}
+			}
+
 			for(const std::string& base_path : p.base_path_) {
 				const std::string path = sys::find_file(base_path + fname);
 				if(sys::file_exists(path)) {
@@ -339,14 +351,19 @@ namespace module
 		}
 		std::string pretty_name = name;
 		std::string abbrev = name;
-		std::string fname = make_base_module_path(name) + "module.cfg";
+		const std::string base_path = make_base_module_path(name);
+		if(g_module_archives && sys::file_exists(base_path + "module.pak")) {
+			ASSERT_LOG(sys::mount_archive(base_path + "module.pak", base_path), "Could not read module archive " << base_path << "module.pak");
+		}
+
+		std::string fname = base_path + "module.cfg";
 		variant v = json::parse_from_file(fname);
 		std::string def_font = "FreeSans";
 		std::string def_font_cjk = "unifont";
 		auto speech_dialog_bg_color = std::make_shared<KRE::Color>(85, 53, 53, 255);
 		variant player_type;
 
-		const std::string constants_path = make_base_module_path(name) + "data/constants.cfg";
+		const std::string constants_path = base_path + "data/constants.cfg";
 		if(sys::file_exists(constants_path)) {
 			const std::string contents = sys::read_file(constants_path);
 			variant v = json::parse(contents, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
@@ -434,7 +451,7 @@ namespace module
 			}
 		}
 		modules m = {name, pretty_name, abbrev,
-					 {make_base_module_path(name), make_user_module_path(name)},
+					 {base_path, make_user_module_path(name)},
 				def_font, def_font_cjk, speech_dialog_bg_color};
 		m.default_preferences = v["default_preferences"];
 		loaded_paths().insert(loaded_paths().begin(), m);
@@ -467,6 +484,7 @@ namespace module
 		preferences::set_preferences_path_from_module(name);
 		loaded_paths().clear();
 		loaded_paths().push_back(core);
+		sys::unmount_archives();
 		load(name, true);
 	}
 
@@ -735,6 +753,34 @@ COMMAND_LINE_UTILITY(generate_manifest)
 	std::cout << manifest.write_json();
 }
 
+	//Packs the files under a module's data/ directory into module.pak,
+	//which is then read in preference to the files themselves, other than
+	//those changed since it was built.
+	COMMAND_LINE_UTILITY(pack_module)
+	{
+		ASSERT_LOG(args.size() == 1, "Expected arguments: module_name");
+
+		//make sure the files are read from disk, not an existing archive.
+		sys::unmount_archives();
+
+		const std::string base_path = make_base_module_path(args.front());
+		ASSERT_LOG(sys::file_exists(base_path + "module.cfg"), "Could not find module " << args.front());
+
+		std::vector<std::string> paths;
+		get_files_in_module(base_path + "data", paths, std::vector<std::string>());
+
+		std::vector<std::pair<std::string, std::string>> files;
+		size_t nbytes = 0;
+		for(const std::string& path : paths) {
+			ASSERT_LOG(path.compare(0, base_path.size(), base_path) == 0, "Unexpected path in module: " << path);
+			files.push_back(std::make_pair(path.substr(base_path.size()), sys::read_file(path)));
+			nbytes += files.back().second.size();
+		}
+
+		sys::write_archive(base_path + "module.pak", files);
+		LOG_INFO("Wrote " << files.size() << " files (" << (nbytes/1024) << "KB) to " << base_path << "module.pak");
+	}
+
 	COMMAND_LINE_UTILITY(replicate_module)
 	{
 		std::string server = "theargentlark.com";
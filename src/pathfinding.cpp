@@ -21,7 +21,10 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <list>
 #include <queue>
+#include <random>
 
 #include "math.h"
 #include "level.hpp"
@@ -408,6 +411,524 @@ namespace pathfinding
 		wg->resetGraph();
 		return variant(&reachable);
 	}
+
+	GridPathfinder::GridPathfinder()
+		: width_(0),
+		height_(0),
+		cost_x_(1.0),
+		cost_y_(1.0),
+		cost_diagonal_(sqrt(2.0)),
+		search_id_(0),
+		solid_(nullptr),
+		dst_x_(0),
+		dst_y_(0),
+		min_x_(0),
+		min_y_(0),
+		max_x_(0),
+		max_y_(0)
+	{
+	}
+
+	void GridPathfinder::resize(int width, int height)
+	{
+		ASSERT_LOG(width > 0 && height > 0, "Invalid pathfinding grid size: " << width << "x" << height);
+		if(width == width_ && height == height_) {
+			return;
+		}
+
+		width_ = width;
+		height_ = height;
+		const size_t cells = size_t(width)*size_t(height);
+		stamp_.assign(cells, 0);
+		flags_.resize(cells);
+		g_.resize(cells);
+		f_.resize(cells);
+		parent_.resize(cells);
+		heap_pos_.resize(cells);
+		heap_.clear();
+		search_id_ = 0;
+	}
+
+	void GridPathfinder::setStepCosts(double cost_x, double cost_y)
+	{
+		cost_x_ = cost_x;
+		cost_y_ = cost_y;
+		cost_diagonal_ = sqrt(cost_x*cost_x + cost_y*cost_y);
+	}
+
+	void GridPathfinder::touch(int n)
+	{
+		if(stamp_[n] != search_id_) {
+			stamp_[n] = search_id_;
+			flags_[n] = 0;
+		}
+	}
+
+	bool GridPathfinder::walkable(int x, int y)
+	{
+		if(x < 0 || y < 0 || x >= width_ || y >= height_) {
+			return false;
+		}
+
+		const int n = index(x, y);
+		touch(n);
+		if((flags_[n]&CELL_SOLID_KNOWN) == 0) {
+			flags_[n] |= CELL_SOLID_KNOWN;
+			if((*solid_)(x, y)) {
+				flags_[n] |= CELL_SOLID;
+			}
+
+			min_x_ = std::min(min_x_, x);
+			min_y_ = std::min(min_y_, y);
+			max_x_ = std::max(max_x_, x);
+			max_y_ = std::max(max_y_, y);
+		}
+
+		return (flags_[n]&CELL_SOLID) == 0;
+	}
+
+	double GridPathfinder::distance(int dx, int dy) const
+	{
+		dx = abs(dx);
+		dy = abs(dy);
+		const int diagonal = std::min(dx, dy);
+		return diagonal*cost_diagonal_ + (dx - diagonal)*cost_x_ + (dy - diagonal)*cost_y_;
+	}
+
+	void GridPathfinder::visit(int n, int parent, double g)
+	{
+		touch(n);
+		if(flags_[n]&CELL_CLOSED) {
+			// The heuristic is consistent, so a closed cell already has its
+			// cheapest cost.
+			return;
+		}
+
+		if(flags_[n]&CELL_OPEN) {
+			if(g >= g_[n]) {
+				return;
+			}
+			f_[n] -= g_[n] - g;
+			g_[n] = g;
+			parent_[n] = parent;
+			heapUp(heap_pos_[n]);
+			return;
+		}
+
+		flags_[n] |= CELL_OPEN;
+		g_[n] = g;
+		f_[n] = g + distance(n%width_ - dst_x_, n/width_ - dst_y_);
+		parent_[n] = parent;
+		heapPush(n);
+	}
+
+	int GridPathfinder::jump(int x, int y, int dx, int dy)
+	{
+		for(;;) {
+			if(!walkable(x, y)) {
+				return -1;
+			}
+
+			if(x == dst_x_ && y == dst_y_) {
+				return index(x, y);
+			}
+
+			if(dx && dy) {
+				// Moving diagonally, this is a jump point if we could jump
+				// from here either across or down.
+				if(jump(x + dx, y, dx, 0) >= 0 || jump(x, y + dy, 0, dy) >= 0) {
+					return index(x, y);
+				}
+			} else if(dx) {
+				// Moving across, a cell above or below which couldn't be
+				// reached from the last cell has to be reached from here.
+				if((walkable(x, y - 1) && !walkable(x - dx, y - 1)) ||
+				   (walkable(x, y + 1) && !walkable(x - dx, y + 1))) {
+					return index(x, y);
+				}
+			} else {
+				if((walkable(x - 1, y) && !walkable(x - 1, y - dy)) ||
+				   (walkable(x + 1, y) && !walkable(x + 1, y - dy))) {
+					return index(x, y);
+				}
+			}
+
+			// Corners can't be cut, so both cells beside a diagonal move have
+			// to be clear.
+			if(!walkable(x + dx, y) || !walkable(x, y + dy)) {
+				return -1;
+			}
+
+			x += dx;
+			y += dy;
+		}
+	}
+
+	void GridPathfinder::addNeighbours(int n, std::vector<int>* successors)
+	{
+		const int x = n%width_;
+		const int y = n/width_;
+		for(int dy = -1; dy <= 1; ++dy) {
+			for(int dx = -1; dx <= 1; ++dx) {
+				if((dx == 0 && dy == 0) || !walkable(x + dx, y + dy)) {
+					continue;
+				}
+
+				if(dx && dy && (!walkable(x + dx, y) || !walkable(x, y + dy))) {
+					continue;
+				}
+
+				successors->push_back(index(x + dx, y + dy));
+			}
+		}
+	}
+
+	void GridPathfinder::addJumpSuccessors(int n, std::vector<int>* successors)
+	{
+		const int x = n%width_;
+		const int y = n/width_;
+
+		// The directions worth searching in, pruned by the direction we
+		// arrived from.
+		int dirs[8][2];
+		int ndirs = 0;
+		if(parent_[n] < 0) {
+			std::vector<int> neighbours;
+			addNeighbours(n, &neighbours);
+			for(int m : neighbours) {
+				dirs[ndirs][0] = m%width_ - x;
+				dirs[ndirs][1] = m/width_ - y;
+				++ndirs;
+			}
+		} else {
+			const int px = parent_[n]%width_;
+			const int py = parent_[n]/width_;
+			const int dx = (x > px) - (x < px);
+			const int dy = (y > py) - (y < py);
+			if(dx && dy) {
+				const bool across = walkable(x + dx, y);
+				const bool down = walkable(x, y + dy);
+				if(down) {
+					dirs[ndirs][0] = 0; dirs[ndirs][1] = dy; ++ndirs;
+				}
+				if(across) {
+					dirs[ndirs][0] = dx; dirs[ndirs][1] = 0; ++ndirs;
+				}
+				if(across && down) {
+					dirs[ndirs][0] = dx; dirs[ndirs][1] = dy; ++ndirs;
+				}
+			} else if(dx) {
+				const bool next = walkable(x + dx, y);
+				const bool up = walkable(x, y - 1);
+				const bool down = walkable(x, y + 1);
+				if(next) {
+					dirs[ndirs][0] = dx; dirs[ndirs][1] = 0; ++ndirs;
+					if(up) {
+						dirs[ndirs][0] = dx; dirs[ndirs][1] = -1; ++ndirs;
+					}
+					if(down) {
+						dirs[ndirs][0] = dx; dirs[ndirs][1] = 1; ++ndirs;
+					}
+				}
+				if(up) {
+					dirs[ndirs][0] = 0; dirs[ndirs][1] = -1; ++ndirs;
+				}
+				if(down) {
+					dirs[ndirs][0] = 0; dirs[ndirs][1] = 1; ++ndirs;
+				}
+			} else {
+				const bool next = walkable(x, y + dy);
+				const bool left = walkable(x - 1, y);
+				const bool right = walkable(x + 1, y);
+				if(next) {
+					dirs[ndirs][0] = 0; dirs[ndirs][1] = dy; ++ndirs;
+					if(left) {
+						dirs[ndirs][0] = -1; dirs[ndirs][1] = dy; ++ndirs;
+					}
+					if(right) {
+						dirs[ndirs][0] = 1; dirs[ndirs][1] = dy; ++ndirs;
+					}
+				}
+				if(left) {
+					dirs[ndirs][0] = -1; dirs[ndirs][1] = 0; ++ndirs;
+				}
+				if(right) {
+					dirs[ndirs][0] = 1; dirs[ndirs][1] = 0; ++ndirs;
+				}
+			}
+		}
+
+		for(int i = 0; i != ndirs; ++i) {
+			const int j = jump(x + dirs[i][0], y + dirs[i][1], dirs[i][0], dirs[i][1]);
+			if(j >= 0) {
+				successors->push_back(j);
+			}
+		}
+	}
+
+	bool GridPathfinder::findPath(const point& src, const point& dst, const SolidFn& solid, bool jump_points, std::vector<point>* path)
+	{
+		ASSERT_LOG(src.x >= 0 && src.y >= 0 && src.x < width_ && src.y < height_, "Path source outside of grid: " << src);
+		ASSERT_LOG(dst.x >= 0 && dst.y >= 0 && dst.x < width_ && dst.y < height_, "Path destination outside of grid: " << dst);
+		path->clear();
+
+		if(++search_id_ == 0) {
+			std::fill(stamp_.begin(), stamp_.end(), 0);
+			search_id_ = 1;
+		}
+
+		solid_ = &solid;
+		dst_x_ = dst.x;
+		dst_y_ = dst.y;
+		min_x_ = max_x_ = src.x;
+		min_y_ = max_y_ = src.y;
+		heap_.clear();
+
+		const int dst_index = index(dst.x, dst.y);
+		bool found = false;
+		if(walkable(src.x, src.y) && walkable(dst.x, dst.y)) {
+			visit(index(src.x, src.y), -1, 0.0);
+
+			std::vector<int> successors;
+			while(!heap_.empty()) {
+				const int n = heapPop();
+				flags_[n] = (flags_[n]&~CELL_OPEN) | CELL_CLOSED;
+				if(n == dst_index) {
+					found = true;
+					break;
+				}
+
+				successors.clear();
+				if(jump_points) {
+					addJumpSuccessors(n, &successors);
+				} else {
+					addNeighbours(n, &successors);
+				}
+
+				const int x = n%width_;
+				const int y = n/width_;
+				for(int m : successors) {
+					visit(m, n, g_[n] + distance(m%width_ - x, m/width_ - y));
+				}
+			}
+		}
+
+		solid_ = nullptr;
+		examined_ = rect::from_coordinates(min_x_, min_y_, max_x_, max_y_);
+
+		if(found) {
+			// Jump points are joined by straight or diagonal lines, so fill
+			// in the cells between them.
+			for(int n = dst_index; n >= 0; n = parent_[n]) {
+				const int x = n%width_;
+				const int y = n/width_;
+				if(parent_[n] < 0) {
+					path->push_back(point(x, y));
+					break;
+				}
+				const int px = parent_[n]%width_;
+				const int py = parent_[n]/width_;
+				const int dx = (px > x) - (px < x);
+				const int dy = (py > y) - (py < y);
+				for(int cx = x, cy = y; cx != px || cy != py; cx += dx, cy += dy) {
+					path->push_back(point(cx, cy));
+				}
+			}
+			std::reverse(path->begin(), path->end());
+		}
+
+		return found;
+	}
+
+	void GridPathfinder::heapPush(int n)
+	{
+		heap_pos_[n] = static_cast<int>(heap_.size());
+		heap_.push_back(n);
+		heapUp(heap_pos_[n]);
+	}
+
+	int GridPathfinder::heapPop()
+	{
+		const int top = heap_.front();
+		heap_.front() = heap_.back();
+		heap_pos_[heap_.front()] = 0;
+		heap_.pop_back();
+		if(!heap_.empty()) {
+			heapDown(0);
+		}
+		return top;
+	}
+
+	namespace
+	{
+		// Orders cells by f, breaking ties in favour of the cell which has
+		// come further, since it's probably nearer the destination.
+		inline bool heap_less(const std::vector<double>& f, const std::vector<double>& g, int a, int b)
+		{
+			return f[a] < f[b] || (f[a] == f[b] && g[a] > g[b]);
+		}
+	}
+
+	void GridPathfinder::heapUp(int pos)
+	{
+		const int n = heap_[pos];
+		while(pos > 0) {
+			const int parent = (pos - 1)/2;
+			if(!heap_less(f_, g_, n, heap_[parent])) {
+				break;
+			}
+			heap_[pos] = heap_[parent];
+			heap_pos_[heap_[pos]] = pos;
+			pos = parent;
+		}
+		heap_[pos] = n;
+		heap_pos_[n] = pos;
+	}
+
+	void GridPathfinder::heapDown(int pos)
+	{
+		const int size = static_cast<int>(heap_.size());
+		const int n = heap_[pos];
+		for(;;) {
+			int child = pos*2 + 1;
+			if(child >= size) {
+				break;
+			}
+			if(child + 1 < size && heap_less(f_, g_, heap_[child + 1], heap_[child])) {
+				++child;
+			}
+			if(!heap_less(f_, g_, heap_[child], n)) {
+				break;
+			}
+			heap_[pos] = heap_[child];
+			heap_pos_[heap_[pos]] = pos;
+			pos = child;
+		}
+		heap_[pos] = n;
+		heap_pos_[n] = pos;
+	}
+
+	namespace
+	{
+		int floor_div(int a, int b)
+		{
+			return a/b - (a%b != 0 && (a < 0) != (b < 0) ? 1 : 0);
+		}
+
+		struct GridPathKey
+		{
+			const Level* lvl;
+			rect grid;
+			int tile_size_x, tile_size_y;
+			point src, dst;
+			bool jump_points;
+
+			bool operator==(const GridPathKey& k) const {
+				return lvl == k.lvl && grid == k.grid && tile_size_x == k.tile_size_x && tile_size_y == k.tile_size_y &&
+					src == k.src && dst == k.dst && jump_points == k.jump_points;
+			}
+		};
+
+		struct GridPathCacheEntry
+		{
+			GridPathKey key;
+			// The part of the level, in pixels, which the path depends on.
+			rect area;
+			// The cells on the path; empty if there is no path.
+			std::vector<point> cells;
+		};
+
+		// Recently found paths, most recently used first.
+		typedef std::list<GridPathCacheEntry> GridPathCache;
+		const size_t MaxCachedGridPaths = 64;
+
+		GridPathCache& get_grid_path_cache()
+		{
+			// Never destroyed, since levels invalidate their paths when they
+			// are destroyed, which may be during exit.
+			static GridPathCache* cache = new GridPathCache;
+			return *cache;
+		}
+	}
+
+	variant grid_find_path(LevelPtr lvl,
+		const point& src_pt1,
+		const point& dst_pt1,
+		const int tile_size_x,
+		const int tile_size_y,
+		const bool jump_points)
+	{
+		ASSERT_LOG(tile_size_x > 0 && tile_size_y > 0, "Invalid tile size for path: " << tile_size_x << "," << tile_size_y);
+		std::vector<variant> path;
+		const rect& b_rect = lvl->boundaries();
+		point src_pt(src_pt1), dst_pt(dst_pt1);
+		clip_pt_to_rect(src_pt, b_rect);
+		clip_pt_to_rect(dst_pt, b_rect);
+
+		// The grid covers the level, with cells lined up on multiples of the
+		// tile size.
+		const int gx = floor_div(b_rect.x(), tile_size_x);
+		const int gy = floor_div(b_rect.y(), tile_size_y);
+		const rect grid = rect::from_coordinates(gx, gy, floor_div(b_rect.x2(), tile_size_x), floor_div(b_rect.y2(), tile_size_y));
+		const point src(floor_div(src_pt.x, tile_size_x) - gx, floor_div(src_pt.y, tile_size_y) - gy);
+		const point dst(floor_div(dst_pt.x, tile_size_x) - gx, floor_div(dst_pt.y, tile_size_y) - gy);
+
+		if(src == dst) {
+			return variant(&path);
+		}
+
+		GridPathCache& cache = get_grid_path_cache();
+		const GridPathKey key = { lvl.get(), grid, tile_size_x, tile_size_y, src, dst, jump_points };
+		auto it = std::find_if(cache.begin(), cache.end(), [&key](const GridPathCacheEntry& e) { return e.key == key; });
+		if(it != cache.end()) {
+			cache.splice(cache.begin(), cache, it);
+		} else {
+			static GridPathfinder finder;
+			finder.resize(grid.w(), grid.h());
+			finder.setStepCosts(tile_size_x, tile_size_y);
+
+			GridPathCacheEntry entry;
+			entry.key = key;
+			finder.findPath(src, dst, [&](int x, int y) {
+				const rect r((gx + x)*tile_size_x, (gy + y)*tile_size_y, tile_size_x, tile_size_y);
+				return lvl->may_be_solid_in_rect(r) && lvl->solid(r);
+			}, jump_points, &entry.cells);
+
+			const rect& examined = finder.getExaminedArea();
+			entry.area = rect((gx + examined.x())*tile_size_x, (gy + examined.y())*tile_size_y,
+				examined.w()*tile_size_x, examined.h()*tile_size_y);
+
+			cache.push_front(entry);
+			if(cache.size() > MaxCachedGridPaths) {
+				cache.pop_back();
+			}
+		}
+
+		const std::vector<point>& cells = cache.front().cells;
+		for(size_t n = 0; n != cells.size(); ++n) {
+			if(n == 0) {
+				path.push_back(point_as_variant_list(src_pt));
+			} else if(n + 1 == cells.size()) {
+				path.push_back(point_as_variant_list(dst_pt));
+			} else {
+				path.push_back(point_as_variant_list(point((gx + cells[n].x)*tile_size_x + tile_size_x/2,
+					(gy + cells[n].y)*tile_size_y + tile_size_y/2)));
+			}
+		}
+		return variant(&path);
+	}
+
+	void invalidate_grid_paths(const Level* lvl, const rect* area)
+	{
+		GridPathCache& cache = get_grid_path_cache();
+		for(auto it = cache.begin(); it != cache.end(); ) {
+			if(it->key.lvl == lvl && (area == nullptr || rects_intersect(it->area, *area))) {
+				it = cache.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
 }
 
 UNIT_TEST(directed_graph_function) {
@@ -424,3 +945,89 @@ UNIT_TEST(cost_path_search_function) {
 	CHECK_EQ(game_logic::Formula(variant("sort(path_cost_search(weighted_graph(directed_graph(map(range(9), [value/3,value%3]), filter(links(v), inside_bounds(value))), distance(a,b)), [1,1], 1)) where links = def(v) [[v[0]-1,v[1]], [v[0]+1,v[1]], [v[0],v[1]-1], [v[0],v[1]+1],[v[0]-1,v[1]-1],[v[0]-1,v[1]+1],[v[0]+1,v[1]-1],[v[0]+1,v[1]+1]], inside_bounds = def(v) v[0]>=0 and v[1]>=0 and v[0]<3 and v[1]<3, distance=def(a,b)sqrt((a[0]-b[0])^2+(a[1]-b[1])^2)")).execute(), 
 		game_logic::Formula(variant("sort([[1,1], [1,0], [2,1], [1,2], [0,1]])")).execute());
 }
+
+namespace
+{
+	std::vector<bool> random_grid(int width, int height, int percent_solid, unsigned seed)
+	{
+		std::mt19937 rng(seed);
+		std::vector<bool> grid(width*height);
+		for(int n = 0; n != width*height; ++n) {
+			grid[n] = int(rng()%100) < percent_solid;
+		}
+		return grid;
+	}
+
+	double grid_path_cost(const std::vector<point>& path)
+	{
+		double cost = 0.0;
+		for(size_t n = 1; n < path.size(); ++n) {
+			cost += (path[n].x != path[n-1].x && path[n].y != path[n-1].y) ? sqrt(2.0) : 1.0;
+		}
+		return cost;
+	}
+}
+
+UNIT_TEST(grid_pathfinder) {
+	const int width = 40, height = 30;
+	pathfinding::GridPathfinder finder;
+	finder.resize(width, height);
+
+	for(unsigned seed = 1; seed <= 20; ++seed) {
+		const std::vector<bool> grid = random_grid(width, height, 30, seed);
+		auto solid = [&grid, width](int x, int y) { return grid[y*width + x]; };
+		const point src(seed%width, 0), dst(width - 1 - seed%width, height - 1);
+
+		std::vector<point> a_star_path, jps_path;
+		const bool found = finder.findPath(src, dst, solid, false, &a_star_path);
+		CHECK_EQ(finder.findPath(src, dst, solid, true, &jps_path), found);
+		if(!found) {
+			CHECK(a_star_path.empty(), "path returned when none was found");
+			continue;
+		}
+
+		CHECK(fabs(grid_path_cost(a_star_path) - grid_path_cost(jps_path)) < 0.001, "jump point path cost differs: " << grid_path_cost(a_star_path) << " vs " << grid_path_cost(jps_path));
+		for(const std::vector<point>* path : { &a_star_path, &jps_path }) {
+			CHECK_EQ(path->front(), src);
+			CHECK_EQ(path->back(), dst);
+			for(size_t n = 0; n != path->size(); ++n) {
+				const point& p = (*path)[n];
+				CHECK(!solid(p.x, p.y), "path passes through solid cell " << p);
+				if(n > 0) {
+					const point& q = (*path)[n-1];
+					CHECK(abs(p.x - q.x) <= 1 && abs(p.y - q.y) <= 1 && p != q, "path cells not adjacent: " << q << " " << p);
+					CHECK(!solid(p.x, q.y) && !solid(q.x, p.y), "path cuts a corner at " << q << " " << p);
+				}
+			}
+		}
+	}
+
+	// A wall with a single gap.
+	std::vector<bool> grid(width*height);
+	for(int y = 0; y != height; ++y) {
+		grid[y*width + width/2] = y != height - 2;
+	}
+	auto solid = [&grid, width](int x, int y) { return grid[y*width + x]; };
+	std::vector<point> path;
+	CHECK(finder.findPath(point(0, 0), point(width - 1, 0), solid, true, &path), "no path through gap");
+	CHECK(std::find(path.begin(), path.end(), point(width/2, height - 2)) != path.end(), "path doesn't use gap");
+	CHECK(finder.getExaminedArea().h() == height, "examined area too small");
+
+	grid[(height - 2)*width + width/2] = true;
+	CHECK(!finder.findPath(point(0, 0), point(width - 1, 0), solid, false, &path), "path found through wall");
+	CHECK(path.empty(), "path returned when none was found");
+}
+
+BENCHMARK(grid_pathfinder) {
+	const int width = 256, height = 256;
+	std::vector<bool> grid = random_grid(width, height, 20, 42);
+	grid.front() = grid.back() = false;
+	auto solid = [&grid, width](int x, int y) { return grid[y*width + x]; };
+	pathfinding::GridPathfinder finder;
+	finder.resize(width, height);
+	std::vector<point> path;
+	BENCHMARK_LOOP {
+		finder.findPath(point(0, 0), point(width - 1, height - 1), solid, false, &path);
+		finder.findPath(point(0, 0), point(width - 1, height - 1), solid, true, &path);
+	}
+}
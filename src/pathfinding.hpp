@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <functional>
 #include <iostream>
 #include <map>
 #include <utility>
@@ -221,4 +222,86 @@ namespace pathfinding
 	variant path_cost_search(WeightedDirectedGraphPtr wg, 
 		const variant src_node, 
 		decimal max_cost );
+
+	// A* over a width by height grid of cells, moving in eight directions
+	// without cutting corners. The per-cell search state is kept in flat
+	// arrays indexed by cell, which are reused between searches rather than
+	// cleared, and the open list is a binary heap of cell indexes which
+	// supports decreasing the key of a cell already on it.
+	class GridPathfinder
+	{
+	public:
+		// Returns true if the cell at (x,y) can't be moved through.
+		typedef std::function<bool(int x, int y)> SolidFn;
+
+		GridPathfinder();
+		void resize(int width, int height);
+		int width() const { return width_; }
+		int height() const { return height_; }
+
+		// The cost of moving to the next cell across and down. Diagonal
+		// moves cost the length of the diagonal.
+		void setStepCosts(double cost_x, double cost_y);
+
+		// Finds a least cost path from src to dst, returning the cells on
+		// it, including src and dst, in path. If jump_points is set, jump
+		// point search is used to skip over the open areas of the grid.
+		// Returns false if there is no path.
+		bool findPath(const point& src, const point& dst, const SolidFn& solid, bool jump_points, std::vector<point>* path);
+
+		// The rectangle of cells which were looked at during the last search.
+		// The result of the search only depends on the cells in it.
+		const rect& getExaminedArea() const { return examined_; }
+	private:
+		enum { CELL_SOLID_KNOWN = 1, CELL_SOLID = 2, CELL_OPEN = 4, CELL_CLOSED = 8 };
+
+		int index(int x, int y) const { return y*width_ + x; }
+		void touch(int n);
+		bool walkable(int x, int y);
+		// The cost of the cheapest path between cells dx across and dy down
+		// from each other, if nothing is in the way.
+		double distance(int dx, int dy) const;
+		void visit(int n, int parent, double g);
+		int jump(int x, int y, int dx, int dy);
+		void addJumpSuccessors(int n, std::vector<int>* successors);
+		void addNeighbours(int n, std::vector<int>* successors);
+
+		void heapPush(int n);
+		int heapPop();
+		void heapUp(int pos);
+		void heapDown(int pos);
+
+		int width_, height_;
+		double cost_x_, cost_y_, cost_diagonal_;
+
+		// Cells whose stamp isn't the current search have no state yet.
+		unsigned search_id_;
+		std::vector<unsigned> stamp_;
+		std::vector<unsigned char> flags_;
+		std::vector<double> g_;
+		std::vector<double> f_;
+		std::vector<int> parent_;
+		std::vector<int> heap_pos_;
+		std::vector<int> heap_;
+
+		const SolidFn* solid_;
+		int dst_x_, dst_y_;
+		int min_x_, min_y_, max_x_, max_y_;
+		rect examined_;
+	};
+
+	// Finds a path across the level on a grid of tile_size_x by tile_size_y
+	// cells, returning the midpoints of the cells it passes through, in the
+	// same form as a_star_find_path. Recent paths are cached until the solid
+	// area they were found over changes.
+	variant grid_find_path(LevelPtr lvl,
+		const point& src,
+		const point& dst,
+		const int tile_size_x,
+		const int tile_size_y,
+		const bool jump_points);
+
+	// Drops the cached paths for lvl which were found over area, or all of
+	// the paths for lvl if area is null.
+	void invalidate_grid_paths(const Level* lvl, const rect* area=nullptr);
 }
@@ -103,6 +103,11 @@ EntityPtr PlayableCustomObject::backup() const
 	return EntityPtr(new PlayableCustomObject(*this));
 }
 
+size_t PlayableCustomObject::backupBytes() const
+{
+	return CustomObject::backupBytes() + sizeof(PlayableCustomObject) - sizeof(CustomObject);
+}
+
 EntityPtr PlayableCustomObject::clone() const
 {
 	return EntityPtr(new PlayableCustomObject(*this));
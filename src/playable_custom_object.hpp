@@ -48,6 +48,11 @@ public:
 	virtual EntityPtr backup() const;
 	virtual EntityPtr clone() const;
 
+	//there are few players, so they are always backed up in full rather
+	//than as deltas.
+	bool diffBackup(const Entity& prev, ConstEntityBackupDeltaPtr* delta) const override { return false; }
+	size_t backupBytes() const override;
+
 	virtual int verticalLook() const { return vertical_look_; }
 
 	virtual bool isActive(const rect& screen_area) const;
@@ -65,6 +70,9 @@ private:
 	variant getValue(const std::string& key) const;	
 	void setValue(const std::string& key, const variant& value);
 
+	//player values are looked up by key before the type's slots.
+	int getSlotLayoutId() const { return 0; }
+
 	variant getPlayerValueBySlot(int slot) const;
 	void setPlayerValueBySlot(int slot, const variant& value);
 
@@ -21,6 +21,8 @@
 	   distribution.
 */
 
+#include <algorithm>
+
 #include "DisplayDevice.hpp"
 
 #include "solid_map.hpp"
@@ -80,6 +82,7 @@ void SolidMap::createObjectSolidMaps(variant node, std::vector<ConstSolidMapPtr>
 		if(legs_height == 0) {
 			body_map->calculateSide(0, 1, body_map->bottom_);
 		}
+		body_map->packSides();
 		v.push_back(body_map);
 	} else {
 		legs_height = area.h();
@@ -105,6 +108,7 @@ void SolidMap::createObjectSolidMaps(variant node, std::vector<ConstSolidMapPtr>
 		legs_map->calculateSide(-1, 0, legs_map->left_);
 		legs_map->calculateSide(1, 0, legs_map->right_);
 		legs_map->calculateSide(-10000, 0, legs_map->all_);
+		legs_map->packSides();
 		v.push_back(legs_map);
 	}
 }
@@ -126,6 +130,7 @@ void SolidMap::createObjectPlatformMaps(const rect& area_ref, std::vector<ConstS
 	platform->calculateSide(-1, 0, platform->left_);
 	platform->calculateSide(1, 0, platform->right_);
 	platform->calculateSide(-100000, 0, platform->all_);
+	platform->packSides();
 	v.push_back(platform);
 }
 SolidMapPtr SolidMap::createFromTexture(const KRE::TexturePtr& t, const rect& area_rect)
@@ -223,6 +228,55 @@ bool SolidMap::isSolidAt(int x, int y) const
 	return solid_[y*area_.w() + x];
 }
 
+const PackedSolidEdge& SolidMap::packedDir(MOVE_DIRECTION d) const
+{
+	return packed_[static_cast<int>(d)];
+}
+
+void SolidMap::packSides()
+{
+	for(int n = 0; n != 5; ++n) {
+		packed_[n].init(dir(static_cast<MOVE_DIRECTION>(n)));
+	}
+}
+
+void PackedSolidEdge::init(const std::vector<point>& points)
+{
+	dense = false;
+	rows.clear();
+	bits.clear();
+	mirrored_bits.clear();
+
+	//points are generated a row at a time, so each run of points with the
+	//same y becomes a row.
+	for(auto i = points.begin(); i != points.end(); ) {
+		auto end = i;
+		int x1 = i->x, x2 = i->x;
+		while(end != points.end() && end->y == i->y) {
+			x1 = std::min(x1, end->x);
+			x2 = std::max(x2, end->x);
+			++end;
+		}
+
+		Row row;
+		row.y = i->y;
+		row.x1 = x1;
+		row.x2 = x2;
+		row.word = static_cast<int>(bits.size());
+		row.nwords = (x2 - x1)/64 + 1;
+		bits.resize(bits.size() + row.nwords);
+		mirrored_bits.resize(bits.size());
+		for(; i != end; ++i) {
+			bits[row.word + (i->x - x1)/64] |= uint64_t(1) << ((i->x - x1)%64);
+			mirrored_bits[row.word + (x2 - i->x)/64] |= uint64_t(1) << ((x2 - i->x)%64);
+		}
+
+		rows.push_back(row);
+	}
+
+	dense = points.size() >= rows.size()*3;
+}
+
 const std::vector<point>& SolidMap::dir(MOVE_DIRECTION d) const
 {
 	switch(d) {
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <vector>
 
 #include "geometry.hpp"
@@ -33,6 +34,54 @@
 
 enum class MOVE_DIRECTION { LEFT, RIGHT, UP, DOWN, NONE };
 
+//The points along one side of a solid map, packed into rows of bits so a
+//whole row can be tested against the level a word at a time.
+struct PackedSolidEdge
+{
+	struct Row {
+		int y;
+
+		//the range of x values the row's points fall in.
+		int x1, x2;
+
+		//index of the row's first word in 'bits' and 'mirrored_bits'.
+		int word;
+		int nwords;
+	};
+
+	void init(const std::vector<point>& points);
+
+	std::vector<Row> rows;
+
+	//whether rows have enough points on average that testing them a row
+	//at a time beats testing the points one at a time. Edges running down
+	//the sides of an object have a single point per row.
+	bool dense;
+
+	//bit n of a row's words in 'bits' is set if there is a point at x1+n.
+	//'mirrored_bits' holds the row reversed, with bit n set for a point at
+	//x2-n, for use when the object is facing left.
+	std::vector<uint64_t> bits, mirrored_bits;
+};
+
+//gets 'nbits' bits, no more than 64, starting at bit 'begin' of the
+//'nwords' words in 'words'.
+inline uint64_t extract_bits(const uint64_t* words, int nwords, int begin, int nbits)
+{
+	const int word = begin >> 6;
+	const int shift = begin&63;
+	uint64_t result = words[word] >> shift;
+	if(shift != 0 && word+1 < nwords) {
+		result |= words[word+1] << (64 - shift);
+	}
+
+	if(nbits < 64) {
+		result &= (uint64_t(1) << nbits) - 1;
+	}
+
+	return result;
+}
+
 class SolidMap
 {
 public:
@@ -51,6 +100,8 @@ public:
 	const std::vector<point>& top() const { return top_; }
 	const std::vector<point>& bottom() const { return bottom_; }
 	const std::vector<point>& all() const { return all_; }
+
+	const PackedSolidEdge& packedDir(MOVE_DIRECTION d) const;
 private:
 	static ConstSolidMapPtr createObjectSolidMapFromSolidNode(variant node);
 
@@ -62,6 +113,9 @@ private:
 
 	void applyOffsets(const std::vector<int>& offsets);
 
+	//fills in the packed edges once the sides have been calculated.
+	void packSides();
+
 	std::string id_;
 	rect area_;
 
@@ -69,6 +123,9 @@ private:
 
 	//all the solid points that are on the different sides of the solid area.
 	std::vector<point> left_, right_, top_, bottom_, all_;
+
+	//the sides packed into bits, indexed by MOVE_DIRECTION.
+	PackedSolidEdge packed_[5];
 };
 
 class SolidInfo
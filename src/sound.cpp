@@ -32,6 +32,7 @@
 #include "SDL_mixer.h"
 
 #include "asserts.hpp"
+#include "background_task_pool.hpp"
 #include "filesystem.hpp"
 #include "module.hpp"
 #include "preferences.hpp"
@@ -339,7 +340,8 @@ namespace sound
 #endif
 		}
 
-		std::map<std::string, std::shared_ptr<threading::thread> > loading_threads;
+		//sounds being decoded in the background, mapped to their task id.
+		std::map<std::string, int> loading_tasks;
 	}
 
 	Manager::Manager()
@@ -402,7 +404,13 @@ namespace sound
 			return;
 		}
 
-		loading_threads.clear();
+		for(auto& p : loading_tasks) {
+			if(!background_task_pool::cancel(p.second)) {
+				background_task_pool::wait(p.second);
+			}
+		}
+
+		loading_tasks.clear();
 
 	#if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_IPHONE
 		Mix_HookMusicFinished(nullptr);
@@ -438,12 +446,11 @@ namespace sound
 			return;
 		}
 
-		if(loading_threads.count(file)) {
+		if(loading_tasks.count(file)) {
 			return;
 		}
 
-		std::shared_ptr<threading::thread> t(new threading::thread("sounds", std::bind(thread_load, file)));
-		loading_threads[file] = t;
+		loading_tasks[file] = background_task_pool::submit(std::bind(thread_load, file), std::function<void()>(), background_task_pool::PRIORITY::AUDIO_DECODE);
 	}
 
 	namespace {
@@ -522,7 +529,7 @@ namespace sound
 			for(cache_map::const_iterator i = threaded_cache.begin(); i != threaded_cache.end(); ++i) {
 				cache.insert(*i);
 				has_items = true;
-				loading_threads.erase(i->first);
+				loading_tasks.erase(i->first);
 			}
 
 			threaded_cache.clear();
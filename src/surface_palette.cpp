@@ -30,6 +30,7 @@
 #include "json_parser.hpp"
 #include "module.hpp"
 #include "surface_palette.hpp"
+#include "SurfaceKernels.hpp"
 
 namespace graphics
 {
@@ -122,17 +123,20 @@ namespace graphics
 
 		// generate a map of the palette.
 		std::map<uint32_t, uint32_t> color_map;
+		SurfaceKernels::ColorLookup lookup;
 		if(psurf->width() > psurf->height()) {
 			for(int x = 0; x != psurf->width(); ++x) {
 				Color normal_color = psurf->getColorAt(x, 0);
 				Color mapped_color = psurf->getColorAt(x, 1);
 				color_map[normal_color.asRGBA()] = mapped_color.asRGBA();
+				lookup.add(normal_color.asRGBA(), mapped_color.asRGBA());
 			}
 		} else {
 			for(int y = 0; y != psurf->height(); ++y) {
 				Color normal_color = psurf->getColorAt(0, y);
 				Color mapped_color = psurf->getColorAt(1, y);
 				color_map[normal_color.asRGBA()] = mapped_color.asRGBA();
+				lookup.add(normal_color.asRGBA(), mapped_color.asRGBA());
 			}
 		}
 
@@ -141,6 +145,27 @@ namespace graphics
 		std::vector<uint8_t> new_pixels;
 		new_pixels.resize(rp * surface->height());
 
+		SurfaceKernels::Layout32 layout;
+		if(SurfaceKernels::get_layout(*surface->getPixelFormat(), &layout)) {
+			SurfaceLock lck(surface);
+			std::vector<uint32_t> row(surface->width());
+			for(int y = 0; y != surface->height(); ++y) {
+				const uint32_t* px = reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(surface->pixels()) + y * rp);
+				SurfaceKernels::decode_row(px, surface->width(), layout, row.data());
+				SurfaceKernels::remap_row(row.data(), surface->width(), lookup);
+				uint8_t* dst = &new_pixels[y * rp];
+				for(auto color : row) {
+					*dst++ = (color >> 24) & 0xff;
+					*dst++ = (color >> 16) & 0xff;
+					*dst++ = (color >>  8) & 0xff;
+					*dst++ = (color >>  0) & 0xff;
+				}
+			}
+			auto new_surf = Surface::create(surface->width(), surface->height(), PixelFormat::PF::PIXELFORMAT_RGBA8888);
+			new_surf->writePixels(&new_pixels[0], static_cast<int>(new_pixels.size()));
+			return new_surf;
+		}
+
 		surface->iterateOverSurface([&color_map, &new_pixels, rp, bpp](int x, int y, int r, int g, int b, int a) {
 			uint32_t color = (static_cast<uint32_t>(r) << 24)
 				| (static_cast<uint32_t>(g) << 16)
@@ -188,6 +188,9 @@ namespace tbs
 	  : type_(type), 
 	    game_id_(generate_game_id()),
 	    started_(false), state_(STATE_SETUP), state_id_(0), cycle_(0), tick_rate_(50),
+		doc_snapshot_version_(-1),
+		doc_in_place_mutations_(0), doc_in_place_mutations_seen_(0),
+		doc_untracked_write_version_(-1), delta_fallbacks_(0),
 		backup_callable_(nullptr)
 	{
 	}
@@ -200,6 +203,9 @@ namespace tbs
 		state_id_(0),
 		cycle_(value["cycle"].as_int(0)),
 		tick_rate_(value["tick_rate"].as_int(50)),
+		doc_snapshot_version_(-1),
+		doc_in_place_mutations_(0), doc_in_place_mutations_seen_(0),
+		doc_untracked_write_version_(-1), delta_fallbacks_(0),
 		backup_callable_(nullptr)
 	{
 	}
@@ -212,8 +218,11 @@ namespace tbs
 		state_id_(doc["state_id"].as_int()),
 		cycle_(doc["cycle"].as_int(0)),
 		tick_rate_(doc["tick_rate"].as_int(50)),
-		backup_callable_(nullptr),
-		doc_(doc["state"])
+		doc_(doc["state"]),
+		doc_snapshot_version_(-1),
+		doc_in_place_mutations_(0), doc_in_place_mutations_seen_(0),
+		doc_untracked_write_version_(-1), delta_fallbacks_(0),
+		backup_callable_(nullptr)
 	{
 		log_ = util::split(doc["log"].as_string(), '\n');
 
@@ -233,6 +242,9 @@ namespace tbs
 		players_.clear();
 		outgoing_messages_.clear();
 		doc_ = variant();
+		doc_snapshot_ = variant();
+		doc_snapshot_version_ = -1;
+		snapshot_deltas_.clear();
 		ai_.clear();
 		bots_.clear();
 		backup_callable_ = nullptr;
@@ -284,6 +296,7 @@ namespace tbs
 		}
 
 		variant state_doc;
+		int state_version = -1;
 
 		if(type_.handlers.count("transform")) {
 			variant msg = FormulaObject::deepClone(doc_);
@@ -294,12 +307,29 @@ namespace tbs
 
 			state_doc = msg;
 		} else {
-			state_doc = FormulaObject::deepClone(doc_);
+			state_doc = get_doc_snapshot();
+			state_version = doc_snapshot_version_;
 		}
 
 		if(send_delta) {
-			result.add("delta", FormulaObject::generateDiff(players_[nplayer].state_sent, state_doc));
-			result.add("delta_basis", players_[nplayer].confirmed_state_id);
+			const player& p = players_[nplayer];
+			if(state_version != -1 && p.state_version_sent != -1) {
+				//everyone who was sent the same snapshot gets the same delta.
+				variant& delta = snapshot_deltas_[p.state_version_sent];
+				if(delta.is_null() && p.state_version_sent < doc_untracked_write_version_) {
+					//a map or list in the doc was changed in place since
+					//then, which the variable versions don't show.
+					++delta_fallbacks_;
+					delta = FormulaObject::generateDiff(p.state_sent, state_doc);
+				} else if(delta.is_null()) {
+					delta = FormulaObject::generateDiffSince(p.state_sent, p.state_version_sent, state_doc);
+				}
+
+				result.add("delta", delta);
+			} else {
+				result.add("delta", FormulaObject::generateDiff(p.state_sent, state_doc));
+			}
+			result.add("delta_basis", p.confirmed_state_id);
 		} else {
 			result.add("state", state_doc);
 		}
@@ -307,6 +337,7 @@ namespace tbs
 		if(nplayer >= 0 && nplayer < static_cast<int>(players_.size()) && players_[nplayer].allow_deltas) {
 			players_[nplayer].state_id_sent = state_id_;
 			players_[nplayer].state_sent = state_doc;
+			players_[nplayer].state_version_sent = state_version;
 		}
 
 		std::string log_str;
@@ -324,6 +355,22 @@ namespace tbs
 		return res;
 	}
 
+	variant game::get_doc_snapshot() const
+	{
+		if(doc_in_place_mutations_seen_ != doc_in_place_mutations_) {
+			doc_in_place_mutations_seen_ = doc_in_place_mutations_;
+			doc_untracked_write_version_ = FormulaObject::advanceVersion();
+		}
+
+		if(doc_snapshot_version_ != FormulaObject::currentVersion()) {
+			doc_snapshot_ = FormulaObject::deepClone(doc_);
+			doc_snapshot_version_ = FormulaObject::currentVersion();
+			snapshot_deltas_.clear();
+		}
+
+		return doc_snapshot_;
+	}
+
 	void game::start_game()
 	{
 		if(started_) {
@@ -382,7 +429,7 @@ namespace tbs
 		queue_message(result.build(), nplayer);
 	}
 
-	game::player::player() : confirmed_state_id(-1), state_id_sent(-1), allow_deltas(true)
+	game::player::player() : confirmed_state_id(-1), state_id_sent(-1), state_version_sent(-1), allow_deltas(true)
 	{
 	}
 
@@ -494,6 +541,7 @@ namespace tbs
 	void game::process()
 	{
 		if(db_client_) {
+			const InPlaceMutationScope mutation_scope(&doc_in_place_mutations_);
 			db_client_->process(100);
 		}
 
@@ -535,6 +583,10 @@ namespace tbs
 			return obj.doc_;
 		DEFINE_SET_FIELD
 			obj.doc_ = value;
+			obj.doc_snapshot_version_ = -1;
+			for(player& p : obj.players_) {
+				p.state_version_sent = -1;
+			}
 
 		DEFINE_FIELD(event, "null")
 			return variant();
@@ -556,6 +608,9 @@ namespace tbs
 		DEFINE_FIELD(db_client, "null")
 			return variant();
 #endif
+		DEFINE_FIELD(delta_fallbacks, "int")
+			return variant(obj.delta_fallbacks_);
+
 		DEFINE_FIELD(state_id, "int")
 			return variant(obj.state_id_);
 		DEFINE_SET_FIELD
@@ -737,6 +792,7 @@ namespace tbs
 	void game::handleEvent(const std::string& name, game_logic::FormulaCallable* variables)
 	{
 		const backup_callable_scope backup_scope(&backup_callable_, variables);
+		const InPlaceMutationScope mutation_scope(&doc_in_place_mutations_);
 
 		std::map<std::string, game_logic::ConstFormulaPtr>::const_iterator itor = type_.handlers.find(name);
 		if(itor == type_.handlers.end() || !itor->second) {
@@ -808,6 +864,7 @@ namespace tbs
 	void game::surrenderReferences(GarbageCollector* collector)
 	{
 		collector->surrenderVariant(&doc_, "doc");
+		collector->surrenderVariant(&doc_snapshot_, "doc_snapshot");
 		for(boost::intrusive_ptr<tbs::bot>& bot : bots_) {
 			collector->surrenderPtr(&bot, "bot");
 		}
@@ -860,3 +917,51 @@ COMMAND_LINE_UTILITY(tbs_bot_game)
 		internal_server::process();
 	}
 }
+
+namespace
+{
+	void observe_game_return(const std::string& msg)
+	{
+	}
+}
+
+//runs a bot game with a number of observers attached, to measure the cost
+//of building and sending the game state. Use e.g.
+//--benchmarks=tbs_bot_game_state:"8:{type: 'create_game', ...}"
+BENCHMARK_ARG(tbs_bot_game_state, const std::string& arg)
+{
+	using namespace tbs;
+	using namespace game_logic;
+
+	static boost::intrusive_ptr<internal_client> client;
+	if(!client) {
+		const std::string::const_iterator colon = std::find(arg.begin(), arg.end(), ':');
+		ASSERT_LOG(colon != arg.end(), "tbs_bot_game_state argument must be nobservers:request");
+		const int nobservers = atoi(std::string(arg.begin(), colon).c_str());
+		variant create_game_request = json::parse(std::string(colon+1, arg.end()));
+
+		boost::intrusive_ptr<MapFormulaCallable> callable(new MapFormulaCallable);
+		client.reset(new internal_client);
+
+		g_create_bot_game = false;
+		client->send_request(create_game_request, -1, callable, create_game_return);
+		while(!g_create_bot_game) {
+			internal_server::process();
+		}
+
+		for(int n = 0; n != nobservers; ++n) {
+			variant_builder observe;
+			observe.add("type", "observe_game");
+			observe.add("user", formatter() << "observer" << n);
+			client->send_request(observe.build(), 1000 + n, callable, observe_game_return);
+		}
+
+		client->send_request(json::parse("{type: 'start_game'}"), 1, callable, start_game_return);
+	}
+
+	BENCHMARK_LOOP {
+		internal_server::process();
+	}
+}
+
+BENCHMARK_ARG_CALL_COMMAND_LINE(tbs_bot_game_state);
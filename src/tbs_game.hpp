@@ -89,6 +89,10 @@ namespace tbs
 
 		mutable variant state_sent;
 		mutable int state_id_sent;
+
+		//the FormulaObject version state_sent was taken at, or -1 if it was
+		//transformed for this player.
+		mutable int state_version_sent;
 		bool allow_deltas;
 		};
 
@@ -162,6 +166,26 @@ namespace tbs
 
 		variant doc_;
 
+		//a deep copy of doc_ shared by everyone sent the state when there is
+		//no transform handler. It is taken again once any FormulaObject has
+		//been written, since then doc_ may have changed.
+		variant get_doc_snapshot() const;
+		mutable variant doc_snapshot_;
+		mutable int doc_snapshot_version_;
+
+		//deltas from earlier snapshots to the current one, keyed by the
+		//version of the earlier snapshot.
+		mutable std::map<int, variant> snapshot_deltas_;
+
+		//maps and lists in doc_ changed in place by this game's handlers.
+		//Once the count moves on, the version is moved on too and recorded
+		//here, and deltas from snapshots older than that are made with the
+		//full diff, counted in delta_fallbacks_.
+		int doc_in_place_mutations_;
+		mutable int doc_in_place_mutations_seen_;
+		mutable int doc_untracked_write_version_;
+		mutable int delta_fallbacks_;
+
 		game_logic::FormulaCallable* backup_callable_;
 
 		std::vector<boost::intrusive_ptr<tbs::bot> > bots_;
@@ -29,6 +29,7 @@
 #include <set>
 
 #include "asserts.hpp"
+#include "background_task_pool.hpp"
 #include "formatter.hpp"
 #include "formula.hpp"
 #include "formula_callable.hpp"
@@ -46,10 +47,18 @@
 #include "tile_map.hpp"
 #include "variant_utils.hpp"
 
+PREF_INT(tile_rebuild_band_rows, 32, "Number of rows of a tile layer each background worker matches patterns for when building tiles. 0 builds each layer on a single thread");
+
 namespace 
 {
 	PREF_INT(tile_pattern_search_border, 1, "How many extra tiles to search for patterns");
 
+	threading::mutex& filter_formula_mutex()
+	{
+		static threading::mutex* instance = new threading::mutex;
+		return *instance;
+	}
+
 	const std::map<std::string, int>& str_to_zorder() {
 		static std::map<std::string, int>* instance = nullptr;
 		if(!instance) {
@@ -811,6 +820,11 @@ void TileMap::flipVariation(int x, int y, int delta)
 	}
 }
 
+void TileMap::preparePatterns() const
+{
+	getPatterns();
+}
+
 void TileMap::prepareForCopyToWorkerThread()
 {
 #ifndef NO_EDITOR
@@ -904,6 +918,12 @@ void TileMap::applyMatchingMultiPattern(int& x, int y,
 void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 {
 	const int begin_time = profile::get_tick_time();
+	const auto begin_size = tiles->size();
+
+	//make sure the patterns are built before any bands are handed out to
+	//other threads.
+	getPatterns();
+
 	int width = 0;
 	for(const auto& row : map_) {
 		int rs = static_cast<int>(row.size());
@@ -912,17 +932,15 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 		}
 	}
 
+	//multi tile patterns are matched greedily across the whole map, so
+	//a change anywhere in a row can move them. They only look up the
+	//pattern index though, so matching them everywhere is cheap, and we
+	//just discard the tiles outside of r.
 	point_map<LevelObject*> multi_pattern_matches;
 	std::map<point_zorder, LevelObject*> different_zorder_multi_pattern_matches;
 
 	for(const MultiTilePattern* p : multi_patterns_) {
 		for(int y = -p->height(); y < static_cast<int>(map_.size()) + p->height(); ++y) {
-			const int ypos = ypos_ + y*TileSize;
-	
-			if((r && ypos < r->y()) || (r && ypos > r->y2())) {
-				continue;
-			}
-
 			for(int x = -p->width(); x < width + p->width(); ++x) {
 				applyMatchingMultiPattern(x, y, *p, multi_pattern_matches, different_zorder_multi_pattern_matches);
 			}
@@ -931,12 +949,14 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 
 	//add all tiles in different zorders to our own.
 	for(auto& i : different_zorder_multi_pattern_matches) {
-		const LevelObject* obj = i.second;
 		const int x = i.first.first.x;
 		const int y = i.first.first.y;
 
 		const int xpos = xpos_ + x*TileSize;
 		const int ypos = ypos_ + y*TileSize;
+		if(r && !pointInRect(xpos, ypos, *r)) {
+			continue;
+		}
 
 		LevelTile t;
 		t.x = xpos;
@@ -948,20 +968,62 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 		tiles->emplace_back(t);
 	}
 
+	int y1 = -g_tile_pattern_search_border;
+	int y2 = static_cast<int>(map_.size()) + g_tile_pattern_search_border;
+	if(r) {
+		y1 = std::max(y1, static_cast<int>(std::floor(static_cast<float>(r->y() - ypos_)/TileSize)));
+		y2 = std::min(y2, static_cast<int>(std::ceil(static_cast<float>(r->y2() - ypos_)/TileSize)));
+	}
+
+	const int nrows = y2 - y1;
+	if(g_tile_rebuild_band_rows > 0 && nrows > g_tile_rebuild_band_rows && background_task_pool::num_workers() > 0) {
+		//split the rows into bands matched by the background workers,
+		//keeping the tiles in the order a single pass would give.
+		const int nbands = (nrows + g_tile_rebuild_band_rows - 1)/g_tile_rebuild_band_rows;
+		std::vector<std::vector<LevelTile>> band_tiles(nbands);
+		std::vector<int> tasks;
+		for(int n = 0; n != nbands; ++n) {
+			const int band_begin = y1 + n*g_tile_rebuild_band_rows;
+			const int band_end = std::min(y2, band_begin + g_tile_rebuild_band_rows);
+			std::vector<LevelTile>* band = &band_tiles[n];
+			const point_map<LevelObject*>* matches = &multi_pattern_matches;
+			tasks.push_back(background_task_pool::submit([=]() {
+				buildTilesInRows(band, band_begin, band_end, width, r, *matches);
+			}, std::function<void()>(), background_task_pool::PRIORITY::LEVEL_LOAD));
+		}
+
+		for(int task : tasks) {
+			background_task_pool::wait(task);
+		}
+
+		for(const std::vector<LevelTile>& band : band_tiles) {
+			tiles->insert(tiles->end(), band.begin(), band.end());
+		}
+	} else {
+		buildTilesInRows(tiles, y1, y2, width, r, multi_pattern_matches);
+	}
 
+	LOG_DEBUG("done build tiles: " << (tiles->size() - begin_size) << " " << (profile::get_tick_time() - begin_time));
+}
+
+void TileMap::buildTilesInRows(std::vector<LevelTile>* tiles, int y1, int y2, int width, const rect* r, const point_map<LevelObject*>& multi_pattern_matches) const
+{
 	TilePatternCache cache;
 
-	int ntiles = 0;
-	for(int y = -g_tile_pattern_search_border; y < static_cast<int>(map_.size()) + g_tile_pattern_search_border; ++y) {
+	for(int y = y1; y < y2; ++y) {
 		const int ypos = ypos_ + y*TileSize;
 
-		if((r && ypos < r->y()) || (r && ypos > r->y2())) {
+		if(r && (ypos < r->y() || ypos >= r->y2())) {
 			continue;
 		}
 
 		for(int x = -g_tile_pattern_search_border; x < width + g_tile_pattern_search_border; ++x) {
 			const int xpos = xpos_ + x*TileSize;
 
+			if(r && (xpos < r->x() || xpos >= r->x2())) {
+				continue;
+			}
+
 			const LevelObject* obj = multi_pattern_matches.get(point(x, y));
 			if(obj) {
 				LevelTile t;
@@ -981,13 +1043,6 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 				continue;
 			}
 
-
-			if((r && xpos < r->x()) || (r && xpos > r->x2())) {
-				continue;
-			}
-
-			++ntiles;
-
 			LevelTile t;
 			t.x = xpos;
 			t.y = ypos;
@@ -1025,7 +1080,27 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 			}
 		}
 	}
-	LOG_DEBUG("done build tiles: " << ntiles << " " << (profile::get_tick_time() - begin_time));
+}
+
+int TileMap::getPatternReach() const
+{
+	const std::vector<const TilePattern*>& patterns = getPatterns();
+
+	//multi tile patterns are matched greedily, a row at a time, so a
+	//change can move matches anywhere after it in the layer.
+	if(multi_patterns_.empty() == false) {
+		return -1;
+	}
+
+	//getMatchingPattern() always looks at the adjacent tiles.
+	int reach = 1;
+	for(const TilePattern* p : patterns) {
+		for(const TilePattern::SurroundingTile& t : p->surrounding_tiles) {
+			reach = std::max(reach, std::max(abs(t.xoffset), abs(t.yoffset)));
+		}
+	}
+
+	return reach;
 }
 
 const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& cache, bool* face_right) const
@@ -1041,8 +1116,6 @@ const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& c
 
 	const int xpos = xpos_ + x*TileSize;
 
-	FilterCallable callable(*this, x, y);
-
 	const char* current_tile = getTile(y,x);
 
 	//we build a cache of all of the patterns which have some chance of
@@ -1063,8 +1136,15 @@ const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& c
 
 	for(const TilePattern* ptr : matching_patterns) {
 		const TilePattern& p = *ptr;
-		if(p.filter_formula && p.filter_formula->execute(callable).as_bool() == false) {
-			continue;
+		if(p.filter_formula) {
+			//formulas aren't thread-safe, so only one band may run a filter
+			//at a time. Creating the callable registers it with the garbage
+			//collector, so that has to be done under the lock too.
+			threading::lock lck(filter_formula_mutex());
+			FilterCallable callable(*this, x, y);
+			if(p.filter_formula->execute(callable).as_bool() == false) {
+				continue;
+			}
 		}
 
 		bool match = true;
@@ -63,6 +63,9 @@ public:
 	~TileMap();
 
 	variant write() const;
+	//adds the tiles built from this map to tiles, only including those
+	//positioned within r if it is given. Bands of rows are matched on the
+	//background task pool.
 	void buildTiles(std::vector<LevelTile>* tiles, const rect* r=nullptr) const;
 	bool setTile(int xpos, int ypos, const std::string& str);
 	int zorder() const { return zorder_; }
@@ -75,6 +78,17 @@ public:
 	int getVariations(int x, int y) const;
 	void flipVariation(int x, int y, int delta=0);
 
+	//the furthest, in tiles, that the pattern chosen for a tile looks at
+	//other tiles. Changing a tile can only change the tiles built within
+	//this distance of it. Returns -1 if changing a tile can change tiles
+	//anywhere in the map, as it can when multi tile patterns are used.
+	int getPatternReach() const;
+
+	//builds the set of patterns which might match this map, if it is out
+	//of date. This isn't thread-safe, so must be done before several maps
+	//are built at once.
+	void preparePatterns() const;
+
 	//variants are not thread-safe, so this function clears out variant
 	//info to prepare the tile map to be placed into a worker thread.
 	void prepareForCopyToWorkerThread();
@@ -93,6 +107,7 @@ private:
 
 	int variation(int x, int y) const;
 	const TilePattern* getMatchingPattern(int x, int y, TilePatternCache& cache, bool* face_right) const;
+	void buildTilesInRows(std::vector<LevelTile>* tiles, int y1, int y2, int width, const rect* r, const point_map<LevelObject*>& multi_pattern_matches) const;
 	variant getValue(const std::string& key) const { return variant(); }
 	int xpos_, ypos_;
 	int x_speed_, y_speed_;
@@ -28,6 +28,7 @@
 #include <iostream>
 #include <string.h>
 #include <sstream>
+#include <unordered_map>
 
 #include "boost/algorithm/string/replace.hpp"
 #include "boost/lexical_cast.hpp"
@@ -43,6 +44,7 @@
 #include "formula_object.hpp"
 
 #include "i18n.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 #include "variant.hpp"
 #include "variant_type.hpp"
@@ -71,6 +73,16 @@ variant::TYPE variant::string_to_type(const std::string& str) {
 namespace {
 std::set<variant*> callable_variants_loading, delayed_variants_loading;
 
+//the counter of the innermost InPlaceMutationScope.
+int* g_in_place_mutation_counter = nullptr;
+
+void count_in_place_mutation()
+{
+	if(g_in_place_mutation_counter != nullptr) {
+		++*g_in_place_mutation_counter;
+	}
+}
+
 std::vector<CallStackEntry> call_stack;
 
 variant last_failed_query_map, last_failed_query_key;
@@ -171,15 +183,19 @@ type_error::type_error(const std::string& str) : message(str) {
 VariantFunctionTypeInfo::VariantFunctionTypeInfo() : num_unneeded_args(0)
 {}
 
+//lists at least this long are stored with spare capacity when they're
+//made by appending to a list that was itself made by appending.
+const size_t ListAppendReserveThreshold = 16;
+
 struct variant_list : public GarbageCollectible {
 
 	variant_list() : begin(elements.begin()), end(elements.end()),
-	                 storage(nullptr)
+	                 storage(nullptr), appended(false)
 	{}
 
 	variant_list(const variant_list& o) :
 	   elements(o.begin, o.end), begin(elements.begin()), end(elements.end()),
-	   storage(nullptr)
+	   storage(nullptr), appended(false)
 	{}
 
 	const variant_list& operator=(const variant_list& o) {
@@ -187,6 +203,7 @@ struct variant_list : public GarbageCollectible {
 		begin = elements.begin();
 		end = elements.end();
 		storage = nullptr;
+		appended = false;
 		return *this;
 	}
 
@@ -219,24 +236,90 @@ struct variant_list : public GarbageCollectible {
 	size_t size() const { return end - begin; }
 #endif
 
+	//true if the elements of this list end exactly where the elements
+	//of storage end. Compared by address, since appending to storage
+	//invalidates the end iterators of lists that are views of it.
+	bool endsAt(const std::vector<variant>& storage) const {
+		return size() != 0 && storage.empty() == false &&
+		       &*begin + size() == storage.data() + storage.size();
+	}
+
 	variant::debug_info info;
 	boost::intrusive_ptr<const game_logic::FormulaExpression> expression;
 	std::vector<variant> elements;
 	boost::intrusive_ptr<variant_list> storage;
 	std::vector<variant>::iterator begin, end;
+
+	//set on lists made by operator+, which are given spare capacity
+	//when appended to again.
+	bool appended;
 };
 
+namespace {
+//strings used as map keys are interned so their hash is calculated once,
+//and two interned keys can be compared by pointer. An interned string is
+//just an entry in this table, mapped to its hash, and lives forever.
+typedef std::pair<const std::string, unsigned> interned_string;
+
+unsigned hash_string(const std::string& str)
+{
+	//FNV-1a
+	unsigned hash = 2166136261u;
+	for(char c : str) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+//strings which are unlikely to be keys aren't interned, and the table
+//stops growing if a program generates an unbounded number of keys.
+const size_t MaxInternedLength = 64;
+const size_t MaxInternedStrings = 65536;
+
+const interned_string* get_interned_string(const std::string& str)
+{
+	if(str.size() > MaxInternedLength) {
+		return nullptr;
+	}
+
+	//documents are parsed on background threads too.
+	static threading::mutex* mutex = new threading::mutex;
+	static std::unordered_map<std::string, unsigned>* table = new std::unordered_map<std::string, unsigned>;
+
+	threading::lock lck(*mutex);
+	auto itor = table->find(str);
+	if(itor != table->end()) {
+		return &*itor;
+	}
+
+	if(table->size() >= MaxInternedStrings) {
+		return nullptr;
+	}
+
+	return &*table->insert(std::make_pair(str, hash_string(str))).first;
+}
+}
+
 struct variant_string {
 	variant::debug_info info;
 	boost::intrusive_ptr<const game_logic::FormulaExpression> expression;
 
-	variant_string() : refcount(0)
+	variant_string() : refcount(0), interned(nullptr)
 	{}
-	variant_string(const variant_string& o) : str(o.str), translated_from(o.translated_from), refcount(1)
+	variant_string(const variant_string& o) : str(o.str), translated_from(o.translated_from), refcount(1), interned(o.interned)
 	{}
 	std::string str, translated_from;
 	int refcount;
 
+	//the interned copy of str, if this string has been interned.
+	const interned_string* interned;
+
+	unsigned hash() const {
+		return interned ? interned->second : hash_string(str);
+	}
+
 	std::vector<const game_logic::Formula*> formulae_using_this;
 
 	private:
@@ -247,11 +330,14 @@ struct variant_map : public GarbageCollectible {
 	variant::debug_info info;
 	boost::intrusive_ptr<const game_logic::FormulaExpression> expression;
 
-	variant_map() : GarbageCollectible(), modcount(0)
+	typedef std::pair<const variant, variant> value_type;
+
+	variant_map() : GarbageCollectible(), modcount(0), num_indexed_keys(0)
 	{
 	}
-	variant_map(const variant_map& o) : GarbageCollectible(o), expression(o.expression), elements(o.elements), modcount(0)
+	variant_map(const variant_map& o) : GarbageCollectible(o), expression(o.expression), elements(o.elements), modcount(0), num_indexed_keys(0)
 	{
+		indexKeys();
 	}
 
 	~variant_map()
@@ -277,10 +363,182 @@ struct variant_map : public GarbageCollectible {
 		return res;
 	}
 
+	//elements should only be modified through set() and erase(), or
+	//indexKeys() must be called after changing it.
 	std::map<variant,variant> elements;
 	int modcount;
+
+	value_type* find(const variant& key) {
+		if(key.is_string()) {
+			const variant_string& str = *key.string_;
+			if(key_index.empty() == false) {
+				return findIndexed(str.str, str.hash(), str.interned);
+			}
+
+			//small maps are scanned, and an interned key such as one held
+			//by a '.' expression usually matches on the pointer alone.
+			for(value_type& p : elements) {
+				if(p.first.is_string() == false) {
+					continue;
+				}
+
+				const variant_string& elem = *p.first.string_;
+				if(str.interned != nullptr && elem.interned != nullptr) {
+					if(str.interned == elem.interned) {
+						return &p;
+					}
+				} else if(elem.str == str.str) {
+					return &p;
+				}
+			}
+
+			return nullptr;
+		}
+
+		auto itor = elements.find(key);
+		return itor == elements.end() ? nullptr : &*itor;
+	}
+
+	//looks up a string key without having to make a variant of it.
+	value_type* findString(const std::string& key) {
+		if(key_index.empty() == false) {
+			return findIndexed(key, hash_string(key), nullptr);
+		}
+
+		for(value_type& p : elements) {
+			if(p.first.is_string() && p.first.string_->str == key) {
+				return &p;
+			}
+		}
+
+		return nullptr;
+	}
+
+	void set(const variant& key, const variant& value) {
+		auto res = elements.insert(value_type(key, value));
+		if(res.second == false) {
+			res.first->second = value;
+		} else if(key_index.empty()) {
+			if(elements.size() >= IndexThreshold) {
+				indexKeys();
+			}
+		} else if(key.is_string()) {
+			if((num_indexed_keys+1)*2 > key_index.size()) {
+				indexKeys();
+			} else {
+				addToIndex(&*res.first);
+			}
+		}
+	}
+
+	void erase(const variant& key) {
+		auto itor = elements.find(key);
+		if(itor == elements.end()) {
+			return;
+		}
+
+		if(key.is_string() && key_index.empty() == false) {
+			removeFromIndex(&*itor);
+		}
+
+		elements.erase(itor);
+	}
+
+	//rebuilds the hash index of the string keys.
+	void indexKeys() {
+		key_index.clear();
+		num_indexed_keys = 0;
+		if(elements.size() < IndexThreshold) {
+			return;
+		}
+
+		size_t nslots = 16;
+		while(nslots < elements.size()*2) {
+			nslots *= 2;
+		}
+
+		key_index.resize(nslots);
+		for(value_type& p : elements) {
+			if(p.first.is_string()) {
+				addToIndex(&p);
+			}
+		}
+	}
+
 private:
 	void operator=(const variant_map&);
+
+	//maps with fewer elements than this look up strings by comparing them
+	//against each key, which is cheaper than hashing.
+	static const size_t IndexThreshold = 8;
+
+	//an open addressing hash table, with linear probing, of the string keys
+	//in elements. elements remains the owner of the keys and decides the
+	//order in which they are iterated.
+	struct key_slot {
+		key_slot() : hash(0), node(nullptr) {}
+		unsigned hash;
+		value_type* node;
+	};
+
+	std::vector<key_slot> key_index;
+	size_t num_indexed_keys;
+
+	value_type* findIndexed(const std::string& key, unsigned hash, const interned_string* interned) {
+		const size_t mask = key_index.size() - 1;
+		for(size_t n = hash&mask; key_index[n].node != nullptr; n = (n+1)&mask) {
+			const key_slot& slot = key_index[n];
+			if(slot.hash != hash) {
+				continue;
+			}
+
+			const variant_string& str = *slot.node->first.string_;
+			if(interned != nullptr && str.interned != nullptr) {
+				if(interned == str.interned) {
+					return slot.node;
+				}
+			} else if(str.str == key) {
+				return slot.node;
+			}
+		}
+
+		return nullptr;
+	}
+
+	void addToIndex(value_type* node) {
+		const size_t mask = key_index.size() - 1;
+		const unsigned hash = node->first.string_->hash();
+		size_t n = hash&mask;
+		while(key_index[n].node != nullptr) {
+			n = (n+1)&mask;
+		}
+
+		key_index[n].hash = hash;
+		key_index[n].node = node;
+		++num_indexed_keys;
+	}
+
+	void removeFromIndex(value_type* node) {
+		const size_t mask = key_index.size() - 1;
+		size_t n = node->first.string_->hash()&mask;
+		while(key_index[n].node != node) {
+			n = (n+1)&mask;
+		}
+
+		//shift back any following entries which would no longer be
+		//reachable from their home slot once this one is emptied.
+		for(size_t m = (n+1)&mask; key_index[m].node != nullptr; m = (m+1)&mask) {
+			const size_t home = key_index[m].hash&mask;
+			const bool reachable = n <= m ? (n < home && home <= m) : (n < home || home <= m);
+			if(!reachable) {
+				key_index[n] = key_index[m];
+				n = m;
+			}
+		}
+
+		key_index[n] = key_slot();
+		--num_indexed_keys;
+	}
 };
 
 struct variant_fn : public GarbageCollectible {
@@ -632,6 +890,13 @@ variant::variant(const std::string& str)
 	increment_refcount();
 }
 
+void variant::intern_string()
+{
+	if(type_ == VARIANT_TYPE_STRING && string_->interned == nullptr) {
+		string_->interned = get_interned_string(string_->str);
+	}
+}
+
 variant variant::create_translated_string(const std::string& str)
 {
 	return create_translated_string(str, i18n::tr(str));
@@ -644,6 +909,15 @@ variant variant::create_translated_string(const std::string& str, const std::str
 	return v;
 }
 
+const std::string* variant::get_translated_from() const
+{
+	if(type_ == VARIANT_TYPE_STRING && string_->translated_from.empty() == false) {
+		return &string_->translated_from;
+	}
+
+	return nullptr;
+}
+
 variant::variant(std::map<variant,variant>* map)
     : type_(VARIANT_TYPE_MAP)
 {
@@ -658,6 +932,7 @@ variant::variant(std::map<variant,variant>* map)
 	map_ = new variant_map;
 	map_->add_ref();
 	map_->elements.swap(*map);
+	map_->indexKeys();
 }
 
 variant::variant(const variant& formula_var, const game_logic::FormulaCallable& callable, int base_slot, const VariantFunctionTypeInfoPtr& type_info, const std::vector<std::string>& generic_types, std::function<game_logic::ConstFormulaPtr(const std::vector<variant_type_ptr>&)> factory)
@@ -770,8 +1045,8 @@ const variant& variant::operator[](const variant v) const
 
 	if(type_ == VARIANT_TYPE_MAP) {
 		assert(map_);
-		std::map<variant,variant>::const_iterator i = map_->elements.find(v);
-		if (i == map_->elements.end())
+		const variant_map::value_type* i = map_->find(v);
+		if(i == nullptr)
 		{
 			last_failed_query_map = *this;
 			last_failed_query_key = v;
@@ -796,7 +1071,20 @@ const variant& variant::operator[](const variant v) const
 
 const variant& variant::operator[](const std::string& key) const
 {
-	return (*this)[variant(key)];
+	if(type_ != VARIANT_TYPE_MAP) {
+		return (*this)[variant(key)];
+	}
+
+	const variant_map::value_type* i = map_->findString(key);
+	if(i == nullptr) {
+		last_failed_query_map = *this;
+		last_failed_query_key = variant(key);
+
+		return UnfoundInMapNullVariant;
+	}
+
+	last_query_map = *this;
+	return i->second;
 }
 
 bool variant::has_key(const variant& key) const
@@ -805,17 +1093,18 @@ bool variant::has_key(const variant& key) const
 		return false;
 	}
 
-	std::map<variant,variant>::const_iterator i = map_->elements.find(key);
-	if(i != map_->elements.end() && i->second.is_null() == false) {
-		return true;
-	} else {
-		return false;
-	}
+	const variant_map::value_type* i = map_->find(key);
+	return i != nullptr && i->second.is_null() == false;
 }
 
 bool variant::has_key(const std::string& key) const
 {
-	return has_key(variant(key));
+	if(type_ != VARIANT_TYPE_MAP) {
+		return false;
+	}
+
+	const variant_map::value_type* i = map_->findString(key);
+	return i != nullptr && i->second.is_null() == false;
 }
 
 variant variant::getKeys() const
@@ -1181,7 +1470,8 @@ bool variant::as_bool() const
 std::vector<variant> variant::as_list() const
 {
 	if(is_list()) {
-		if(list_->elements.empty() == false) {
+		//an owner of storage may have had elements appended past its end.
+		if(list_->endsAt(list_->elements) && list_->size() == list_->elements.size()) {
 			return list_->elements;
 		} else {
 			return std::vector<variant>(list_->begin, list_->end);
@@ -1300,7 +1590,7 @@ variant variant::add_attr(variant key, variant value)
 		}
 
 		make_unique();
-		map_->elements[key] = value;
+		map_->set(key, value);
 		return *this;
 	} else {
 		return variant();
@@ -1319,7 +1609,7 @@ variant variant::remove_attr(variant key)
 		}
 
 		make_unique();
-		map_->elements.erase(key);
+		map_->erase(key);
 		return *this;
 	} else {
 		return variant();
@@ -1329,25 +1619,28 @@ variant variant::remove_attr(variant key)
 void variant::add_attr_mutation(variant key, variant value)
 {
 	if(is_map()) {
-		map_->elements[key] = value;
+		map_->set(key, value);
 		map_->modcount++;
+		count_in_place_mutation();
 	}
 }
 
 void variant::remove_attr_mutation(variant key)
 {
 	if(is_map()) {
-		map_->elements.erase(key);
+		map_->erase(key);
 		map_->modcount++;
+		count_in_place_mutation();
 	}
 }
 
 variant* variant::get_attr_mutable(variant key)
 {
 	if(is_map()) {
-		std::map<variant,variant>::iterator i = map_->elements.find(key);
-		if(i != map_->elements.end()) {
+		variant_map::value_type* i = map_->find(key);
+		if(i != nullptr) {
 			map_->modcount++;
+			count_in_place_mutation();
 			return &i->second;
 		}
 	}
@@ -1359,6 +1652,7 @@ variant* variant::get_index_mutable(int index)
 {
 	if(is_list()) {
 		if(index >= 0 && static_cast<unsigned>(index) < list_->size()) {
+			count_in_place_mutation();
 			return &list_->begin[index];
 		}
 	}
@@ -1366,6 +1660,36 @@ variant* variant::get_index_mutable(int index)
 	return nullptr;
 }
 
+InPlaceMutationScope::InPlaceMutationScope(int* counter) : prev_counter_(g_in_place_mutation_counter)
+{
+	g_in_place_mutation_counter = counter;
+}
+
+InPlaceMutationScope::~InPlaceMutationScope()
+{
+	g_in_place_mutation_counter = prev_counter_;
+}
+
+const GarbageCollectible* variant::get_collectible() const
+{
+	switch(type_) {
+	case VARIANT_TYPE_LIST:
+		return list_;
+	case VARIANT_TYPE_MAP:
+		return map_;
+	case VARIANT_TYPE_CALLABLE:
+		return callable_;
+	case VARIANT_TYPE_FUNCTION:
+		return fn_;
+	case VARIANT_TYPE_GENERIC_FUNCTION:
+		return generic_fn_;
+	case VARIANT_TYPE_MULTI_FUNCTION:
+		return multi_fn_;
+	default:
+		return nullptr;
+	}
+}
+
 void variant::weaken()
 {
 	if(type_ == VARIANT_TYPE_CALLABLE) {
@@ -1596,8 +1920,43 @@ variant variant::operator+(const variant& v) const
 		if(v.type_ == VARIANT_TYPE_LIST) {
 			const size_t new_size = list_->size() + v.list_->size();
 
+			//if this list ends where the storage it's a view of ends, and
+			//the storage has room, the new elements are put after it in
+			//place and the result is a view of the same storage. Other
+			//views don't see the new elements, and the next list to be
+			//appended to this one will find its end taken and copy.
+			//
+			//This mutates storage shared with the const operand, with no
+			//locking, so a list must not be appended to from more than one
+			//thread at a time.
+			variant_list* owner = list_;
+			while(owner->storage) {
+				owner = owner->storage.get();
+			}
+
+			std::vector<variant>& storage = owner->elements;
+			const size_t nappend = v.list_->size();
+			if(list_->endsAt(storage) && storage.capacity() - storage.size() >= nappend) {
+				//the capacity check means this can't reallocate, so the
+				//iterators of v stay valid even if it shares the storage.
+				for(size_t j = 0; j < nappend; ++j) {
+					storage.push_back(v.list_->begin[j]);
+				}
+
+				std::vector<variant> items;
+				variant result(&items);
+				result.list_->begin = list_->begin;
+				result.list_->end = list_->begin + new_size;
+				result.list_->storage.reset(owner);
+				result.list_->appended = true;
+				return result;
+			}
+
+			//a long list that is being built up by repeated appends is
+			//given spare capacity, so each append takes amortized constant
+			//time. A one-off concatenation is stored at its exact size.
 			std::vector<variant> res;
-			res.reserve(new_size);
+			res.reserve(list_->appended && new_size >= ListAppendReserveThreshold ? new_size*2 : new_size);
 			for(size_t i = 0; i < list_->size(); ++i) {
 				const variant& var = list_->begin[i];
 				res.push_back(var);
@@ -1608,7 +1967,9 @@ variant variant::operator+(const variant& v) const
 				res.push_back(var);
 			}
 
-			return variant(&res);
+			variant result(&res);
+			result.list_->appended = true;
+			return result;
 		}
 	}
 	if(type_ == VARIANT_TYPE_MAP) {
@@ -2140,6 +2501,7 @@ void variant::make_unique()
 		vm->add_ref();
 		vm->info = map_->info;
 		vm->elements.swap(m);
+		vm->indexKeys();
 		map_ = vm;
 		break;
 	}
@@ -2658,3 +3020,122 @@ BENCHMARK(variant_assign)
 		}
 	}
 }
+
+UNIT_TEST(variant_map_index)
+{
+	std::map<variant,variant> m;
+	variant v(&m);
+
+	for(int n = 0; n != 200; ++n) {
+		variant key(formatter() << "key" << n);
+		if(n%2 == 0) {
+			key.intern_string();
+		}
+
+		v.add_attr_mutation(key, variant(n));
+	}
+
+	v.add_attr_mutation(variant(7), variant("seven"));
+
+	for(int n = 0; n < 200; n += 3) {
+		v.remove_attr_mutation(variant(formatter() << "key" << n));
+	}
+
+	for(int n = 0; n != 200; ++n) {
+		const std::string key = formatter() << "key" << n;
+		variant interned_key(key);
+		interned_key.intern_string();
+
+		CHECK_EQ(v.has_key(key), n%3 != 0);
+		CHECK_EQ(v.has_key(variant(key)), n%3 != 0);
+		CHECK_EQ(v.has_key(interned_key), n%3 != 0);
+		if(n%3 != 0) {
+			CHECK_EQ(v[key], variant(n));
+			CHECK_EQ(v[interned_key], variant(n));
+		}
+	}
+
+	CHECK_EQ(v[variant(7)], variant("seven"));
+
+	//the keys still iterate in order.
+	variant prev;
+	for(const variant_pair& p : v.as_map()) {
+		CHECK(prev.is_null() || prev < p.first, "map keys out of order: " << prev << ", " << p.first);
+		prev = p.first;
+	}
+
+	//copies made when modifying a shared map find the same keys.
+	variant copy = v;
+	copy = copy.add_attr(variant("key0"), variant(-1));
+	CHECK_EQ(copy["key0"], variant(-1));
+	CHECK_EQ(copy["key1"], variant(1));
+	CHECK_EQ(v.has_key("key0"), false);
+}
+
+BENCHMARK_ARG(variant_map_lookup, int nkeys)
+{
+	std::map<variant,variant> m;
+	std::vector<std::string> keys;
+	for(int n = 0; n != nkeys; ++n) {
+		keys.push_back(formatter() << "attribute_" << n);
+		variant key(keys.back());
+		key.intern_string();
+		m[key] = variant(n);
+	}
+
+	variant v(&m);
+	int64_t total = 0;
+	BENCHMARK_LOOP {
+		for(const std::string& key : keys) {
+			total += v[key].as_int();
+		}
+	}
+
+	ASSERT_GE(total, int64_t(0));
+}
+
+BENCHMARK_ARG_CALL(variant_map_lookup, small, 4);
+BENCHMARK_ARG_CALL(variant_map_lookup, medium, 32);
+BENCHMARK_ARG_CALL(variant_map_lookup, large, 512);
+
+UNIT_TEST(variant_list_append)
+{
+	std::vector<variant> items;
+	for(int n = 0; n != 40; ++n) {
+		items.push_back(variant(n));
+	}
+
+	variant a(&items);
+	variant one_item[] = { variant(-1), variant(-2) };
+	std::vector<variant> append1(one_item, one_item+1), append2(one_item+1, one_item+2);
+
+	//b goes into a's storage if it has room, c must not see it.
+	variant b = a + variant(&append1);
+	variant c = a + variant(&append2);
+	variant d = b + b;
+	CHECK_EQ(a.num_elements(), 40);
+	CHECK_EQ(b.num_elements(), 41);
+	CHECK_EQ(c.num_elements(), 41);
+	CHECK_EQ(d.num_elements(), 82);
+	CHECK_EQ(b[40], variant(-1));
+	CHECK_EQ(c[40], variant(-2));
+	CHECK_EQ(d[40], variant(-1));
+	CHECK_EQ(d[81], variant(-1));
+	CHECK_EQ(a.as_list().size(), size_t(40));
+
+	//appending to a slice of b, and building a long list one at a time.
+	variant e = b.get_list_slice(0, 41) + variant(&append2);
+	CHECK_EQ(e[41], variant(-2));
+	CHECK_EQ(b.num_elements(), 41);
+
+	variant built(&append1);
+	for(int n = 0; n != 1000; ++n) {
+		std::vector<variant> next(1, variant(n));
+		built = built + variant(&next);
+	}
+
+	CHECK_EQ(built.num_elements(), 1001);
+	for(int n = 0; n != 1000; ++n) {
+		CHECK_EQ(built[n+1], variant(n));
+	}
+}
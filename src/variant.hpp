@@ -42,6 +42,8 @@ namespace game_logic
 	class FormulaExpression;
 }
 
+class GarbageCollectible;
+
 class variant_type;
 typedef boost::intrusive_ptr<const variant_type> variant_type_ptr;
 typedef boost::intrusive_ptr<const variant_type> const_variant_type_ptr;
@@ -72,6 +74,19 @@ struct CallStackManager
 	}
 };
 
+//while one of these is alive, maps and lists changed in place through
+//variant::add_attr_mutation() and the other mutating functions are counted
+//in *counter. Code which tracks changes to a document can't see these
+//changes, but can put a scope around the code which may change it to tell
+//that one may have happened. Scopes nest, and only the innermost counts.
+struct InPlaceMutationScope
+{
+	explicit InPlaceMutationScope(int* counter);
+	~InPlaceMutationScope();
+private:
+	int* prev_counter_;
+};
+
 class variant;
 void swap_variants_loading(std::set<variant*>& v);
 
@@ -113,6 +128,7 @@ public:
 
 	friend class GarbageCollectorImpl;
 	friend class GarbageCollectorAnalyzer;
+	friend struct variant_map;
 
 	enum DECIMAL_VARIANT_TYPE { DECIMAL_VARIANT };
 
@@ -136,6 +152,16 @@ public:
 	explicit variant(const std::string& str);
 	static variant create_translated_string(const std::string& str);
 	static variant create_translated_string(const std::string& str, const std::string& translation);
+
+	//the text a string made by create_translated_string() was translated
+	//from, or nullptr if this isn't a translated string.
+	const std::string* get_translated_from() const;
+
+	//Shares this string with all other interned strings of the same value,
+	//so it has its hash computed once and compares equal to them by pointer.
+	//Used for strings which are going to be map keys. The value, and any
+	//debug info attached to this variant, is unchanged.
+	void intern_string();
 	explicit variant(std::map<variant,variant>* map);
 	variant(const variant& formula_var, const game_logic::FormulaCallable& callable, int base_slot, const VariantFunctionTypeInfoPtr& type_info, const std::vector<std::string>& types, std::function<game_logic::ConstFormulaPtr(const std::vector<variant_type_ptr>&)> factory);
 	variant(const game_logic::ConstFormulaPtr& formula, const game_logic::FormulaCallable& callable, int base_slot, const VariantFunctionTypeInfoPtr& type_info);
@@ -240,6 +266,10 @@ public:
 
 	const void* get_addr() const { return list_; }
 
+	//the garbage collected object the variant refers to, or nullptr if it
+	//doesn't refer to one.
+	const GarbageCollectible* get_collectible() const;
+
 	//weaken returns a weak reference to the variant if it's some kind
 	//of reference. Otherwise it returns the variant without modifying.
 	//strengthen returns a strong reference to the variant if it's
@@ -23,6 +23,7 @@
 
 #include "asserts.hpp"
 #include "string_utils.hpp"
+#include "unit_test.hpp"
 #include "variant_utils.hpp"
 
 glm::vec3 variant_to_vec3(const variant& v)
@@ -231,6 +232,63 @@ variant deep_copy_variant(variant v)
 	}
 }
 
+bool variants_identical(const variant& a, const variant& b)
+{
+	if(a.type() != b.type()) {
+		return false;
+	}
+
+	switch(a.type()) {
+	case variant::VARIANT_TYPE_NULL:
+	case variant::VARIANT_TYPE_BOOL:
+	case variant::VARIANT_TYPE_INT:
+	case variant::VARIANT_TYPE_DECIMAL:
+	case variant::VARIANT_TYPE_STRING:
+		return a == b;
+
+	case variant::VARIANT_TYPE_LIST: {
+		if(a.get_addr() == b.get_addr()) {
+			return true;
+		}
+
+		if(a.num_elements() != b.num_elements()) {
+			return false;
+		}
+
+		for(int n = 0; n != a.num_elements(); ++n) {
+			if(!variants_identical(a[n], b[n])) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	case variant::VARIANT_TYPE_MAP: {
+		if(a.get_addr() == b.get_addr()) {
+			return true;
+		}
+
+		const std::map<variant,variant>& am = a.as_map();
+		const std::map<variant,variant>& bm = b.as_map();
+		if(am.size() != bm.size()) {
+			return false;
+		}
+
+		for(auto i = am.begin(), j = bm.begin(); i != am.end(); ++i, ++j) {
+			if(!variants_identical(i->first, j->first) || !variants_identical(i->second, j->second)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	default:
+		return a.get_addr() == b.get_addr();
+	}
+}
+
 variant interpolate_variants(variant a, variant b, float ratiof)
 {
 	if(a.is_numeric() && b.is_numeric()) {
@@ -306,3 +364,20 @@ variant variant_builder::build()
 	return variant(&res);
 }
 
+
+UNIT_TEST(variants_identical)
+{
+	const variant one(1);
+	const variant one_decimal(decimal::from_int(1));
+	CHECK(one == one_decimal, "expected 1 == 1.0");
+	CHECK(!variants_identical(one, one_decimal), "1 and 1.0 should not be identical");
+
+	std::vector<variant> items;
+	items.push_back(one);
+	items.push_back(variant("a"));
+	const variant list(&items);
+	CHECK(variants_identical(list, deep_copy_variant(list)), "a list should be identical to a copy of it");
+
+	items[0] = one_decimal;
+	CHECK(!variants_identical(list, variant(&items)), "lists with 1 and 1.0 should not be identical");
+}
@@ -72,6 +72,12 @@ void visitVariants(variant v, std::function<void (variant)> fn);
 
 variant deep_copy_variant(variant v);
 
+//returns true iff a and b are of the same type and hold the same value.
+//Unlike operator==, an int never matches a decimal and callables and
+//functions only match if they are the same object. Lists and maps are
+//compared element by element.
+bool variants_identical(const variant& a, const variant& b);
+
 //function which interpolates two variants. ratio is between 0 and 1.
 //a and b must be of the same type and must be decimals, ints,
 //or lists or maps of interpolatable values.